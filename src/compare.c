@@ -0,0 +1,861 @@
+// File: compare.c
+// -----------------------
+#define _GNU_SOURCE        // for qsort_r, O_PATH
+#include <curses.h>        // for WINDOW, newwin, delwin, wgetch, mvwprintw, werase, wrefresh, wattron, wattroff
+#include <fcntl.h>         // for open, openat, posix_fadvise, O_RDONLY, O_PATH, O_DIRECTORY, O_NOFOLLOW, O_NONBLOCK, O_CLOEXEC
+#include <stdatomic.h>     // for atomic_bool, atomic_ullong, atomic_load, atomic_store, atomic_fetch_add
+#include <stdint.h>        // for uint8_t, uint32_t, uint64_t, int64_t, UINT32_MAX
+#include <stdio.h>         // for snprintf
+#include <stdlib.h>        // for malloc, realloc, calloc, free, qsort_r
+#include <string.h>        // for strlen, strcmp, strdup, memcpy, memcmp
+#include <sys/stat.h>      // for struct stat, fstat, S_IFMT, S_IFDIR, S_IFREG, S_IFLNK, S_ISDIR, S_ISREG
+#include <unistd.h>        // for readlinkat, close
+// Local includes
+#include <compare.h>       // for compare_view, COMPARE_BLOCK
+#include <files.h>         // for format_file_size
+#include <fsio.h>          // for Fsio_submit, Fsio_poll, Fsio_unresponsive, FSIO_DEADLINE_LIST
+#include <utils.h>         // for MIN, MAX, SIZE, read_full
+#include <walk.h>          // for walk_tree, Walker, WalkEntry
+#include <workpool.h>      // for WorkPool, Job, Job_new, Job_cancel, WorkPool_submit, WorkPool_poll
+
+typedef uint32_t CmpIndex;
+#define CMP_NONE UINT32_MAX
+#define CMP_ROOT 0
+
+// Pairs whose contents are compared by a single job. Jobs are also cut after
+// this many bytes (of both sides), so big files are spread over the workers.
+#define CHUNK_PAIRS 256
+#define CHUNK_BYTES (64ULL << 20)
+
+// st_mode & S_IFMT fits in a byte once shifted
+#define TYPE_OF(mode) ((uint8_t)(((mode) & S_IFMT) >> 12))
+#define TYPE_DIR TYPE_OF(S_IFDIR)
+#define TYPE_REG TYPE_OF(S_IFREG)
+#define TYPE_LNK TYPE_OF(S_IFLNK)
+
+enum {
+    // Not everything in the directory is known: some entries couldn't be
+    // read, it's a mount point or there was no memory left
+    CMP_INCOMPLETE = 1 << 0,
+};
+
+// 40 bytes per entry of a walked tree
+typedef struct {
+    uint32_t name;         // Offset in CmpTree.names
+    CmpIndex parent;
+    // Entries of a directory, sorted by name:
+    // CmpTree.children[children .. children + nchildren)
+    uint32_t children;
+    uint32_t nchildren;
+    uint64_t size;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint8_t type;
+    uint8_t flags;
+} CmpEntry;
+
+typedef struct Compare Compare;
+
+typedef struct {
+    Compare *owner;
+    char *root;
+    dev_t root_dev;
+    // Walk in flight, NULL once it's done
+    Job *walk;
+    // The walk couldn't open the root
+    bool unreadable;
+
+    CmpEntry *entries;
+    size_t len, cap;
+    // '\0' separated
+    char *names;
+    size_t names_len, names_cap;
+    // Every entry but the root, grouped by directory
+    CmpIndex *children;
+
+    // Progress, read by the UI thread while walking
+    atomic_ullong walked;
+    atomic_ullong errors;
+} CmpTree;
+
+typedef enum {
+    CMP_SAME,
+    CMP_ADDED,     // Only on the right
+    CMP_REMOVED,   // Only on the left
+    CMP_CHANGED,
+    CMP_PENDING,   // Contents being compared
+    CMP_UNKNOWN,   // Couldn't be compared, or the other side isn't known
+    CMP_STATES,
+} CmpState;
+
+// An entry of the merged tree, on one side or both. The entries of a
+// directory are next to each other, after the directory itself.
+typedef struct {
+    CmpIndex left, right;
+    CmpIndex parent;
+    CmpIndex children;
+    uint32_t nchildren;
+    // Pairs below still being compared
+    uint32_t pending;
+    uint8_t state;
+    // It's not the same, or something below it isn't
+    bool differs;
+} CmpNode;
+
+typedef enum {
+    COMPARE_WALKING,
+    COMPARE_MERGING,
+    COMPARE_BROWSING,
+} CompareState;
+
+struct Compare {
+    CmpTree sides[2];
+    // Handles (O_PATH) of the roots, contents are opened relative to them
+    int fds[2];
+    WorkPool *pool;
+    atomic_bool cancelled;
+    CompareState state;
+    char status[256];
+    size_t pending_jobs;
+
+    // Written by the merge job, then only on the UI thread
+    CmpNode *nodes;
+    size_t nnodes, nodes_cap;
+    bool truncated;
+    // Nodes of the pairs whose contents are compared
+    CmpIndex *ambiguous;
+    size_t nambiguous, ambiguous_cap;
+    // Nodes in each state, directories on both sides left out
+    size_t counts[CMP_STATES];
+    uint64_t ambiguous_bytes;
+    atomic_ullong compared_bytes;
+
+    // Directory being shown and the rows of its entries
+    CmpIndex dir;
+    CmpIndex *rows;
+    size_t nrows;
+    bool rows_dirty;
+    bool only_differences;
+    SIZE cursor;
+    SIZE start;
+};
+
+typedef struct {
+    Compare *c;
+    const CmpIndex *pairs;
+    size_t count;
+    uint8_t *results;
+} CmpChunk;
+
+static bool should_stop(const Compare *c, const Job *job) {
+    return atomic_load(&c->cancelled) || Job_cancelled(job);
+}
+
+static const char *entry_name(const CmpTree *t, CmpIndex idx) {
+    return t->names + t->entries[idx].name;
+}
+
+static CmpIndex add_entry(CmpTree *t, CmpIndex parent, const char *name, const struct stat *st) {
+    size_t len = strlen(name);
+    if (t->len >= CMP_NONE - 1 || t->names_len + len + 1 >= UINT32_MAX)
+        return CMP_NONE;
+    if (t->len == t->cap) {
+        size_t cap = MAX(t->cap * 2, 1024);
+        CmpEntry *entries = realloc(t->entries, cap * sizeof(CmpEntry));
+        if (entries == NULL)
+            return CMP_NONE;
+        t->entries = entries;
+        t->cap = cap;
+    }
+    if (t->names_len + len + 1 > t->names_cap) {
+        size_t cap = MAX(t->names_cap * 2, t->names_len + len + 1 + 4096);
+        char *names = realloc(t->names, cap);
+        if (names == NULL)
+            return CMP_NONE;
+        t->names = names;
+        t->names_cap = cap;
+    }
+
+    memcpy(t->names + t->names_len, name, len + 1);
+    CmpIndex idx = t->len++;
+    t->entries[idx] = (CmpEntry){
+        .name = t->names_len,
+        .parent = parent,
+        .size = st->st_size,
+        .mtime_sec = st->st_mtim.tv_sec,
+        .mtime_nsec = st->st_mtim.tv_nsec,
+        .type = TYPE_OF(st->st_mode),
+    };
+    t->names_len += len + 1;
+    return idx;
+}
+
+// Cookies handed to the walker are entry indexes
+static bool walk_visit(void *ctx, const WalkEntry *e, uintptr_t *cookie) {
+    CmpTree *t = ctx;
+    CmpIndex parent = (CmpIndex)e->parent;
+    atomic_fetch_add(&t->walked, 1);
+
+    CmpIndex idx = add_entry(t, parent, e->name, e->st);
+    if (idx == CMP_NONE) {
+        // What's missing is shown as unknown, not as gone
+        t->entries[parent].flags |= CMP_INCOMPLETE;
+        return false;
+    }
+    *cookie = idx;
+    if (S_ISDIR(e->st->st_mode) && e->st->st_dev != t->root_dev) {
+        t->entries[idx].flags |= CMP_INCOMPLETE;
+        return false;
+    }
+    return true;
+}
+
+static void walk_error(void *ctx, const WalkEntry *e, [[maybe_unused]] int err) {
+    CmpTree *t = ctx;
+    CmpIndex parent = (CmpIndex)e->parent;
+    atomic_fetch_add(&t->errors, 1);
+
+    // A directory that couldn't be read was visited right before, an entry
+    // that couldn't be stat'ed wasn't
+    CmpIndex last = t->len - 1;
+    if (last != CMP_ROOT && t->entries[last].parent == parent && strcmp(entry_name(t, last), e->name) == 0)
+        t->entries[last].flags |= CMP_INCOMPLETE;
+    else
+        t->entries[parent].flags |= CMP_INCOMPLETE;
+}
+
+static int compare_siblings(const void *a, const void *b, void *ctx) {
+    const CmpTree *t = ctx;
+    CmpIndex ia = *(const CmpIndex *)a, ib = *(const CmpIndex *)b;
+    CmpIndex pa = t->entries[ia].parent, pb = t->entries[ib].parent;
+    if (pa != pb)
+        return pa < pb ? -1 : 1;
+    return strcmp(entry_name(t, ia), entry_name(t, ib));
+}
+
+// The walk is depth first, so the entries of a directory are scattered.
+// Groups them by directory, sorted by name so both sides can be merged.
+static bool sort_children(CmpTree *t) {
+    size_t n = t->len - 1;
+    if (n == 0)
+        return true;
+    t->children = malloc(n * sizeof(CmpIndex));
+    if (t->children == NULL)
+        return false;
+    for (size_t i = 0; i < n; i++)
+        t->children[i] = i + 1;
+    qsort_r(t->children, n, sizeof(CmpIndex), compare_siblings, t);
+
+    size_t i = 0;
+    while (i < n) {
+        CmpEntry *dir = &t->entries[t->entries[t->children[i]].parent];
+        dir->children = i;
+        for (; i < n && &t->entries[t->entries[t->children[i]].parent] == dir; i++)
+            dir->nchildren++;
+    }
+    return true;
+}
+
+static void walk_run(Job *job) {
+    CmpTree *t = job->data;
+    Compare *c = t->owner;
+    int side = t - c->sides;
+
+    // Opened here rather than on the UI thread, the root may be on a hung mount
+    struct stat st;
+    c->fds[side] = open(t->root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (c->fds[side] == -1 || fstat(c->fds[side], &st) == -1 || add_entry(t, CMP_NONE, "", &st) != CMP_ROOT) {
+        t->unreadable = true;
+        return;
+    }
+    t->root_dev = st.st_dev;
+
+    Walker walker = {
+        .visit = walk_visit,
+        .error = walk_error,
+        .ctx = t,
+        .one_filesystem = true,
+        .cancelled = &job->cancelled,
+    };
+    if (!walk_tree(t->root, CMP_ROOT, &walker))
+        t->entries[CMP_ROOT].flags |= CMP_INCOMPLETE;
+    // Without the groups nothing below the root is known
+    if (!Job_cancelled(job) && !sort_children(t))
+        t->entries[CMP_ROOT].flags |= CMP_INCOMPLETE;
+}
+
+// The entry if it's a directory, CMP_NONE otherwise
+static CmpIndex side_dir(const CmpTree *t, CmpIndex idx) {
+    return idx != CMP_NONE && t->entries[idx].type == TYPE_DIR ? idx : CMP_NONE;
+}
+
+static bool is_dir_pair(const Compare *c, const CmpNode *n) {
+    return side_dir(&c->sides[0], n->left) != CMP_NONE && side_dir(&c->sides[1], n->right) != CMP_NONE;
+}
+
+static const char *node_name(const Compare *c, CmpIndex idx) {
+    const CmpNode *n = &c->nodes[idx];
+    return n->left != CMP_NONE ? entry_name(&c->sides[0], n->left) : entry_name(&c->sides[1], n->right);
+}
+
+// Returns a malloc'd path of the node relative to the roots, "." for them
+static char *node_path(const Compare *c, CmpIndex idx) {
+    if (idx == CMP_ROOT)
+        return strdup(".");
+
+    size_t len = 0;
+    for (CmpIndex i = idx; i != CMP_ROOT; i = c->nodes[i].parent)
+        len += strlen(node_name(c, i)) + 1;
+
+    char *path = malloc(len);
+    if (path == NULL)
+        return NULL;
+    path[--len] = '\0';
+    for (CmpIndex i = idx; i != CMP_ROOT; i = c->nodes[i].parent) {
+        const char *name = node_name(c, i);
+        size_t name_len = strlen(name);
+        len -= name_len;
+        memcpy(path + len, name, name_len);
+        if (len > 0)
+            path[--len] = '/';
+    }
+    return path;
+}
+
+// First pass: type, size and mtime. Files of the same size whose mtimes
+// differ, and symlinks of the same length, can't be told apart without
+// reading them.
+static uint8_t classify_pair(const Compare *c, CmpIndex left, CmpIndex right) {
+    const CmpEntry *a = &c->sides[0].entries[left];
+    const CmpEntry *b = &c->sides[1].entries[right];
+    if (a->type != b->type)
+        return CMP_CHANGED;
+    if (a->type != TYPE_REG && a->type != TYPE_LNK)
+        return CMP_SAME;
+    if (a->size != b->size)
+        return CMP_CHANGED;
+    if (a->type == TYPE_REG && a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec)
+        return CMP_SAME;
+    return CMP_PENDING;
+}
+
+static bool add_node(Compare *c, CmpIndex left, CmpIndex right, CmpIndex parent, uint8_t state) {
+    if (c->nnodes >= CMP_NONE - 1)
+        return false;
+    if (c->nnodes == c->nodes_cap) {
+        size_t cap = MAX(c->nodes_cap * 2, 1024);
+        CmpNode *nodes = realloc(c->nodes, cap * sizeof(CmpNode));
+        if (nodes == NULL)
+            return false;
+        c->nodes = nodes;
+        c->nodes_cap = cap;
+    }
+    if (state == CMP_PENDING && c->nambiguous == c->ambiguous_cap) {
+        size_t cap = MAX(c->ambiguous_cap * 2, 1024);
+        CmpIndex *ambiguous = realloc(c->ambiguous, cap * sizeof(CmpIndex));
+        if (ambiguous == NULL)
+            return false;
+        c->ambiguous = ambiguous;
+        c->ambiguous_cap = cap;
+    }
+
+    CmpIndex idx = c->nnodes++;
+    c->nodes[idx] = (CmpNode){
+        .left = left,
+        .right = right,
+        .parent = parent,
+        .state = state,
+        .differs = state != CMP_SAME && state != CMP_PENDING,
+    };
+    if (state == CMP_PENDING) {
+        c->ambiguous[c->nambiguous++] = idx;
+        c->ambiguous_bytes += 2 * c->sides[0].entries[left].size;
+    }
+    return true;
+}
+
+// Adds the entries of node `idx` on either side, matching them by name
+static bool merge_children(Compare *c, CmpIndex idx) {
+    const CmpTree *lt = &c->sides[0], *rt = &c->sides[1];
+    CmpIndex ldir = side_dir(lt, c->nodes[idx].left);
+    CmpIndex rdir = side_dir(rt, c->nodes[idx].right);
+    if (ldir == CMP_NONE && rdir == CMP_NONE)
+        return true;
+
+    // Entries missing from a directory that wasn't read completely may be
+    // there all the same
+    uint8_t only_left = CMP_REMOVED, only_right = CMP_ADDED;
+    if (c->nodes[idx].state == CMP_UNKNOWN)
+        only_left = only_right = CMP_UNKNOWN;
+    if (rdir != CMP_NONE && (rt->entries[rdir].flags & CMP_INCOMPLETE))
+        only_left = CMP_UNKNOWN;
+    if (ldir != CMP_NONE && (lt->entries[ldir].flags & CMP_INCOMPLETE))
+        only_right = CMP_UNKNOWN;
+
+    size_t ln = ldir != CMP_NONE ? lt->entries[ldir].nchildren : 0;
+    size_t rn = rdir != CMP_NONE ? rt->entries[rdir].nchildren : 0;
+    const CmpIndex *lc = ln > 0 ? lt->children + lt->entries[ldir].children : NULL;
+    const CmpIndex *rc = rn > 0 ? rt->children + rt->entries[rdir].children : NULL;
+
+    c->nodes[idx].children = c->nnodes;
+    size_t li = 0, ri = 0;
+    while (li < ln || ri < rn) {
+        int cmp = li == ln ? 1 : ri == rn ? -1 : strcmp(entry_name(lt, lc[li]), entry_name(rt, rc[ri]));
+        bool added;
+        if (cmp < 0) {
+            added = add_node(c, lc[li++], CMP_NONE, idx, only_left);
+        } else if (cmp > 0) {
+            added = add_node(c, CMP_NONE, rc[ri++], idx, only_right);
+        } else {
+            added = add_node(c, lc[li], rc[ri], idx, classify_pair(c, lc[li], rc[ri]));
+            li++;
+            ri++;
+        }
+        if (!added)
+            return false;
+        c->nodes[idx].nchildren++;
+    }
+    return true;
+}
+
+static void merge_run(Job *job) {
+    Compare *c = job->data;
+    if (!add_node(c, CMP_ROOT, CMP_ROOT, CMP_NONE, CMP_SAME))
+        return;
+
+    // Breadth first, appending the entries of each node as it's reached
+    for (size_t i = 0; i < c->nnodes; i++) {
+        if (should_stop(c, job))
+            return;
+        if (!merge_children(c, i)) {
+            c->truncated = true;
+            break;
+        }
+    }
+
+    // Children come after their parents
+    for (size_t i = c->nnodes; i-- > 1;)
+        if (c->nodes[i].differs)
+            c->nodes[c->nodes[i].parent].differs = true;
+    for (size_t i = 0; i < c->nambiguous; i++)
+        for (CmpIndex p = c->nodes[c->ambiguous[i]].parent; p != CMP_NONE; p = c->nodes[p].parent)
+            c->nodes[p].pending++;
+    for (size_t i = 1; i < c->nnodes; i++)
+        if (!is_dir_pair(c, &c->nodes[i]))
+            c->counts[c->nodes[i].state]++;
+}
+
+static bool row_shown(const Compare *c, CmpIndex idx) {
+    const CmpNode *n = &c->nodes[idx];
+    return !c->only_differences || n->differs || n->pending > 0 || n->state == CMP_PENDING;
+}
+
+// Rebuilds the rows of the shown directory, keeping the cursor on `select`
+// if it's still there
+static void load_rows(Compare *c, CmpIndex select) {
+    if (c->nnodes == 0)
+        return;
+    const CmpNode *dir = &c->nodes[c->dir];
+    CmpIndex *rows = realloc(c->rows, MAX(dir->nchildren, 1) * sizeof(CmpIndex));
+    if (rows == NULL)
+        return;
+    c->rows = rows;
+    c->nrows = 0;
+    for (CmpIndex i = dir->children; i < dir->children + dir->nchildren; i++)
+        if (row_shown(c, i))
+            c->rows[c->nrows++] = i;
+
+    c->cursor = MIN(c->cursor, (SIZE)c->nrows - 1);
+    for (size_t i = 0; i < c->nrows; i++)
+        if (c->rows[i] == select)
+            c->cursor = i;
+    c->cursor = MAX(c->cursor, 0);
+}
+
+// The contents of the pair are known: the directories above learn about it
+static void resolve(Compare *c, CmpIndex idx, uint8_t state) {
+    CmpNode *n = &c->nodes[idx];
+    c->counts[CMP_PENDING]--;
+    c->counts[state]++;
+    n->state = state;
+    n->differs = state != CMP_SAME;
+    for (CmpIndex p = n->parent; p != CMP_NONE; p = c->nodes[p].parent) {
+        c->nodes[p].pending--;
+        c->nodes[p].differs |= n->differs;
+    }
+    c->rows_dirty = true;
+}
+
+// Compares both files a block at a time, stopping at the first block that
+// differs. Memory use doesn't depend on the size of the files.
+static uint8_t compare_contents(Compare *c, const Job *job, const char *path, unsigned char *buf) {
+    int fds[2];
+    for (int side = 0; side < 2; side++) {
+        // Not blocking on a FIFO that took the file's place
+        fds[side] = openat(c->fds[side], path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+        struct stat st;
+        if (fds[side] != -1 && (fstat(fds[side], &st) == -1 || !S_ISREG(st.st_mode))) {
+            close(fds[side]);
+            fds[side] = -1;
+        }
+        if (fds[side] != -1)
+            posix_fadvise(fds[side], 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    uint8_t state = fds[0] == -1 || fds[1] == -1 ? CMP_UNKNOWN : CMP_PENDING;
+    while (state == CMP_PENDING) {
+        if (should_stop(c, job)) {
+            state = CMP_UNKNOWN;
+            break;
+        }
+        ssize_t got[2];
+        for (int side = 0; side < 2; side++)
+            got[side] = read_full(fds[side], buf + side * COMPARE_BLOCK, COMPARE_BLOCK);
+        if (got[0] == -1 || got[1] == -1) {
+            state = CMP_UNKNOWN;
+            break;
+        }
+        atomic_fetch_add(&c->compared_bytes, got[0] + got[1]);
+
+        if (got[0] != got[1] || memcmp(buf, buf + COMPARE_BLOCK, got[0]) != 0)
+            state = CMP_CHANGED;
+        else if (got[0] < COMPARE_BLOCK)
+            state = CMP_SAME;
+    }
+
+    for (int side = 0; side < 2; side++)
+        if (fds[side] != -1)
+            close(fds[side]);
+    return state;
+}
+
+static uint8_t compare_links(const Compare *c, const char *path, unsigned char *buf) {
+    ssize_t len[2];
+    for (int side = 0; side < 2; side++)
+        len[side] = readlinkat(c->fds[side], path, (char *)buf + side * COMPARE_BLOCK, COMPARE_BLOCK);
+    if (len[0] == -1 || len[1] == -1)
+        return CMP_UNKNOWN;
+    return len[0] == len[1] && memcmp(buf, buf + COMPARE_BLOCK, len[0]) == 0 ? CMP_SAME : CMP_CHANGED;
+}
+
+static void chunk_run(Job *job) {
+    CmpChunk *chunk = job->data;
+    Compare *c = chunk->c;
+    unsigned char *buf = malloc(2 * COMPARE_BLOCK);
+
+    for (size_t i = 0; i < chunk->count; i++) {
+        chunk->results[i] = CMP_UNKNOWN;
+        if (buf == NULL || should_stop(c, job))
+            continue;
+        const CmpNode *n = &c->nodes[chunk->pairs[i]];
+        char *path = node_path(c, chunk->pairs[i]);
+        if (path == NULL)
+            continue;
+        if (c->sides[0].entries[n->left].type == TYPE_LNK)
+            chunk->results[i] = compare_links(c, path, buf);
+        else
+            chunk->results[i] = compare_contents(c, job, path, buf);
+        free(path);
+    }
+    free(buf);
+}
+
+static void chunk_done(Job *job) {
+    CmpChunk *chunk = job->data;
+    Compare *c = chunk->c;
+    c->pending_jobs--;
+    if (!atomic_load(&c->cancelled))
+        for (size_t i = 0; i < chunk->count; i++)
+            resolve(c, chunk->pairs[i], job->ran ? chunk->results[i] : CMP_UNKNOWN);
+    free(chunk->results);
+    free(chunk);
+}
+
+static void submit_pairs(Compare *c) {
+    size_t first = 0;
+    while (first < c->nambiguous) {
+        size_t n = 0;
+        uint64_t bytes = 0;
+        while (first + n < c->nambiguous && n < CHUNK_PAIRS && (n == 0 || bytes < CHUNK_BYTES))
+            bytes += 2 * c->sides[0].entries[c->nodes[c->ambiguous[first + n++]].left].size;
+
+        CmpChunk *chunk = malloc(sizeof(CmpChunk));
+        uint8_t *results = malloc(n);
+        Job *job = chunk && results ? Job_new(chunk_run, chunk_done, chunk, JOB_PRIO_HIGH) : NULL;
+        if (job == NULL) {
+            free(chunk);
+            free(results);
+            break;
+        }
+        *chunk = (CmpChunk){ .c = c, .pairs = c->ambiguous + first, .count = n, .results = results };
+        c->pending_jobs++;
+        WorkPool_submit(c->pool, job);
+        first += n;
+    }
+
+    // Whatever couldn't be submitted will never be compared
+    for (; first < c->nambiguous; first++)
+        resolve(c, c->ambiguous[first], CMP_UNKNOWN);
+}
+
+static void merge_done(Job *job) {
+    Compare *c = job->data;
+    c->pending_jobs--;
+    if (atomic_load(&c->cancelled))
+        return;
+
+    c->state = COMPARE_BROWSING;
+    if (c->nnodes == 0 || c->truncated)
+        snprintf(c->status, sizeof(c->status), "Out of memory, the comparison is incomplete");
+    c->dir = CMP_ROOT;
+    load_rows(c, CMP_NONE);
+    submit_pairs(c);
+}
+
+static void walk_done(Job *job) {
+    CmpTree *t = job->data;
+    Compare *c = t->owner;
+    t->walk = NULL;
+    if (--c->pending_jobs > 0 || atomic_load(&c->cancelled))
+        return;
+
+    for (int side = 0; side < 2; side++) {
+        if (c->sides[side].unreadable) {
+            c->state = COMPARE_BROWSING;
+            snprintf(c->status, sizeof(c->status), "%s isn't a directory that can be read", c->sides[side].root);
+            return;
+        }
+    }
+
+    Job *merge = Job_new(merge_run, merge_done, c, JOB_PRIO_HIGH);
+    if (merge == NULL) {
+        c->state = COMPARE_BROWSING;
+        snprintf(c->status, sizeof(c->status), "Out of memory");
+        return;
+    }
+    c->state = COMPARE_MERGING;
+    c->pending_jobs++;
+    WorkPool_submit(c->pool, merge);
+}
+
+static bool tree_init(Compare *c, int side, const char *root) {
+    CmpTree *t = &c->sides[side];
+    t->owner = c;
+    atomic_init(&t->walked, 0);
+    atomic_init(&t->errors, 0);
+    t->root = strdup(root);
+    return t->root != NULL;
+}
+
+static void tree_bye(CmpTree *t) {
+    free(t->root);
+    free(t->entries);
+    free(t->names);
+    free(t->children);
+}
+
+static void compare_free(Compare *c) {
+    for (int side = 0; side < 2; side++) {
+        tree_bye(&c->sides[side]);
+        if (c->fds[side] != -1)
+            close(c->fds[side]);
+    }
+    free(c->nodes);
+    free(c->ambiguous);
+    free(c->rows);
+    free(c);
+}
+
+static char node_marker(const Compare *c, const CmpNode *n) {
+    switch (n->state) {
+        case CMP_ADDED:   return '+';
+        case CMP_REMOVED: return '-';
+        case CMP_CHANGED: return '~';
+        case CMP_PENDING: return '?';
+        case CMP_UNKNOWN: return '!';
+    }
+    // Directories on both sides sum up what's below them
+    if (is_dir_pair(c, n))
+        return n->differs ? '~' : n->pending > 0 ? '?' : ' ';
+    return ' ';
+}
+
+// Size of a file on one side, blank for directories and missing entries
+static const char *side_size(char *buffer, const CmpTree *t, CmpIndex idx) {
+    if (idx == CMP_NONE || t->entries[idx].type == TYPE_DIR)
+        return "";
+    return format_file_size(buffer, t->entries[idx].size);
+}
+
+static void draw_progress(WINDOW *win, Compare *c) {
+    werase(win);
+    box(win, 0, 0);
+    mvwprintw(win, 0, 2, "Compare: %.*s", COLS - 14, c->sides[0].root);
+    mvwprintw(win, 1, 2, "   with: %.*s", COLS - 14, c->sides[1].root);
+    mvwprintw(win, 3, 2, "Walked %llu entries on the left, %llu on the right",
+              (unsigned long long)atomic_load(&c->sides[0].walked),
+              (unsigned long long)atomic_load(&c->sides[1].walked));
+    unsigned long long errors = atomic_load(&c->sides[0].errors) + atomic_load(&c->sides[1].errors);
+    if (errors)
+        mvwprintw(win, 4, 2, "%llu entries couldn't be read", errors);
+    if (c->state == COMPARE_MERGING)
+        mvwprintw(win, 5, 2, "Matching entries...");
+    const char *unresponsive = Fsio_unresponsive();
+    if (unresponsive != NULL)
+        mvwprintw(win, 6, 2, "%.*s is not responding", COLS - 22, unresponsive);
+    mvwprintw(win, 7, 2, "Press q to cancel");
+    wrefresh(win);
+}
+
+static void draw_rows(WINDOW *win, Compare *c) {
+    int lines, cols;
+    getmaxyx(win, lines, cols);
+    SIZE num_lines = lines - 6;
+    char left[32], right[32];
+
+    c->start = MIN(c->start, c->cursor);
+    c->start = MAX(c->start, c->cursor + 1 - num_lines);
+
+    werase(win);
+    box(win, 0, 0);
+    mvwprintw(win, 0, 2, "Compare: %.*s", cols - 14, c->sides[0].root);
+    mvwprintw(win, 1, 2, "   with: %.*s", cols - 14, c->sides[1].root);
+
+    char *path = c->nnodes > 0 ? node_path(c, c->dir) : NULL;
+    mvwprintw(win, 2, 2, "In %.*s: %zu added, %zu removed, %zu changed, %zu unknown%s",
+              MAX(cols - 70, 1), path ? path : "?",
+              c->counts[CMP_ADDED], c->counts[CMP_REMOVED], c->counts[CMP_CHANGED], c->counts[CMP_UNKNOWN],
+              c->only_differences ? "   (identical entries hidden)" : "");
+    free(path);
+
+    for (SIZE i = c->start; i < (SIZE)c->nrows && i - c->start < num_lines; i++) {
+        const CmpNode *n = &c->nodes[c->rows[i]];
+        bool is_dir = side_dir(&c->sides[0], n->left) != CMP_NONE || side_dir(&c->sides[1], n->right) != CMP_NONE;
+        if (i == c->cursor)
+            wattron(win, A_REVERSE);
+        mvwprintw(win, 4 + i - c->start, 2, "%c %11s %11s  %.*s%s",
+                  node_marker(c, n),
+                  side_size(left, &c->sides[0], n->left), side_size(right, &c->sides[1], n->right),
+                  MAX(cols - 34, 1), node_name(c, c->rows[i]), is_dir ? "/" : "");
+        if (i == c->cursor)
+            wattroff(win, A_REVERSE);
+    }
+    if (c->nrows == 0 && c->nnodes > 0)
+        mvwprintw(win, 4, 2, c->only_differences ? "No differences here" : "Empty on both sides");
+
+    if (c->counts[CMP_PENDING] > 0)
+        mvwprintw(win, lines - 2, 2, "Comparing the contents of %zu files: %s of %s read",
+                  c->counts[CMP_PENDING], format_file_size(left, atomic_load(&c->compared_bytes)),
+                  format_file_size(right, c->ambiguous_bytes));
+    else if (c->status[0])
+        mvwprintw(win, lines - 2, 2, "%.*s", cols - 4, c->status);
+    else
+        mvwprintw(win, lines - 2, 2, "q: back  h: hide/show identical entries  + added  - removed  ~ changed  ! unknown");
+    wrefresh(win);
+}
+
+static void browse_key(Compare *c, int ch) {
+    if (c->state != COMPARE_BROWSING || c->nnodes == 0)
+        return;
+
+    switch (ch) {
+        case KEY_UP:
+            c->cursor = MAX(c->cursor - 1, 0);
+            break;
+        case KEY_DOWN:
+            c->cursor = MIN(c->cursor + 1, MAX((SIZE)c->nrows - 1, 0));
+            break;
+        case KEY_RIGHT:
+        case '\n': {
+            if (c->nrows == 0)
+                break;
+            CmpIndex idx = c->rows[c->cursor];
+            if (side_dir(&c->sides[0], c->nodes[idx].left) != CMP_NONE
+                || side_dir(&c->sides[1], c->nodes[idx].right) != CMP_NONE) {
+                c->dir = idx;
+                c->cursor = c->start = 0;
+                load_rows(c, CMP_NONE);
+            }
+            break;
+        }
+        case KEY_LEFT:
+            if (c->dir != CMP_ROOT) {
+                CmpIndex from = c->dir;
+                c->dir = c->nodes[from].parent;
+                c->start = 0;
+                load_rows(c, from);
+            }
+            break;
+        case 'h':
+            c->only_differences = !c->only_differences;
+            load_rows(c, c->nrows ? c->rows[c->cursor] : CMP_NONE);
+            break;
+    }
+}
+
+void compare_view(WorkPool *pool, const char *left, const char *right) {
+    Compare *c = calloc(1, sizeof(Compare));
+    if (c == NULL)
+        return;
+    c->pool = pool;
+    c->fds[0] = c->fds[1] = -1;
+    atomic_init(&c->cancelled, false);
+    atomic_init(&c->compared_bytes, 0);
+
+    if (!tree_init(c, 0, left) || !tree_init(c, 1, right)) {
+        compare_free(c);
+        return;
+    }
+    for (int side = 0; side < 2; side++) {
+        c->sides[side].walk = Job_new(walk_run, walk_done, &c->sides[side], JOB_PRIO_HIGH);
+        if (c->sides[side].walk == NULL) {
+            free(c->sides[0].walk);
+            compare_free(c);
+            return;
+        }
+    }
+    // Both trees are walked at once
+    c->state = COMPARE_WALKING;
+    c->pending_jobs = 2;
+    for (int side = 0; side < 2; side++)
+        Fsio_submit(c->sides[side].walk, c->sides[side].root, FSIO_DEADLINE_LIST);
+
+    WINDOW *win = newwin(LINES, COLS, 0, 0);
+    keypad(win, TRUE);
+    wtimeout(win, 100);
+
+    for (;;) {
+        WorkPool_poll(pool);
+        Fsio_poll();
+
+        // Jobs point to the view, it can only go once they are done
+        if (atomic_load(&c->cancelled) && c->pending_jobs == 0)
+            break;
+
+        if (c->rows_dirty) {
+            c->rows_dirty = false;
+            load_rows(c, c->nrows ? c->rows[c->cursor] : CMP_NONE);
+        }
+        if (c->state == COMPARE_BROWSING)
+            draw_rows(win, c);
+        else
+            draw_progress(win, c);
+
+        int ch = wgetch(win);
+        if (ch == ERR)
+            continue;
+        if (ch == 'q' || ch == KEY_F(1)) {
+            atomic_store(&c->cancelled, true);
+            for (int side = 0; side < 2; side++)
+                if (c->sides[side].walk != NULL)
+                    Job_cancel(c->sides[side].walk);
+            continue;
+        }
+        browse_key(c, ch);
+    }
+
+    werase(win);
+    wrefresh(win);
+    delwin(win);
+    compare_free(c);
+}
@@ -0,0 +1,20 @@
+// File: compare.h
+// -----------------------
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <workpool.h>  // for WorkPool
+
+// Bytes read from each file of a pair at a time when comparing contents, a
+// difference stops the comparison at the first block that has it
+#define COMPARE_BLOCK (256 << 10)
+
+// Compares the trees below `left` and `right` and shows them merged, with
+// the entries that were added, removed or changed marked, until the user
+// leaves with 'q'. Entries are matched by name and compared by type, size
+// and mtime. Only files with the same size but another mtime have their
+// contents compared, by several workers at once. Neither tree is entered past
+// its filesystem.
+void compare_view(WorkPool *pool, const char *left, const char *right);
+
+#endif // COMPARE_H
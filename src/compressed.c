@@ -0,0 +1,704 @@
+// File: compressed.c
+// -----------------------
+#define _POSIX_C_SOURCE 200809L  // for pread
+#include <lzma.h>          // for lzma_stream, lzma_code, lzma_index, lzma_block_decoder, lzma_file_info_decoder
+#include <stdint.h>        // for uint64_t, UINT64_MAX
+#include <stdlib.h>        // for malloc, calloc, realloc, free
+#include <string.h>        // for memcpy, memchr, memcmp
+#include <sys/stat.h>      // for struct stat, fstat, S_ISREG
+#include <unistd.h>        // for pread, close
+#include <zlib.h>          // for z_stream, inflate, inflateReset2, inflatePrime, inflateSetDictionary
+#ifdef CUPID_WITH_ZSTD
+#include <zstd.h>          // for ZSTD_DCtx, ZSTD_decompressStream, ZSTD_DCtx_reset
+#endif
+// Local includes
+#include <compressed.h>    // for Compressed, CompressedFormat, COMPRESSED_CHECKPOINT_SPACING
+#include <utils.h>         // for MIN, MAX, SIZE
+
+#define IN_CHUNK (64 * 1024)
+#define OUT_CHUNK (64 * 1024)
+// Deflate looks at most this far back, it's what a gzip checkpoint keeps
+#define WINDOW_SIZE 32768
+// Only the start of long lines is kept, no preview is that wide
+#define KEPT_LINE_BYTES 1024
+
+// A place decompression can resume from: for gzip any deflate block boundary
+// with the 32 KiB that precede it, for zstd the start of a frame.
+typedef struct {
+    uint64_t out;
+    uint64_t in;
+    // gzip: bits of the byte at in - 1 that belong to the next block
+    int bits;
+    unsigned char *window;
+    size_t window_len;
+} Checkpoint;
+
+struct Compressed {
+    int fd;
+    CompressedFormat format;
+    uint64_t file_size;
+
+    unsigned char in_buf[IN_CHUNK];
+    const unsigned char *next_in;
+    size_t avail_in;
+    // File offset right after what's in in_buf
+    uint64_t in_off;
+
+    // Uncompressed offset of the next byte the decoder produces
+    uint64_t out;
+    bool eof;
+    bool error;
+    unsigned char out_buf[OUT_CHUNK];
+    size_t out_pos, out_len;
+
+    // The first one is the start of the data, they're sorted by `out`
+    Checkpoint *checkpoints;
+    size_t num_checkpoints;
+    uint64_t spacing;
+
+    z_stream z;
+    // After resuming at a checkpoint the rest of the member is raw deflate
+    bool raw;
+    bool new_member;
+    unsigned char window[WINDOW_SIZE];
+
+    lzma_stream x;
+    // xz files list their blocks at the end, blocks are where xz resumes
+    lzma_index *xz_index;
+    bool xz_index_loaded;
+    lzma_index_iter xz_iter;
+    bool xz_block_mode;
+    lzma_filter filters[LZMA_FILTERS_MAX + 1];
+
+#ifdef CUPID_WITH_ZSTD
+    ZSTD_DCtx *zstd;
+#endif
+
+    // samples[i] is the offset of line i * COMPRESSED_LINE_SAMPLE
+    uint64_t *samples;
+    size_t num_samples, samples_cap;
+    SIZE total_lines;
+
+    // Lines of the last call, repeated calls are answered from here
+    char *text;
+    size_t text_len, text_cap;
+    size_t *starts;
+    int *lens;
+    SIZE starts_cap;
+    SIZE cached_first, cached_count, cached_n;
+};
+
+CompressedFormat Compressed_detect(int fd) {
+    // Reading a FIFO or a device would block or have side effects
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+        return COMPRESSED_NONE;
+
+    unsigned char magic[6];
+    ssize_t got = pread(fd, magic, sizeof(magic), 0);
+
+    if (got >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        return COMPRESSED_GZIP;
+    if (got >= 6 && memcmp(magic, "\xfd" "7zXZ\0", 6) == 0)
+        return COMPRESSED_XZ;
+    if (got >= 4 && memcmp(magic, "\x28\xb5\x2f\xfd", 4) == 0)
+        return COMPRESSED_ZSTD;
+    return COMPRESSED_NONE;
+}
+
+const char *Compressed_format_name(CompressedFormat format) {
+    switch (format) {
+        case COMPRESSED_GZIP: return "gzip";
+        case COMPRESSED_XZ:   return "xz";
+        case COMPRESSED_ZSTD: return "zstd";
+        default:              return "uncompressed";
+    }
+}
+
+static bool fill_input(Compressed *c) {
+    if (c->in_off >= c->file_size)
+        return false;
+    ssize_t got = pread(c->fd, c->in_buf, IN_CHUNK, c->in_off);
+    if (got <= 0)
+        return false;
+    c->next_in = c->in_buf;
+    c->avail_in = got;
+    c->in_off += got;
+    return true;
+}
+
+static bool skip_input(Compressed *c, size_t n) {
+    while (n > 0) {
+        if (c->avail_in == 0 && !fill_input(c))
+            return false;
+        size_t k = MIN(n, c->avail_in);
+        c->next_in += k;
+        c->avail_in -= k;
+        n -= k;
+    }
+    return true;
+}
+
+static void reset_input(Compressed *c, uint64_t offset) {
+    c->in_off = offset;
+    c->next_in = c->in_buf;
+    c->avail_in = 0;
+}
+
+// Keeps the last WINDOW_SIZE bytes of output, indexed by uncompressed offset
+static void remember_output(Compressed *c, const unsigned char *data, size_t len) {
+    uint64_t out = c->out;
+    if (len > WINDOW_SIZE) {
+        out += len - WINDOW_SIZE;
+        data += len - WINDOW_SIZE;
+        len = WINDOW_SIZE;
+    }
+    size_t at = out % WINDOW_SIZE;
+    size_t first = MIN(len, WINDOW_SIZE - at);
+    memcpy(c->window + at, data, first);
+    memcpy(c->window, data + first, len - first);
+}
+
+static void add_checkpoint(Compressed *c, int bits, bool with_window) {
+    if (c->out < c->checkpoints[c->num_checkpoints - 1].out + c->spacing)
+        return;
+
+    if (c->num_checkpoints == COMPRESSED_MAX_CHECKPOINTS) {
+        // Keeps the memory bounded on huge files, at the cost of
+        // decompressing a little more after a jump
+        size_t kept = 0;
+        for (size_t i = 0; i < c->num_checkpoints; i++) {
+            if (i % 2 == 0)
+                c->checkpoints[kept++] = c->checkpoints[i];
+            else
+                free(c->checkpoints[i].window);
+        }
+        c->num_checkpoints = kept;
+        c->spacing *= 2;
+        if (c->out < c->checkpoints[c->num_checkpoints - 1].out + c->spacing)
+            return;
+    }
+
+    Checkpoint cp = {
+        .out = c->out,
+        .in = c->in_off - c->avail_in,
+        .bits = bits,
+    };
+    if (with_window) {
+        cp.window_len = MIN(c->out, WINDOW_SIZE);
+        cp.window = malloc(cp.window_len);
+        if (cp.window == NULL)
+            return;
+        size_t at = (c->out - cp.window_len) % WINDOW_SIZE;
+        size_t first = MIN(cp.window_len, WINDOW_SIZE - at);
+        memcpy(cp.window, c->window + at, first);
+        memcpy(cp.window + first, c->window, cp.window_len - first);
+    }
+    c->checkpoints[c->num_checkpoints++] = cp;
+}
+
+static const Checkpoint *checkpoint_before(const Compressed *c, uint64_t target) {
+    size_t lo = 0, hi = c->num_checkpoints;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (c->checkpoints[mid].out <= target)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return &c->checkpoints[lo];
+}
+
+static ssize_t gzip_decode(Compressed *c, unsigned char *buf, size_t size) {
+    c->z.next_out = buf;
+    c->z.avail_out = size;
+
+    while (c->z.avail_out > 0) {
+        if (c->avail_in == 0 && !fill_input(c)) {
+            // The end, or a truncated file
+            c->eof = true;
+            break;
+        }
+
+        unsigned char *before = c->z.next_out;
+        c->z.next_in = (unsigned char *)c->next_in;
+        c->z.avail_in = c->avail_in;
+        int ret = inflate(&c->z, Z_BLOCK);
+        c->next_in = c->z.next_in;
+        c->avail_in = c->z.avail_in;
+
+        size_t produced = c->z.next_out - before;
+        remember_output(c, before, produced);
+        c->out += produced;
+        if (produced)
+            c->new_member = false;
+
+        if (ret == Z_STREAM_END) {
+            // Resuming in raw mode skipped the header, the trailer is left
+            if (c->raw && !skip_input(c, 8)) {
+                c->eof = true;
+                break;
+            }
+            // Members can be concatenated, like rotated logs appended together
+            inflateReset2(&c->z, 15 + 16);
+            c->raw = false;
+            c->new_member = true;
+            continue;
+        }
+        if (ret == Z_DATA_ERROR && c->new_member && c->out > 0) {
+            // Padding after the last member
+            c->eof = true;
+            break;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            c->error = true;
+            break;
+        }
+
+        // Right after a block that isn't the last one of the member
+        if ((c->z.data_type & 128) && !(c->z.data_type & 64))
+            add_checkpoint(c, c->z.data_type & 7, true);
+    }
+
+    return c->z.next_out - buf;
+}
+
+static bool gzip_restore(Compressed *c, const Checkpoint *cp) {
+    c->out = cp->out;
+    if (cp->out == 0) {
+        inflateReset2(&c->z, 15 + 16);
+        c->raw = false;
+        c->new_member = true;
+        reset_input(c, 0);
+        return true;
+    }
+
+    inflateReset2(&c->z, -15);
+    c->raw = true;
+    c->new_member = false;
+    reset_input(c, cp->in - (cp->bits ? 1 : 0));
+    if (cp->bits) {
+        if (!fill_input(c))
+            return false;
+        inflatePrime(&c->z, cp->bits, *c->next_in >> (8 - cp->bits));
+        c->next_in++;
+        c->avail_in--;
+    }
+    inflateSetDictionary(&c->z, cp->window, cp->window_len);
+    // Later checkpoints need the history too
+    for (size_t i = 0; i < cp->window_len; i++)
+        c->window[(cp->out - cp->window_len + i) % WINDOW_SIZE] = cp->window[i];
+    return true;
+}
+
+// Only reads the stream footers and indexes, which are at the end
+static void xz_load_index(Compressed *c) {
+    c->xz_index_loaded = true;
+    unsigned char *buf = malloc(IN_CHUNK);
+    if (buf == NULL)
+        return;
+
+    lzma_stream s = LZMA_STREAM_INIT;
+    if (lzma_file_info_decoder(&s, &c->xz_index, UINT64_MAX, c->file_size) != LZMA_OK) {
+        free(buf);
+        return;
+    }
+
+    uint64_t off = 0;
+    for (;;) {
+        ssize_t got = pread(c->fd, buf, IN_CHUNK, off);
+        if (got < 0)
+            break;
+        s.next_in = buf;
+        s.avail_in = got;
+        lzma_ret ret = lzma_code(&s, got == 0 ? LZMA_FINISH : LZMA_RUN);
+        if (ret == LZMA_SEEK_NEEDED) {
+            off = s.seek_pos;
+            continue;
+        }
+        if (ret != LZMA_OK || got == 0)
+            break;
+        off += got - s.avail_in;
+    }
+    // Only set once the decoder returned LZMA_STREAM_END
+    lzma_end(&s);
+    free(buf);
+}
+
+static bool xz_start_block(Compressed *c) {
+    uint64_t off = c->xz_iter.block.compressed_file_offset;
+    unsigned char header[LZMA_BLOCK_HEADER_SIZE_MAX];
+    ssize_t got = pread(c->fd, header, sizeof(header), off);
+    if (got <= 0)
+        return false;
+
+    lzma_block block = {
+        .version = 1,
+        .check = c->xz_iter.stream.flags->check,
+        .filters = c->filters,
+        .header_size = lzma_block_header_size_decode(header[0]),
+    };
+    if ((ssize_t)block.header_size > got || lzma_block_header_decode(&block, NULL, header) != LZMA_OK)
+        return false;
+
+    lzma_ret ret = lzma_block_decoder(&c->x, &block);
+    for (size_t i = 0; c->filters[i].id != LZMA_VLI_UNKNOWN; i++)
+        free(c->filters[i].options);
+    if (ret != LZMA_OK)
+        return false;
+
+    c->xz_block_mode = true;
+    c->out = c->xz_iter.block.uncompressed_file_offset;
+    reset_input(c, off + block.header_size);
+    return true;
+}
+
+static bool xz_restart(Compressed *c) {
+    c->xz_block_mode = false;
+    c->out = 0;
+    reset_input(c, 0);
+    return lzma_stream_decoder(&c->x, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+}
+
+static uint64_t xz_restore_point(Compressed *c, uint64_t target) {
+    if (!c->xz_index_loaded)
+        xz_load_index(c);
+    if (c->xz_index == NULL)
+        return 0;
+    lzma_index_iter iter;
+    lzma_index_iter_init(&iter, c->xz_index);
+    if (lzma_index_iter_locate(&iter, target))
+        return 0;
+    return iter.block.uncompressed_file_offset;
+}
+
+static bool xz_restore(Compressed *c, uint64_t target) {
+    if (!c->xz_index_loaded)
+        xz_load_index(c);
+    if (c->xz_index == NULL)
+        return xz_restart(c);
+
+    lzma_index_iter_init(&c->xz_iter, c->xz_index);
+    if (lzma_index_iter_locate(&c->xz_iter, target) || !xz_start_block(c))
+        return xz_restart(c);
+    return true;
+}
+
+static ssize_t xz_decode(Compressed *c, unsigned char *buf, size_t size) {
+    c->x.next_out = buf;
+    c->x.avail_out = size;
+
+    while (c->x.avail_out > 0) {
+        if (c->avail_in == 0)
+            fill_input(c);
+
+        unsigned char *before = c->x.next_out;
+        c->x.next_in = c->next_in;
+        c->x.avail_in = c->avail_in;
+        lzma_ret ret = lzma_code(&c->x, c->avail_in == 0 ? LZMA_FINISH : LZMA_RUN);
+        c->next_in = c->x.next_in;
+        c->avail_in = c->x.avail_in;
+        c->out += c->x.next_out - before;
+
+        if (ret == LZMA_STREAM_END) {
+            // In block mode that's the end of a block, the index knows the next
+            if (c->xz_block_mode
+                && !lzma_index_iter_next(&c->xz_iter, LZMA_INDEX_ITER_NONEMPTY_BLOCK)
+                && xz_start_block(c))
+                continue;
+            c->eof = true;
+            break;
+        }
+        if (ret != LZMA_OK) {
+            // Truncated files end with LZMA_BUF_ERROR
+            c->eof = true;
+            c->error = ret != LZMA_BUF_ERROR;
+            break;
+        }
+    }
+
+    return c->x.next_out - buf;
+}
+
+#ifdef CUPID_WITH_ZSTD
+static ssize_t zstd_decode(Compressed *c, unsigned char *buf, size_t size) {
+    ZSTD_outBuffer out = { buf, size, 0 };
+
+    while (out.pos < out.size) {
+        if (c->avail_in == 0 && !fill_input(c)) {
+            c->eof = true;
+            break;
+        }
+
+        size_t before = out.pos;
+        ZSTD_inBuffer in = { c->next_in, c->avail_in, 0 };
+        size_t ret = ZSTD_decompressStream(c->zstd, &out, &in);
+        c->next_in += in.pos;
+        c->avail_in -= in.pos;
+        c->out += out.pos - before;
+
+        if (ZSTD_isError(ret)) {
+            c->error = true;
+            break;
+        }
+        // A frame just ended, the next one doesn't depend on it
+        if (ret == 0)
+            add_checkpoint(c, 0, false);
+    }
+
+    return out.pos;
+}
+
+static bool zstd_restore(Compressed *c, const Checkpoint *cp) {
+    ZSTD_DCtx_reset(c->zstd, ZSTD_reset_session_only);
+    c->out = cp->out;
+    reset_input(c, cp->in);
+    return true;
+}
+#endif
+
+static ssize_t decode(Compressed *c, unsigned char *buf, size_t size) {
+    switch (c->format) {
+        case COMPRESSED_GZIP: return gzip_decode(c, buf, size);
+        case COMPRESSED_XZ:   return xz_decode(c, buf, size);
+#ifdef CUPID_WITH_ZSTD
+        case COMPRESSED_ZSTD: return zstd_decode(c, buf, size);
+#endif
+        default:              return -1;
+    }
+}
+
+// Where decompression would resume to reach `target`
+static uint64_t restore_point(Compressed *c, uint64_t target) {
+    if (c->format == COMPRESSED_XZ)
+        return xz_restore_point(c, target);
+    return checkpoint_before(c, target)->out;
+}
+
+static bool restore(Compressed *c, uint64_t target) {
+    c->eof = c->error = false;
+    c->out_pos = c->out_len = 0;
+    switch (c->format) {
+        case COMPRESSED_GZIP: return gzip_restore(c, checkpoint_before(c, target));
+        case COMPRESSED_XZ:   return xz_restore(c, target);
+#ifdef CUPID_WITH_ZSTD
+        case COMPRESSED_ZSTD: return zstd_restore(c, checkpoint_before(c, target));
+#endif
+        default:              return false;
+    }
+}
+
+static bool fill_output(Compressed *c) {
+    if (c->out_pos < c->out_len)
+        return true;
+    c->out_pos = c->out_len = 0;
+    if (c->eof || c->error)
+        return false;
+    ssize_t n = decode(c, c->out_buf, OUT_CHUNK);
+    if (n <= 0)
+        return false;
+    c->out_len = n;
+    return true;
+}
+
+// Uncompressed offset of the next byte handed out
+static uint64_t position(const Compressed *c) {
+    return c->out - (c->out_len - c->out_pos);
+}
+
+static bool seek(Compressed *c, uint64_t target) {
+    uint64_t pos = position(c);
+    // Going on from here beats resuming at a checkpoint, unless there's one
+    // in between
+    if ((pos > target || pos < restore_point(c, target)) && !restore(c, target))
+        return false;
+
+    while (position(c) < target) {
+        if (!fill_output(c))
+            return false;
+        c->out_pos += MIN(c->out_len - c->out_pos, target - position(c));
+    }
+    return true;
+}
+
+Compressed *Compressed_open(int fd) {
+    CompressedFormat format = Compressed_detect(fd);
+    struct stat st;
+#ifndef CUPID_WITH_ZSTD
+    if (format == COMPRESSED_ZSTD)
+        format = COMPRESSED_NONE;
+#endif
+    if (format == COMPRESSED_NONE || fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    Compressed *c = calloc(1, sizeof(Compressed));
+    if (c == NULL) {
+        close(fd);
+        return NULL;
+    }
+    c->fd = fd;
+    c->format = format;
+    c->file_size = st.st_size;
+    c->spacing = COMPRESSED_CHECKPOINT_SPACING;
+    c->total_lines = -1;
+    c->cached_n = -1;
+    c->x = (lzma_stream)LZMA_STREAM_INIT;
+    c->checkpoints = calloc(COMPRESSED_MAX_CHECKPOINTS, sizeof(Checkpoint));
+    c->samples = malloc(64 * sizeof(uint64_t));
+    c->samples_cap = 64;
+    c->num_checkpoints = 1;
+    c->num_samples = 1;
+
+    bool ok = c->checkpoints != NULL && c->samples != NULL;
+    if (ok) {
+        c->samples[0] = 0;
+        switch (format) {
+            case COMPRESSED_GZIP:
+                ok = inflateInit2(&c->z, 15 + 16) == Z_OK;
+                c->new_member = true;
+                break;
+            case COMPRESSED_XZ:
+                ok = xz_restart(c);
+                break;
+#ifdef CUPID_WITH_ZSTD
+            case COMPRESSED_ZSTD:
+                c->zstd = ZSTD_createDCtx();
+                ok = c->zstd != NULL;
+                break;
+#endif
+            default:
+                ok = false;
+        }
+    }
+
+    if (!ok) {
+        Compressed_close(c);
+        return NULL;
+    }
+    return c;
+}
+
+void Compressed_close(Compressed *c) {
+    if (c == NULL)
+        return;
+    if (c->format == COMPRESSED_GZIP)
+        inflateEnd(&c->z);
+    lzma_end(&c->x);
+    if (c->xz_index)
+        lzma_index_end(c->xz_index, NULL);
+#ifdef CUPID_WITH_ZSTD
+    ZSTD_freeDCtx(c->zstd);
+#endif
+    if (c->checkpoints)
+        for (size_t i = 0; i < c->num_checkpoints; i++)
+            free(c->checkpoints[i].window);
+    free(c->checkpoints);
+    free(c->samples);
+    free(c->text);
+    free(c->starts);
+    free(c->lens);
+    close(c->fd);
+    free(c);
+}
+
+static bool append_text(Compressed *c, const unsigned char *data, size_t len) {
+    if (c->text_len + len > c->text_cap) {
+        size_t cap = MAX(c->text_cap * 2, c->text_len + len + 4096);
+        char *text = realloc(c->text, cap);
+        if (text == NULL)
+            return false;
+        c->text = text;
+        c->text_cap = cap;
+    }
+    memcpy(c->text + c->text_len, data, len);
+    c->text_len += len;
+    return true;
+}
+
+static void add_sample(Compressed *c, uint64_t offset) {
+    if (c->num_samples == c->samples_cap) {
+        uint64_t *samples = realloc(c->samples, c->samples_cap * 2 * sizeof(uint64_t));
+        if (samples == NULL)
+            return;
+        c->samples = samples;
+        c->samples_cap *= 2;
+    }
+    c->samples[c->num_samples++] = offset;
+}
+
+SIZE Compressed_lines(Compressed *c, SIZE first, SIZE count, const char **lines, int *lens) {
+    if (first < 0 || count <= 0)
+        return 0;
+
+    if (first != c->cached_first || count != c->cached_count || c->cached_n < 0) {
+        if (count > c->starts_cap) {
+            size_t *starts = realloc(c->starts, count * sizeof(size_t));
+            int *line_lens = starts ? realloc(c->lens, count * sizeof(int)) : NULL;
+            if (starts)
+                c->starts = starts;
+            if (line_lens == NULL)
+                return 0;
+            c->lens = line_lens;
+            c->starts_cap = count;
+        }
+
+        c->cached_first = first;
+        c->cached_count = count;
+        c->cached_n = 0;
+        c->text_len = 0;
+
+        size_t sample = MIN((size_t)first / COMPRESSED_LINE_SAMPLE, c->num_samples - 1);
+        SIZE line = sample * COMPRESSED_LINE_SAMPLE;
+        if ((c->total_lines >= 0 && first >= c->total_lines) || !seek(c, c->samples[sample]))
+            count = 0;
+
+        while (c->cached_n < count) {
+            // Every sample offset gets remembered the first time it's passed
+            if (line % COMPRESSED_LINE_SAMPLE == 0 && (size_t)line / COMPRESSED_LINE_SAMPLE == c->num_samples)
+                add_sample(c, position(c));
+
+            bool keep = line >= first;
+            size_t start = c->text_len;
+            bool any = false, ended = false;
+            while (!ended && fill_output(c)) {
+                const unsigned char *p = c->out_buf + c->out_pos;
+                size_t avail = c->out_len - c->out_pos;
+                const unsigned char *nl = memchr(p, '\n', avail);
+                size_t take = nl ? (size_t)(nl - p) : avail;
+                if (keep && c->text_len - start < KEPT_LINE_BYTES)
+                    append_text(c, p, MIN(take, KEPT_LINE_BYTES - (c->text_len - start)));
+                c->out_pos += take + (nl != NULL);
+                any = true;
+                ended = nl != NULL;
+            }
+
+            if (!any) {
+                c->total_lines = line;
+                break;
+            }
+            if (keep) {
+                c->starts[c->cached_n] = start;
+                c->lens[c->cached_n] = c->text_len - start;
+                c->cached_n++;
+            }
+            line++;
+            if (!ended) {
+                // No line feed at the end
+                c->total_lines = line;
+                break;
+            }
+        }
+    }
+
+    for (SIZE i = 0; i < c->cached_n; i++) {
+        lines[i] = c->text + c->starts[i];
+        lens[i] = c->lens[i];
+    }
+    return c->cached_n;
+}
+
+SIZE Compressed_line_count(const Compressed *c) {
+    return c->total_lines;
+}
@@ -0,0 +1,42 @@
+// File: compressed.h
+// -----------------------
+#ifndef COMPRESSED_H
+#define COMPRESSED_H
+
+#include <stdint.h>   // for uint64_t
+#include <utils.h>    // for SIZE
+
+typedef enum {
+    COMPRESSED_NONE = 0,
+    COMPRESSED_GZIP,
+    COMPRESSED_XZ,
+    COMPRESSED_ZSTD,
+} CompressedFormat;
+
+// Uncompressed bytes between two gzip (or zstd frame) checkpoints at first.
+// When there are too many the spacing doubles and every other one is dropped.
+#define COMPRESSED_CHECKPOINT_SPACING (1 << 20)
+#define COMPRESSED_MAX_CHECKPOINTS 256
+// The offset of every this many lines is remembered
+#define COMPRESSED_LINE_SAMPLE 64
+
+typedef struct Compressed Compressed;
+
+// Looks at the magic bytes of the file open as `fd`, the name doesn't matter.
+// Anything but a regular file is COMPRESSED_NONE.
+CompressedFormat Compressed_detect(int fd);
+// Takes over `fd`, which is closed along with the reader. NULL (with `fd`
+// closed) if the file can't be read or its format isn't supported by this
+// build.
+Compressed *Compressed_open(int fd);
+void Compressed_close(Compressed *c);
+// Decompresses only what's needed to get up to `count` lines starting at
+// line `first` (0 based), resuming from the closest checkpoint. Fills lines[]
+// and lens[] with the lines, without their line feed, valid until the next
+// call. Returns how many lines there are, fewer at the end of the data.
+SIZE Compressed_lines(Compressed *c, SIZE first, SIZE count, const char **lines, int *lens);
+// Number of lines, -1 until the end of the data has been seen
+SIZE Compressed_line_count(const Compressed *c);
+const char *Compressed_format_name(CompressedFormat format);
+
+#endif // COMPRESSED_H
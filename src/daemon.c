@@ -0,0 +1,692 @@
+// File: daemon.c
+// -----------------------
+#define _GNU_SOURCE              // for memfd_create, accept4, struct ucred, SO_PEERCRED, POLLRDHUP, F_ADD_SEALS, O_PATH
+#include <dirent.h>              // for DIR, struct dirent, fdopendir, readdir, closedir, DT_DIR
+#include <errno.h>               // for errno, EINTR, EIO, ENOTDIR, ECANCELED, EADDRINUSE, ECONNREFUSED
+#include <fcntl.h>               // for open, openat, fcntl, O_PATH, O_DIRECTORY, O_CLOEXEC, F_ADD_SEALS, F_GET_SEALS, F_SEAL_*
+#include <poll.h>                // for poll, struct pollfd, POLLIN, POLLRDHUP, POLLHUP, POLLERR
+#include <pthread.h>             // for pthread_mutex_t, pthread_mutex_lock, pthread_mutex_unlock
+#include <signal.h>              // for sigaction, struct sigaction, SIGINT, SIGTERM
+#include <stdalign.h>            // for alignas
+#include <stdint.h>              // for uint32_t, uint64_t, int64_t, uint8_t, UINT32_MAX
+#include <stdio.h>               // for fprintf, snprintf, stderr
+#include <stdlib.h>              // for calloc, realloc, free, getenv
+#include <string.h>              // for memcpy, strcmp, strlen, strerror
+#include <sys/mman.h>            // for memfd_create, mmap, munmap, MFD_CLOEXEC, MFD_ALLOW_SEALING
+#include <sys/socket.h>          // for socket, connect, bind, listen, accept4, sendmsg, recvmsg, getsockopt, setsockopt
+#include <sys/stat.h>            // for fstat, fstatat, struct stat, umask, S_ISDIR, S_ISLNK
+#include <sys/time.h>            // for struct timeval
+#include <sys/un.h>              // for struct sockaddr_un
+#include <time.h>                // for struct timespec, clock_gettime, CLOCK_MONOTONIC
+#include <unistd.h>              // for close, write, unlink, getuid, geteuid
+// Local includes
+#include <daemon.h>              // for DAEMON_DIR_SLOTS, DAEMON_SIZE_SLOTS, DAEMON_SIZE_TTL_MS, DAEMON_LIST_TIMEOUT_MS
+#include <files.h>               // for FileAttr, FileAttr_get_meta, mk_attr
+#include <metadata.h>            // for Metadata_fill
+#include <utils.h>               // for is_directory, same_dir_state, elapsed_ms
+#include <vector.h>              // for Vector, Vector_add, Vector_len, Vector_set_len
+#include <walk.h>                // for Walker, WalkEntry, walk_tree
+#include <watch.h>               // for Watch_init, Watch_bye, Watch_fd, Watch_add, Watch_subscribe, Watch_unsubscribe, Watch_drop_unused, Watch_poll
+#include <workpool.h>            // for WorkPool, Job, Job_new, WorkPool_init, WorkPool_submit, WorkPool_poll, WorkPool_bye
+
+// "CFML" at the start of every listing
+#define LISTING_MAGIC 0x4c4d4643
+// How long the daemon's loop sleeps when nothing happens, done callbacks
+// only subscribe to watches so they may wait that long
+#define DAEMON_POLL_MS 100
+// Slices of the client's wait for a reply, between checks of *cancelled
+#define AWAIT_SLICE_MS 50
+
+typedef enum {
+    DAEMON_LIST = 1,
+    DAEMON_SIZE = 2,
+} DaemonOp;
+
+// A request is the op alone, the directory comes with it as a descriptor.
+// The reply to a listing comes with the memfd holding it.
+typedef struct {
+    // 0, or the errno of what went wrong
+    int32_t error;
+    uint32_t unused;
+    // The size of the tree for DAEMON_SIZE
+    uint64_t value;
+} DaemonReply;
+
+// The memfd: this header, `count` entries, then their names, '\0'
+// terminated
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+} ListingHeader;
+
+typedef struct {
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime;
+    uint32_t mode;
+    uint32_t uid;
+    // Offset of the name from the first one
+    uint32_t name;
+    uint8_t is_dir;
+    // The entry couldn't be stat'ed, only `ino` and `is_dir` are known
+    uint8_t unknown;
+} ListedEntry;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} Buffer;
+
+// A slot of the daemon's cache, free while `used` is 0. Directories are told
+// apart by inode, whatever path the client found them by.
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    unsigned long used;
+    // Identity of the directory when it was read, see same_dir_state
+    struct stat st;
+    int memfd;
+    // An event came since, the listing is read again on the next request
+    bool stale;
+    unsigned long events;
+    // The watch added by the last read, and the one subscribed to on the
+    // main thread (Watch_subscribe isn't for workers)
+    int wd;
+    int subscribed;
+} CachedListing;
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    unsigned long used;
+    struct stat st;
+    long size;
+    struct timespec at;
+} CachedSize;
+
+// A connection, which carries a single request
+typedef struct {
+    int conn;
+    // Watch added by the job, and the slot it filled
+    int wd;
+    CachedListing *slot;
+} ServeRequest;
+
+typedef struct {
+    long total;
+    int conn;
+    size_t visited;
+    atomic_bool stop;
+} SizeWalk;
+
+// Workers fill the slots, the main thread subscribes their watches and
+// marks them stale
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static CachedListing listings[DAEMON_DIR_SLOTS];
+static CachedSize sizes[DAEMON_SIZE_SLOTS];
+static unsigned long use_clock;
+// The process that serves never asks itself
+static atomic_bool serving;
+// Set by SIGINT and SIGTERM
+static atomic_bool stopping;
+
+static bool socket_address(struct sockaddr_un *addr) {
+    *addr = (struct sockaddr_un){ .sun_family = AF_UNIX };
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    int len = runtime != NULL && runtime[0] == '/'
+        ? snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/cupidfm.sock", runtime)
+        : snprintf(addr->sun_path, sizeof(addr->sun_path), "/tmp/cupidfm-%u.sock", (unsigned int)getuid());
+    return len > 0 && (size_t)len < sizeof(addr->sun_path);
+}
+
+// Both ends make sure the other runs as the same user: the daemon reads
+// with its own permissions, and a socket in /tmp may be anyone's
+static bool peer_is_us(int conn) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid();
+}
+
+static bool send_with_fd(int conn, const void *data, size_t len, int fd) {
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+    if (fd != -1) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return sendmsg(conn, &msg, MSG_NOSIGNAL) == (ssize_t)len;
+}
+
+// A message of exactly `len` bytes, and the first descriptor that came with
+// it in *fd (-1 if none)
+static bool recv_with_fd(int conn, void *data, size_t len, int *fd) {
+    struct iovec iov = { .iov_base = data, .iov_len = len };
+    alignas(struct cmsghdr) char control[CMSG_SPACE(4 * sizeof(int))];
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+    *fd = -1;
+    ssize_t n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    if (n == -1)
+        return false;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int received;
+            memcpy(&received, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (*fd == -1)
+                *fd = received;
+            else
+                close(received);
+        }
+    }
+    if ((size_t)n != len || (msg.msg_flags & MSG_TRUNC)) {
+        if (*fd != -1)
+            close(*fd);
+        *fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// The client closed the connection, or the daemon is stopping
+static bool gone(int conn) {
+    struct pollfd p = { .fd = conn, .events = POLLRDHUP };
+    return atomic_load(&stopping)
+        || (poll(&p, 1, 0) == 1 && (p.revents & (POLLRDHUP | POLLHUP | POLLERR)));
+}
+
+static bool buffer_append(Buffer *b, const void *data, size_t len) {
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + len)
+            cap *= 2;
+        char *grown = realloc(b->data, cap);
+        if (grown == NULL)
+            return false;
+        b->data = grown;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return true;
+}
+
+static bool write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Sealed, so clients can map it without fearing it shrinks or changes under
+// them
+static int write_listing(const ListingHeader *header, const Buffer *entries, const Buffer *names) {
+    int memfd = memfd_create("cupidfm-listing", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd == -1)
+        return -1;
+    if (!write_all(memfd, (const char *)header, sizeof(*header))
+        || !write_all(memfd, entries->data, entries->len)
+        || !write_all(memfd, names->data, names->len)
+        || fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+        close(memfd);
+        return -1;
+    }
+    return memfd;
+}
+
+// Reads and stats every entry of the directory `dirfd`, returns the memfd
+// holding the listing or -1
+static int read_listing(int dirfd, int conn) {
+    int fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd != -1 ? fdopendir(fd) : NULL;
+    if (dir == NULL) {
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    Buffer entries = { 0 }, names = { 0 };
+    ListingHeader header = { .magic = LISTING_MAGIC };
+    bool ok = true;
+    struct dirent *d;
+    while (ok && (d = readdir(dir)) != NULL) {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+            continue;
+        if (++header.count % DAEMON_HANGUP_CHECK == 0 && gone(conn)) {
+            ok = false;
+            break;
+        }
+
+        ListedEntry e = { .ino = d->d_ino, .name = names.len };
+        struct stat st;
+        if (fstatat(fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            e.size = st.st_size;
+            e.mtime = st.st_mtime;
+            e.mode = st.st_mode;
+            e.uid = st.st_uid;
+            e.is_dir = S_ISDIR(st.st_mode) || (S_ISLNK(st.st_mode) && is_directory(fd, d->d_name));
+        } else {
+            // Listed anyway, like append_files_to_vec does
+            e.unknown = 1;
+            e.is_dir = d->d_type == DT_DIR;
+        }
+        ok = names.len <= UINT32_MAX
+            && buffer_append(&names, d->d_name, strlen(d->d_name) + 1)
+            && buffer_append(&entries, &e, sizeof(e));
+    }
+    closedir(dir);
+
+    int memfd = ok ? write_listing(&header, &entries, &names) : -1;
+    free(entries.data);
+    free(names.data);
+    return memfd;
+}
+
+// The slot of the directory `st`, or if `grab` the least recently used one
+static CachedListing *find_listing(const struct stat *st, bool grab) {
+    CachedListing *victim = &listings[0];
+    for (size_t i = 0; i < DAEMON_DIR_SLOTS; i++) {
+        CachedListing *c = &listings[i];
+        if (c->used != 0 && c->dev == st->st_dev && c->ino == st->st_ino)
+            return c;
+        if (c->used < victim->used)
+            victim = c;
+    }
+    return grab ? victim : NULL;
+}
+
+static CachedSize *find_size(const struct stat *st, bool grab) {
+    CachedSize *victim = &sizes[0];
+    for (size_t i = 0; i < DAEMON_SIZE_SLOTS; i++) {
+        CachedSize *c = &sizes[i];
+        if (c->used != 0 && c->dev == st->st_dev && c->ino == st->st_ino)
+            return c;
+        if (c->used < victim->used)
+            victim = c;
+    }
+    return grab ? victim : NULL;
+}
+
+static void listing_event(void *owner, const WatchEvent *event) {
+    CachedListing *c = owner;
+    pthread_mutex_lock(&cache_lock);
+    c->stale = true;
+    c->events++;
+    // The kernel dropped the watch, the subscription went with it
+    if (event->mask & IN_IGNORED) {
+        if (c->wd == c->subscribed)
+            c->wd = -1;
+        c->subscribed = -1;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static void serve_list(ServeRequest *r, int dirfd, DaemonReply *reply, int *memfd) {
+    struct stat st;
+    if (fstat(dirfd, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        reply->error = ENOTDIR;
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    CachedListing *c = find_listing(&st, false);
+    unsigned long events = c != NULL ? c->events : 0;
+    if (c != NULL && !c->stale && c->memfd != -1 && same_dir_state(&c->st, &st)) {
+        *memfd = fcntl(c->memfd, F_DUPFD_CLOEXEC, 0);
+        c->used = ++use_clock;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (*memfd != -1)
+        return;
+
+    // Added before reading, so nothing that changes meanwhile is missed
+    r->wd = Watch_add(dirfd);
+    *memfd = read_listing(dirfd, r->conn);
+    if (*memfd == -1) {
+        reply->error = errno != 0 ? errno : EIO;
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    bool same_slot = c != NULL && c == find_listing(&st, false);
+    c = find_listing(&st, true);
+    if (c->memfd != -1)
+        close(c->memfd);
+    c->dev = st.st_dev;
+    c->ino = st.st_ino;
+    c->used = ++use_clock;
+    c->st = st;
+    c->memfd = fcntl(*memfd, F_DUPFD_CLOEXEC, 0);
+    // An event that came while it was read may not be in it
+    c->stale = c->memfd == -1 || (same_slot && c->events != events);
+    c->wd = r->wd;
+    r->slot = c;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static bool add_size(void *ctx, const WalkEntry *e, [[maybe_unused]] uintptr_t *cookie) {
+    SizeWalk *w = ctx;
+    if (!S_ISDIR(e->st->st_mode))
+        w->total += e->st->st_size;
+    if (++w->visited % DAEMON_HANGUP_CHECK == 0 && gone(w->conn))
+        atomic_store(&w->stop, true);
+    return true;
+}
+
+static void serve_size(ServeRequest *r, int dirfd, DaemonReply *reply) {
+    struct stat st;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (fstat(dirfd, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        reply->error = ENOTDIR;
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    CachedSize *c = find_size(&st, false);
+    bool cached = c != NULL && same_dir_state(&c->st, &st) && elapsed_ms(&c->at, &now) < DAEMON_SIZE_TTL_MS;
+    if (cached) {
+        reply->value = c->size;
+        c->used = ++use_clock;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (cached)
+        return;
+
+    // The walk goes by path, the link in /proc leads straight to the
+    // directory the client sent
+    char root[32];
+    snprintf(root, sizeof(root), "/proc/self/fd/%d", dirfd);
+    SizeWalk w = { .conn = r->conn };
+    Walker walker = {
+        .visit = add_size,
+        .ctx = &w,
+        .cancelled = &w.stop,
+    };
+    if (!walk_tree(root, 0, &walker)) {
+        reply->error = ECANCELED;
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    c = find_size(&st, true);
+    *c = (CachedSize){ .dev = st.st_dev, .ino = st.st_ino, .used = ++use_clock, .st = st, .size = w.total, .at = now };
+    pthread_mutex_unlock(&cache_lock);
+    reply->value = w.total;
+}
+
+static void serve_run(Job *job) {
+    ServeRequest *r = job->data;
+    uint32_t op;
+    int dirfd = -1;
+    if (!peer_is_us(r->conn) || !recv_with_fd(r->conn, &op, sizeof(op), &dirfd) || dirfd == -1) {
+        if (dirfd != -1)
+            close(dirfd);
+        return;
+    }
+
+    DaemonReply reply = { 0 };
+    int memfd = -1;
+    errno = 0;
+    if (op == DAEMON_LIST)
+        serve_list(r, dirfd, &reply, &memfd);
+    else if (op == DAEMON_SIZE)
+        serve_size(r, dirfd, &reply);
+    else
+        reply.error = EINVAL;
+    send_with_fd(r->conn, &reply, sizeof(reply), memfd);
+
+    if (memfd != -1)
+        close(memfd);
+    close(dirfd);
+}
+
+static void serve_done(Job *job) {
+    ServeRequest *r = job->data;
+    CachedListing *c = r->slot;
+    if (c != NULL) {
+        pthread_mutex_lock(&cache_lock);
+        if (c->wd != c->subscribed) {
+            if (c->subscribed != -1)
+                Watch_unsubscribe(c->subscribed, c);
+            c->subscribed = Watch_subscribe(c->wd, listing_event, c) ? c->wd : -1;
+        }
+        pthread_mutex_unlock(&cache_lock);
+    }
+    // The listing couldn't be read, or another one took the slot since
+    Watch_drop_unused(r->wd);
+    close(r->conn);
+    free(r);
+}
+
+static void serve(WorkPool *pool, int conn) {
+    ServeRequest *r = calloc(1, sizeof(ServeRequest));
+    Job *job = r != NULL ? Job_new(serve_run, serve_done, r, JOB_PRIO_HIGH) : NULL;
+    if (job == NULL) {
+        free(r);
+        close(conn);
+        return;
+    }
+    // A client that connects and never asks doesn't keep a worker
+    struct timeval timeout = { .tv_sec = 1 };
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    r->conn = conn;
+    r->wd = -1;
+    WorkPool_submit(pool, job);
+}
+
+static int listen_at(const struct sockaddr_un *addr) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    // A socket left behind by a daemon that died is replaced, one that
+    // answers isn't
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0) {
+        close(fd);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    if (errno == ECONNREFUSED)
+        unlink(addr->sun_path);
+    close(fd);
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1)
+        return -1;
+    mode_t mask = umask(0077);
+    bool ok = bind(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0 && listen(fd, SOMAXCONN) == 0;
+    umask(mask);
+    if (!ok) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static void on_signal([[maybe_unused]] int sig) {
+    atomic_store(&stopping, true);
+}
+
+int Daemon_run(void) {
+    struct sockaddr_un addr;
+    if (!socket_address(&addr)) {
+        fprintf(stderr, "cupidfm: the socket path is too long\n");
+        return 1;
+    }
+    int listener = listen_at(&addr);
+    if (listener == -1) {
+        fprintf(stderr, "cupidfm: can't listen on %s: %s\n", addr.sun_path, strerror(errno));
+        return 1;
+    }
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    atomic_store(&serving, true);
+    for (size_t i = 0; i < DAEMON_DIR_SLOTS; i++)
+        listings[i] = (CachedListing){ .memfd = -1, .wd = -1, .subscribed = -1 };
+
+    // Without inotify listings are only checked against the directory's
+    // mtime, changes to the entries go unnoticed
+    if (!Watch_init())
+        fprintf(stderr, "cupidfm: inotify unavailable, listings may be stale\n");
+    WorkPool pool;
+    WorkPool_init(&pool, DAEMON_WORKERS, 0);
+
+    while (!atomic_load(&stopping)) {
+        // poll() skips the inotify descriptor if it's -1
+        struct pollfd fds[2] = {
+            { .fd = listener, .events = POLLIN },
+            { .fd = Watch_fd(), .events = POLLIN },
+        };
+        poll(fds, 2, DAEMON_POLL_MS);
+
+        int conn;
+        while ((conn = accept4(listener, NULL, NULL, SOCK_CLOEXEC)) != -1)
+            serve(&pool, conn);
+        // Watches of the listings just read are subscribed to before their
+        // events are handed out
+        WorkPool_poll(&pool);
+        Watch_poll();
+    }
+
+    WorkPool_bye(&pool);
+    for (size_t i = 0; i < DAEMON_DIR_SLOTS; i++)
+        if (listings[i].memfd != -1)
+            close(listings[i].memfd);
+    Watch_bye();
+    close(listener);
+    unlink(addr.sun_path);
+    return 0;
+}
+
+// Waits for the reply in slices, so a cancelled job doesn't wait for it.
+// A timeout of 0 waits as long as it takes.
+static bool await_reply(int conn, int timeout_ms, const atomic_bool *cancelled) {
+    for (int waited = 0; timeout_ms == 0 || waited < timeout_ms; waited += AWAIT_SLICE_MS) {
+        if (cancelled != NULL && atomic_load(cancelled))
+            return false;
+        struct pollfd p = { .fd = conn, .events = POLLIN };
+        int ready = poll(&p, 1, AWAIT_SLICE_MS);
+        // A hang up is readable too, recvmsg tells
+        if (ready > 0)
+            return true;
+        if (ready == -1 && errno != EINTR)
+            return false;
+    }
+    return false;
+}
+
+static int connect_daemon(void) {
+    struct sockaddr_un addr;
+    if (atomic_load(&serving) || !socket_address(&addr))
+        return -1;
+    int conn = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (conn != -1 && (connect(conn, (const struct sockaddr *)&addr, sizeof(addr)) == -1 || !peer_is_us(conn))) {
+        close(conn);
+        conn = -1;
+    }
+    return conn;
+}
+
+// One request per connection: sends `op` with the directory, returns the
+// reply and the descriptor that came with it in *fd (-1 if none)
+static bool ask(DaemonOp op, int dirfd, int timeout_ms, const atomic_bool *cancelled, DaemonReply *reply, int *fd) {
+    *fd = -1;
+    int conn = connect_daemon();
+    if (conn == -1)
+        return false;
+    uint32_t request = op;
+    bool ok = send_with_fd(conn, &request, sizeof(request), dirfd)
+        && await_reply(conn, timeout_ms, cancelled)
+        && recv_with_fd(conn, reply, sizeof(*reply), fd)
+        && reply->error == 0;
+    close(conn);
+    if (!ok && *fd != -1) {
+        close(*fd);
+        *fd = -1;
+    }
+    return ok;
+}
+
+// Maps the listing and appends its entries, nothing if it's damaged
+static bool append_listing(Vector *v, int memfd) {
+    struct stat st;
+    int seals = fcntl(memfd, F_GET_SEALS);
+    if (fstat(memfd, &st) == -1 || seals == -1 || !(seals & F_SEAL_SHRINK) || !(seals & F_SEAL_WRITE)
+        || (size_t)st.st_size < sizeof(ListingHeader))
+        return false;
+    size_t size = st.st_size;
+    const char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, memfd, 0);
+    if (map == MAP_FAILED)
+        return false;
+
+    ListingHeader header;
+    memcpy(&header, map, sizeof(header));
+    const ListedEntry *entries = (const ListedEntry *)(map + sizeof(ListingHeader));
+    bool ok = header.magic == LISTING_MAGIC
+        && header.count <= (size - sizeof(ListingHeader)) / sizeof(ListedEntry);
+    size_t names_at = sizeof(ListingHeader) + (size_t)header.count * sizeof(ListedEntry);
+    // Every name ends before the end of the file
+    ok = ok && (header.count == 0 || (names_at < size && map[size - 1] == '\0'));
+    for (uint32_t i = 0; ok && i < header.count; i++)
+        ok = entries[i].name < size - names_at;
+
+    for (uint32_t i = 0; ok && i < header.count; i++) {
+        const ListedEntry *e = &entries[i];
+        FileAttr file_attr = mk_attr(map + names_at + e->name, e->is_dir, e->ino);
+        if (file_attr == NULL)
+            continue;
+        if (!e->unknown)
+            Metadata_fill(FileAttr_get_meta(file_attr), e->mode, e->uid, e->size, e->mtime);
+        Vector_add(v, 1);
+        v->el[Vector_len(*v)] = file_attr;
+        Vector_set_len(v, Vector_len(*v) + 1);
+    }
+
+    munmap((void *)map, size);
+    return ok;
+}
+
+bool Daemon_list(Vector *v, int dirfd, const atomic_bool *cancelled) {
+    DaemonReply reply;
+    int memfd;
+    if (dirfd < 0 || !ask(DAEMON_LIST, dirfd, DAEMON_LIST_TIMEOUT_MS, cancelled, &reply, &memfd))
+        return false;
+    bool ok = memfd != -1 && append_listing(v, memfd);
+    if (memfd != -1)
+        close(memfd);
+    return ok;
+}
+
+long Daemon_size(const char *path, const atomic_bool *cancelled) {
+    if (atomic_load(&serving))
+        return -1;
+    int dirfd = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd == -1)
+        return -1;
+    DaemonReply reply;
+    int fd;
+    bool ok = ask(DAEMON_SIZE, dirfd, 0, cancelled, &reply, &fd);
+    if (fd != -1)
+        close(fd);
+    close(dirfd);
+    return ok ? (long)reply.value : -1;
+}
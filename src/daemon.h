@@ -0,0 +1,47 @@
+// File: daemon.h
+// -----------------------
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdatomic.h> // for atomic_bool
+#include <stdbool.h>   // for bool
+#include <vector.h>    // for Vector
+
+// Directories whose listing the daemon keeps, the least recently used one is
+// dropped past that
+#define DAEMON_DIR_SLOTS 512
+// Directory trees whose size it keeps
+#define DAEMON_SIZE_SLOTS 256
+// inotify only sees the directory itself, so the size of the tree below is
+// trusted this long
+#define DAEMON_SIZE_TTL_MS 30000
+// Requests served at once
+#define DAEMON_WORKERS 8
+// A listing the daemon hasn't sent by then is read by the client itself.
+// Sizes are waited for, summing a tree legitimately takes long.
+#define DAEMON_LIST_TIMEOUT_MS 2000
+// Entries read or walked between checks that the client is still there
+#define DAEMON_HANGUP_CHECK 1024
+
+// `cupidfm --daemon`: keeps the listings (stat data of the entries included)
+// and tree sizes that cupidfm instances of the same user asked for, and
+// watches those directories with inotify. It listens on
+// $XDG_RUNTIME_DIR/cupidfm.sock (/tmp/cupidfm-<uid>.sock without it) until
+// SIGINT or SIGTERM. Directories are handed over as descriptors and cached
+// by inode, listings come back as a sealed memfd every client maps, so a
+// large one is never copied through the socket. Returns the exit status.
+int Daemon_run(void);
+
+// Client side, on workers. Both give up as soon as *cancelled becomes true,
+// and fail right away when no daemon runs, the caller then does the work
+// itself.
+
+// Appends the listing of the directory `dirfd` (O_PATH is enough) to `v`,
+// the metadata of the entries filled in. False, with nothing appended, if
+// the daemon couldn't.
+bool Daemon_list(Vector *v, int dirfd, const atomic_bool *cancelled);
+// The size of the tree `path`, like get_directory_size. -1 if the daemon
+// couldn't.
+long Daemon_size(const char *path, const atomic_bool *cancelled);
+
+#endif // DAEMON_H
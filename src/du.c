@@ -0,0 +1,841 @@
+// File: du.c
+// -----------------------
+#define _GNU_SOURCE        // for qsort_r
+#include <curses.h>        // for WINDOW, newwin, delwin, wgetch, mvwprintw, werase, wrefresh, wattron, wattroff
+#include <errno.h>         // for errno
+#include <fcntl.h>         // for AT_REMOVEDIR, AT_FDCWD
+#include <stdatomic.h>     // for atomic_ullong, atomic_load, atomic_fetch_add
+#include <stdint.h>        // for uint8_t, uint32_t, uint64_t, UINT32_MAX
+#include <stdio.h>         // for snprintf
+#include <stdlib.h>        // for malloc, realloc, calloc, free, getenv, strtoul, qsort_r
+#include <string.h>        // for strlen, strcmp, memcpy, strerror
+#include <sys/stat.h>      // for struct stat, stat, S_ISDIR
+#include <unistd.h>        // for unlinkat
+// Local includes
+#include <du.h>            // for du_view, DU_DEFAULT_BUDGET_MIB
+#include <files.h>         // for format_file_size
+#include <utils.h>         // for MIN, MAX, SIZE
+#include <walk.h>          // for walk_tree, Walker, WalkEntry
+#include <fsio.h>          // for Fsio_submit, Fsio_poll, Fsio_unresponsive, FSIO_DEADLINE_LIST
+#include <workpool.h>      // for Job, Job_new, Job_cancel
+
+typedef uint32_t DuIndex;
+#define DU_NONE UINT32_MAX
+#define DU_ROOT 0
+
+enum {
+    DU_DIR      = 1 << 0,
+    DU_HARDLINK = 1 << 1,  // Another link to the same inode was counted already
+    DU_ERROR    = 1 << 2,  // Something inside couldn't be read
+    DU_FOLDED   = 1 << 3,  // Some entries inside only count towards the totals
+    DU_OTHERFS  = 1 << 4,  // Mount point that wasn't entered
+};
+
+// 40 bytes per entry. Children are a singly linked list so that the nodes of
+// a directory don't have to be contiguous while scanning depth first.
+typedef struct {
+    uint32_t name;         // Offset in DuTree.names
+    DuIndex parent;
+    DuIndex first_child;
+    DuIndex next_sibling;
+    uint64_t apparent;     // st_size, including everything below
+    uint64_t allocated;    // st_blocks * 512, including everything below
+    uint32_t items;        // Entries below, including itself
+    uint8_t flags;
+} DuNode;
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+} DuInode;
+
+typedef struct {
+    char *root;
+    dev_t root_dev;
+    bool one_filesystem;
+    size_t budget;
+
+    DuNode *nodes;
+    size_t len, cap;
+
+    // Interned names, '\0' separated
+    char *names;
+    size_t names_len, names_cap;
+    // Open addressing table of name offsets + 1, 0 means empty
+    uint32_t *name_table;
+    size_t name_table_cap, name_count;
+
+    // Inodes with more than one link that were seen already
+    DuInode *inodes;
+    size_t inodes_cap, inodes_len;
+
+    // Progress, read by the UI thread while scanning
+    atomic_ullong scanned_items;
+    atomic_ullong scanned_bytes;
+    atomic_ullong errors;
+} DuTree;
+
+static size_t tree_memory(const DuTree *t) {
+    return t->cap * sizeof(DuNode)
+         + t->names_cap
+         + t->name_table_cap * sizeof(uint32_t)
+         + t->inodes_cap * sizeof(DuInode);
+}
+
+// Grows *array so it fits `need` elements without going over `limit` bytes
+// of total tree memory
+static bool tree_grow(DuTree *t, void **array, size_t *cap, size_t elem_size, size_t need, size_t limit) {
+    if (need <= *cap)
+        return true;
+
+    size_t used = tree_memory(t);
+    size_t new_cap = MAX(MAX(*cap * 2, need), 64);
+    if (used + (new_cap - *cap) * elem_size > limit) {
+        // Try to squeeze in what's left of the budget
+        new_cap = need + need / 8;
+        if (used + (new_cap - *cap) * elem_size > limit)
+            return false;
+    }
+
+    void *grown = realloc(*array, new_cap * elem_size);
+    if (grown == NULL)
+        return false;
+    *array = grown;
+    *cap = new_cap;
+    return true;
+}
+
+static uint32_t hash_bytes(const void *data, size_t len) {
+    // FNV-1a
+    const unsigned char *p = data;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static bool rehash_names(DuTree *t, size_t new_cap, size_t limit) {
+    if (tree_memory(t) + (new_cap - t->name_table_cap) * sizeof(uint32_t) > limit)
+        return false;
+    uint32_t *table = calloc(new_cap, sizeof(uint32_t));
+    if (table == NULL)
+        return false;
+
+    for (size_t i = 0; i < t->name_table_cap; i++) {
+        uint32_t entry = t->name_table[i];
+        if (entry == 0)
+            continue;
+        const char *name = t->names + entry - 1;
+        size_t slot = hash_bytes(name, strlen(name)) & (new_cap - 1);
+        while (table[slot] != 0)
+            slot = (slot + 1) & (new_cap - 1);
+        table[slot] = entry;
+    }
+
+    free(t->name_table);
+    t->name_table = table;
+    t->name_table_cap = new_cap;
+    return true;
+}
+
+static bool intern_name(DuTree *t, const char *name, uint32_t *offset, size_t limit) {
+    if ((t->name_count + 1) * 10 > t->name_table_cap * 7
+        && !rehash_names(t, t->name_table_cap ? t->name_table_cap * 2 : 1024, limit))
+        return false;
+
+    size_t len = strlen(name);
+    size_t mask = t->name_table_cap - 1;
+    size_t slot = hash_bytes(name, len) & mask;
+    while (t->name_table[slot] != 0) {
+        if (strcmp(t->names + t->name_table[slot] - 1, name) == 0) {
+            *offset = t->name_table[slot] - 1;
+            return true;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if (t->names_len + len + 2 >= UINT32_MAX)
+        return false;
+    if (!tree_grow(t, (void **)&t->names, &t->names_cap, 1, t->names_len + len + 1, limit))
+        return false;
+
+    *offset = t->names_len;
+    memcpy(t->names + t->names_len, name, len + 1);
+    t->names_len += len + 1;
+    t->name_table[slot] = *offset + 1;
+    t->name_count++;
+    return true;
+}
+
+static DuIndex add_node(DuTree *t, DuIndex parent, const char *name, uint8_t flags, size_t limit) {
+    if (t->len >= DU_NONE - 1)
+        return DU_NONE;
+    if (!tree_grow(t, (void **)&t->nodes, &t->cap, sizeof(DuNode), t->len + 1, limit))
+        return DU_NONE;
+
+    uint32_t name_offset;
+    if (!intern_name(t, name, &name_offset, limit))
+        return DU_NONE;
+
+    DuIndex idx = t->len++;
+    DuNode *n = &t->nodes[idx];
+    *n = (DuNode){
+        .name = name_offset,
+        .parent = parent,
+        .first_child = DU_NONE,
+        .next_sibling = DU_NONE,
+        .items = 1,
+        .flags = flags,
+    };
+    if (parent != DU_NONE) {
+        n->next_sibling = t->nodes[parent].first_child;
+        t->nodes[parent].first_child = idx;
+    }
+    return idx;
+}
+
+// Returns true if the inode was seen before, remembering it otherwise
+static bool seen_inode(DuTree *t, dev_t dev, ino_t ino) {
+    if ((t->inodes_len + 1) * 10 > t->inodes_cap * 7) {
+        size_t new_cap = t->inodes_cap ? t->inodes_cap * 2 : 256;
+        if (tree_memory(t) + (new_cap - t->inodes_cap) * sizeof(DuInode) > t->budget)
+            // Counting a hard link twice is better than running out of memory
+            return false;
+        DuInode *table = calloc(new_cap, sizeof(DuInode));
+        if (table == NULL)
+            return false;
+        for (size_t i = 0; i < t->inodes_cap; i++) {
+            if (t->inodes[i].ino == 0)
+                continue;
+            size_t slot = hash_bytes(&t->inodes[i], sizeof(DuInode)) & (new_cap - 1);
+            while (table[slot].ino != 0)
+                slot = (slot + 1) & (new_cap - 1);
+            table[slot] = t->inodes[i];
+        }
+        free(t->inodes);
+        t->inodes = table;
+        t->inodes_cap = new_cap;
+    }
+
+    DuInode key;
+    // Zero the padding, the whole struct is hashed
+    memset(&key, 0, sizeof(key));
+    key.dev = dev;
+    key.ino = ino;
+    size_t mask = t->inodes_cap - 1;
+    size_t slot = hash_bytes(&key, sizeof(key)) & mask;
+    while (t->inodes[slot].ino != 0) {
+        if (t->inodes[slot].dev == dev && t->inodes[slot].ino == ino)
+            return true;
+        slot = (slot + 1) & mask;
+    }
+    t->inodes[slot] = key;
+    t->inodes_len++;
+    return false;
+}
+
+static const char *node_name(const DuTree *t, DuIndex idx) {
+    return t->names + t->nodes[idx].name;
+}
+
+// Returns a malloc'd path of the node
+static char *node_path(const DuTree *t, DuIndex idx) {
+    if (idx == DU_ROOT)
+        return strdup(t->root);
+
+    // Avoids a double slash when scanning "/"
+    size_t root_len = strcmp(t->root, "/") == 0 ? 0 : strlen(t->root);
+    size_t len = root_len;
+    for (DuIndex i = idx; i != DU_ROOT; i = t->nodes[i].parent)
+        len += strlen(node_name(t, i)) + 1;
+
+    char *path = malloc(len + 1);
+    if (path == NULL)
+        return NULL;
+    path[len] = '\0';
+
+    size_t end = len;
+    for (DuIndex i = idx; i != DU_ROOT; i = t->nodes[i].parent) {
+        const char *name = node_name(t, i);
+        size_t name_len = strlen(name);
+        end -= name_len;
+        memcpy(path + end, name, name_len);
+        path[--end] = '/';
+    }
+    memcpy(path, t->root, root_len);
+    return path;
+}
+
+// Cookies handed to the walker: node index shifted left, with the lowest bit
+// set for directories that didn't get a node. Those point to the closest
+// ancestor that did, and everything inside them is accounted to it directly.
+#define COOKIE(idx, untracked) (((uintptr_t)(idx) << 1) | (untracked))
+#define COOKIE_NODE(cookie) ((DuIndex)((cookie) >> 1))
+#define COOKIE_UNTRACKED(cookie) ((cookie) & 1)
+
+static bool scan_visit(void *ctx, const WalkEntry *e, uintptr_t *cookie) {
+    DuTree *t = ctx;
+    DuIndex parent = COOKIE_NODE(e->parent);
+    const struct stat *st = e->st;
+    bool is_dir = S_ISDIR(st->st_mode);
+    uint64_t apparent = st->st_size;
+    uint64_t allocated = (uint64_t)st->st_blocks * 512;
+    uint8_t flags = is_dir ? DU_DIR : 0;
+
+    if (!is_dir && st->st_nlink > 1 && seen_inode(t, st->st_dev, st->st_ino)) {
+        flags |= DU_HARDLINK;
+        apparent = allocated = 0;
+    }
+    if (is_dir && t->one_filesystem && st->st_dev != t->root_dev)
+        flags |= DU_OTHERFS;
+
+    atomic_fetch_add(&t->scanned_items, 1);
+    atomic_fetch_add(&t->scanned_bytes, allocated);
+
+    // Files stop getting nodes a bit before the budget runs out, so that
+    // the directories still have room for theirs
+    DuIndex idx = DU_NONE;
+    if (!COOKIE_UNTRACKED(e->parent))
+        idx = add_node(t, parent, e->name, flags, is_dir ? t->budget : t->budget / 8 * 7);
+
+    if (idx == DU_NONE) {
+        DuNode *ancestor = &t->nodes[parent];
+        ancestor->flags |= DU_FOLDED;
+        ancestor->apparent += apparent;
+        ancestor->allocated += allocated;
+        ancestor->items++;
+        *cookie = COOKIE(parent, 1);
+        return !(flags & DU_OTHERFS);
+    }
+
+    DuNode *n = &t->nodes[idx];
+    n->apparent = apparent;
+    n->allocated = allocated;
+    *cookie = COOKIE(idx, 0);
+
+    // Directories hand their totals to the parent once they're left
+    if (!is_dir) {
+        t->nodes[parent].apparent += apparent;
+        t->nodes[parent].allocated += allocated;
+        t->nodes[parent].items++;
+    }
+    return !(flags & DU_OTHERFS);
+}
+
+static void scan_leave(void *ctx, const WalkEntry *e, uintptr_t cookie) {
+    DuTree *t = ctx;
+    if (e->depth == 0 || COOKIE_UNTRACKED(cookie))
+        return;
+
+    const DuNode *n = &t->nodes[COOKIE_NODE(cookie)];
+    DuNode *parent = &t->nodes[COOKIE_NODE(e->parent)];
+    parent->apparent += n->apparent;
+    parent->allocated += n->allocated;
+    parent->items += n->items;
+    parent->flags |= n->flags & DU_ERROR;
+}
+
+static void scan_error(void *ctx, const WalkEntry *e, [[maybe_unused]] int err) {
+    DuTree *t = ctx;
+    atomic_fetch_add(&t->errors, 1);
+    t->nodes[COOKIE_NODE(e->parent)].flags |= DU_ERROR;
+}
+
+static bool tree_init(DuTree *t, const char *root, bool one_filesystem) {
+    memset(t, 0, sizeof(*t));
+    atomic_init(&t->scanned_items, 0);
+    atomic_init(&t->scanned_bytes, 0);
+    atomic_init(&t->errors, 0);
+
+    // The root is stat'ed by the scan, it may be on a hung mount
+    t->root = strdup(root);
+    if (t->root == NULL)
+        return false;
+    t->one_filesystem = one_filesystem;
+
+    const char *env = getenv("CUPIDFM_DU_MEMORY");
+    unsigned long mib = env ? strtoul(env, NULL, 10) : 0;
+    t->budget = (size_t)(mib ? mib : DU_DEFAULT_BUDGET_MIB) << 20;
+
+    if (add_node(t, DU_NONE, root, DU_DIR, t->budget) != DU_ROOT) {
+        free(t->root);
+        return false;
+    }
+    return true;
+}
+
+static void tree_bye(DuTree *t) {
+    free(t->root);
+    free(t->nodes);
+    free(t->names);
+    free(t->name_table);
+    free(t->inodes);
+}
+
+// Removes the sizes from the node and all of its ancestors
+static void tree_subtract(DuTree *t, DuIndex idx, uint64_t apparent, uint64_t allocated, uint32_t items) {
+    for (DuIndex i = idx; i != DU_NONE; i = t->nodes[i].parent) {
+        DuNode *n = &t->nodes[i];
+        n->apparent -= MIN(n->apparent, apparent);
+        n->allocated -= MIN(n->allocated, allocated);
+        n->items -= MIN(n->items, items);
+    }
+}
+
+static void tree_detach(DuTree *t, DuIndex idx) {
+    DuIndex parent = t->nodes[idx].parent;
+    DuIndex *link = &t->nodes[parent].first_child;
+    while (*link != DU_NONE && *link != idx)
+        link = &t->nodes[*link].next_sibling;
+    if (*link == idx)
+        *link = t->nodes[idx].next_sibling;
+}
+
+typedef enum {
+    DU_SCANNING,
+    DU_BROWSING,
+    DU_CONFIRM_DELETE,
+    DU_DELETING,
+} DuState;
+
+typedef struct {
+    DuTree tree;
+    DuState state;
+    bool scan_complete;
+    // The root couldn't be stat'ed or isn't a directory
+    bool root_missing;
+    bool show_apparent;
+    char status[256];
+
+    // Directory being shown and its children, sorted. DU_NONE stands for the
+    // entries that were folded into the directory.
+    DuIndex dir;
+    DuIndex *rows;
+    size_t nrows;
+    uint64_t folded_size;
+    uint32_t folded_items;
+    SIZE cursor;
+    SIZE start;
+} DuView;
+
+typedef struct {
+    DuView *view;
+    DuIndex node;
+    char *path;
+    bool is_dir;
+    bool failed;
+    int err;
+    uint64_t freed_apparent;
+    uint64_t freed_allocated;
+    uint32_t freed_items;
+} DuDelete;
+
+static uint64_t node_size(const DuView *v, DuIndex idx) {
+    return v->show_apparent ? v->tree.nodes[idx].apparent : v->tree.nodes[idx].allocated;
+}
+
+// What is accounted to the directory but isn't in any of its child nodes
+static void folded_totals(const DuView *v, uint64_t *size, uint32_t *items) {
+    const DuTree *t = &v->tree;
+    uint64_t children_size = 0;
+    uint32_t children_items = 0;
+    for (DuIndex c = t->nodes[v->dir].first_child; c != DU_NONE; c = t->nodes[c].next_sibling) {
+        children_size += node_size(v, c);
+        children_items += t->nodes[c].items;
+    }
+    uint64_t total = node_size(v, v->dir);
+    *size = total - MIN(total, children_size);
+    *items = t->nodes[v->dir].items - MIN(t->nodes[v->dir].items, children_items + 1);
+}
+
+static uint64_t row_size(const DuView *v, DuIndex row) {
+    return row == DU_NONE ? v->folded_size : node_size(v, row);
+}
+
+static int compare_rows(const void *a, const void *b, void *ctx) {
+    const DuView *v = ctx;
+    DuIndex ia = *(const DuIndex *)a, ib = *(const DuIndex *)b;
+    uint64_t sa = row_size(v, ia), sb = row_size(v, ib);
+
+    if (sa != sb)
+        return sa < sb ? 1 : -1;
+    if (ia == DU_NONE || ib == DU_NONE)
+        return ia == DU_NONE ? 1 : -1;
+    return strcmp(node_name(&v->tree, ia), node_name(&v->tree, ib));
+}
+
+// Rebuilds the sorted rows of the shown directory, keeping the cursor on
+// `select` if it's still there
+static void load_rows(DuView *v, DuIndex select) {
+    const DuTree *t = &v->tree;
+    size_t n = 0;
+    for (DuIndex c = t->nodes[v->dir].first_child; c != DU_NONE; c = t->nodes[c].next_sibling)
+        n++;
+    if (t->nodes[v->dir].flags & DU_FOLDED)
+        n++;
+
+    DuIndex *rows = realloc(v->rows, MAX(n, 1) * sizeof(DuIndex));
+    if (rows == NULL)
+        return;
+    v->rows = rows;
+    v->nrows = 0;
+    for (DuIndex c = t->nodes[v->dir].first_child; c != DU_NONE; c = t->nodes[c].next_sibling)
+        v->rows[v->nrows++] = c;
+    if (t->nodes[v->dir].flags & DU_FOLDED)
+        v->rows[v->nrows++] = DU_NONE;
+
+    folded_totals(v, &v->folded_size, &v->folded_items);
+    qsort_r(v->rows, v->nrows, sizeof(DuIndex), compare_rows, v);
+
+    v->cursor = MIN(v->cursor, (SIZE)v->nrows - 1);
+    for (size_t i = 0; i < v->nrows; i++)
+        if (v->rows[i] == select)
+            v->cursor = i;
+    v->cursor = MAX(v->cursor, 0);
+}
+
+static void scan_run(Job *job) {
+    DuView *v = job->data;
+    DuTree *t = &v->tree;
+    struct stat st;
+    if (stat(t->root, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        v->root_missing = true;
+        return;
+    }
+    t->root_dev = st.st_dev;
+    t->nodes[DU_ROOT].apparent = st.st_size;
+    t->nodes[DU_ROOT].allocated = (uint64_t)st.st_blocks * 512;
+
+    Walker walker = {
+        .visit = scan_visit,
+        .leave = scan_leave,
+        .error = scan_error,
+        .ctx = &v->tree,
+        .one_filesystem = v->tree.one_filesystem,
+        .cancelled = &job->cancelled,
+    };
+    v->scan_complete = walk_tree(v->tree.root, COOKIE(DU_ROOT, 0), &walker);
+}
+
+static void scan_done(Job *job) {
+    DuView *v = job->data;
+    v->state = DU_BROWSING;
+    v->dir = DU_ROOT;
+    load_rows(v, DU_NONE);
+    if (v->root_missing)
+        snprintf(v->status, sizeof(v->status), "%s isn't a directory that can be read", v->tree.root);
+    else if (!v->scan_complete)
+        snprintf(v->status, sizeof(v->status), "Scan interrupted, totals are incomplete");
+}
+
+static bool delete_visit(void *ctx, const WalkEntry *e, [[maybe_unused]] uintptr_t *cookie) {
+    DuDelete *d = ctx;
+    if (S_ISDIR(e->st->st_mode))
+        return true;
+
+    if (unlinkat(e->dirfd, e->name, 0) == -1) {
+        d->failed = true;
+        d->err = errno;
+        return false;
+    }
+    d->freed_apparent += e->st->st_size;
+    d->freed_allocated += (uint64_t)e->st->st_blocks * 512;
+    d->freed_items++;
+    return false;
+}
+
+static void delete_leave(void *ctx, const WalkEntry *e, [[maybe_unused]] uintptr_t cookie) {
+    DuDelete *d = ctx;
+    if (unlinkat(e->dirfd, e->depth == 0 ? e->path : e->name, AT_REMOVEDIR) == -1) {
+        d->failed = true;
+        d->err = errno;
+        return;
+    }
+    d->freed_apparent += e->st->st_size;
+    d->freed_allocated += (uint64_t)e->st->st_blocks * 512;
+    d->freed_items++;
+}
+
+static void delete_error(void *ctx, [[maybe_unused]] const WalkEntry *e, int err) {
+    DuDelete *d = ctx;
+    d->failed = true;
+    d->err = err;
+}
+
+static void delete_run(Job *job) {
+    DuDelete *d = job->data;
+
+    if (!d->is_dir) {
+        struct stat st;
+        if (lstat(d->path, &st) == -1 || unlink(d->path) == -1) {
+            d->failed = true;
+            d->err = errno;
+        }
+        return;
+    }
+
+    // Never wander into whatever is mounted below
+    Walker walker = {
+        .visit = delete_visit,
+        .leave = delete_leave,
+        .error = delete_error,
+        .ctx = d,
+        .one_filesystem = true,
+        .cancelled = &job->cancelled,
+    };
+    if (!walk_tree(d->path, 0, &walker) && !d->failed) {
+        d->failed = true;
+        d->err = errno;
+    }
+}
+
+static void delete_done(Job *job) {
+    DuDelete *d = job->data;
+    DuView *v = d->view;
+    DuTree *t = &v->tree;
+    const DuNode *n = &t->nodes[d->node];
+
+    if (!job->ran) {
+        snprintf(v->status, sizeof(v->status), "Deletion cancelled");
+    } else if (!d->failed) {
+        // The scanned sizes are what the totals were built from, so they are
+        // what has to go (hard links included)
+        tree_subtract(t, n->parent, n->apparent, n->allocated, n->items);
+        tree_detach(t, d->node);
+        snprintf(v->status, sizeof(v->status), "Deleted %s", node_name(t, d->node));
+    } else {
+        tree_subtract(t, d->node, d->freed_apparent, d->freed_allocated, d->freed_items);
+        t->nodes[d->node].flags |= DU_ERROR;
+        snprintf(v->status, sizeof(v->status), "Couldn't delete everything in %s: %s",
+                 node_name(t, d->node), strerror(d->err));
+    }
+
+    v->state = DU_BROWSING;
+    load_rows(v, d->node);
+    free(d->path);
+    free(d);
+}
+
+static void start_delete(DuView *v) {
+    if (v->nrows == 0 || v->rows[v->cursor] == DU_NONE)
+        return;
+
+    DuDelete *d = calloc(1, sizeof(DuDelete));
+    if (d == NULL)
+        return;
+    d->view = v;
+    d->node = v->rows[v->cursor];
+    d->is_dir = v->tree.nodes[d->node].flags & DU_DIR;
+    d->path = node_path(&v->tree, d->node);
+    Job *job = d->path ? Job_new(delete_run, delete_done, d, JOB_PRIO_HIGH) : NULL;
+    if (job == NULL) {
+        free(d->path);
+        free(d);
+        return;
+    }
+
+    v->state = DU_DELETING;
+    snprintf(v->status, sizeof(v->status), "Deleting %s...", node_name(&v->tree, d->node));
+    Fsio_submit(job, d->path, FSIO_DEADLINE_LIST);
+}
+
+static void draw_scanning(WINDOW *win, DuView *v) {
+    char size[32];
+    werase(win);
+    box(win, 0, 0);
+    mvwprintw(win, 0, 2, "Disk usage: %.*s", COLS - 16, v->tree.root);
+    mvwprintw(win, 2, 2, "Scanning... %llu items, %s",
+              (unsigned long long)atomic_load(&v->tree.scanned_items),
+              format_file_size(size, atomic_load(&v->tree.scanned_bytes)));
+    if (atomic_load(&v->tree.errors))
+        mvwprintw(win, 3, 2, "%llu entries couldn't be read", (unsigned long long)atomic_load(&v->tree.errors));
+    const char *unresponsive = Fsio_unresponsive();
+    if (unresponsive != NULL)
+        mvwprintw(win, 4, 2, "%.*s is not responding", COLS - 22, unresponsive);
+    mvwprintw(win, 5, 2, "Press q to cancel");
+    wrefresh(win);
+}
+
+static void draw_rows(WINDOW *win, DuView *v) {
+    const DuTree *t = &v->tree;
+    int lines, cols;
+    getmaxyx(win, lines, cols);
+    SIZE num_lines = lines - 5;
+    char size[32];
+
+    v->start = MIN(v->start, v->cursor);
+    v->start = MAX(v->start, v->cursor + 1 - num_lines);
+
+    werase(win);
+    box(win, 0, 0);
+
+    char *path = node_path(t, v->dir);
+    mvwprintw(win, 0, 2, "Disk usage: %.*s", cols - 16, path ? path : "?");
+    free(path);
+
+    const DuNode *dir = &t->nodes[v->dir];
+    mvwprintw(win, 1, 2, "Total %s: %s   Items: %u%s",
+              v->show_apparent ? "apparent size" : "disk usage",
+              format_file_size(size, node_size(v, v->dir)), dir->items,
+              (dir->flags & DU_ERROR) ? "   (some entries couldn't be read)" : "");
+
+    // Rows are sorted, the first one is the biggest
+    uint64_t biggest = MAX(v->nrows ? row_size(v, v->rows[0]) : 0, 1);
+    uint64_t total = MAX(node_size(v, v->dir), 1);
+
+    const int bar_width = 20;
+    for (SIZE i = v->start; i < (SIZE)v->nrows && i - v->start < num_lines; i++) {
+        DuIndex idx = v->rows[i];
+        uint64_t s = row_size(v, idx);
+        const char *name;
+        const char *suffix = "";
+        char folded_name[64];
+
+        if (idx == DU_NONE) {
+            snprintf(folded_name, sizeof(folded_name), "<%u more entries, not tracked individually>", v->folded_items);
+            name = folded_name;
+        } else {
+            const DuNode *n = &t->nodes[idx];
+            name = node_name(t, idx);
+            if (n->flags & DU_OTHERFS)
+                suffix = "/ (other filesystem)";
+            else if (n->flags & DU_HARDLINK)
+                suffix = " (hard link, counted once)";
+            else if (n->flags & DU_DIR)
+                suffix = (n->flags & DU_ERROR) ? "/ !" : "/";
+        }
+
+        char bar[32];
+        int filled = (int)((double)s / (double)biggest * bar_width + 0.5);
+        for (int b = 0; b < bar_width; b++)
+            bar[b] = b < filled ? '#' : ' ';
+        bar[bar_width] = '\0';
+
+        if (i == v->cursor)
+            wattron(win, A_REVERSE);
+        mvwprintw(win, 3 + i - v->start, 2, "%11s %5.1f%% [%s] %.*s%s",
+                  format_file_size(size, s), (double)s * 100.0 / (double)total, bar,
+                  MAX(cols - 48, 1), name, suffix);
+        if (i == v->cursor)
+            wattroff(win, A_REVERSE);
+    }
+
+    if (v->state == DU_CONFIRM_DELETE)
+        mvwprintw(win, lines - 2, 2, "Delete %.*s? (y/n)", cols - 20, node_name(t, v->rows[v->cursor]));
+    else if (v->status[0])
+        mvwprintw(win, lines - 2, 2, "%.*s", cols - 4, v->status);
+    else
+        mvwprintw(win, lines - 2, 2, "q: back  a: apparent/disk usage  d: delete");
+    wrefresh(win);
+}
+
+static void browse_key(DuView *v, int ch) {
+    const DuTree *t = &v->tree;
+
+    if (v->state == DU_CONFIRM_DELETE) {
+        v->state = DU_BROWSING;
+        if (ch == 'y' || ch == 'Y')
+            start_delete(v);
+        return;
+    }
+    if (v->state != DU_BROWSING)
+        return;
+
+    v->status[0] = '\0';
+    switch (ch) {
+        case KEY_UP:
+            v->cursor = MAX(v->cursor - 1, 0);
+            break;
+        case KEY_DOWN:
+            v->cursor = MIN(v->cursor + 1, MAX((SIZE)v->nrows - 1, 0));
+            break;
+        case KEY_RIGHT:
+        case '\n':
+            if (v->nrows > 0 && v->rows[v->cursor] != DU_NONE
+                && (t->nodes[v->rows[v->cursor]].flags & DU_DIR)) {
+                v->dir = v->rows[v->cursor];
+                v->cursor = v->start = 0;
+                load_rows(v, DU_NONE);
+            }
+            break;
+        case KEY_LEFT:
+            if (v->dir != DU_ROOT) {
+                DuIndex from = v->dir;
+                v->dir = t->nodes[from].parent;
+                v->start = 0;
+                load_rows(v, from);
+            }
+            break;
+        case 'a':
+            v->show_apparent = !v->show_apparent;
+            load_rows(v, v->nrows ? v->rows[v->cursor] : DU_NONE);
+            break;
+        case 'd':
+            if (v->nrows == 0 || v->rows[v->cursor] == DU_NONE)
+                break;
+            // The deletion would happily empty whatever is mounted there
+            if (t->nodes[v->rows[v->cursor]].flags & DU_OTHERFS)
+                snprintf(v->status, sizeof(v->status), "Refusing to delete a mount point");
+            else
+                v->state = DU_CONFIRM_DELETE;
+            break;
+    }
+}
+
+void du_view(const char *root, bool cross_filesystems) {
+    DuView *v = calloc(1, sizeof(DuView));
+    if (v == NULL)
+        return;
+    if (!tree_init(&v->tree, root, !cross_filesystems)) {
+        free(v);
+        return;
+    }
+
+    Job *scan = Job_new(scan_run, scan_done, v, JOB_PRIO_HIGH);
+    if (scan == NULL) {
+        tree_bye(&v->tree);
+        free(v);
+        return;
+    }
+    v->state = DU_SCANNING;
+    Fsio_submit(scan, v->tree.root, FSIO_DEADLINE_LIST);
+
+    WINDOW *win = newwin(LINES, COLS, 0, 0);
+    keypad(win, TRUE);
+    wtimeout(win, 100);
+
+    bool leaving = false;
+    for (;;) {
+        Fsio_poll();
+
+        // Jobs point to the view, it can only go once they are done
+        if (leaving && v->state != DU_SCANNING && v->state != DU_DELETING)
+            break;
+
+        if (v->state == DU_SCANNING)
+            draw_scanning(win, v);
+        else
+            draw_rows(win, v);
+
+        int ch = wgetch(win);
+        if (ch == ERR)
+            continue;
+        if ((ch == 'q' || ch == KEY_F(1)) && v->state != DU_CONFIRM_DELETE) {
+            leaving = true;
+            if (v->state == DU_SCANNING)
+                Job_cancel(scan);
+            continue;
+        }
+        browse_key(v, ch);
+    }
+
+    werase(win);
+    wrefresh(win);
+    delwin(win);
+
+    free(v->rows);
+    tree_bye(&v->tree);
+    free(v);
+}
@@ -0,0 +1,18 @@
+// File: du.h
+// -----------------------
+#ifndef DU_H
+#define DU_H
+
+#include <stdbool.h>   // for bool
+
+// Memory the disk usage tree may use unless CUPIDFM_DU_MEMORY (in MiB) says
+// otherwise. Past it, files are only accounted in their directory's totals.
+#define DU_DEFAULT_BUDGET_MIB 512
+
+// Scans `root` in the background and shows its disk usage, ncdu style, until
+// the user leaves with 'q'. Entries may be deleted from the view. Unless
+// `cross_filesystems` is set the scan doesn't descend into mount points. The
+// scan and the deletions are fsio requests.
+void du_view(const char *root, bool cross_filesystems);
+
+#endif // DU_H
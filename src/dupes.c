@@ -0,0 +1,853 @@
+// File: dupes.c
+// -----------------------
+#define _GNU_SOURCE        // for qsort_r, O_NOATIME
+#include <curses.h>        // for WINDOW, newwin, delwin, wgetch, mvwprintw, werase, wrefresh, wattron, wattroff
+#include <errno.h>         // for errno
+#include <fcntl.h>         // for open, posix_fadvise, O_RDONLY, O_NOFOLLOW, O_NONBLOCK, O_CLOEXEC
+#include <stdatomic.h>     // for atomic_bool, atomic_ullong, atomic_load, atomic_store, atomic_fetch_add
+#include <stdint.h>        // for uint8_t, uint32_t, uint64_t, SIZE_MAX
+#include <stdio.h>         // for snprintf
+#include <stdlib.h>        // for malloc, realloc, calloc, free, qsort_r
+#include <string.h>        // for strlen, strcmp, strncmp, memcpy, memcmp
+#include <sys/stat.h>      // for struct stat, fstat, S_ISREG, S_ISDIR
+#include <unistd.h>        // for pread, close, unlink
+// Local includes
+#include <dupes.h>         // for dupes_view, DUPES_PARTIAL_BLOCK
+#include <files.h>         // for format_file_size
+#include <fsio.h>          // for Fsio_submit, Fsio_poll, Fsio_unresponsive, FSIO_DEADLINE_LIST
+#include <hash.h>          // for Hash64, Hash64_init, Hash64_update, Hash64_final, hash64
+#include <utils.h>         // for MIN, MAX, SIZE
+#include <walk.h>          // for walk_tree, Walker, WalkEntry
+#include <workpool.h>      // for WorkPool, Job, Job_new, WorkPool_submit, WorkPool_poll
+
+// Candidates whose first and last blocks are hashed by a single job
+#define PARTIAL_CHUNK_FILES 256
+// Full hashing jobs are cut after this many bytes, so a set of big files is
+// hashed by several workers at once
+#define FULL_CHUNK_BYTES (64ULL << 20)
+// Files are read this much at a time, between checks for cancellation
+#define HASH_STEP (4ULL << 20)
+
+enum {
+    DUP_ERROR   = 1 << 0,  // Couldn't be read, never reported as a duplicate
+    DUP_MARKED  = 1 << 1,  // Selected for deletion
+    DUP_DELETED = 1 << 2,
+};
+
+typedef struct {
+    uint64_t size;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    // Offset of the path in Dupes.paths
+    size_t path;
+    uint64_t partial;
+    uint64_t full;
+    // Other names of the same inode found in the tree. Those are never
+    // hashed nor reported: deleting them doesn't free anything.
+    uint32_t links;
+    uint8_t flags;
+} DupFile;
+
+typedef struct {
+    uint64_t size;
+    size_t *members;
+    size_t count;
+} DupGroup;
+
+typedef enum {
+    DUPES_WALKING,
+    DUPES_HASHING,
+    DUPES_BROWSING,
+    DUPES_CONFIRM_DELETE,
+    DUPES_DELETING,
+} DupesState;
+
+typedef struct {
+    size_t group;
+    // SIZE_MAX for the line describing the group
+    size_t member;
+} DupRow;
+
+typedef struct {
+    char *root;
+    WorkPool *pool;
+    atomic_bool cancelled;
+    DupesState state;
+    char status[256];
+
+    // Filled by the walk, read only once hashing starts
+    DupFile *files;
+    size_t nfiles, files_cap;
+    char *paths;
+    size_t paths_len, paths_cap;
+
+    // Progress
+    atomic_ullong walked;
+    atomic_ullong hashed_bytes;
+    size_t candidates;
+    // Only touched on the UI thread
+    size_t pending_jobs;
+
+    DupGroup *groups;
+    size_t ngroups, groups_cap;
+
+    DupRow *rows;
+    size_t nrows;
+    SIZE cursor;
+    SIZE start;
+} Dupes;
+
+// A set of files that may have the same contents, hashed in chunks. Once all
+// chunks are done it's split by hash into smaller sets or final groups.
+typedef struct {
+    Dupes *d;
+    size_t *members;
+    size_t count;
+    size_t outstanding;
+    bool full;
+} DupSet;
+
+typedef struct {
+    DupSet *set;
+    size_t first;
+    size_t count;
+} DupChunk;
+
+static bool should_stop(const Dupes *d, const Job *job) {
+    return atomic_load(&d->cancelled) || Job_cancelled(job);
+}
+
+static const char *file_path(const Dupes *d, size_t idx) {
+    return d->paths + d->files[idx].path;
+}
+
+static bool walk_visit(void *ctx, const WalkEntry *e, [[maybe_unused]] uintptr_t *cookie) {
+    Dupes *d = ctx;
+    const struct stat *st = e->st;
+    atomic_fetch_add(&d->walked, 1);
+
+    if (S_ISDIR(st->st_mode))
+        return true;
+    // Every empty file is a duplicate of every other one, that's not useful
+    if (!S_ISREG(st->st_mode) || st->st_size == 0)
+        return false;
+
+    size_t len = strlen(e->path);
+    if (d->paths_len + len + 1 > d->paths_cap) {
+        size_t cap = MAX(d->paths_cap * 2, d->paths_len + len + 1 + 4096);
+        char *paths = realloc(d->paths, cap);
+        if (paths == NULL)
+            return false;
+        d->paths = paths;
+        d->paths_cap = cap;
+    }
+    if (d->nfiles == d->files_cap) {
+        size_t cap = MAX(d->files_cap * 2, 1024);
+        DupFile *files = realloc(d->files, cap * sizeof(DupFile));
+        if (files == NULL)
+            return false;
+        d->files = files;
+        d->files_cap = cap;
+    }
+
+    memcpy(d->paths + d->paths_len, e->path, len + 1);
+    d->files[d->nfiles++] = (DupFile){
+        .size = st->st_size,
+        .dev = st->st_dev,
+        .ino = st->st_ino,
+        .mtime = st->st_mtim,
+        .path = d->paths_len,
+    };
+    d->paths_len += len + 1;
+    return false;
+}
+
+static int compare_identity(const void *a, const void *b, void *ctx) {
+    const Dupes *d = ctx;
+    const DupFile *fa = &d->files[*(const size_t *)a], *fb = &d->files[*(const size_t *)b];
+    if (fa->size != fb->size)
+        return fa->size < fb->size ? -1 : 1;
+    if (fa->dev != fb->dev)
+        return fa->dev < fb->dev ? -1 : 1;
+    if (fa->ino != fb->ino)
+        return fa->ino < fb->ino ? -1 : 1;
+    return 0;
+}
+
+static int compare_partial(const void *a, const void *b, void *ctx) {
+    const Dupes *d = ctx;
+    uint64_t ha = d->files[*(const size_t *)a].partial, hb = d->files[*(const size_t *)b].partial;
+    return ha < hb ? -1 : ha > hb;
+}
+
+static int compare_full(const void *a, const void *b, void *ctx) {
+    const Dupes *d = ctx;
+    uint64_t ha = d->files[*(const size_t *)a].full, hb = d->files[*(const size_t *)b].full;
+    return ha < hb ? -1 : ha > hb;
+}
+
+static void hash_partial(Dupes *d, DupFile *f, const char *path) {
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        f->flags |= DUP_ERROR;
+        return;
+    }
+    // Only two blocks are read, readahead would be wasted
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+    unsigned char block[DUPES_PARTIAL_BLOCK];
+    Hash64 h;
+    Hash64_init(&h, f->size);
+
+    size_t head = MIN(f->size, DUPES_PARTIAL_BLOCK);
+    ssize_t got = pread(fd, block, head, 0);
+    if (got != (ssize_t)head) {
+        f->flags |= DUP_ERROR;
+        close(fd);
+        return;
+    }
+    Hash64_update(&h, block, head);
+
+    if (f->size > DUPES_PARTIAL_BLOCK) {
+        // Doesn't overlap the first block, so small files are read exactly once
+        off_t tail_off = MAX(f->size - DUPES_PARTIAL_BLOCK, DUPES_PARTIAL_BLOCK);
+        size_t tail = f->size - tail_off;
+        got = pread(fd, block, tail, tail_off);
+        if (got != (ssize_t)tail) {
+            f->flags |= DUP_ERROR;
+            close(fd);
+            return;
+        }
+        Hash64_update(&h, block, tail);
+    }
+
+    atomic_fetch_add(&d->hashed_bytes, MIN(f->size, 2 * DUPES_PARTIAL_BLOCK));
+    f->partial = Hash64_final(&h);
+    close(fd);
+}
+
+static void hash_full(Dupes *d, const Job *job, DupFile *f, const char *path) {
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat st;
+    // Read rather than mapped: a file truncated meanwhile would be a SIGBUS
+    unsigned char *block = fd != -1 ? malloc(MIN(MAX(f->size, 1), HASH_STEP)) : NULL;
+    if (block == NULL || fstat(fd, &st) == -1 || (uint64_t)st.st_size != f->size) {
+        f->flags |= DUP_ERROR;
+        free(block);
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    Hash64 h;
+    Hash64_init(&h, f->size);
+    bool failed = false;
+    for (uint64_t off = 0; off < f->size && !failed;) {
+        size_t step = MIN(f->size - off, HASH_STEP);
+        ssize_t got = should_stop(d, job) ? -1 : pread(fd, block, step, off);
+        // Shorter than it was when stat'ed, it changed
+        failed = got <= 0;
+        if (!failed) {
+            Hash64_update(&h, block, got);
+            atomic_fetch_add(&d->hashed_bytes, got);
+            off += got;
+        }
+    }
+    if (failed)
+        f->flags |= DUP_ERROR;
+    else
+        f->full = Hash64_final(&h);
+    free(block);
+    close(fd);
+}
+
+static void chunk_run(Job *job) {
+    DupChunk *chunk = job->data;
+    DupSet *set = chunk->set;
+    Dupes *d = set->d;
+
+    for (size_t i = chunk->first; i < chunk->first + chunk->count; i++) {
+        if (should_stop(d, job))
+            return;
+        size_t idx = set->members[i];
+        if (set->full)
+            hash_full(d, job, &d->files[idx], file_path(d, idx));
+        else
+            hash_partial(d, &d->files[idx], file_path(d, idx));
+    }
+}
+
+static void add_group(Dupes *d, size_t *members, size_t count) {
+    if (d->ngroups == d->groups_cap) {
+        size_t cap = MAX(d->groups_cap * 2, 64);
+        DupGroup *groups = realloc(d->groups, cap * sizeof(DupGroup));
+        if (groups == NULL)
+            return;
+        d->groups = groups;
+        d->groups_cap = cap;
+    }
+    size_t *copy = malloc(count * sizeof(size_t));
+    if (copy == NULL)
+        return;
+    memcpy(copy, members, count * sizeof(size_t));
+    d->groups[d->ngroups++] = (DupGroup){
+        .size = d->files[members[0]].size,
+        .members = copy,
+        .count = count,
+    };
+}
+
+static void chunk_done(Job *job);
+
+static void submit_set(Dupes *d, const size_t *members, size_t count, bool full) {
+    DupSet *set = malloc(sizeof(DupSet));
+    size_t *copy = malloc(count * sizeof(size_t));
+    if (set == NULL || copy == NULL) {
+        free(set);
+        free(copy);
+        return;
+    }
+    memcpy(copy, members, count * sizeof(size_t));
+    *set = (DupSet){ .d = d, .members = copy, .count = count, .full = full };
+
+    // Cut the set in chunks so that several workers share big sets
+    size_t first = 0;
+    while (first < count) {
+        size_t n = 0;
+        if (full) {
+            uint64_t bytes = 0;
+            while (first + n < count && (n == 0 || bytes < FULL_CHUNK_BYTES))
+                bytes += d->files[copy[first + n++]].size;
+        } else {
+            n = MIN(count - first, PARTIAL_CHUNK_FILES);
+        }
+
+        DupChunk *chunk = malloc(sizeof(DupChunk));
+        Job *job = chunk ? Job_new(chunk_run, chunk_done, chunk, JOB_PRIO_HIGH) : NULL;
+        if (job == NULL) {
+            free(chunk);
+            break;
+        }
+        *chunk = (DupChunk){ .set = set, .first = first, .count = n };
+        set->outstanding++;
+        d->pending_jobs++;
+        WorkPool_submit(d->pool, job);
+        first += n;
+    }
+
+    if (set->outstanding == 0) {
+        free(set->members);
+        free(set);
+    }
+}
+
+// All the hashes of the set are known: files with the same hash are either
+// hashed fully next, or reported
+static void classify_set(DupSet *set) {
+    Dupes *d = set->d;
+    qsort_r(set->members, set->count, sizeof(size_t), set->full ? compare_full : compare_partial, d);
+
+    size_t run_start = 0;
+    for (size_t i = 1; i <= set->count; i++) {
+        bool same = false;
+        if (i < set->count) {
+            const DupFile *a = &d->files[set->members[run_start]];
+            const DupFile *b = &d->files[set->members[i]];
+            same = set->full ? a->full == b->full : a->partial == b->partial;
+        }
+        if (same)
+            continue;
+
+        // Unreadable files are dropped from the run
+        size_t out = run_start;
+        for (size_t j = run_start; j < i; j++)
+            if (!(d->files[set->members[j]].flags & DUP_ERROR))
+                set->members[out++] = set->members[j];
+
+        size_t n = out - run_start;
+        if (n >= 2) {
+            uint64_t size = d->files[set->members[run_start]].size;
+            // When the first and last blocks cover the whole file, the partial
+            // hash already is a full one
+            if (set->full || size <= 2 * DUPES_PARTIAL_BLOCK)
+                add_group(d, set->members + run_start, n);
+            else
+                submit_set(d, set->members + run_start, n, true);
+        }
+        run_start = i;
+    }
+}
+
+static void chunk_done(Job *job) {
+    DupChunk *chunk = job->data;
+    DupSet *set = chunk->set;
+    Dupes *d = set->d;
+    free(chunk);
+
+    d->pending_jobs--;
+    if (--set->outstanding > 0)
+        return;
+
+    if (!atomic_load(&d->cancelled))
+        classify_set(set);
+    free(set->members);
+    free(set);
+}
+
+static void walk_run(Job *job) {
+    Dupes *d = job->data;
+    Walker walker = {
+        .visit = walk_visit,
+        .ctx = d,
+        .one_filesystem = true,
+        .cancelled = &job->cancelled,
+    };
+    walk_tree(d->root, 0, &walker);
+}
+
+// Groups the walked files by size. Names of the same inode are collapsed into
+// one candidate, they are links and not copies.
+static void walk_done(Job *job) {
+    Dupes *d = job->data;
+    d->pending_jobs--;
+    d->state = DUPES_HASHING;
+    if (atomic_load(&d->cancelled) || d->nfiles == 0)
+        return;
+
+    size_t *order = malloc(d->nfiles * sizeof(size_t));
+    size_t *candidates = malloc(d->nfiles * sizeof(size_t));
+    if (order == NULL || candidates == NULL) {
+        free(order);
+        free(candidates);
+        snprintf(d->status, sizeof(d->status), "Out of memory");
+        return;
+    }
+    for (size_t i = 0; i < d->nfiles; i++)
+        order[i] = i;
+    qsort_r(order, d->nfiles, sizeof(size_t), compare_identity, d);
+
+    size_t i = 0;
+    while (i < d->nfiles) {
+        uint64_t size = d->files[order[i]].size;
+        size_t n = 0;
+        for (; i < d->nfiles && d->files[order[i]].size == size; i++) {
+            DupFile *f = &d->files[order[i]];
+            DupFile *prev = n ? &d->files[candidates[n - 1]] : NULL;
+            if (prev && prev->dev == f->dev && prev->ino == f->ino)
+                prev->links++;
+            else
+                candidates[n++] = order[i];
+        }
+        if (n >= 2) {
+            d->candidates += n;
+            submit_set(d, candidates, n, false);
+        }
+    }
+
+    free(order);
+    free(candidates);
+}
+
+static uint64_t group_waste(const DupGroup *g) {
+    return g->size * (g->count - 1);
+}
+
+static int compare_groups(const void *a, const void *b) {
+    uint64_t wa = group_waste(a), wb = group_waste(b);
+    return wa > wb ? -1 : wa < wb;
+}
+
+// Drops deleted members and groups that don't have copies anymore, then
+// lists what's left
+static void rebuild_rows(Dupes *d) {
+    size_t kept = 0;
+    for (size_t g = 0; g < d->ngroups; g++) {
+        DupGroup *group = &d->groups[g];
+        size_t out = 0;
+        for (size_t m = 0; m < group->count; m++)
+            if (!(d->files[group->members[m]].flags & DUP_DELETED))
+                group->members[out++] = group->members[m];
+        group->count = out;
+
+        if (group->count >= 2)
+            d->groups[kept++] = *group;
+        else
+            free(group->members);
+    }
+    d->ngroups = kept;
+    qsort(d->groups, d->ngroups, sizeof(DupGroup), compare_groups);
+
+    size_t nrows = 0;
+    for (size_t g = 0; g < d->ngroups; g++)
+        nrows += d->groups[g].count + 1;
+    DupRow *rows = realloc(d->rows, MAX(nrows, 1) * sizeof(DupRow));
+    if (rows == NULL)
+        return;
+    d->rows = rows;
+    d->nrows = 0;
+    for (size_t g = 0; g < d->ngroups; g++) {
+        d->rows[d->nrows++] = (DupRow){ g, SIZE_MAX };
+        for (size_t m = 0; m < d->groups[g].count; m++)
+            d->rows[d->nrows++] = (DupRow){ g, m };
+    }
+    d->cursor = MAX(MIN(d->cursor, (SIZE)d->nrows - 1), 0);
+}
+
+static size_t unmarked_in_group(const Dupes *d, const DupGroup *g) {
+    size_t n = 0;
+    for (size_t m = 0; m < g->count; m++)
+        if (!(d->files[g->members[m]].flags & DUP_MARKED))
+            n++;
+    return n;
+}
+
+static void mark_all_but_first(Dupes *d, DupGroup *g) {
+    for (size_t m = 0; m < g->count; m++) {
+        DupFile *f = &d->files[g->members[m]];
+        if (m == 0)
+            f->flags &= ~DUP_MARKED;
+        else
+            f->flags |= DUP_MARKED;
+    }
+}
+
+typedef struct {
+    Dupes *d;
+    size_t *files;
+    // For each file, the member of its group that stays
+    size_t *keep;
+    size_t count;
+    size_t deleted;
+    size_t skipped;
+    uint64_t freed;
+} DupDelete;
+
+// Opens the file `idx` if it's still the one that was hashed, not whatever
+// took its place since. -1 otherwise.
+static int open_unchanged(const Dupes *d, size_t idx, struct stat *st) {
+    const DupFile *f = &d->files[idx];
+    int fd = open(file_path(d, idx), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, st) == -1 || st->st_dev != f->dev || st->st_ino != f->ino
+        || (uint64_t)st->st_size != f->size
+        || st->st_mtim.tv_sec != f->mtime.tv_sec || st->st_mtim.tv_nsec != f->mtime.tv_nsec) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Hashes only say the files are most likely the same, they are compared
+// byte by byte before one goes. `buf` holds two steps.
+static bool same_contents(int a, int b, uint64_t size, unsigned char *buf) {
+    for (uint64_t off = 0; off < size;) {
+        size_t step = MIN(size - off, HASH_STEP);
+        if (pread(a, buf, step, off) != (ssize_t)step
+            || pread(b, buf + HASH_STEP, step, off) != (ssize_t)step
+            || memcmp(buf, buf + HASH_STEP, step) != 0)
+            return false;
+        off += step;
+    }
+    return true;
+}
+
+static void delete_run(Job *job) {
+    DupDelete *del = job->data;
+    Dupes *d = del->d;
+    unsigned char *buf = malloc(2 * HASH_STEP);
+
+    for (size_t i = 0; i < del->count; i++) {
+        DupFile *f = &d->files[del->files[i]];
+        struct stat st, keep_st;
+        // The copy that stays has to be there and still hold the same data
+        int fd = buf != NULL ? open_unchanged(d, del->files[i], &st) : -1;
+        int keep = fd != -1 ? open_unchanged(d, del->keep[i], &keep_st) : -1;
+        bool same = keep != -1 && same_contents(fd, keep, f->size, buf);
+        if (keep != -1)
+            close(keep);
+        if (fd != -1)
+            close(fd);
+        if (!same || unlink(file_path(d, del->files[i])) == -1) {
+            del->skipped++;
+            continue;
+        }
+        f->flags |= DUP_DELETED;
+        del->deleted++;
+        if (f->links == 0 && st.st_nlink == 1)
+            del->freed += f->size;
+    }
+    free(buf);
+}
+
+static void delete_done(Job *job) {
+    DupDelete *del = job->data;
+    Dupes *d = del->d;
+    char freed[32];
+
+    for (size_t i = 0; i < del->count; i++)
+        d->files[del->files[i]].flags &= ~DUP_MARKED;
+    snprintf(d->status, sizeof(d->status), "Deleted %zu files, freed %s%s",
+             del->deleted, format_file_size(freed, del->freed),
+             del->skipped ? " (some were skipped: missing, changed or not deletable)" : "");
+
+    d->state = DUPES_BROWSING;
+    rebuild_rows(d);
+    free(del->files);
+    free(del->keep);
+    free(del);
+}
+
+static size_t count_marked(const Dupes *d, uint64_t *bytes) {
+    size_t n = 0;
+    *bytes = 0;
+    for (size_t g = 0; g < d->ngroups; g++) {
+        for (size_t m = 0; m < d->groups[g].count; m++) {
+            if (d->files[d->groups[g].members[m]].flags & DUP_MARKED) {
+                n++;
+                *bytes += d->groups[g].size;
+            }
+        }
+    }
+    return n;
+}
+
+static void start_delete(Dupes *d) {
+    uint64_t bytes;
+    size_t n = count_marked(d, &bytes);
+    if (n == 0)
+        return;
+
+    DupDelete *del = calloc(1, sizeof(DupDelete));
+    size_t *files = malloc(n * sizeof(size_t));
+    size_t *keep = malloc(n * sizeof(size_t));
+    Job *job = del && files && keep ? Job_new(delete_run, delete_done, del, JOB_PRIO_HIGH) : NULL;
+    if (job == NULL) {
+        free(del);
+        free(files);
+        free(keep);
+        return;
+    }
+    del->d = d;
+    del->files = files;
+    del->keep = keep;
+    for (size_t g = 0; g < d->ngroups; g++) {
+        const DupGroup *group = &d->groups[g];
+        size_t kept = SIZE_MAX;
+        for (size_t m = 0; m < group->count && kept == SIZE_MAX; m++)
+            if (!(d->files[group->members[m]].flags & DUP_MARKED))
+                kept = group->members[m];
+        // Marking never leaves a group without a copy, but just in case
+        if (kept == SIZE_MAX)
+            continue;
+        for (size_t m = 0; m < group->count; m++) {
+            if (d->files[group->members[m]].flags & DUP_MARKED) {
+                del->files[del->count] = group->members[m];
+                del->keep[del->count++] = kept;
+            }
+        }
+    }
+
+    d->state = DUPES_DELETING;
+    snprintf(d->status, sizeof(d->status), "Deleting %zu files...", n);
+    WorkPool_submit(d->pool, job);
+}
+
+static void draw_progress(WINDOW *win, Dupes *d) {
+    char bytes[32];
+    werase(win);
+    box(win, 0, 0);
+    mvwprintw(win, 0, 2, "Duplicates: %.*s", COLS - 16, d->root);
+    mvwprintw(win, 2, 2, "Walked %llu entries, %zu files",
+              (unsigned long long)atomic_load(&d->walked), d->state == DUPES_WALKING ? 0 : d->nfiles);
+    if (d->state == DUPES_HASHING)
+        mvwprintw(win, 3, 2, "Hashing %zu candidates: %s read, %zu jobs left, %zu groups so far",
+                  d->candidates, format_file_size(bytes, atomic_load(&d->hashed_bytes)),
+                  d->pending_jobs, d->ngroups);
+    const char *unresponsive = Fsio_unresponsive();
+    if (unresponsive != NULL)
+        mvwprintw(win, 4, 2, "%.*s is not responding", COLS - 22, unresponsive);
+    mvwprintw(win, 5, 2, "Press q to cancel");
+    wrefresh(win);
+}
+
+static void draw_groups(WINDOW *win, Dupes *d) {
+    int lines, cols;
+    getmaxyx(win, lines, cols);
+    SIZE num_lines = lines - 5;
+    char size[32], waste[32];
+
+    d->start = MIN(d->start, d->cursor);
+    d->start = MAX(d->start, d->cursor + 1 - num_lines);
+
+    werase(win);
+    box(win, 0, 0);
+    mvwprintw(win, 0, 2, "Duplicates: %.*s", cols - 16, d->root);
+
+    uint64_t total_waste = 0;
+    for (size_t g = 0; g < d->ngroups; g++)
+        total_waste += group_waste(&d->groups[g]);
+    uint64_t marked_bytes;
+    size_t marked = count_marked(d, &marked_bytes);
+    mvwprintw(win, 1, 2, "%zu groups, %s in extra copies, %zu marked (%s)",
+              d->ngroups, format_file_size(waste, total_waste), marked, format_file_size(size, marked_bytes));
+
+    size_t root_len = strlen(d->root);
+    for (SIZE i = d->start; i < (SIZE)d->nrows && i - d->start < num_lines; i++) {
+        const DupRow *row = &d->rows[i];
+        const DupGroup *g = &d->groups[row->group];
+
+        if (i == d->cursor)
+            wattron(win, A_REVERSE);
+        if (row->member == SIZE_MAX) {
+            wattron(win, A_BOLD);
+            mvwprintw(win, 3 + i - d->start, 2, "%zu copies of %s, %s wasted",
+                      g->count, format_file_size(size, g->size), format_file_size(waste, group_waste(g)));
+            wattroff(win, A_BOLD);
+        } else {
+            size_t idx = g->members[row->member];
+            const DupFile *f = &d->files[idx];
+            const char *path = file_path(d, idx);
+            // Paths are shown relative to the scanned directory
+            if (strncmp(path, d->root, root_len) == 0 && path[root_len] == '/')
+                path += root_len + 1;
+            char links[32] = "";
+            if (f->links)
+                snprintf(links, sizeof(links), " (+%u hard links)", f->links);
+            mvwprintw(win, 3 + i - d->start, 2, "  [%c] %.*s%s",
+                      (f->flags & DUP_MARKED) ? 'x' : ' ', MAX(cols - 30, 1), path, links);
+        }
+        if (i == d->cursor)
+            wattroff(win, A_REVERSE);
+    }
+
+    if (d->ngroups == 0)
+        mvwprintw(win, 3, 2, "No duplicates found");
+
+    if (d->state == DUPES_CONFIRM_DELETE)
+        mvwprintw(win, lines - 2, 2, "Delete %zu marked files (%s)? (y/n)", marked, format_file_size(size, marked_bytes));
+    else if (d->status[0])
+        mvwprintw(win, lines - 2, 2, "%.*s", cols - 4, d->status);
+    else
+        mvwprintw(win, lines - 2, 2, "q: back  space: mark  a: mark all but first  A: same, every group  d: delete marked");
+    wrefresh(win);
+}
+
+static void browse_key(Dupes *d, int ch) {
+    if (d->state == DUPES_CONFIRM_DELETE) {
+        d->state = DUPES_BROWSING;
+        if (ch == 'y' || ch == 'Y')
+            start_delete(d);
+        return;
+    }
+    if (d->state != DUPES_BROWSING)
+        return;
+
+    d->status[0] = '\0';
+    DupRow *row = d->nrows ? &d->rows[d->cursor] : NULL;
+    switch (ch) {
+        case KEY_UP:
+            d->cursor = MAX(d->cursor - 1, 0);
+            break;
+        case KEY_DOWN:
+            d->cursor = MIN(d->cursor + 1, MAX((SIZE)d->nrows - 1, 0));
+            break;
+        case ' ':
+            if (row == NULL || row->member == SIZE_MAX)
+                break;
+            DupGroup *g = &d->groups[row->group];
+            DupFile *f = &d->files[g->members[row->member]];
+            if (!(f->flags & DUP_MARKED) && unmarked_in_group(d, g) <= 1)
+                snprintf(d->status, sizeof(d->status), "At least one copy has to stay");
+            else
+                f->flags ^= DUP_MARKED;
+            d->cursor = MIN(d->cursor + 1, MAX((SIZE)d->nrows - 1, 0));
+            break;
+        case 'a':
+            if (row != NULL)
+                mark_all_but_first(d, &d->groups[row->group]);
+            break;
+        case 'A':
+            for (size_t i = 0; i < d->ngroups; i++)
+                mark_all_but_first(d, &d->groups[i]);
+            break;
+        case 'd': {
+            uint64_t unused;
+            if (count_marked(d, &unused) > 0)
+                d->state = DUPES_CONFIRM_DELETE;
+            break;
+        }
+    }
+}
+
+void dupes_view(WorkPool *pool, const char *root) {
+    Dupes *d = calloc(1, sizeof(Dupes));
+    if (d == NULL)
+        return;
+    d->root = strdup(root);
+    d->pool = pool;
+    atomic_init(&d->cancelled, false);
+    atomic_init(&d->walked, 0);
+    atomic_init(&d->hashed_bytes, 0);
+
+    Job *walk = d->root ? Job_new(walk_run, walk_done, d, JOB_PRIO_HIGH) : NULL;
+    if (walk == NULL) {
+        free(d->root);
+        free(d);
+        return;
+    }
+    d->state = DUPES_WALKING;
+    d->pending_jobs = 1;
+    // The root may be on a hung mount, the walk gets a deadline per step
+    Fsio_submit(walk, d->root, FSIO_DEADLINE_LIST);
+
+    WINDOW *win = newwin(LINES, COLS, 0, 0);
+    keypad(win, TRUE);
+    wtimeout(win, 100);
+
+    for (;;) {
+        WorkPool_poll(pool);
+        Fsio_poll();
+
+        if (d->state == DUPES_HASHING && d->pending_jobs == 0) {
+            if (atomic_load(&d->cancelled))
+                break;
+            d->state = DUPES_BROWSING;
+            rebuild_rows(d);
+        }
+        // Jobs point to the finder, it can only go once they are done
+        if (atomic_load(&d->cancelled) && d->pending_jobs == 0 && d->state != DUPES_DELETING)
+            break;
+
+        if (d->state == DUPES_WALKING || d->state == DUPES_HASHING)
+            draw_progress(win, d);
+        else
+            draw_groups(win, d);
+
+        int ch = wgetch(win);
+        if (ch == ERR)
+            continue;
+        if ((ch == 'q' || ch == KEY_F(1)) && d->state != DUPES_CONFIRM_DELETE) {
+            atomic_store(&d->cancelled, true);
+            if (d->state == DUPES_WALKING)
+                Job_cancel(walk);
+            continue;
+        }
+        browse_key(d, ch);
+    }
+
+    werase(win);
+    wrefresh(win);
+    delwin(win);
+
+    for (size_t g = 0; g < d->ngroups; g++)
+        free(d->groups[g].members);
+    free(d->groups);
+    free(d->rows);
+    free(d->files);
+    free(d->paths);
+    free(d->root);
+    free(d);
+}
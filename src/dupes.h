@@ -0,0 +1,16 @@
+// File: dupes.h
+// -----------------------
+#ifndef DUPES_H
+#define DUPES_H
+
+#include <workpool.h>  // for WorkPool
+
+// Bytes hashed at the start and at the end of every candidate before any
+// file gets hashed completely
+#define DUPES_PARTIAL_BLOCK 4096
+
+// Looks for files with the same contents below `root` and lets the user mark
+// and delete the extra copies, until they leave with 'q'.
+void dupes_view(WorkPool *pool, const char *root);
+
+#endif // DUPES_H
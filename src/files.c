@@ -1,28 +1,33 @@
 // File: files.c
 // -----------------------
-#define _POSIX_C_SOURCE 200112L    // for strdup
+#define _GNU_SOURCE                // for strdup, openat, fdopendir, O_PATH, DT_DIR
+#include <fcntl.h>                 // for open, openat, O_RDONLY, O_DIRECTORY, O_CLOEXEC
 #include <stdlib.h>                // for malloc, free
 #include <stddef.h>                // for NULL
 #include <sys/types.h>             // for ino_t
-#include <string.h>                // for strdup
-#include <dirent.h>                // for DIR, struct dirent, opendir, readdir, closedir
-#include <unistd.h>                // for lstat
+#include <string.h>                // for memcpy, strlen
+#include <dirent.h>                // for DIR, struct dirent, fdopendir, readdir, closedir, dirfd, DT_DIR
+#include <unistd.h>                // for lstat, close
 #include <stdio.h>                 // for snprintf
 #include <sys/stat.h>              // for struct stat, lstat, S_ISDIR
 #include <time.h>                  // for strftime
 #include <main.h>                  // for FileAttr, Vector, Vector_add, Vector_len, Vector_set_len
 #include <utils.h>                 // for path_join, is_directory
-#include <files.h>                 // for FileAttributes, FileAttr, MAX_PATH_LENGTH
+#include <files.h>                 // for FileAttributes, FileAttr
 #include <curses.h>                // for WINDOW, mvwprintw
 #include <stdbool.h>               // for bool, true, false
 #include <string.h>                // for strcmp
-
-#define MAX_PATH_LENGTH 1024
+#include <stdatomic.h>             // for atomic_bool, atomic_load
+#include <errno.h>                 // for errno, ENOTDIR
+#include <tar.h>                   // for Tar_list
+#include <daemon.h>                // for Daemon_list, Daemon_size
+#include <walk.h>                  // for Walker, WalkEntry, walk_tree
 
 struct FileAttributes {
-    char *name;  // Change from char name*;
+    char *name;  // Points right after the struct, see mk_attr
     ino_t inode;
     bool is_dir;
+    FileMeta meta;
 };
 
 const char *FileAttr_get_name(FileAttr fa) {
@@ -39,20 +44,22 @@ bool FileAttr_is_dir(FileAttr fa) {
     return fa->is_dir;
 }
 
+FileMeta *FileAttr_get_meta(FileAttr fa) {
+    return &fa->meta;
+}
+
 FileAttr mk_attr(const char *name, bool is_dir, ino_t inode) {
-    FileAttr fa = malloc(sizeof(struct FileAttributes));
+    size_t name_len = strlen(name);
+    // The name lives in the same allocation, so a plain free() (which is what
+    // Vector_set_len and Vector_bye do) releases the whole entry
+    FileAttr fa = malloc(sizeof(struct FileAttributes) + name_len + 1);
 
     if (fa != NULL) {
-        fa->name = strdup(name);
-
-        if (fa->name == NULL) {
-            // Handle memory allocation failure for the name
-            free(fa);
-            return NULL;
-        }
-
+        fa->name = (char *)(fa + 1);
+        memcpy(fa->name, name, name_len + 1);
         fa->inode = inode;
         fa->is_dir = is_dir;
+        fa->meta = (FileMeta){ .state = META_NONE };
         return fa;
     } else {
         // Handle memory allocation failure for the FileAttr
@@ -61,78 +68,87 @@ FileAttr mk_attr(const char *name, bool is_dir, ino_t inode) {
 }
 
 void free_attr(FileAttr fa) {
-    if (fa != NULL) {
-        free(fa->name);  // Free the allocated memory for the name
-        free(fa);
-    }
+    free(fa);
 }
 
-void append_files_to_vec(Vector *v, const char *name) {
-    DIR *dir = opendir(name);
-    if (dir != NULL) {
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
-            // Filter out "." and ".." entries
-            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-                char full_path[MAX_PATH_LENGTH];
-                path_join(full_path, name, entry->d_name);
-
-                bool is_dir = is_directory(name, entry->d_name);
-
-                // Allocate memory for the FileAttr object
-                FileAttr file_attr = mk_attr(entry->d_name, is_dir, entry->d_ino);
-
-                // Add the FileAttr object to the vector
-                Vector_add(v, 1);
-                v->el[Vector_len(*v)] = file_attr;
-
-                // Update the vector length
-                Vector_set_len(v, Vector_len(*v) + 1);
-            }
-        }
-        closedir(dir);
+bool append_files_to_vec_cancellable(Vector *v, int dirfd, const char *name, const atomic_bool *cancelled) {
+    // A running daemon may have it cached, the stat data of the entries too
+    if (dirfd >= 0 && Daemon_list(v, dirfd, cancelled))
+        return true;
+
+    // Reopened relative to the handle, the path isn't looked up again
+    int fd = dirfd >= 0
+        ? openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+        : open(name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd != -1 ? fdopendir(fd) : NULL;
+    if (dir == NULL) {
+        // Archives and the directories inside them are listed from their index
+        bool archive = dirfd < 0 && errno == ENOTDIR;
+        if (fd != -1)
+            close(fd);
+        if (archive)
+            return Tar_list(v, name, cancelled);
+        return true;
     }
-}
 
-// Recursive function to calculate directory size
-// NOTE: this function may take long, it might be better to have the size of
-//       the directories displayed as "-" until we have a value. Use of "du" or
-//       another already existent tool might be better. The sizes should
-//       probably be cached.
-//       fork() -> exec() (if using du)
-//       fork() -> calculate directory size and return it somehow (maybe print
-//       as binary to the stdout)
-long get_directory_size(const char *dir_path) {
-    DIR *dir;
     struct dirent *entry;
-    struct stat statbuf;
-    long total_size = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        // Checked once per entry, huge directories on slow mounts are exactly
+        // what gets cancelled
+        if (cancelled != NULL && atomic_load(cancelled)) {
+            closedir(dir);
+            return false;
+        }
 
-    // Open directory
-    if (!(dir = opendir(dir_path)))
-        return -1;
+        // Filter out "." and ".." entries
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            // Most filesystems tell the type right away, only links and the
+            // rest need a stat()
+            bool is_dir = entry->d_type == DT_DIR
+                || ((entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) && is_directory(fd, entry->d_name));
 
-    // Iterate over directory entries
-    while ((entry = readdir(dir)) != NULL) {
-        char path[MAX_PATH_LENGTH];
-        // Skip "." and ".." entries
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-            continue;
-        // Construct full path to entry
-        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
-        // Get entry's information
-        if (lstat(path, &statbuf) == -1)
-            continue;
-        // If entry is a directory, recursively calculate its size
-        if (S_ISDIR(statbuf.st_mode))
-            // This recursion may cause a stack overflow
-            total_size += get_directory_size(path);
-        else
-            total_size += statbuf.st_size; // Add size of regular file
-    }
+            // Allocate memory for the FileAttr object
+            FileAttr file_attr = mk_attr(entry->d_name, is_dir, entry->d_ino);
+            if (file_attr == NULL)
+                continue;
 
+            // Add the FileAttr object to the vector
+            Vector_add(v, 1);
+            v->el[Vector_len(*v)] = file_attr;
+
+            // Update the vector length
+            Vector_set_len(v, Vector_len(*v) + 1);
+        }
+    }
     closedir(dir);
-    return total_size;
+    return true;
+}
+
+void append_files_to_vec(Vector *v, const char *name) {
+    append_files_to_vec_cancellable(v, -1, name, NULL);
+}
+
+static bool add_size(void *ctx, const WalkEntry *e, [[maybe_unused]] uintptr_t *cookie) {
+    if (!S_ISDIR(e->st->st_mode))
+        *(long *)ctx += e->st->st_size;
+    return true;
+}
+
+// Sum of the sizes of everything below the directory, without following
+// symlinks. Returns -1 if it can't be read or *cancelled became true.
+long get_directory_size(const char *dir_path, const atomic_bool *cancelled) {
+    // A running daemon may have summed it up already
+    long daemon_size = Daemon_size(dir_path, cancelled);
+    if (daemon_size >= 0)
+        return daemon_size;
+
+    long total_size = 0;
+    Walker walker = {
+        .visit = add_size,
+        .ctx = &total_size,
+        .cancelled = cancelled,
+    };
+    return walk_tree(dir_path, 0, &walker) ? total_size : -1;
 }
 
 char* format_file_size(char *buffer, size_t size) {
@@ -149,33 +165,27 @@ char* format_file_size(char *buffer, size_t size) {
     return buffer;
 }
 
-void display_file_info(WINDOW *window, const char *file_path, int max_x) {
-    struct stat file_stat;
-
-    // Get file information
-    if (stat(file_path, &file_stat) == -1) {
-        mvwprintw(window, 1, 2, "Unable to retrieve file information");
-        return;
-    }
-
+void display_file_info(WINDOW *window, const struct stat *file_stat, long dir_size, int max_x) {
     // Display file information
-    if (S_ISDIR(file_stat.st_mode)) {
-        // If it's a directory, calculate its size using get_directory_size
-        long dir_size = get_directory_size(file_path);
+    if (S_ISDIR(file_stat->st_mode)) {
+        // The size of a directory is summed up on a worker
         char fileSizeStr[20];
-        mvwprintw(window, 2, 2, "Directory Size: %.*s", max_x - 4, format_file_size(fileSizeStr, dir_size));
+        if (dir_size < 0)
+            mvwprintw(window, 2, 2, "Directory Size: ...");
+        else
+            mvwprintw(window, 2, 2, "Directory Size: %.*s", max_x - 4, format_file_size(fileSizeStr, dir_size));
     } else {
         // If it's a regular file, display its size directly
         char fileSizeStr[20];
-        mvwprintw(window, 2, 2, "File Size: %.*s", max_x - 4, format_file_size(fileSizeStr, file_stat.st_size));
+        mvwprintw(window, 2, 2, "File Size: %.*s", max_x - 4, format_file_size(fileSizeStr, file_stat->st_size));
     }
 
     char permissions[22];
-    sprintf(permissions, "File Permissions: %o", file_stat.st_mode & 0777);
+    sprintf(permissions, "File Permissions: %o", file_stat->st_mode & 0777);
     mvwprintw(window, 3, 2, "%.*s", max_x - 4, permissions);
 
     char modTime[50];
-    strftime(modTime, sizeof(modTime), "%c", localtime(&file_stat.st_mtime));
+    strftime(modTime, sizeof(modTime), "%c", localtime(&file_stat->st_mtime));
     mvwprintw(window, 4, 2, "Last Modification Time: %.24s", modTime);
 }
 /**
@@ -1,13 +1,56 @@
+#ifndef FILES_H
+#define FILES_H
+
 #include <vector.h>
 #include <curses.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 // 256 in most systems
 #define MAX_FILENAME_LEN 512
 
 typedef struct FileAttributes* FileAttr;
 
+typedef enum {
+    META_NONE = 0,  // Nobody asked for it yet
+    META_PENDING,   // A worker is fetching it
+    META_READY,
+    META_STALE,     // Shown as it is, but the entry changed and is stat'ed again
+    META_ERROR,     // The entry vanished or can't be stat'ed
+} MetaState;
+
+// Extended metadata, only fetched for the rows that are on screen
+typedef struct {
+    MetaState state;
+    // Which MetaColumn fields are valid, see metadata.h
+    unsigned int columns;
+    // Which ones were asked for. The filesystem may not have all of them,
+    // they aren't asked for again until the entry changes.
+    unsigned int requested;
+    unsigned int mode;
+    unsigned int uid;
+    unsigned long long size;
+    long long mtime;
+} FileMeta;
+
 const char *FileAttr_get_name(FileAttr fa);
 bool FileAttr_is_dir(FileAttr fa);
+FileMeta *FileAttr_get_meta(FileAttr fa);
+// The name is copied into the entry, free() releases everything
+FileAttr mk_attr(const char *name, bool is_dir, ino_t inode);
 void append_files_to_vec(Vector *v, const char *name);
-void display_file_info(WINDOW *window, const char *file_path, int max_x);
-bool is_supported_file_type(const char *filename);
\ No newline at end of file
+// Same as append_files_to_vec, but lists the directory `dirfd` refers to
+// (O_PATH is enough) unless it's -1, and gives up as soon as *cancelled
+// becomes true. Returns false in that case, leaving a partial listing in v.
+// Archives have no descriptor, `name` is their path.
+bool append_files_to_vec_cancellable(Vector *v, int dirfd, const char *name, const atomic_bool *cancelled);
+char *format_file_size(char *buffer, size_t size);
+// Sums up a directory tree, -1 if it can't be read or got cancelled
+long get_directory_size(const char *dir_path, const atomic_bool *cancelled);
+// Shows the stat() of the preview target. A negative dir_size is still being
+// computed.
+void display_file_info(WINDOW *window, const struct stat *file_stat, long dir_size, int max_x);
+bool is_supported_file_type(const char *filename);
+
+#endif // FILES_H
@@ -0,0 +1,410 @@
+// File: frecency.c
+// -----------------------
+#define _GNU_SOURCE        // for strdup, getline, clock_gettime, CLOCK_MONOTONIC
+#include <ctype.h>         // for tolower
+#include <fcntl.h>         // for open, O_RDWR, O_CREAT, O_CLOEXEC
+#include <stdint.h>        // for SIZE_MAX
+#include <stdio.h>         // for FILE, fopen, fprintf, fclose, getline
+#include <stdlib.h>        // for malloc, realloc, calloc, free, qsort, bsearch, getenv, strtoull, strtoll
+#include <string.h>        // for strlen, strcmp, strchr, strrchr, strdup, memcpy
+#include <sys/file.h>      // for flock, LOCK_EX, LOCK_UN
+#include <time.h>          // for time, time_t, struct timespec, clock_gettime
+#include <unistd.h>        // for close
+// Local includes
+#include <frecency.h>      // for FRECENCY_MAX_TOTAL, FRECENCY_FLUSH_MS
+#include <fsio.h>          // for Fsio_submit, FSIO_DEADLINE_READ
+#include <utils.h>         // for MAX, path_join, make_parents, create_temp, replace_with_temp, elapsed_ms
+#include <workpool.h>      // for Job, Job_new
+
+typedef struct {
+    char *path;
+    double rank;
+    time_t last;
+} FrecencyEntry;
+
+typedef struct {
+    FrecencyEntry *el;
+    size_t len, cap;
+} FrecencyIndex;
+
+typedef struct {
+    char *file;
+    // Visits to merge into the index, taken from `pending`
+    FrecencyIndex visits;
+    // The index as it's on disk afterwards, sorted by path
+    FrecencyIndex index;
+    // The visits couldn't be written, `index` has them but the file doesn't
+    bool unsaved;
+} FrecencySync;
+
+typedef struct {
+    const char *path;
+    double score;
+} FrecencyMatch;
+
+// NULL without a home, visits are only kept for the session then
+static char *index_file;
+// What was read back last, sorted by path
+static FrecencyIndex shown;
+// Visits not handed to a sync yet, and when the first one was made
+static FrecencyIndex pending;
+static struct timespec first_pending;
+static Job *sync_job;
+
+// Takes `path` over unless there's no memory
+static bool index_add(FrecencyIndex *x, char *path, double rank, time_t last) {
+    if (x->len == x->cap) {
+        size_t cap = MAX(x->cap * 2, 64);
+        FrecencyEntry *el = realloc(x->el, cap * sizeof(FrecencyEntry));
+        if (el == NULL)
+            return false;
+        x->el = el;
+        x->cap = cap;
+    }
+    x->el[x->len++] = (FrecencyEntry){ .path = path, .rank = rank, .last = last };
+    return true;
+}
+
+static void index_free(FrecencyIndex *x) {
+    for (size_t i = 0; i < x->len; i++)
+        free(x->el[i].path);
+    free(x->el);
+    *x = (FrecencyIndex){ 0 };
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(((const FrecencyEntry *)a)->path, ((const FrecencyEntry *)b)->path);
+}
+
+// Sorts the entries by path, summing up those of the same path
+static void index_sort(FrecencyIndex *x) {
+    if (x->len == 0)
+        return;
+    qsort(x->el, x->len, sizeof(FrecencyEntry), compare_paths);
+    size_t n = 0;
+    for (size_t i = 0; i < x->len; i++) {
+        if (n > 0 && strcmp(x->el[n - 1].path, x->el[i].path) == 0) {
+            x->el[n - 1].rank += x->el[i].rank;
+            x->el[n - 1].last = MAX(x->el[n - 1].last, x->el[i].last);
+            free(x->el[i].path);
+        } else {
+            x->el[n++] = x->el[i];
+        }
+    }
+    x->len = n;
+}
+
+static const FrecencyEntry *index_find(const FrecencyIndex *x, const char *path) {
+    if (x->len == 0)
+        return NULL;
+    FrecencyEntry key = { .path = (char *)path };
+    return bsearch(&key, x->el, x->len, sizeof(FrecencyEntry), compare_paths);
+}
+
+// Scales every rank down once the total gets too high, old entries that
+// weren't visited again fall out
+static void index_age(FrecencyIndex *x) {
+    double total = 0;
+    for (size_t i = 0; i < x->len; i++)
+        total += x->el[i].rank;
+    if (total <= FRECENCY_MAX_TOTAL)
+        return;
+
+    double factor = 0.9 * FRECENCY_MAX_TOTAL / total;
+    size_t n = 0;
+    for (size_t i = 0; i < x->len; i++) {
+        x->el[i].rank *= factor;
+        if (x->el[i].rank >= 1)
+            x->el[n++] = x->el[i];
+        else
+            free(x->el[i].path);
+    }
+    x->len = n;
+}
+
+// One entry per line: "<rank in hundredths> <last visit> <path>". Ranks are
+// integers so that instances running with another locale read them back.
+static void read_index(const char *file, FrecencyIndex *x) {
+    FILE *f = fopen(file, "r");
+    if (f == NULL)
+        return;
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, f)) > 0) {
+        if (line[len - 1] == '\n')
+            line[len - 1] = '\0';
+        char *end;
+        unsigned long long rank = strtoull(line, &end, 10);
+        if (end == line || *end != ' ' || rank == 0)
+            continue;
+        char *start = end + 1;
+        long long last = strtoll(start, &end, 10);
+        if (end == start || end[0] != ' ' || end[1] != '/')
+            continue;
+
+        char *path = strdup(end + 1);
+        if (path == NULL || !index_add(x, path, rank / 100.0, last)) {
+            free(path);
+            break;
+        }
+    }
+    free(line);
+    fclose(f);
+}
+
+static bool write_index(const char *file, const FrecencyIndex *x) {
+    char *tmp;
+    FILE *f = create_temp(file, &tmp);
+    if (f == NULL)
+        return false;
+    for (size_t i = 0; i < x->len; i++)
+        fprintf(f, "%llu %lld %s\n", (unsigned long long)(x->el[i].rank * 100 + 0.5),
+                (long long)x->el[i].last, x->el[i].path);
+    return replace_with_temp(f, tmp, file);
+}
+
+// Reads the index and, if there are visits, merges them in and writes it
+// back. The lock is held from the read to the rename, so instances syncing
+// at once don't lose each other's visits.
+static void sync_index(FrecencySync *s) {
+    if (s->visits.len > 0)
+        make_parents(s->file);
+    char *lock_file = malloc(strlen(s->file) + sizeof(".lock"));
+    int lock = -1;
+    if (lock_file != NULL) {
+        memcpy(lock_file, s->file, strlen(s->file));
+        memcpy(lock_file + strlen(s->file), ".lock", sizeof(".lock"));
+        // Without one (read-only home, no directory yet) it's read all the same
+        lock = open(lock_file, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (lock != -1)
+            flock(lock, LOCK_EX);
+        free(lock_file);
+    }
+
+    read_index(s->file, &s->index);
+    // The index gets copies: the visits are only dropped once they are on
+    // disk, the ones that aren't are synced again
+    size_t merged = 0;
+    for (; merged < s->visits.len; merged++) {
+        const FrecencyEntry *v = &s->visits.el[merged];
+        char *path = strdup(v->path);
+        if (path == NULL || !index_add(&s->index, path, v->rank, v->last)) {
+            free(path);
+            break;
+        }
+    }
+    index_sort(&s->index);
+    if (merged > 0) {
+        index_age(&s->index);
+        s->unsaved = !write_index(s->file, &s->index);
+        for (size_t i = 0; i < merged && !s->unsaved; i++) {
+            free(s->visits.el[i].path);
+            s->visits.el[i].path = NULL;
+        }
+    }
+
+    if (lock != -1) {
+        flock(lock, LOCK_UN);
+        close(lock);
+    }
+}
+
+static void sync_run(Job *job) {
+    sync_index(job->data);
+}
+
+static void add_pending(const char *path, double rank, time_t last) {
+    for (size_t i = 0; i < pending.len; i++) {
+        if (strcmp(pending.el[i].path, path) == 0) {
+            pending.el[i].rank += rank;
+            pending.el[i].last = MAX(pending.el[i].last, last);
+            return;
+        }
+    }
+    if (pending.len == 0)
+        clock_gettime(CLOCK_MONOTONIC, &first_pending);
+    char *copy = strdup(path);
+    if (copy != NULL && !index_add(&pending, copy, rank, last))
+        free(copy);
+}
+
+static void sync_done(Job *job) {
+    FrecencySync *s = job->data;
+    if (job == sync_job)
+        sync_job = NULL;
+
+    // Unsaved visits are shown from `pending` again, not twice
+    if (job->ran && !s->unsaved) {
+        index_free(&shown);
+        shown = s->index;
+    } else {
+        index_free(&s->index);
+    }
+    // The visits that didn't make it into the index wait for the next sync
+    for (size_t i = 0; i < s->visits.len; i++)
+        if (s->visits.el[i].path != NULL)
+            add_pending(s->visits.el[i].path, s->visits.el[i].rank, s->visits.el[i].last);
+    index_free(&s->visits);
+    free(s->file);
+    free(s);
+}
+
+static char *index_path(void) {
+    const char *data = getenv("XDG_DATA_HOME");
+    if (data != NULL && data[0] == '/')
+        return path_join(data, "cupidfm/frecency");
+    const char *home = getenv("HOME");
+    if (home == NULL || home[0] != '/')
+        return NULL;
+    return path_join(home, ".local/share/cupidfm/frecency");
+}
+
+void Frecency_init(void) {
+    index_file = index_path();
+    Frecency_sync();
+}
+
+void Frecency_bye(void) {
+    // A sync that's still in flight is stuck on the mount, it keeps its own
+    // visits. Writing the rest may block the same way, there's no way around
+    // that short of losing them.
+    if (index_file != NULL && pending.len > 0) {
+        FrecencySync s = { .file = index_file, .visits = pending };
+        sync_index(&s);
+        index_free(&s.index);
+        pending = s.visits;
+    }
+    index_free(&pending);
+    index_free(&shown);
+    free(index_file);
+    index_file = NULL;
+}
+
+void Frecency_visit(const char *path) {
+    // A newline can't be stored, a relative path can't be jumped to
+    if (path[0] != '/' || strchr(path, '\n') != NULL)
+        return;
+    add_pending(path, 1, time(NULL));
+}
+
+void Frecency_sync(void) {
+    if (index_file == NULL || sync_job != NULL)
+        return;
+    FrecencySync *s = calloc(1, sizeof(FrecencySync));
+    char *file = strdup(index_file);
+    Job *job = s != NULL && file != NULL ? Job_new(sync_run, sync_done, s, JOB_PRIO_HIGH) : NULL;
+    if (job == NULL) {
+        free(s);
+        free(file);
+        return;
+    }
+    s->file = file;
+    s->visits = pending;
+    pending = (FrecencyIndex){ 0 };
+    sync_job = job;
+    Fsio_submit(job, index_file, FSIO_DEADLINE_READ);
+}
+
+void Frecency_poll(void) {
+    if (pending.len == 0)
+        return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (elapsed_ms(&first_pending, &now) >= FRECENCY_FLUSH_MS)
+        Frecency_sync();
+}
+
+// Frecency of an entry: visits in the last hour count four times, in the
+// last day twice, past a week a quarter
+static double frecency(double rank, time_t last, time_t now) {
+    time_t age = now - last;
+    if (age < 3600)
+        return rank * 4;
+    if (age < 86400)
+        return rank * 2;
+    if (age < 604800)
+        return rank / 2;
+    return rank / 4;
+}
+
+static bool is_boundary(char c) {
+    return c == '/' || c == '-' || c == '_' || c == '.' || c == ' ';
+}
+
+// Matches `query` backwards from the end of `path`, ignoring case and the
+// spaces of the query, so the last components are preferred. 0 if some
+// character isn't there.
+static int match_quality(const char *path, const char *query) {
+    const char *last_slash = strrchr(path, '/');
+    size_t last_component = last_slash != NULL ? (size_t)(last_slash - path) + 1 : 0;
+    size_t p = strlen(path), next = SIZE_MAX;
+    int points = 1;
+
+    for (size_t q = strlen(query); q-- > 0;) {
+        if (query[q] == ' ')
+            continue;
+        int want = tolower((unsigned char)query[q]);
+        while (p > 0 && tolower((unsigned char)path[p - 1]) != want)
+            p--;
+        if (p == 0)
+            return 0;
+        size_t at = --p;
+        points += 1;
+        if (at == 0 || is_boundary(path[at - 1]))
+            points += 2;
+        if (at + 1 == next)
+            points += 2;
+        if (at >= last_component)
+            points += 1;
+        next = at;
+    }
+    return points;
+}
+
+static int compare_matches(const void *a, const void *b) {
+    const FrecencyMatch *ma = a, *mb = b;
+    if (ma->score != mb->score)
+        return ma->score > mb->score ? -1 : 1;
+    return strcmp(ma->path, mb->path);
+}
+
+static void add_match(FrecencyMatch *matches, size_t *n, const char *path, const char *query,
+                      double rank, time_t last, time_t now) {
+    int quality = match_quality(path, query);
+    if (quality > 0)
+        matches[(*n)++] = (FrecencyMatch){ path, frecency(rank, last, now) * quality };
+}
+
+size_t Frecency_search(const char *query, const char **results, size_t max) {
+    FrecencyMatch *matches = malloc(MAX(shown.len + pending.len, 1) * sizeof(FrecencyMatch));
+    if (matches == NULL)
+        return 0;
+
+    // Visits that weren't synced yet count too
+    time_t now = time(NULL);
+    size_t n = 0;
+    for (size_t i = 0; i < shown.len; i++) {
+        const FrecencyEntry *e = &shown.el[i];
+        double rank = e->rank;
+        time_t last = e->last;
+        for (size_t j = 0; j < pending.len; j++) {
+            if (strcmp(pending.el[j].path, e->path) == 0) {
+                rank += pending.el[j].rank;
+                last = MAX(last, pending.el[j].last);
+            }
+        }
+        add_match(matches, &n, e->path, query, rank, last, now);
+    }
+    for (size_t j = 0; j < pending.len; j++)
+        if (index_find(&shown, pending.el[j].path) == NULL)
+            add_match(matches, &n, pending.el[j].path, query, pending.el[j].rank, pending.el[j].last, now);
+
+    qsort(matches, n, sizeof(FrecencyMatch), compare_matches);
+    size_t count = n < max ? n : max;
+    for (size_t i = 0; i < count; i++)
+        results[i] = matches[i].path;
+    free(matches);
+    return count;
+}
@@ -0,0 +1,41 @@
+// File: frecency.h
+// -----------------------
+#ifndef FRECENCY_H
+#define FRECENCY_H
+
+#include <stddef.h>   // for size_t
+
+// Past this total rank every entry is aged, and those that drop below 1 are
+// forgotten, so the index stays small
+#define FRECENCY_MAX_TOTAL 10000
+// Visits are written out this long after the first one that's pending
+#define FRECENCY_FLUSH_MS 5000
+// Characters of a query, the rest is ignored
+#define FRECENCY_MAX_QUERY 255
+
+// Directories visited, ranked by how often and how recently. The index is
+// kept in $XDG_DATA_HOME/cupidfm/frecency (~/.local/share/cupidfm/frecency)
+// and shared by every running instance: visits are merged into it under a
+// lock and the file is replaced atomically. It's read and written through
+// fsio, the first read is started here.
+void Frecency_init(void);
+// Writes the pending visits right away. After Fsio_bye, so jobs that never
+// ran gave theirs back.
+void Frecency_bye(void);
+
+// Records a visit of the directory `path`
+void Frecency_visit(const char *path);
+// Writes the pending visits and reads back what every instance wrote,
+// unless that's in flight already
+void Frecency_sync(void);
+// Syncs once the pending visits are FRECENCY_FLUSH_MS old. Once per main loop
+// iteration.
+void Frecency_poll(void);
+// Stores in `results` up to `max` paths of the index that fuzzily match
+// `query`, best first. Its characters must appear in the path in order,
+// matches starting a component, following each other or in the last
+// component count more, then frecency decides. Returns how many were stored.
+// The paths are valid until the next Fsio_poll.
+size_t Frecency_search(const char *query, const char **results, size_t max);
+
+#endif // FRECENCY_H
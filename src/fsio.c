@@ -0,0 +1,215 @@
+// File: fsio.c
+// -----------------------
+#define _POSIX_C_SOURCE 200809L  // for strdup, getline, clock_gettime, CLOCK_MONOTONIC
+#include <pthread.h>             // for pthread_mutex_t, pthread_mutex_lock, pthread_mutex_unlock
+#include <stdio.h>               // for FILE, fopen, getline, fclose
+#include <stdlib.h>              // for calloc, free
+#include <string.h>              // for strchr, strdup, strlen, strncmp
+#include <time.h>                // for struct timespec, clock_gettime
+// Local includes
+#include <fsio.h>                // for FSIO_WORKERS, FSIO_MAX_SPARE
+#include <utils.h>               // for elapsed_ms
+#include <workpool.h>            // for WorkPool, Job, WorkPool_submit, WorkPool_poll, WorkPool_add_worker, WorkPool_retire_worker
+
+typedef struct FsRequest {
+    Job *job;
+    // What the job did before it was wrapped by fsio_run and fsio_done
+    JobRunFn run;
+    JobDoneFn done;
+    char *path;
+    int deadline_ms;
+    // When a worker picked it up or it last made progress, valid while
+    // running
+    struct timespec started;
+    bool running;
+    // Past its deadline, stuck on `mount`. Only touched by the UI thread.
+    bool overdue;
+    char *mount;
+    struct FsRequest *next;
+} FsRequest;
+
+static WorkPool pool;
+// The list is only changed by the UI thread, workers look their request up
+// and set `running` and `started` under the lock
+static pthread_mutex_t requests_lock = PTHREAD_MUTEX_INITIALIZER;
+static FsRequest *requests;
+// Started for the stuck requests and still in the pool, idle or not
+static size_t spare_workers;
+// What the worker is running, for Fsio_progress
+static _Thread_local FsRequest *current;
+
+// Must be called with the lock held, or from the UI thread
+static FsRequest *find(const Job *job) {
+    for (FsRequest *r = requests; r != NULL; r = r->next)
+        if (r->job == job)
+            return r;
+    return NULL;
+}
+
+static void fsio_run(Job *job) {
+    pthread_mutex_lock(&requests_lock);
+    FsRequest *r = find(job);
+    clock_gettime(CLOCK_MONOTONIC, &r->started);
+    r->running = true;
+    JobRunFn run = r->run;
+    pthread_mutex_unlock(&requests_lock);
+
+    current = r;
+    run(job);
+    current = NULL;
+
+    pthread_mutex_lock(&requests_lock);
+    r->running = false;
+    pthread_mutex_unlock(&requests_lock);
+}
+
+static void fsio_done(Job *job) {
+    pthread_mutex_lock(&requests_lock);
+    FsRequest **link = &requests;
+    while (*link != NULL && (*link)->job != job)
+        link = &(*link)->next;
+    FsRequest *r = *link;
+    *link = r->next;
+    pthread_mutex_unlock(&requests_lock);
+
+    job->run = r->run;
+    job->done = r->done;
+    if (job->done)
+        job->done(job);
+    free(r->path);
+    free(r->mount);
+    free(r);
+}
+
+// /proc/self/mounts escapes spaces and a few others as \ooo
+static void unescape_octal(char *s) {
+    char *out = s;
+    for (; *s; s++) {
+        if (s[0] == '\\' && s[1] >= '0' && s[1] <= '7' && s[2] >= '0' && s[2] <= '7' && s[3] >= '0' && s[3] <= '7') {
+            *out++ = (s[1] - '0') * 64 + (s[2] - '0') * 8 + (s[3] - '0');
+            s += 3;
+        } else {
+            *out++ = *s;
+        }
+    }
+    *out = '\0';
+}
+
+// Longest mount point containing `path`. Reading /proc never blocks on the
+// mounts themselves.
+static char *mount_point(const char *path) {
+    FILE *mounts = fopen("/proc/self/mounts", "r");
+    if (mounts == NULL)
+        return NULL;
+
+    char *line = NULL, *best = NULL;
+    size_t cap = 0, best_len = 0;
+    while (getline(&line, &cap, mounts) > 0) {
+        char *dir = strchr(line, ' ');
+        char *end = dir ? strchr(dir + 1, ' ') : NULL;
+        if (end == NULL)
+            continue;
+        dir++;
+        *end = '\0';
+        unescape_octal(dir);
+
+        size_t len = strlen(dir);
+        bool contains = strncmp(path, dir, len) == 0 && (len == 1 || path[len] == '/' || path[len] == '\0');
+        if (contains && len >= best_len) {
+            free(best);
+            best = strdup(dir);
+            best_len = len;
+        }
+    }
+    free(line);
+    fclose(mounts);
+    return best;
+}
+
+void Fsio_init(size_t idle_threads) {
+    WorkPool_init(&pool, FSIO_WORKERS, idle_threads);
+}
+
+void Fsio_bye(void) {
+    // Joining a worker stuck in the kernel would hang until the mount comes
+    // back, which may be never
+    if (Fsio_unresponsive() != NULL)
+        return;
+    WorkPool_bye(&pool);
+}
+
+void Fsio_submit(Job *job, const char *path, int deadline_ms) {
+    FsRequest *r = calloc(1, sizeof(FsRequest));
+    if (r != NULL) {
+        r->job = job;
+        r->run = job->run;
+        r->done = job->done;
+        r->path = strdup(path);
+        r->deadline_ms = deadline_ms;
+        job->run = fsio_run;
+        job->done = fsio_done;
+
+        pthread_mutex_lock(&requests_lock);
+        r->next = requests;
+        requests = r;
+        pthread_mutex_unlock(&requests_lock);
+    }
+    // Without memory for the bookkeeping it just runs without a deadline
+    WorkPool_submit(&pool, job);
+}
+
+void Fsio_progress(void) {
+    if (current == NULL)
+        return;
+    pthread_mutex_lock(&requests_lock);
+    clock_gettime(CLOCK_MONOTONIC, &current->started);
+    pthread_mutex_unlock(&requests_lock);
+}
+
+size_t Fsio_poll(void) {
+    size_t count = WorkPool_poll(&pool);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    size_t stuck = 0;
+    pthread_mutex_lock(&requests_lock);
+    for (FsRequest *r = requests; r != NULL; r = r->next) {
+        // Long requests that report progress come back from being overdue
+        if (r->running && r->deadline_ms > 0)
+            r->overdue = elapsed_ms(&r->started, &now) > r->deadline_ms;
+        if (r->running && r->overdue)
+            stuck++;
+    }
+    pthread_mutex_unlock(&requests_lock);
+
+    // The UI thread is the only one changing the list, no lock needed
+    for (FsRequest *r = requests; r != NULL; r = r->next)
+        if (r->overdue && r->mount == NULL && r->path != NULL)
+            r->mount = mount_point(r->path);
+
+    // Requests for the other mounts keep going on fresh workers, one per
+    // stuck request. Once theirs come back the spares retire, so later hangs
+    // get fresh ones again.
+    while (stuck > spare_workers && spare_workers < FSIO_MAX_SPARE && WorkPool_add_worker(&pool))
+        spare_workers++;
+    for (; spare_workers > stuck; spare_workers--)
+        WorkPool_retire_worker(&pool);
+
+    return count;
+}
+
+size_t Fsio_pending(void) {
+    size_t n = 0;
+    for (FsRequest *r = requests; r != NULL; r = r->next)
+        if (r->job->priority == JOB_PRIO_HIGH && !r->overdue)
+            n++;
+    return n;
+}
+
+const char *Fsio_unresponsive(void) {
+    for (FsRequest *r = requests; r != NULL; r = r->next)
+        if (r->overdue)
+            return r->mount != NULL ? r->mount : r->path;
+    return NULL;
+}
@@ -0,0 +1,45 @@
+// File: fsio.h
+// -----------------------
+#ifndef FSIO_H
+#define FSIO_H
+
+#include <stddef.h>   // for size_t
+#include <workpool.h> // for Job
+
+// Deadlines of the different requests, in milliseconds. A request still
+// running past its deadline marks its mount unresponsive until it returns.
+#define FSIO_DEADLINE_STAT 1000
+#define FSIO_DEADLINE_LIST 3000
+#define FSIO_DEADLINE_READ 3000
+// Workers for filesystem requests, and how many more may be started to
+// replace the ones stuck on an unresponsive mount
+#define FSIO_WORKERS 4
+#define FSIO_MAX_SPARE 8
+
+// Every listing, stat and read of the UI goes through here, so that a hung
+// NFS or FUSE mount only ever stalls a worker. Requests are ordinary jobs
+// (see workpool.h) run on their own pool, next to `idle_threads` workers for
+// JOB_PRIO_IDLE jobs.
+void Fsio_init(size_t idle_threads);
+// Waits for the workers, unless some are stuck: the process exits anyway
+void Fsio_bye(void);
+
+// Submits a job doing filesystem I/O on `path`. A deadline of 0 means the
+// request may legitimately take long without reporting progress, walks
+// rather call Fsio_progress on the way.
+// Cancelling is done with Job_cancel as usual.
+void Fsio_submit(Job *job, const char *path, int deadline_ms);
+// Called by a request's job whenever it got somewhere, like a walk for every
+// entry: its deadline counts from there, so a long walk only counts as stuck
+// when a single step is. Does nothing outside fsio requests.
+void Fsio_progress(void);
+// Runs the done callbacks of the finished requests and checks the deadlines
+// of the running ones. UI thread only, once per main loop iteration.
+size_t Fsio_poll(void);
+// JOB_PRIO_HIGH requests in flight that aren't past their deadline. The UI
+// polls more often while there are some.
+size_t Fsio_pending(void);
+// Mount point of a request past its deadline, NULL if every mount answers
+const char *Fsio_unresponsive(void);
+
+#endif // FSIO_H
@@ -0,0 +1,330 @@
+// File: gitindex.c
+// -----------------------
+#define _POSIX_C_SOURCE 200809L  // for AT_FDCWD
+#include <fcntl.h>         // for AT_FDCWD
+#include <stdint.h>        // for uint8_t, uint16_t, uint32_t, SIZE_MAX
+#include <stdlib.h>        // for malloc, realloc, free, qsort, strtol
+#include <string.h>        // for strcmp, strlen, memcmp, memcpy, memchr
+// Local includes
+#include <gitindex.h>      // for GitIndex, GitIndexEntry, GitCachedTree, GIT_MAX_INDEX
+#include <utils.h>         // for MIN, MAX, slurp_file
+
+// Stat data, then the name of the blob
+#define ENTRY_STAT_LEN 40
+// Subtrees nested deeper than this are taken as damage
+#define MAX_TREE_DEPTH 4096
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} PathBuffer;
+
+static uint32_t read_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static uint16_t read_be16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+// Appends the `len` bytes at `prefix` in the buffer itself (v4 paths start
+// like the previous one) then `len2` of `suffix`, returns the offset of the
+// result or SIZE_MAX
+static size_t append_path(PathBuffer *b, size_t prefix, size_t len, const uint8_t *suffix, size_t len2) {
+    if (b->len + len + len2 + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + len + len2 + 1)
+            cap *= 2;
+        char *grown = realloc(b->data, cap);
+        if (grown == NULL)
+            return SIZE_MAX;
+        b->data = grown;
+        b->cap = cap;
+    }
+    size_t offset = b->len;
+    if (len > 0)
+        memcpy(b->data + offset, b->data + prefix, len);
+    memcpy(b->data + offset + len, suffix, len2);
+    b->data[offset + len + len2] = '\0';
+    b->len += len + len2 + 1;
+    return offset;
+}
+
+static bool grow_trees(GitIndex *ix, size_t *cap) {
+    size_t grown = *cap ? *cap * 2 : 64;
+    GitCachedTree *trees = realloc(ix->trees, grown * sizeof(GitCachedTree));
+    if (trees == NULL)
+        return false;
+    ix->trees = trees;
+    *cap = grown;
+    return true;
+}
+
+static int compare_trees(const void *a, const void *b) {
+    return strcmp(((const GitCachedTree *)a)->path, ((const GitCachedTree *)b)->path);
+}
+
+// One entry of the TREE extension and its subtrees: "<name>\0<entries>
+// <subtrees>\n", then the tree's name unless entries is -1 (invalidated)
+static const uint8_t *read_cached_tree(GitIndex *ix, const uint8_t *p, const uint8_t *end, size_t hash_len,
+                                       const char *parent, size_t *cap, int depth) {
+    const uint8_t *nul = memchr(p, '\0', end - p);
+    const uint8_t *eol = nul != NULL ? memchr(nul, '\n', end - nul) : NULL;
+    if (eol == NULL || depth > MAX_TREE_DEPTH)
+        return NULL;
+
+    char counts[64];
+    size_t counts_len = MIN((size_t)(eol - nul - 1), sizeof(counts) - 1);
+    memcpy(counts, nul + 1, counts_len);
+    counts[counts_len] = '\0';
+    char *rest;
+    long entries = strtol(counts, &rest, 10);
+    long subtrees = strtol(rest, &rest, 10);
+    if (*rest != '\0' || subtrees < 0)
+        return NULL;
+
+    // The root has an empty name
+    size_t parent_len = strlen(parent);
+    size_t name_len = nul - p;
+    char *path = malloc(parent_len + 1 + name_len + 1);
+    if (path == NULL)
+        return NULL;
+    size_t len = 0;
+    if (parent_len > 0) {
+        memcpy(path, parent, parent_len);
+        path[parent_len] = '/';
+        len = parent_len + 1;
+    }
+    memcpy(path + len, p, name_len);
+    path[len + name_len] = '\0';
+
+    p = eol + 1;
+    if (entries >= 0) {
+        if ((size_t)(end - p) < hash_len || (ix->num_trees == *cap && !grow_trees(ix, cap))) {
+            free(path);
+            return NULL;
+        }
+        GitCachedTree *t = &ix->trees[ix->num_trees++];
+        t->path = path;
+        memcpy(t->oid, p, hash_len);
+        p += hash_len;
+    }
+
+    for (long i = 0; i < subtrees && p != NULL; i++)
+        p = read_cached_tree(ix, p, end, hash_len, path, cap, depth + 1);
+    if (entries < 0)
+        free(path);
+    return p;
+}
+
+static bool read_entries(GitIndex *ix, const uint8_t **pos, const uint8_t *end, uint32_t version, size_t hash_len) {
+    PathBuffer paths = { 0 };
+    size_t previous = 0, previous_len = 0;
+    const uint8_t *p = *pos;
+
+    for (size_t i = 0; i < ix->count; i++) {
+        const uint8_t *start = p;
+        if ((size_t)(end - p) < ENTRY_STAT_LEN + hash_len + 2)
+            break;
+
+        GitIndexEntry *e = &ix->entries[i];
+        e->ctime_sec = read_be32(p);
+        e->ctime_nsec = read_be32(p + 4);
+        e->mtime_sec = read_be32(p + 8);
+        e->mtime_nsec = read_be32(p + 12);
+        // The device at p + 16 isn't compared, like git does by default
+        e->ino = read_be32(p + 20);
+        e->mode = read_be32(p + 24);
+        e->uid = read_be32(p + 28);
+        e->gid = read_be32(p + 32);
+        e->size = read_be32(p + 36);
+        memcpy(e->oid, p + ENTRY_STAT_LEN, hash_len);
+        e->flags = read_be16(p + ENTRY_STAT_LEN + hash_len);
+        p += ENTRY_STAT_LEN + hash_len + 2;
+
+        if (e->flags & 0x4000) {
+            if (version < 3 || end - p < 2)
+                break;
+            uint16_t extended = read_be16(p);
+            p += 2;
+            if (extended & 0x4000)
+                e->flags |= GIT_INDEX_SKIP_WORKTREE;
+            if (extended & 0x2000)
+                e->flags |= GIT_INDEX_INTENT_TO_ADD;
+        }
+
+        // Version 4 drops this many bytes off the end of the previous path
+        // and appends the rest
+        size_t strip = 0;
+        if (version == 4) {
+            if (p == end)
+                break;
+            uint8_t c = *p++;
+            strip = c & 0x7f;
+            while (c & 0x80 && p < end && strip < previous_len) {
+                c = *p++;
+                strip = ((strip + 1) << 7) | (c & 0x7f);
+            }
+            if ((c & 0x80) || strip > previous_len)
+                break;
+        }
+
+        const uint8_t *nul = memchr(p, '\0', end - p);
+        if (nul == NULL)
+            break;
+        size_t kept = version == 4 ? previous_len - strip : 0;
+        e->path = append_path(&paths, previous, kept, p, nul - p);
+        if (e->path == SIZE_MAX)
+            break;
+        e->path_len = kept + (nul - p);
+        previous = e->path;
+        previous_len = e->path_len;
+
+        // Versions 2 and 3 pad entries with NULs to a multiple of 8 bytes
+        if (version == 4)
+            p = nul + 1;
+        else
+            p = start + (((size_t)(nul - start) + 8) & ~(size_t)7);
+        if (p > end)
+            break;
+
+        if (i + 1 == ix->count) {
+            ix->paths = paths.data;
+            *pos = p;
+            return true;
+        }
+    }
+
+    if (ix->count == 0) {
+        *pos = p;
+        return true;
+    }
+    free(paths.data);
+    return false;
+}
+
+// Only the cache-tree is used, split indexes (and anything else git must
+// understand to use the index) are refused
+static bool read_extensions(GitIndex *ix, const uint8_t *p, const uint8_t *end, size_t hash_len) {
+    while (end - p >= 8) {
+        const uint8_t *signature = p;
+        uint32_t size = read_be32(p + 4);
+        p += 8;
+        if (size > (size_t)(end - p))
+            return false;
+
+        if (memcmp(signature, "TREE", 4) == 0 && size > 0) {
+            size_t cap = 0;
+            if (read_cached_tree(ix, p, p + size, hash_len, "", &cap, 0) == NULL) {
+                // Without it every directory is compared with HEAD
+                for (size_t i = 0; i < ix->num_trees; i++)
+                    free(ix->trees[i].path);
+                free(ix->trees);
+                ix->trees = NULL;
+                ix->num_trees = 0;
+            }
+        } else if (signature[0] >= 'a' && signature[0] <= 'z' && memcmp(signature, "sdir", 4) != 0) {
+            return false;
+        }
+        p += size;
+    }
+
+    if (ix->num_trees > 0)
+        qsort(ix->trees, ix->num_trees, sizeof(GitCachedTree), compare_trees);
+    return true;
+}
+
+bool GitIndex_read(GitIndex *ix, const char *path, size_t hash_len) {
+    *ix = (GitIndex){ 0 };
+
+    size_t len;
+    const uint8_t *data = (const uint8_t *)slurp_file(AT_FDCWD, path, GIT_MAX_INDEX, &len);
+    if (data == NULL)
+        return false;
+
+    // Header, entries, extensions and the checksum of all that
+    const uint8_t *end = data + len - MIN(len, hash_len);
+    uint32_t version = len >= 12 ? read_be32(data + 4) : 0;
+    bool ok = len >= 12 + hash_len && memcmp(data, "DIRC", 4) == 0 && version >= 2 && version <= 4;
+    if (ok) {
+        ix->count = read_be32(data + 8);
+        // Every entry takes at least this much, a count past that is damage
+        ok = ix->count <= len / (ENTRY_STAT_LEN + hash_len + 3);
+    }
+    if (ok)
+        ix->entries = malloc(MAX(ix->count, 1) * sizeof(GitIndexEntry));
+
+    const uint8_t *p = data + 12;
+    ok = ok && ix->entries != NULL && read_entries(ix, &p, end, version, hash_len)
+         && read_extensions(ix, p, end, hash_len);
+
+    free((void *)data);
+    if (!ok)
+        GitIndex_free(ix);
+    return ok;
+}
+
+void GitIndex_free(GitIndex *ix) {
+    for (size_t i = 0; i < ix->num_trees; i++)
+        free(ix->trees[i].path);
+    free(ix->trees);
+    free(ix->entries);
+    free(ix->paths);
+    *ix = (GitIndex){ 0 };
+}
+
+const char *GitIndex_path(const GitIndex *ix, size_t i) {
+    return ix->paths + ix->entries[i].path;
+}
+
+// Negative if the entry sorts before everything starting with `prefix`,
+// positive after, 0 if it starts with it
+static int compare_prefix(const GitIndex *ix, size_t i, const char *prefix, size_t len) {
+    const GitIndexEntry *e = &ix->entries[i];
+    int cmp = memcmp(ix->paths + e->path, prefix, MIN(e->path_len, len));
+    if (cmp != 0)
+        return cmp;
+    return e->path_len < len ? -1 : 0;
+}
+
+void GitIndex_range(const GitIndex *ix, const char *prefix, size_t len, size_t *first, size_t *last) {
+    size_t lo = 0, hi = ix->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compare_prefix(ix, mid, prefix, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *first = lo;
+
+    hi = ix->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compare_prefix(ix, mid, prefix, len) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *last = lo;
+}
+
+const uint8_t *GitIndex_cached_tree(const GitIndex *ix, const char *dir, size_t len) {
+    size_t lo = 0, hi = ix->num_trees;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const char *path = ix->trees[mid].path;
+        size_t path_len = strlen(path);
+        int cmp = memcmp(path, dir, MIN(path_len, len));
+        if (cmp == 0)
+            cmp = path_len < len ? -1 : path_len > len;
+        if (cmp == 0)
+            return ix->trees[mid].oid;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
@@ -0,0 +1,71 @@
+// File: gitindex.h
+// -----------------------
+#ifndef GITINDEX_H
+#define GITINDEX_H
+
+#include <stdbool.h>    // for bool
+#include <stddef.h>     // for size_t
+#include <stdint.h>     // for uint8_t, uint16_t, uint32_t
+#include <gitobject.h>  // for GIT_MAX_HASH
+
+// Larger indexes are not read
+#define GIT_MAX_INDEX (1ULL << 31)
+
+// Bits of GitIndexEntry.flags
+#define GIT_INDEX_STAGE_MASK 0x3000
+#define GIT_INDEX_SKIP_WORKTREE (1u << 16)
+#define GIT_INDEX_INTENT_TO_ADD (1u << 17)
+
+// What `git add` recorded about a file: the stat data it had then, truncated
+// to 32 bits as git does, and the blob it was added as
+typedef struct {
+    uint32_t ctime_sec;
+    uint32_t ctime_nsec;
+    uint32_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t ino;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t size;
+    // The 16 bit flags of the entry, then the extended ones above
+    uint32_t flags;
+    size_t path;
+    size_t path_len;
+    uint8_t oid[GIT_MAX_HASH];
+} GitIndexEntry;
+
+// A directory whose tree the cache-tree extension has, `path` without the
+// trailing slash, "" for the root
+typedef struct {
+    char *path;
+    uint8_t oid[GIT_MAX_HASH];
+} GitCachedTree;
+
+// .git/index (versions 2 to 4) as read by GitIndex_read. Entries are sorted
+// by path, then stage, like in the file.
+typedef struct {
+    GitIndexEntry *entries;
+    size_t count;
+    // Every path, '\0' terminated
+    char *paths;
+    // Sorted by path, only those still valid
+    GitCachedTree *trees;
+    size_t num_trees;
+} GitIndex;
+
+// False if it can't be read, is damaged or is split (core.splitIndex), which
+// isn't supported
+bool GitIndex_read(GitIndex *ix, const char *path, size_t hash_len);
+void GitIndex_free(GitIndex *ix);
+
+const char *GitIndex_path(const GitIndex *ix, size_t i);
+
+// The entries whose path starts with the `len` bytes of `prefix` are
+// [*first, *last)
+void GitIndex_range(const GitIndex *ix, const char *prefix, size_t len, size_t *first, size_t *last);
+// The tree `dir` had when the index was last written, NULL if the
+// index changed below it since
+const uint8_t *GitIndex_cached_tree(const GitIndex *ix, const char *dir, size_t len);
+
+#endif // GITINDEX_H
@@ -0,0 +1,527 @@
+// File: gitobject.c
+// -----------------------
+#define _GNU_SOURCE        // for O_CLOEXEC
+#include <dirent.h>        // for DIR, struct dirent, opendir, readdir, closedir
+#include <fcntl.h>         // for open, O_RDONLY, O_CLOEXEC, AT_FDCWD
+#include <limits.h>        // for UINT_MAX
+#include <stdint.h>        // for uint8_t, uint32_t, uint64_t
+#include <stdio.h>         // for snprintf
+#include <stdlib.h>        // for malloc, realloc, free
+#include <string.h>        // for strlen, strcmp, strncmp, memcmp, memcpy, memchr
+#include <sys/mman.h>      // for mmap, munmap, PROT_READ, MAP_PRIVATE, MAP_FAILED
+#include <sys/stat.h>      // for struct stat, fstat
+#include <unistd.h>        // for close
+#include <zlib.h>          // for z_stream, inflateInit, inflate, inflateEnd, Z_FINISH, Z_STREAM_END
+// Local includes
+#include <gitobject.h>     // for GitObjects, GitObjectType, GitTreeEntry, GIT_MAX_OBJECT, GIT_MAX_DELTA_DEPTH
+#include <utils.h>         // for MIN, path_join, slurp_file
+
+#define PACK_IDX_MAGIC 0xff744f63
+#define PACK_OFS_DELTA 6
+#define PACK_REF_DELTA 7
+// Symbolic refs followed from HEAD before giving up
+#define MAX_REF_DEPTH 5
+// Refs and HEAD are short, packed-refs may be large
+#define MAX_REF_FILE (64 << 20)
+
+typedef struct {
+    const uint8_t *idx;
+    size_t idx_size;
+    const uint8_t *pack;
+    size_t pack_size;
+    uint32_t count;
+} Pack;
+
+struct GitObjects {
+    char *dir;
+    size_t hash_len;
+    Pack *packs;
+    size_t num_packs;
+};
+
+static uint32_t read_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static const uint8_t *map_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    *size = st.st_size;
+    return map;
+}
+
+// Maps `name`.idx and the pack next to it, after checking what's looked at
+// later fits in them
+static bool open_pack(GitObjects *objs, const char *pack_dir, const char *name, Pack *pack) {
+    char path[4096];
+    size_t hl = objs->hash_len;
+
+    snprintf(path, sizeof(path), "%s/%s", pack_dir, name);
+    pack->idx = map_file(path, &pack->idx_size);
+    if (pack->idx == NULL)
+        return false;
+
+    bool ok = pack->idx_size >= 8 + 256 * 4
+           && read_be32(pack->idx) == PACK_IDX_MAGIC && read_be32(pack->idx + 4) == 2;
+    if (ok) {
+        pack->count = read_be32(pack->idx + 8 + 255 * 4);
+        // Names, CRCs and 32-bit offsets, then the checksums of both files
+        ok = pack->idx_size >= 8 + 256 * 4 + (uint64_t)pack->count * (hl + 8) + 2 * hl;
+    }
+    if (!ok) {
+        munmap((void *)pack->idx, pack->idx_size);
+        return false;
+    }
+
+    // "pack-<hash>.idx" goes with "pack-<hash>.pack"
+    size_t len = strlen(path);
+    snprintf(path + len - 4, sizeof(path) - len + 4, ".pack");
+    pack->pack = map_file(path, &pack->pack_size);
+    if (pack->pack == NULL || pack->pack_size < 12 + hl || memcmp(pack->pack, "PACK", 4) != 0) {
+        if (pack->pack != NULL)
+            munmap((void *)pack->pack, pack->pack_size);
+        munmap((void *)pack->idx, pack->idx_size);
+        return false;
+    }
+    return true;
+}
+
+GitObjects *GitObjects_open(const char *dir, size_t hash_len) {
+    GitObjects *objs = malloc(sizeof(GitObjects));
+    if (objs == NULL)
+        return NULL;
+    objs->dir = strdup(dir);
+    objs->hash_len = hash_len;
+    objs->packs = NULL;
+    objs->num_packs = 0;
+    if (objs->dir == NULL) {
+        free(objs);
+        return NULL;
+    }
+
+    char *pack_dir = path_join(dir, "pack");
+    DIR *d = pack_dir != NULL ? opendir(pack_dir) : NULL;
+    if (d != NULL) {
+        size_t capacity = 0;
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            size_t len = strlen(de->d_name);
+            if (len < 5 || strcmp(de->d_name + len - 4, ".idx") != 0)
+                continue;
+            if (objs->num_packs == capacity) {
+                size_t grown = capacity ? capacity * 2 : 8;
+                Pack *packs = realloc(objs->packs, grown * sizeof(Pack));
+                if (packs == NULL)
+                    break;
+                objs->packs = packs;
+                capacity = grown;
+            }
+            if (open_pack(objs, pack_dir, de->d_name, &objs->packs[objs->num_packs]))
+                objs->num_packs++;
+        }
+        closedir(d);
+    }
+    free(pack_dir);
+    return objs;
+}
+
+void GitObjects_close(GitObjects *objs) {
+    if (objs == NULL)
+        return;
+    for (size_t i = 0; i < objs->num_packs; i++) {
+        munmap((void *)objs->packs[i].idx, objs->packs[i].idx_size);
+        munmap((void *)objs->packs[i].pack, objs->packs[i].pack_size);
+    }
+    free(objs->packs);
+    free(objs->dir);
+    free(objs);
+}
+
+static bool find_in_pack(const GitObjects *objs, const Pack *pack, const uint8_t *oid, uint64_t *offset) {
+    size_t hl = objs->hash_len;
+    const uint8_t *fanout = pack->idx + 8;
+    const uint8_t *names = fanout + 256 * 4;
+
+    uint32_t lo = oid[0] ? read_be32(fanout + (oid[0] - 1) * 4) : 0;
+    uint32_t hi = read_be32(fanout + oid[0] * 4);
+    if (hi > pack->count || lo > hi)
+        return false;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(names + (size_t)mid * hl, oid, hl);
+        if (cmp == 0) {
+            const uint8_t *offsets = names + (size_t)pack->count * (hl + 4);
+            uint32_t off = read_be32(offsets + (size_t)mid * 4);
+            if (!(off & 0x80000000)) {
+                *offset = off;
+                return true;
+            }
+            // Past 2GiB the offset is in the 64-bit table that follows
+            const uint8_t *large = offsets + (size_t)pack->count * 4 + (size_t)(off & 0x7fffffff) * 8;
+            if (large + 8 > pack->idx + pack->idx_size - 2 * hl)
+                return false;
+            *offset = (uint64_t)read_be32(large) << 32 | read_be32(large + 4);
+            return true;
+        }
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return false;
+}
+
+// Inflates exactly `size` bytes out of `src`, '\0' terminated
+static uint8_t *inflate_exact(const uint8_t *src, size_t src_len, size_t size) {
+    if (size > GIT_MAX_OBJECT)
+        return NULL;
+    uint8_t *out = malloc(size + 1);
+    if (out == NULL)
+        return NULL;
+
+    z_stream z = { 0 };
+    if (inflateInit(&z) != Z_OK) {
+        free(out);
+        return NULL;
+    }
+    z.next_in = (uint8_t *)src;
+    z.avail_in = MIN(src_len, UINT_MAX);
+    z.next_out = out;
+    z.avail_out = size;
+    int ret = inflate(&z, Z_FINISH);
+    bool ok = ret == Z_STREAM_END && z.total_out == size;
+    inflateEnd(&z);
+
+    if (!ok) {
+        free(out);
+        return NULL;
+    }
+    out[size] = '\0';
+    return out;
+}
+
+static bool delta_size(const uint8_t **p, const uint8_t *end, size_t *size) {
+    size_t value = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        uint8_t c = *(*p)++;
+        value |= (size_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *size = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Rebuilds an object out of its base and the copy and insert instructions
+// of a delta
+static uint8_t *apply_delta(const uint8_t *base, size_t base_size, const uint8_t *delta, size_t delta_len, size_t *size) {
+    const uint8_t *p = delta;
+    const uint8_t *end = delta + delta_len;
+    size_t src_size, dst_size;
+    if (!delta_size(&p, end, &src_size) || !delta_size(&p, end, &dst_size)
+        || src_size != base_size || dst_size > GIT_MAX_OBJECT)
+        return NULL;
+
+    uint8_t *out = malloc(dst_size + 1);
+    if (out == NULL)
+        return NULL;
+
+    size_t used = 0;
+    while (p < end) {
+        uint8_t op = *p++;
+        if (op & 0x80) {
+            size_t offset = 0, len = 0;
+            for (int i = 0; i < 4; i++)
+                if (op & (1 << i)) {
+                    if (p == end)
+                        break;
+                    offset |= (size_t)*p++ << (8 * i);
+                }
+            for (int i = 0; i < 3; i++)
+                if (op & (0x10 << i)) {
+                    if (p == end)
+                        break;
+                    len |= (size_t)*p++ << (8 * i);
+                }
+            if (len == 0)
+                len = 0x10000;
+            if (offset > base_size || len > base_size - offset || len > dst_size - used)
+                break;
+            memcpy(out + used, base + offset, len);
+            used += len;
+        } else if (op != 0) {
+            if (op > end - p || op > dst_size - used)
+                break;
+            memcpy(out + used, p, op);
+            used += op;
+            p += op;
+        } else {
+            break;
+        }
+    }
+
+    if (p != end || used != dst_size) {
+        free(out);
+        return NULL;
+    }
+    out[dst_size] = '\0';
+    *size = dst_size;
+    return out;
+}
+
+static void *read_object(GitObjects *objs, const uint8_t *oid, int depth, GitObjectType *type, size_t *size);
+
+static void *read_packed(GitObjects *objs, const Pack *pack, uint64_t offset, int depth, GitObjectType *type, size_t *size) {
+    const uint8_t *p = pack->pack + offset;
+    const uint8_t *end = pack->pack + pack->pack_size - objs->hash_len;
+    if (depth > GIT_MAX_DELTA_DEPTH || offset < 12 || p >= end)
+        return NULL;
+
+    uint8_t c = *p++;
+    int kind = (c >> 4) & 7;
+    size_t len = c & 0x0f;
+    for (int shift = 4; c & 0x80; shift += 7) {
+        if (p == end || shift > 57)
+            return NULL;
+        c = *p++;
+        len |= (size_t)(c & 0x7f) << shift;
+    }
+
+    if (kind >= GIT_OBJ_COMMIT && kind <= GIT_OBJ_TAG) {
+        uint8_t *data = inflate_exact(p, end - p, len);
+        if (data == NULL)
+            return NULL;
+        *type = kind;
+        *size = len;
+        return data;
+    }
+
+    uint8_t *base;
+    size_t base_size;
+    if (kind == PACK_OFS_DELTA) {
+        // Distance back to the base, with an offset added per extra byte
+        if (p == end)
+            return NULL;
+        c = *p++;
+        uint64_t back = c & 0x7f;
+        while (c & 0x80) {
+            if (p == end || back >> 56)
+                return NULL;
+            c = *p++;
+            back = ((back + 1) << 7) | (c & 0x7f);
+        }
+        if (back == 0 || back >= offset)
+            return NULL;
+        base = read_packed(objs, pack, offset - back, depth + 1, type, &base_size);
+    } else if (kind == PACK_REF_DELTA) {
+        if ((size_t)(end - p) < objs->hash_len)
+            return NULL;
+        base = read_object(objs, p, depth + 1, type, &base_size);
+        p += objs->hash_len;
+    } else {
+        return NULL;
+    }
+    if (base == NULL)
+        return NULL;
+
+    uint8_t *delta = inflate_exact(p, end - p, len);
+    uint8_t *data = delta != NULL ? apply_delta(base, base_size, delta, len, size) : NULL;
+    free(delta);
+    free(base);
+    return data;
+}
+
+static void *read_loose(GitObjects *objs, const uint8_t *oid, GitObjectType *type, size_t *size) {
+    char path[4096];
+    int len = snprintf(path, sizeof(path), "%s/%02x/", objs->dir, oid[0]);
+    for (size_t i = 1; i < objs->hash_len && len + 3 < (int)sizeof(path); i++)
+        len += snprintf(path + len, sizeof(path) - len, "%02x", oid[i]);
+
+    size_t compressed_len;
+    uint8_t *compressed = (uint8_t *)slurp_file(AT_FDCWD, path, GIT_MAX_OBJECT, &compressed_len);
+    if (compressed == NULL)
+        return NULL;
+
+    // "<type> <size>\0" comes first
+    z_stream z = { 0 };
+    uint8_t header[64];
+    uint8_t *data = NULL;
+    if (inflateInit(&z) != Z_OK) {
+        free(compressed);
+        return NULL;
+    }
+    z.next_in = compressed;
+    z.avail_in = MIN(compressed_len, UINT_MAX);
+    z.next_out = header;
+    z.avail_out = sizeof(header);
+    int ret = inflate(&z, Z_NO_FLUSH);
+
+    size_t got = sizeof(header) - z.avail_out;
+    uint8_t *nul = memchr(header, '\0', got);
+    if ((ret == Z_OK || ret == Z_STREAM_END) && nul != NULL) {
+        static const char *names[] = { NULL, "commit ", "tree ", "blob ", "tag " };
+        GitObjectType kind = GIT_OBJ_NONE;
+        for (int i = GIT_OBJ_COMMIT; i <= GIT_OBJ_TAG; i++)
+            if (strncmp((char *)header, names[i], strlen(names[i])) == 0)
+                kind = i;
+
+        char *digits = kind ? (char *)header + strlen(names[kind]) : NULL;
+        char *digits_end;
+        unsigned long long value = digits != NULL ? strtoull(digits, &digits_end, 10) : 0;
+        if (digits != NULL && digits_end == (char *)nul && value <= GIT_MAX_OBJECT
+            && (data = malloc(value + 1)) != NULL) {
+            // What came after the header already
+            size_t have = MIN(got - (nul + 1 - header), value);
+            memcpy(data, nul + 1, have);
+            z.next_out = data + have;
+            z.avail_out = value - have;
+            if (ret != Z_STREAM_END)
+                ret = inflate(&z, Z_FINISH);
+            if (ret == Z_STREAM_END && z.total_out == value + (nul + 1 - header)) {
+                data[value] = '\0';
+                *type = kind;
+                *size = value;
+            } else {
+                free(data);
+                data = NULL;
+            }
+        }
+    }
+    inflateEnd(&z);
+    free(compressed);
+    return data;
+}
+
+static void *read_object(GitObjects *objs, const uint8_t *oid, int depth, GitObjectType *type, size_t *size) {
+    for (size_t i = 0; i < objs->num_packs; i++) {
+        uint64_t offset;
+        if (find_in_pack(objs, &objs->packs[i], oid, &offset))
+            return read_packed(objs, &objs->packs[i], offset, depth, type, size);
+    }
+    return read_loose(objs, oid, type, size);
+}
+
+void *GitObjects_read(GitObjects *objs, const uint8_t *oid, GitObjectType *type, size_t *size) {
+    return read_object(objs, oid, 0, type, size);
+}
+
+bool git_parse_hex(const char *hex, size_t len, uint8_t *oid) {
+    for (size_t i = 0; i < len; i++) {
+        char c = hex[i];
+        int digit = c >= '0' && c <= '9' ? c - '0'
+                  : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                  : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit == -1)
+            return false;
+        if (i % 2 == 0)
+            oid[i / 2] = digit << 4;
+        else
+            oid[i / 2] |= digit;
+    }
+    return true;
+}
+
+// Looks `ref` up in packed-refs, lines are "<hex> <ref>"
+static bool packed_ref(const char *common_dir, const char *ref, size_t hash_len, uint8_t *oid) {
+    char *path = path_join(common_dir, "packed-refs");
+    char *packed = path != NULL ? slurp_file(AT_FDCWD, path, MAX_REF_FILE, NULL) : NULL;
+    free(path);
+    if (packed == NULL)
+        return false;
+
+    bool found = false;
+    size_t ref_len = strlen(ref);
+    for (char *line = packed; *line != '\0' && !found;) {
+        char *eol = strchr(line, '\n');
+        size_t len = eol != NULL ? (size_t)(eol - line) : strlen(line);
+        if (len == 2 * hash_len + 1 + ref_len && line[2 * hash_len] == ' '
+            && memcmp(line + 2 * hash_len + 1, ref, ref_len) == 0)
+            found = git_parse_hex(line, 2 * hash_len, oid);
+        line += len + (eol != NULL);
+    }
+    free(packed);
+    return found;
+}
+
+bool git_resolve_head(const char *git_dir, const char *common_dir, size_t hash_len, uint8_t *oid) {
+    char *path = path_join(git_dir, "HEAD");
+    char *content = path != NULL ? slurp_file(AT_FDCWD, path, MAX_REF_FILE, NULL) : NULL;
+    free(path);
+
+    for (int depth = 0; content != NULL && depth < MAX_REF_DEPTH; depth++) {
+        content[strcspn(content, "\r\n")] = '\0';
+        if (strncmp(content, "ref: ", 5) != 0) {
+            bool ok = strlen(content) == 2 * hash_len && git_parse_hex(content, 2 * hash_len, oid);
+            free(content);
+            return ok;
+        }
+
+        char *ref = content + 5;
+        // Refs never go up, whatever the file says
+        if (strstr(ref, "..") != NULL)
+            break;
+        path = path_join(common_dir, ref);
+        char *next = path != NULL ? slurp_file(AT_FDCWD, path, MAX_REF_FILE, NULL) : NULL;
+        free(path);
+        if (next == NULL) {
+            // Not loose, maybe packed, or an unborn branch
+            bool ok = packed_ref(common_dir, ref, hash_len, oid);
+            free(content);
+            return ok;
+        }
+        free(content);
+        content = next;
+    }
+    free(content);
+    return false;
+}
+
+bool git_commit_tree(GitObjects *objs, const uint8_t *oid, uint8_t *tree) {
+    GitObjectType type;
+    size_t size;
+    char *commit = GitObjects_read(objs, oid, &type, &size);
+    if (commit == NULL)
+        return false;
+
+    size_t hl = objs->hash_len;
+    bool ok = type == GIT_OBJ_COMMIT && size >= 5 + 2 * hl && strncmp(commit, "tree ", 5) == 0
+           && git_parse_hex(commit + 5, 2 * hl, tree);
+    free(commit);
+    return ok;
+}
+
+bool git_tree_next(const char *tree, size_t size, size_t hash_len, size_t *pos, GitTreeEntry *entry) {
+    const char *p = tree + *pos;
+    const char *end = tree + size;
+    if (p >= end)
+        return false;
+
+    // "<octal mode> <name>\0<binary name>"
+    unsigned int mode = 0;
+    while (p < end && *p >= '0' && *p <= '7')
+        mode = mode * 8 + (*p++ - '0');
+    if (p == end || *p != ' ')
+        return false;
+    const char *name = ++p;
+    const char *nul = memchr(name, '\0', end - name);
+    if (nul == NULL || (size_t)(end - nul - 1) < hash_len)
+        return false;
+
+    entry->mode = mode;
+    entry->name = name;
+    entry->name_len = nul - name;
+    entry->oid = (const uint8_t *)nul + 1;
+    *pos = nul + 1 + hash_len - tree;
+    return true;
+}
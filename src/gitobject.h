@@ -0,0 +1,59 @@
+// File: gitobject.h
+// -----------------------
+#ifndef GITOBJECT_H
+#define GITOBJECT_H
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for uint8_t
+
+// SHA-256 repositories have the longer names
+#define GIT_MAX_HASH 32
+// Objects larger than this are not read, trees and commits never get there
+#define GIT_MAX_OBJECT (256 << 20)
+// Longer delta chains are taken as damage, git stops at 50 by default
+#define GIT_MAX_DELTA_DEPTH 1000
+
+typedef enum {
+    GIT_OBJ_NONE = 0,
+    GIT_OBJ_COMMIT = 1,
+    GIT_OBJ_TREE = 2,
+    GIT_OBJ_BLOB = 3,
+    GIT_OBJ_TAG = 4,
+} GitObjectType;
+
+// Read only access to the objects of a repository, loose or in packs (index
+// version 2). The packs there are when it's opened are mapped, one that
+// shows up later isn't looked at. Not thread safe, and it blocks: only on
+// workers.
+typedef struct GitObjects GitObjects;
+
+// `dir` is the objects directory, `hash_len` 20 or 32. NULL if there's no
+// memory.
+GitObjects *GitObjects_open(const char *dir, size_t hash_len);
+void GitObjects_close(GitObjects *objs);
+// Returns the contents of the object `oid`, malloc()ed and '\0' terminated,
+// with its type and size. NULL if it's missing or damaged.
+void *GitObjects_read(GitObjects *objs, const uint8_t *oid, GitObjectType *type, size_t *size);
+
+// Resolves HEAD through the refs of `common_dir` (loose or packed), stores
+// what it points to in `oid`. False for an unborn branch.
+bool git_resolve_head(const char *git_dir, const char *common_dir, size_t hash_len, uint8_t *oid);
+// The tree of the commit `oid`, false if it can't be read
+bool git_commit_tree(GitObjects *objs, const uint8_t *oid, uint8_t *tree);
+
+// An entry of a tree, `name` isn't '\0' terminated and points into the tree
+typedef struct {
+    unsigned int mode;
+    const char *name;
+    size_t name_len;
+    const uint8_t *oid;
+} GitTreeEntry;
+
+// Walks the entries of a tree object, starting at *pos (0 the first time).
+// False at the end or if it's damaged.
+bool git_tree_next(const char *tree, size_t size, size_t hash_len, size_t *pos, GitTreeEntry *entry);
+// Parses `len` hex digits, false if there's anything else
+bool git_parse_hex(const char *hex, size_t len, uint8_t *oid);
+
+#endif // GITOBJECT_H
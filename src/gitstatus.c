@@ -0,0 +1,1220 @@
+// File: gitstatus.c
+// -----------------------
+#define _GNU_SOURCE        // for strdup, strncasecmp, O_PATH, clock_gettime, CLOCK_MONOTONIC
+#include <dirent.h>        // for DIR, struct dirent, opendir, readdir, closedir, DT_DIR, DT_UNKNOWN
+#include <errno.h>         // for errno, EINTR
+#include <fcntl.h>         // for open, openat, O_RDONLY, O_PATH, O_DIRECTORY, O_NOFOLLOW, O_CLOEXEC, AT_FDCWD, AT_SYMLINK_NOFOLLOW
+#include <pthread.h>       // for pthread_mutex_t, pthread_mutex_init, pthread_mutex_lock, pthread_mutex_trylock, pthread_mutex_unlock
+#include <stdint.h>        // for uint8_t, uint32_t
+#include <stdio.h>         // for snprintf
+#include <stdlib.h>        // for malloc, calloc, realloc, free, qsort, bsearch, getenv
+#include <string.h>        // for strcmp, strncmp, strlen, strchr, strrchr, strstr, strspn, strcspn, strdup, strndup, strncasecmp, memcmp, memcpy
+#include <sys/stat.h>      // for struct stat, fstatat, lstat, S_ISDIR, S_ISREG, S_ISLNK
+#include <time.h>          // for struct timespec, clock_gettime
+#include <unistd.h>        // for read, readlinkat, close
+// Local includes
+#include <gitindex.h>      // for GitIndex, GitIndexEntry, GitIndex_read, GitIndex_range, GitIndex_cached_tree
+#include <gitobject.h>     // for GitObjects, GitTreeEntry, git_resolve_head, git_commit_tree, git_tree_next
+#include <gitstatus.h>     // for GitDirStatus, GIT_DIR_SLOTS, GIT_MAX_REPOS, GIT_RECHECK_MS
+#include <hash.h>          // for Sha1, Sha1_init, Sha1_update, Sha1_final, SHA1_SIZE
+#include <utils.h>         // for path_join, path_parent, slurp_file, elapsed_ms
+#include <watch.h>         // for Watch_add, Watch_subscribe, Watch_unsubscribe, Watch_drop_unused, WatchEvent
+#include <workpool.h>      // for WorkPool, Job, Job_new, Job_cancel, Job_cancelled, WorkPool_submit
+
+// Bytes of a file hashed at a time, when its stat data can't tell
+#define HASH_BLOCK (64 << 10)
+// Longest path the entries are looked up with
+#define MAX_PATH_LEN 8192
+
+#define GIT_MODE_GITLINK 0160000
+
+// A path whose index entry differs from HEAD. A directory HEAD has and the
+// index has nothing of ends with '/'.
+typedef struct {
+    char *path;
+    char status;
+} GitChange;
+
+// Stat data a file had when it was last hashed, truncated like the index's
+typedef struct {
+    uint32_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t ctime_sec;
+    uint32_t ctime_nsec;
+    uint32_t ino;
+    uint32_t size;
+    // ' ' or the Y letter, '\0' if it was never hashed
+    char status;
+} GitChecked;
+
+typedef struct GitRepo GitRepo;
+struct GitRepo {
+    GitRepo *next;
+    // Fixed once found
+    char *worktree;
+    char *git_dir;
+    // Where objects and refs are, the git directory but for linked work trees
+    char *common_dir;
+    size_t hash_len;
+
+    // UI thread: bumped whenever the watch of the git directory reports the
+    // index or HEAD changed, every status of the repository is stale then
+    unsigned long epoch;
+    int wd;
+
+    // Workers, under `lock`
+    pthread_mutex_t lock;
+    bool loaded;
+    GitIndex index;
+    // Of the index that was parsed, zeroed if there's none
+    struct stat index_st;
+    // Parallel to the index entries, allocated once a file is hashed
+    GitChecked *checked;
+    // Sorted by path
+    GitChange *staged;
+    size_t num_staged;
+    // `staged` is for this HEAD and the parsed index
+    bool staged_valid;
+    bool has_head;
+    uint8_t head[GIT_MAX_HASH];
+
+    // Under repos_lock
+    unsigned long last_use;
+};
+
+// The status of one entry, only those that aren't clean are kept
+typedef struct {
+    char *name;
+    char marker[3];
+} GitEntry;
+
+struct GitDirStatus {
+    char *path;
+    // What the entries are as of
+    unsigned long generation;
+    unsigned long epoch;
+    struct timespec checked_at;
+    bool known;
+    bool in_repo;
+    GitRepo *repo;
+    GitEntry *entries;
+    size_t count;
+    Job *job;
+    unsigned long last_use;
+};
+
+typedef struct {
+    // NULL once the slot went to another directory
+    GitDirStatus *slot;
+    char *path;
+    unsigned long generation;
+    // The repository as the slot knew it and its epoch then
+    GitRepo *known_repo;
+    unsigned long epoch;
+    // Results
+    bool ok;
+    bool in_repo;
+    GitRepo *repo;
+    int wd;
+    GitEntry *entries;
+    size_t count;
+} GitJob;
+
+typedef struct {
+    // "" or the directory the file is in, with a trailing '/'
+    char *base;
+    char *text;
+    // Pointers into `text`, in the order of the file
+    char **patterns;
+    size_t count;
+} IgnoreFile;
+
+typedef struct {
+    GitRepo *repo;
+    const Job *job;
+    GitObjects *objs;
+    bool *seen;
+    GitChange *changes;
+    size_t count;
+    size_t cap;
+} StagedDiff;
+
+static WorkPool *pool;
+static GitDirStatus slots[GIT_DIR_SLOTS];
+static unsigned long use_counter;
+static size_t jobs_in_flight;
+static bool closing;
+
+// Repositories are only ever added, their parsed index may be dropped
+static pthread_mutex_t repos_lock = PTHREAD_MUTEX_INITIALIZER;
+static GitRepo *repos;
+static unsigned long repo_use_counter;
+
+// Folds a letter into the one of a directory: the letter every change below
+// it has, or M
+static char roll_up(char status, char change) {
+    if (status == ' ' || status == change)
+        return change;
+    return 'M';
+}
+
+// Repository discovery
+
+// The git directory `.git` refers to, a directory or a "gitdir: <path>" file
+static char *git_dir_of(const char *dir) {
+    char *dotgit = path_join(dir, ".git");
+    if (dotgit == NULL)
+        return NULL;
+
+    struct stat st;
+    if (lstat(dotgit, &st) == -1) {
+        free(dotgit);
+        return NULL;
+    }
+    if (S_ISDIR(st.st_mode))
+        return dotgit;
+
+    char *link = NULL;
+    char *content = S_ISREG(st.st_mode) ? slurp_file(AT_FDCWD, dotgit, MAX_PATH_LEN, NULL) : NULL;
+    if (content != NULL && strncmp(content, "gitdir: ", 8) == 0) {
+        char *target = content + 8;
+        target[strcspn(target, "\r\n")] = '\0';
+        link = target[0] == '/' ? strdup(target) : path_join(dir, target);
+    }
+    free(content);
+    free(dotgit);
+    return link;
+}
+
+// Walks up from `path` to the work tree it's in. Nothing inside a git
+// directory is part of one.
+static bool find_worktree(const char *path, char **worktree, char **git_dir) {
+    size_t len = strlen(path);
+    if (strstr(path, "/.git/") != NULL || (len >= 5 && strcmp(path + len - 5, "/.git") == 0))
+        return false;
+
+    char *dir = strdup(path);
+    while (dir != NULL) {
+        char *found = git_dir_of(dir);
+        if (found != NULL) {
+            *worktree = dir;
+            *git_dir = found;
+            return true;
+        }
+        if (strcmp(dir, "/") == 0 || strchr(dir, '/') == NULL)
+            break;
+        char *parent = path_parent(dir);
+        free(dir);
+        dir = parent;
+    }
+    free(dir);
+    return false;
+}
+
+// Linked work trees keep objects and refs in the main git directory
+static char *common_dir_of(const char *git_dir) {
+    char *path = path_join(git_dir, "commondir");
+    char *content = path != NULL ? slurp_file(AT_FDCWD, path, MAX_PATH_LEN, NULL) : NULL;
+    free(path);
+    if (content == NULL)
+        return strdup(git_dir);
+
+    content[strcspn(content, "\r\n")] = '\0';
+    char *common = content[0] == '/' ? strdup(content) : path_join(git_dir, content);
+    free(content);
+    return common;
+}
+
+// Repositories made with --object-format=sha256 say so in their config
+static size_t hash_len_of(const char *common_dir) {
+    char *path = path_join(common_dir, "config");
+    char *config = path != NULL ? slurp_file(AT_FDCWD, path, GIT_MAX_IGNORE_FILE, NULL) : NULL;
+    free(path);
+    if (config == NULL)
+        return SHA1_SIZE;
+
+    size_t hash_len = SHA1_SIZE;
+    for (char *line = config; line != NULL;) {
+        char *eol = strchr(line, '\n');
+        if (eol != NULL)
+            *eol = '\0';
+        line += strspn(line, " \t");
+        if (strncasecmp(line, "objectformat", 12) == 0 && strstr(line, "sha256") != NULL)
+            hash_len = 32;
+        line = eol != NULL ? eol + 1 : NULL;
+    }
+    free(config);
+    return hash_len;
+}
+
+// The repository of `worktree`, made on first use. Takes the strings over.
+static GitRepo *get_repo(char *worktree, char *git_dir) {
+    pthread_mutex_lock(&repos_lock);
+    GitRepo *repo = repos;
+    while (repo != NULL && strcmp(repo->worktree, worktree) != 0)
+        repo = repo->next;
+    if (repo != NULL) {
+        repo->last_use = ++repo_use_counter;
+        pthread_mutex_unlock(&repos_lock);
+        free(worktree);
+        free(git_dir);
+        return repo;
+    }
+    pthread_mutex_unlock(&repos_lock);
+
+    // Reading the config may block, it's done outside the lock. Another job
+    // may add the same repository meanwhile, the first one wins.
+    char *common_dir = common_dir_of(git_dir);
+    size_t hash_len = common_dir != NULL ? hash_len_of(common_dir) : SHA1_SIZE;
+    GitRepo *made = calloc(1, sizeof(GitRepo));
+    if (made == NULL || common_dir == NULL) {
+        free(made);
+        free(common_dir);
+        free(worktree);
+        free(git_dir);
+        return NULL;
+    }
+    made->worktree = worktree;
+    made->git_dir = git_dir;
+    made->common_dir = common_dir;
+    made->hash_len = hash_len;
+    made->wd = -1;
+    pthread_mutex_init(&made->lock, NULL);
+
+    pthread_mutex_lock(&repos_lock);
+    repo = repos;
+    while (repo != NULL && strcmp(repo->worktree, made->worktree) != 0)
+        repo = repo->next;
+    if (repo == NULL) {
+        made->next = repos;
+        repos = made;
+        repo = made;
+        made = NULL;
+    }
+    repo->last_use = ++repo_use_counter;
+    pthread_mutex_unlock(&repos_lock);
+
+    if (made != NULL) {
+        pthread_mutex_destroy(&made->lock);
+        free(made->worktree);
+        free(made->git_dir);
+        free(made->common_dir);
+        free(made);
+    }
+    return repo;
+}
+
+static void free_staged(GitRepo *repo) {
+    for (size_t i = 0; i < repo->num_staged; i++)
+        free(repo->staged[i].path);
+    free(repo->staged);
+    repo->staged = NULL;
+    repo->num_staged = 0;
+    repo->staged_valid = false;
+}
+
+// Under the repository's lock
+static void unload_repo(GitRepo *repo) {
+    GitIndex_free(&repo->index);
+    free(repo->checked);
+    repo->checked = NULL;
+    free_staged(repo);
+    repo->loaded = false;
+}
+
+// Drops the parsed index of the least recently used repositories past
+// GIT_MAX_REPOS. One that's busy is left for the next time.
+static void trim_repos(void) {
+    pthread_mutex_lock(&repos_lock);
+    size_t loaded = 0;
+    for (GitRepo *r = repos; r != NULL; r = r->next)
+        loaded += r->loaded;
+
+    while (loaded > GIT_MAX_REPOS) {
+        GitRepo *oldest = NULL;
+        for (GitRepo *r = repos; r != NULL; r = r->next)
+            if (r->loaded && (oldest == NULL || r->last_use < oldest->last_use))
+                oldest = r;
+        if (oldest == NULL || pthread_mutex_trylock(&oldest->lock) != 0)
+            break;
+        unload_repo(oldest);
+        pthread_mutex_unlock(&oldest->lock);
+        loaded--;
+    }
+    pthread_mutex_unlock(&repos_lock);
+}
+
+// Index and HEAD
+
+static bool same_index_file(const struct stat *a, const struct stat *b) {
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev && a->st_size == b->st_size
+        && a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// Parses the index again if its mtime, size or inode changed. No index is
+// an empty one, a new repository has none.
+static bool refresh_index(GitRepo *repo) {
+    char *path = path_join(repo->git_dir, "index");
+    if (path == NULL)
+        return false;
+
+    struct stat st;
+    if (stat(path, &st) == -1)
+        st = (struct stat){ 0 };
+    if (repo->loaded && same_index_file(&st, &repo->index_st)) {
+        free(path);
+        return true;
+    }
+
+    unload_repo(repo);
+    bool ok = st.st_ino == 0 || GitIndex_read(&repo->index, path, repo->hash_len);
+    free(path);
+    if (!ok)
+        return false;
+    repo->index_st = st;
+    repo->loaded = true;
+    return true;
+}
+
+static int compare_changes(const void *a, const void *b) {
+    return strcmp(((const GitChange *)a)->path, ((const GitChange *)b)->path);
+}
+
+static bool add_change(StagedDiff *d, const char *path, size_t len, char status) {
+    if (d->count == d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 64;
+        GitChange *grown = realloc(d->changes, cap * sizeof(GitChange));
+        if (grown == NULL)
+            return false;
+        d->changes = grown;
+        d->cap = cap;
+    }
+    char *copy = strndup(path, len);
+    if (copy == NULL)
+        return false;
+    d->changes[d->count++] = (GitChange){ .path = copy, .status = status };
+    return true;
+}
+
+static unsigned int stage_of(const GitIndexEntry *e) {
+    return (e->flags & GIT_INDEX_STAGE_MASK) >> 12;
+}
+
+// Compares the tree `oid` of the directory `prefix` ("" or ending with '/')
+// with the index entries [first, last) below it. A directory whose cached
+// tree is still `oid` has nothing staged and isn't read at all.
+static bool diff_tree(StagedDiff *d, const uint8_t *oid, const char *prefix, size_t prefix_len,
+                      size_t first, size_t last) {
+    const GitIndex *ix = &d->repo->index;
+    size_t hl = d->repo->hash_len;
+    if (Job_cancelled(d->job))
+        return false;
+
+    const uint8_t *cached = GitIndex_cached_tree(ix, prefix, prefix_len ? prefix_len - 1 : 0);
+    if (cached != NULL && memcmp(cached, oid, hl) == 0) {
+        for (size_t i = first; i < last; i++)
+            d->seen[i] = true;
+        return true;
+    }
+
+    GitObjectType type;
+    size_t size;
+    char *tree = GitObjects_read(d->objs, oid, &type, &size);
+    if (tree == NULL || type != GIT_OBJ_TREE) {
+        free(tree);
+        return false;
+    }
+
+    bool ok = true;
+    char *path = malloc(prefix_len + 256 + 2);
+    size_t pos = 0;
+    GitTreeEntry te;
+    while (ok && path != NULL && git_tree_next(tree, size, hl, &pos, &te)) {
+        if (te.name_len > 255)
+            continue;
+        memcpy(path, prefix, prefix_len);
+        memcpy(path + prefix_len, te.name, te.name_len);
+        size_t len = prefix_len + te.name_len;
+        path[len] = '\0';
+
+        if (S_ISDIR(te.mode)) {
+            path[len++] = '/';
+            path[len] = '\0';
+            size_t from, to;
+            GitIndex_range(ix, path, len, &from, &to);
+            if (from == to)
+                ok = add_change(d, path, len, 'D');
+            else
+                ok = diff_tree(d, te.oid, path, len, from, to);
+            continue;
+        }
+
+        // The entry of the path itself sorts before those it prefixes
+        size_t from, to;
+        GitIndex_range(ix, path, len, &from, &to);
+        if (from == to || ix->entries[from].path_len != len) {
+            ok = add_change(d, path, len, 'D');
+            continue;
+        }
+        const GitIndexEntry *e = &ix->entries[from];
+        d->seen[from] = true;
+        if (stage_of(e) != 0) {
+            for (size_t i = from; i < to && ix->entries[i].path_len == len; i++)
+                d->seen[i] = true;
+            ok = add_change(d, path, len, 'U');
+        } else if ((e->mode & S_IFMT) != (te.mode & S_IFMT)) {
+            ok = add_change(d, path, len, 'T');
+        } else if (e->mode != te.mode || memcmp(e->oid, te.oid, hl) != 0) {
+            ok = add_change(d, path, len, 'M');
+        }
+    }
+    free(path);
+    free(tree);
+    return ok && path != NULL;
+}
+
+// What's staged: the index against the tree of HEAD, for the whole
+// repository. Kept until the index or HEAD change.
+static void refresh_staged(GitRepo *repo, const Job *job) {
+    uint8_t head[GIT_MAX_HASH];
+    bool has_head = git_resolve_head(repo->git_dir, repo->common_dir, repo->hash_len, head);
+    if (repo->staged_valid && has_head == repo->has_head
+        && (!has_head || memcmp(head, repo->head, repo->hash_len) == 0))
+        return;
+
+    free_staged(repo);
+    const GitIndex *ix = &repo->index;
+    StagedDiff d = { .repo = repo, .job = job };
+    d.seen = calloc(ix->count ? ix->count : 1, sizeof(bool));
+    if (d.seen == NULL)
+        return;
+
+    // An unborn branch has everything added
+    bool ok = true;
+    if (has_head) {
+        char *objects = path_join(repo->common_dir, "objects");
+        d.objs = objects != NULL ? GitObjects_open(objects, repo->hash_len) : NULL;
+        free(objects);
+        uint8_t tree[GIT_MAX_HASH];
+        ok = d.objs != NULL && git_commit_tree(d.objs, head, tree)
+             && diff_tree(&d, tree, "", 0, 0, ix->count);
+        GitObjects_close(d.objs);
+    }
+
+    for (size_t i = 0; ok && i < ix->count; i++) {
+        const GitIndexEntry *e = &ix->entries[i];
+        if (d.seen[i] || (e->flags & GIT_INDEX_INTENT_TO_ADD))
+            continue;
+        // The stages of a conflict follow each other
+        if (i > 0 && stage_of(e) != 0 && ix->entries[i - 1].path_len == e->path_len
+            && strcmp(GitIndex_path(ix, i - 1), GitIndex_path(ix, i)) == 0)
+            continue;
+        ok = add_change(&d, GitIndex_path(ix, i), e->path_len, stage_of(e) != 0 ? 'U' : 'A');
+    }
+    free(d.seen);
+
+    // If the trees can't be read, or the job was cancelled, nothing shows as
+    // staged. Damaged objects are tried again once the index or HEAD change.
+    if (!ok) {
+        for (size_t i = 0; i < d.count; i++)
+            free(d.changes[i].path);
+        free(d.changes);
+        if (Job_cancelled(job))
+            return;
+        d.changes = NULL;
+        d.count = 0;
+    }
+    if (d.count > 0)
+        qsort(d.changes, d.count, sizeof(GitChange), compare_changes);
+    repo->staged = d.changes;
+    repo->num_staged = d.count;
+    repo->staged_valid = true;
+    repo->has_head = has_head;
+    memcpy(repo->head, head, repo->hash_len);
+}
+
+// The index letter of `path`, or of everything below it if it ends with '/'
+static char staged_status(const GitRepo *repo, const char *path, size_t len) {
+    size_t lo = 0, hi = repo->num_staged;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(repo->staged[mid].path, path) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (path[len - 1] != '/')
+        return lo < repo->num_staged && strcmp(repo->staged[lo].path, path) == 0 ? repo->staged[lo].status : ' ';
+
+    char status = ' ';
+    for (size_t i = lo; i < repo->num_staged && strncmp(repo->staged[i].path, path, len) == 0; i++)
+        status = roll_up(status, repo->staged[i].status);
+    return status;
+}
+
+// Work tree
+
+// Names the blob the file would be added as. Only for SHA-1 repositories,
+// and content filters (autocrlf, LFS) are not applied.
+static bool hash_blob(int workfd, const char *path, const struct stat *st, uint8_t *oid) {
+    Sha1 s;
+    char header[32];
+    Sha1_init(&s);
+
+    if (S_ISLNK(st->st_mode)) {
+        char target[MAX_PATH_LEN];
+        ssize_t len = readlinkat(workfd, path, target, sizeof(target));
+        if (len < 0)
+            return false;
+        int n = snprintf(header, sizeof(header), "blob %zd", len);
+        Sha1_update(&s, header, n + 1);
+        Sha1_update(&s, target, len);
+        Sha1_final(&s, oid);
+        return true;
+    }
+
+    int fd = openat(workfd, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    unsigned char *buf = malloc(HASH_BLOCK);
+    if (buf == NULL) {
+        close(fd);
+        return false;
+    }
+
+    int n = snprintf(header, sizeof(header), "blob %lld", (long long)st->st_size);
+    Sha1_update(&s, header, n + 1);
+    long long total = 0;
+    ssize_t got;
+    while ((got = read(fd, buf, HASH_BLOCK)) != 0) {
+        if (got == -1 && errno == EINTR)
+            continue;
+        if (got == -1)
+            break;
+        Sha1_update(&s, buf, got);
+        total += got;
+    }
+    free(buf);
+    close(fd);
+    if (got != 0 || total != st->st_size)
+        return false;
+    Sha1_final(&s, oid);
+    return true;
+}
+
+static GitChecked stat_data(const struct stat *st) {
+    return (GitChecked){
+        .mtime_sec = st->st_mtim.tv_sec, .mtime_nsec = st->st_mtim.tv_nsec,
+        .ctime_sec = st->st_ctim.tv_sec, .ctime_nsec = st->st_ctim.tv_nsec,
+        .ino = st->st_ino, .size = st->st_size,
+    };
+}
+
+// The work tree letter of index entry `i`: ' ' if the file is as it was
+// added. Its stat data tells most of the time, like for git; a file touched
+// since (or modified too close to when the index was written to tell) is
+// hashed, once per change of its own stat data.
+static char worktree_status(GitRepo *repo, int workfd, size_t i) {
+    const GitIndexEntry *e = &repo->index.entries[i];
+    if (e->flags & GIT_INDEX_SKIP_WORKTREE)
+        return ' ';
+    if (e->flags & GIT_INDEX_INTENT_TO_ADD)
+        return 'A';
+    // Submodules are not looked into
+    if ((e->mode & S_IFMT) == GIT_MODE_GITLINK)
+        return ' ';
+
+    struct stat st;
+    if (fstatat(workfd, GitIndex_path(&repo->index, i), &st, AT_SYMLINK_NOFOLLOW) == -1)
+        return 'D';
+    if ((S_ISLNK(st.st_mode) != S_ISLNK(e->mode)) || (!S_ISLNK(st.st_mode) && !S_ISREG(st.st_mode)))
+        return 'T';
+    if ((uint32_t)st.st_size != e->size)
+        return 'M';
+    if (S_ISREG(st.st_mode) && !(st.st_mode & 0100) != !(e->mode & 0100))
+        return 'M';
+
+    GitChecked now = stat_data(&st);
+    bool same = now.mtime_sec == e->mtime_sec && now.mtime_nsec == e->mtime_nsec
+             && now.ctime_sec == e->ctime_sec && now.ctime_nsec == e->ctime_nsec
+             && now.ino == e->ino && st.st_uid == e->uid && st.st_gid == e->gid;
+    // Racily clean: modified in the same instant the index was written
+    const struct timespec *written = &repo->index_st.st_mtim;
+    bool racy = st.st_mtim.tv_sec > written->tv_sec
+             || (st.st_mtim.tv_sec == written->tv_sec && st.st_mtim.tv_nsec >= written->tv_nsec);
+    if (same && !racy)
+        return ' ';
+
+    if (repo->checked == NULL)
+        repo->checked = calloc(repo->index.count, sizeof(GitChecked));
+    GitChecked *c = repo->checked != NULL ? &repo->checked[i] : NULL;
+    if (c != NULL && c->status != '\0' && c->mtime_sec == now.mtime_sec && c->mtime_nsec == now.mtime_nsec
+        && c->ctime_sec == now.ctime_sec && c->ctime_nsec == now.ctime_nsec && c->ino == now.ino
+        && c->size == now.size)
+        return c->status;
+
+    uint8_t oid[GIT_MAX_HASH];
+    char status = 'M';
+    if (repo->hash_len == SHA1_SIZE && hash_blob(workfd, GitIndex_path(&repo->index, i), &st, oid))
+        status = memcmp(oid, e->oid, SHA1_SIZE) == 0 ? ' ' : 'M';
+    if (c != NULL) {
+        *c = now;
+        c->status = status;
+    }
+    return status;
+}
+
+// Ignore rules
+
+static void free_ignore(IgnoreFile *f) {
+    free(f->base);
+    free(f->text);
+    free(f->patterns);
+}
+
+// Splits a .gitignore into its patterns, comments and blank lines dropped
+static bool read_ignore(IgnoreFile *f, const char *path, const char *base) {
+    *f = (IgnoreFile){ 0 };
+    f->text = slurp_file(AT_FDCWD, path, GIT_MAX_IGNORE_FILE, NULL);
+    if (f->text == NULL)
+        return false;
+    f->base = strdup(base);
+
+    size_t cap = 0;
+    for (char *line = f->text; line != NULL && f->base != NULL;) {
+        char *eol = strchr(line, '\n');
+        if (eol != NULL)
+            *eol = '\0';
+        size_t len = strlen(line);
+        // Trailing spaces go unless escaped
+        while (len > 0 && (line[len - 1] == '\r' || (line[len - 1] == ' ' && (len < 2 || line[len - 2] != '\\'))))
+            line[--len] = '\0';
+
+        if (len > 0 && line[0] != '#') {
+            if (f->count == cap) {
+                cap = cap ? cap * 2 : 16;
+                char **grown = realloc(f->patterns, cap * sizeof(char *));
+                if (grown == NULL)
+                    break;
+                f->patterns = grown;
+            }
+            f->patterns[f->count++] = line;
+        }
+        line = eol != NULL ? eol + 1 : NULL;
+    }
+    return true;
+}
+
+static bool glob_match(const char *pattern, const char *p, const char *t);
+
+// Matches `c` against the bracket expression at `p`, just past its '['.
+// Sets *end past the ']', returns -1 if there's none.
+static int match_class(const char *p, char c, const char **end) {
+    bool negate = *p == '!' || *p == '^';
+    if (negate)
+        p++;
+
+    bool matched = false;
+    const char *start = p;
+    while (*p != '\0' && (*p != ']' || p == start)) {
+        char lo = *p;
+        if (lo == '\\' && p[1] != '\0')
+            lo = *++p;
+        char hi = lo;
+        if (p[1] == '-' && p[2] != ']' && p[2] != '\0') {
+            hi = p[2];
+            p += 2;
+        }
+        p++;
+        if (c >= lo && c <= hi)
+            matched = true;
+    }
+    if (*p != ']')
+        return -1;
+    *end = p + 1;
+    return c != '/' && matched != negate;
+}
+
+// wildmatch as git does it: '*', '?' and classes don't match '/', "**"
+// between slashes matches any number of directories
+static bool glob_match(const char *pattern, const char *p, const char *t) {
+    while (*p != '\0') {
+        if (*p == '*') {
+            bool doublestar = p[1] == '*' && (p == pattern || p[-1] == '/') && (p[2] == '\0' || p[2] == '/');
+            if (doublestar) {
+                p += 2;
+                if (*p == '\0')
+                    return true;
+                // "**/" also matches no directory at all
+                if (glob_match(pattern, p + 1, t))
+                    return true;
+                for (; *t != '\0'; t++)
+                    if (t[0] == '/' && glob_match(pattern, p + 1, t + 1))
+                        return true;
+                return false;
+            }
+            while (*p == '*')
+                p++;
+            for (;; t++) {
+                if (glob_match(pattern, p, t))
+                    return true;
+                if (*t == '\0' || *t == '/')
+                    return false;
+            }
+        }
+
+        if (*t == '\0')
+            return false;
+        if (*p == '?') {
+            if (*t == '/')
+                return false;
+        } else if (*p == '[') {
+            const char *end;
+            int matched = match_class(p + 1, *t, &end);
+            if (matched == 0)
+                return false;
+            if (matched == 1) {
+                p = end;
+                t++;
+                continue;
+            }
+            if (*t != '[')
+                return false;
+        } else {
+            if (*p == '\\' && p[1] != '\0')
+                p++;
+            if (*p != *t)
+                return false;
+        }
+        p++;
+        t++;
+    }
+    return *t == '\0';
+}
+
+// 1 if `pattern` ignores `path` (relative to the base of its file), 0 if it
+// brings it back, -1 if it doesn't match
+static int match_pattern(const char *pattern, const char *path, bool is_dir) {
+    bool negate = pattern[0] == '!';
+    if (negate)
+        pattern++;
+    if (pattern[0] == '\\' && (pattern[1] == '!' || pattern[1] == '#'))
+        pattern++;
+
+    char buf[MAX_PATH_LEN];
+    size_t len = strlen(pattern);
+    if (len == 0 || len >= sizeof(buf))
+        return -1;
+    memcpy(buf, pattern, len + 1);
+    // "dir/" only matches directories
+    if (buf[len - 1] == '/') {
+        if (!is_dir)
+            return -1;
+        buf[--len] = '\0';
+    }
+
+    // Without a slash it matches at any depth, by name
+    const char *glob = buf;
+    const char *subject = path;
+    if (strchr(buf, '/') == NULL) {
+        const char *slash = strrchr(path, '/');
+        subject = slash != NULL ? slash + 1 : path;
+    } else if (buf[0] == '/') {
+        glob++;
+    }
+    if (!glob_match(glob, glob, subject))
+        return -1;
+    return !negate;
+}
+
+// Files come from the most to the least important: the .gitignore of the
+// deepest directory first
+static bool is_ignored(const IgnoreFile *files, size_t count, const char *path, bool is_dir) {
+    for (size_t i = 0; i < count; i++) {
+        size_t base_len = strlen(files[i].base);
+        if (strncmp(path, files[i].base, base_len) != 0 || path[base_len] == '\0')
+            continue;
+        // The last pattern that matches decides
+        for (size_t j = files[i].count; j-- > 0;) {
+            int result = match_pattern(files[i].patterns[j], path + base_len, is_dir);
+            if (result != -1)
+                return result;
+        }
+    }
+    return false;
+}
+
+// The .gitignore of `prefix` ("" or ending with '/') and of the directories
+// above it, then info/exclude and the user's global one
+static IgnoreFile *load_ignores(const GitRepo *repo, const char *prefix, size_t *count) {
+    size_t depth = 1;
+    for (const char *p = prefix; *p != '\0'; p++)
+        depth += *p == '/';
+    IgnoreFile *files = calloc(depth + 2, sizeof(IgnoreFile));
+    if (files == NULL)
+        return NULL;
+    *count = 0;
+
+    char base[MAX_PATH_LEN];
+    for (size_t len = strlen(prefix) + 1; len-- > 0;) {
+        if (len > 0 && prefix[len - 1] != '/')
+            continue;
+        snprintf(base, sizeof(base), "%.*s", (int)len, prefix);
+        char *dir = path_join(repo->worktree, base);
+        char *path = dir != NULL ? path_join(dir, ".gitignore") : NULL;
+        if (path != NULL && read_ignore(&files[*count], path, base))
+            (*count)++;
+        free(path);
+        free(dir);
+    }
+
+    char *exclude = path_join(repo->common_dir, "info/exclude");
+    if (exclude != NULL && read_ignore(&files[*count], exclude, ""))
+        (*count)++;
+    free(exclude);
+
+    // core.excludesFile isn't read, only where it is by default
+    const char *config = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+    char global[MAX_PATH_LEN] = "";
+    if (config != NULL && config[0] != '\0')
+        snprintf(global, sizeof(global), "%s/git/ignore", config);
+    else if (home != NULL)
+        snprintf(global, sizeof(global), "%s/.config/git/ignore", home);
+    if (global[0] != '\0' && read_ignore(&files[*count], global, ""))
+        (*count)++;
+    return files;
+}
+
+// Status of a directory
+
+typedef struct {
+    GitEntry *el;
+    size_t len;
+    size_t cap;
+} EntryList;
+
+static bool add_entry(EntryList *list, const char *name, char x, char y) {
+    if (list->len == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 32;
+        GitEntry *grown = realloc(list->el, cap * sizeof(GitEntry));
+        if (grown == NULL)
+            return false;
+        list->el = grown;
+        list->cap = cap;
+    }
+    GitEntry *e = &list->el[list->len];
+    e->name = strdup(name);
+    if (e->name == NULL)
+        return false;
+    e->marker[0] = x;
+    e->marker[1] = y;
+    e->marker[2] = '\0';
+    list->len++;
+    return true;
+}
+
+static void free_entries(GitEntry *entries, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        free(entries[i].name);
+    free(entries);
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const GitEntry *)a)->name, ((const GitEntry *)b)->name);
+}
+
+// Whether the directory `prefix` (ending with '/') or one above it is
+// ignored, everything untracked in it is then
+static bool prefix_ignored(const IgnoreFile *files, size_t count, const char *prefix) {
+    char dir[MAX_PATH_LEN];
+    for (const char *slash = strchr(prefix, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - prefix), prefix);
+        if (is_ignored(files, count, dir, true))
+            return true;
+    }
+    return false;
+}
+
+// The status of every entry of the directory `j->path`, `prefix` being its
+// path in the work tree
+static bool directory_status(GitRepo *repo, GitJob *j, const Job *job, const char *prefix) {
+    const GitIndex *ix = &repo->index;
+
+    int workfd = open(repo->worktree, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    DIR *d = workfd != -1 ? opendir(j->path) : NULL;
+    if (d == NULL) {
+        if (workfd != -1)
+            close(workfd);
+        return false;
+    }
+
+    IgnoreFile *ignores = NULL;
+    size_t num_ignores = 0;
+    bool all_ignored = false;
+    EntryList list = { 0 };
+    char path[MAX_PATH_LEN];
+    bool ok = true;
+    struct dirent *de;
+
+    while (ok && (de = readdir(d)) != NULL && !Job_cancelled(job)) {
+        const char *name = de->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strcmp(name, ".git") == 0)
+            continue;
+        int len = snprintf(path, sizeof(path), "%s%s/", prefix, name);
+        if (len < 0 || len >= (int)sizeof(path))
+            continue;
+        // `path` is the entry's, then the prefix of what's below it
+        path[len - 1] = '\0';
+
+        size_t from, to;
+        GitIndex_range(ix, path, len - 1, &from, &to);
+        char x = ' ', y = ' ';
+
+        if (from < to && ix->entries[from].path_len == (size_t)len - 1) {
+            if (stage_of(&ix->entries[from]) != 0) {
+                x = y = 'U';
+            } else {
+                x = staged_status(repo, path, len - 1);
+                y = worktree_status(repo, workfd, from);
+            }
+        } else {
+            path[len - 1] = '/';
+            GitIndex_range(ix, path, len, &from, &to);
+            x = staged_status(repo, path, len);
+            // Conflicts show up as staged
+            for (size_t i = from; i < to && !Job_cancelled(job); i++) {
+                if (stage_of(&ix->entries[i]) != 0)
+                    continue;
+                char status = worktree_status(repo, workfd, i);
+                if (status != ' ')
+                    y = roll_up(y, status);
+            }
+
+            if (from == to && x == ' ') {
+                // Nothing below is tracked, it's untracked or ignored
+                if (ignores == NULL) {
+                    ignores = load_ignores(repo, prefix, &num_ignores);
+                    all_ignored = ignores != NULL && prefix_ignored(ignores, num_ignores, prefix);
+                }
+                bool is_dir = de->d_type == DT_DIR;
+                if (de->d_type == DT_UNKNOWN) {
+                    struct stat st;
+                    is_dir = fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+                }
+                path[len - 1] = '\0';
+                bool ignored = all_ignored || (ignores != NULL && is_ignored(ignores, num_ignores, path, is_dir));
+                x = y = ignored ? '!' : '?';
+            }
+        }
+
+        if (x != ' ' || y != ' ')
+            ok = add_entry(&list, name, x, y);
+    }
+
+    if (ignores != NULL) {
+        for (size_t i = 0; i < num_ignores; i++)
+            free_ignore(&ignores[i]);
+        free(ignores);
+    }
+    closedir(d);
+    close(workfd);
+
+    if (!ok || Job_cancelled(job)) {
+        free_entries(list.el, list.len);
+        return false;
+    }
+    if (list.len > 0)
+        qsort(list.el, list.len, sizeof(GitEntry), compare_entries);
+    j->entries = list.el;
+    j->count = list.len;
+    return true;
+}
+
+static void git_run(Job *job) {
+    GitJob *j = job->data;
+    if (Job_cancelled(job))
+        return;
+
+    char *worktree, *git_dir;
+    if (!find_worktree(j->path, &worktree, &git_dir)) {
+        j->ok = true;
+        return;
+    }
+    GitRepo *repo = get_repo(worktree, git_dir);
+    if (repo == NULL)
+        return;
+    j->repo = repo;
+
+    // What git writes in there tells when the index or HEAD change
+    int fd = open(repo->git_dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    j->wd = Watch_add(fd);
+    if (fd != -1)
+        close(fd);
+
+    // The path of the directory in the work tree, "" or ending with '/'
+    const char *rel = j->path + strlen(repo->worktree);
+    rel += *rel == '/';
+    char prefix[MAX_PATH_LEN];
+    int len = snprintf(prefix, sizeof(prefix), "%s%s", rel, rel[0] != '\0' ? "/" : "");
+
+    pthread_mutex_lock(&repo->lock);
+    if (len >= 0 && len < (int)sizeof(prefix) && refresh_index(repo)) {
+        refresh_staged(repo, job);
+        j->in_repo = directory_status(repo, j, job, prefix);
+    }
+    pthread_mutex_unlock(&repo->lock);
+
+    trim_repos();
+    j->ok = !Job_cancelled(job);
+}
+
+static void git_event(void *owner, const WatchEvent *event) {
+    GitRepo *repo = owner;
+    if (event->mask & IN_IGNORED) {
+        // The git directory went away, the next job watches it again
+        repo->wd = -1;
+        repo->epoch++;
+        return;
+    }
+    if (event->name == NULL || (event->mask & IN_Q_OVERFLOW) || strcmp(event->name, "index") == 0
+        || strcmp(event->name, "HEAD") == 0 || strcmp(event->name, "packed-refs") == 0)
+        repo->epoch++;
+}
+
+static void free_repos(void) {
+    while (repos != NULL) {
+        GitRepo *repo = repos;
+        repos = repo->next;
+        Watch_unsubscribe(repo->wd, repo);
+        unload_repo(repo);
+        pthread_mutex_destroy(&repo->lock);
+        free(repo->worktree);
+        free(repo->git_dir);
+        free(repo->common_dir);
+        free(repo);
+    }
+}
+
+static void git_done(Job *job) {
+    GitJob *j = job->data;
+    GitDirStatus *slot = j->slot;
+    jobs_in_flight--;
+
+    if (j->repo != NULL && j->wd != -1) {
+        if (j->repo->wd == -1 && !closing && Watch_subscribe(j->wd, git_event, j->repo))
+            j->repo->wd = j->wd;
+        else if (j->repo->wd != j->wd)
+            Watch_drop_unused(j->wd);
+    }
+
+    if (slot != NULL) {
+        slot->job = NULL;
+        // Cancelled jobs are asked for again by the next GitStatus_get
+        if (j->ok) {
+            free_entries(slot->entries, slot->count);
+            slot->entries = j->entries;
+            slot->count = j->count;
+            j->entries = NULL;
+            j->count = 0;
+            slot->generation = j->generation;
+            slot->repo = j->repo;
+            // Changes the watch saw while the job ran make it stale again.
+            // A repository found for the first time wasn't watched before.
+            slot->epoch = j->repo == NULL ? 0 : j->repo == j->known_repo ? j->epoch : j->repo->epoch;
+            slot->in_repo = j->in_repo;
+            slot->known = true;
+            clock_gettime(CLOCK_MONOTONIC, &slot->checked_at);
+        }
+    }
+
+    free_entries(j->entries, j->count);
+    free(j->path);
+    free(j);
+
+    if (closing && jobs_in_flight == 0)
+        free_repos();
+}
+
+static void submit(GitDirStatus *slot, unsigned long generation) {
+    GitJob *j = calloc(1, sizeof(GitJob));
+    if (j == NULL)
+        return;
+    j->path = strdup(slot->path);
+    j->slot = slot;
+    j->generation = generation;
+    j->known_repo = slot->repo;
+    j->epoch = slot->repo != NULL ? slot->repo->epoch : 0;
+    j->wd = -1;
+
+    Job *job = j->path != NULL ? Job_new(git_run, git_done, j, JOB_PRIO_HIGH) : NULL;
+    if (job == NULL) {
+        free(j->path);
+        free(j);
+        return;
+    }
+    slot->job = job;
+    jobs_in_flight++;
+    WorkPool_submit(pool, job);
+}
+
+static void clear_slot(GitDirStatus *slot) {
+    if (slot->job != NULL) {
+        ((GitJob *)slot->job->data)->slot = NULL;
+        Job_cancel(slot->job);
+    }
+    free(slot->path);
+    free_entries(slot->entries, slot->count);
+    *slot = (GitDirStatus){ 0 };
+}
+
+void GitStatus_init(WorkPool *workpool) {
+    pool = workpool;
+    closing = false;
+}
+
+void GitStatus_bye(void) {
+    for (size_t i = 0; i < GIT_DIR_SLOTS; i++)
+        clear_slot(&slots[i]);
+    closing = true;
+    if (jobs_in_flight == 0)
+        free_repos();
+}
+
+const GitDirStatus *GitStatus_get(const char *path, unsigned long generation) {
+    GitDirStatus *slot = NULL;
+    for (size_t i = 0; i < GIT_DIR_SLOTS && slot == NULL; i++)
+        if (slots[i].path != NULL && strcmp(slots[i].path, path) == 0)
+            slot = &slots[i];
+
+    if (slot == NULL) {
+        slot = &slots[0];
+        for (size_t i = 1; i < GIT_DIR_SLOTS; i++)
+            if (slots[i].last_use < slot->last_use)
+                slot = &slots[i];
+        clear_slot(slot);
+        slot->path = strdup(path);
+        if (slot->path == NULL)
+            return NULL;
+    }
+    slot->last_use = ++use_counter;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    bool stale = !slot->known || slot->generation != generation
+              || (slot->repo != NULL && slot->epoch != slot->repo->epoch)
+              || (slot->in_repo && elapsed_ms(&slot->checked_at, &now) >= GIT_RECHECK_MS);
+    if (stale && slot->job == NULL)
+        submit(slot, generation);
+
+    return slot->known && slot->in_repo ? slot : NULL;
+}
+
+const char *GitStatus_marker(const GitDirStatus *status, const char *name) {
+    if (status->count == 0)
+        return "  ";
+    GitEntry key = { .name = (char *)name };
+    const GitEntry *entry = bsearch(&key, status->entries, status->count, sizeof(GitEntry), compare_entries);
+    return entry != NULL ? entry->marker : "  ";
+}
@@ -0,0 +1,45 @@
+// File: gitstatus.h
+// -----------------------
+#ifndef GITSTATUS_H
+#define GITSTATUS_H
+
+#include <workpool.h> // for WorkPool
+
+// Directories whose status is kept, the ones on screen and a few left
+#define GIT_DIR_SLOTS 16
+// Repositories whose index stays parsed, the least recently used one is
+// dropped past that
+#define GIT_MAX_REPOS 8
+// inotify doesn't see changes deeper down than the directory shown, so the
+// status of its subdirectories is computed again this often while it's shown
+#define GIT_RECHECK_MS 10000
+// .gitignore and exclude files larger than this are skipped
+#define GIT_MAX_IGNORE_FILE (1 << 20)
+
+// The git status of the entries of a directory inside a work tree, like the
+// two columns of `git status --short`
+typedef struct GitDirStatus GitDirStatus;
+
+// Status is computed by jobs of `pool`, without running git: .git/index is
+// parsed and its stat data compared with the files, it's compared with the
+// tree of HEAD read from the objects (loose or packed) for what's staged,
+// and .gitignore files decide what's ignored. The parsed index is kept per
+// repository until its mtime changes, what git writes in .git is watched.
+void GitStatus_init(WorkPool *pool);
+// Before WorkPool_bye, the repositories go once their last job is done
+void GitStatus_bye(void);
+
+// The status of the directory `path` (not inside an archive) as of the
+// `generation` of its listing. A job computes it if it's not known, or if
+// the listing or the repository changed; what was known before is returned
+// meanwhile. NULL if it's not in a work tree, or not known yet. Valid until
+// the next WorkPool_poll.
+const GitDirStatus *GitStatus_get(const char *path, unsigned long generation);
+// Two characters for the entry `name`: what's staged (index against HEAD)
+// then what's not (work tree against index), as M, A, D, T or U (unmerged).
+// "??" if it's untracked, "!!" if it's ignored and "  " if it's clean. A
+// directory shows the letter every change below it has, M if they differ,
+// or "??"/"!!" if nothing below it is tracked.
+const char *GitStatus_marker(const GitDirStatus *status, const char *name);
+
+#endif // GITSTATUS_H
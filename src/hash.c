@@ -0,0 +1,224 @@
+// File: hash.c
+// -----------------------
+#include <stdint.h>   // for uint64_t, uint32_t, uint8_t
+#include <string.h>   // for memcpy, memset
+// Local includes
+#include <hash.h>     // for Hash64, Sha1, SHA1_SIZE
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Unaligned little endian reads, the compiler turns them into plain loads
+static uint64_t read64(const uint8_t *p) {
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24
+         | (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static uint32_t read32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static uint64_t merge_round(uint64_t acc, uint64_t val) {
+    acc ^= round64(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+void Hash64_init(Hash64 *h, uint64_t seed) {
+    h->total_len = 0;
+    h->buffered = 0;
+    h->seed = seed;
+    h->v[0] = seed + PRIME1 + PRIME2;
+    h->v[1] = seed + PRIME2;
+    h->v[2] = seed;
+    h->v[3] = seed - PRIME1;
+}
+
+void Hash64_update(Hash64 *h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + len;
+    h->total_len += len;
+
+    if (h->buffered + len < 32) {
+        memcpy(h->buffer + h->buffered, p, len);
+        h->buffered += len;
+        return;
+    }
+
+    if (h->buffered) {
+        size_t fill = 32 - h->buffered;
+        memcpy(h->buffer + h->buffered, p, fill);
+        for (int i = 0; i < 4; i++)
+            h->v[i] = round64(h->v[i], read64(h->buffer + i * 8));
+        p += fill;
+        h->buffered = 0;
+    }
+
+    while (p + 32 <= end) {
+        for (int i = 0; i < 4; i++)
+            h->v[i] = round64(h->v[i], read64(p + i * 8));
+        p += 32;
+    }
+
+    if (p < end) {
+        memcpy(h->buffer, p, end - p);
+        h->buffered = end - p;
+    }
+}
+
+uint64_t Hash64_final(const Hash64 *h) {
+    uint64_t acc;
+    if (h->total_len >= 32) {
+        acc = rotl(h->v[0], 1) + rotl(h->v[1], 7) + rotl(h->v[2], 12) + rotl(h->v[3], 18);
+        for (int i = 0; i < 4; i++)
+            acc = merge_round(acc, h->v[i]);
+    } else {
+        acc = h->seed + PRIME5;
+    }
+    acc += h->total_len;
+
+    const uint8_t *p = h->buffer;
+    const uint8_t *end = p + h->buffered;
+    while (p + 8 <= end) {
+        acc ^= round64(0, read64(p));
+        acc = rotl(acc, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        acc ^= (uint64_t)read32(p) * PRIME1;
+        acc = rotl(acc, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        acc ^= *p * PRIME5;
+        acc = rotl(acc, 11) * PRIME1;
+        p++;
+    }
+
+    acc ^= acc >> 33;
+    acc *= PRIME2;
+    acc ^= acc >> 29;
+    acc *= PRIME3;
+    acc ^= acc >> 32;
+    return acc;
+}
+
+uint64_t hash64(const void *data, size_t len, uint64_t seed) {
+    Hash64 h;
+    Hash64_init(&h, seed);
+    Hash64_update(&h, data, len);
+    return Hash64_final(&h);
+}
+
+static uint32_t rotl32(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static uint32_t read32be(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static void sha1_block(uint32_t h[5], const uint8_t *block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++)
+        w[i] = read32be(block + 4 * i);
+    for (int i = 16; i < 80; i++)
+        w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = rotl32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl32(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+void Sha1_init(Sha1 *s) {
+    s->total_len = 0;
+    s->h[0] = 0x67452301;
+    s->h[1] = 0xEFCDAB89;
+    s->h[2] = 0x98BADCFE;
+    s->h[3] = 0x10325476;
+    s->h[4] = 0xC3D2E1F0;
+    s->buffered = 0;
+}
+
+void Sha1_update(Sha1 *s, const void *data, size_t len) {
+    const uint8_t *p = data;
+    s->total_len += len;
+
+    if (s->buffered > 0) {
+        size_t fill = sizeof(s->buffer) - s->buffered;
+        if (len < fill) {
+            memcpy(s->buffer + s->buffered, p, len);
+            s->buffered += len;
+            return;
+        }
+        memcpy(s->buffer + s->buffered, p, fill);
+        sha1_block(s->h, s->buffer);
+        p += fill;
+        len -= fill;
+        s->buffered = 0;
+    }
+
+    for (; len >= 64; p += 64, len -= 64)
+        sha1_block(s->h, p);
+    memcpy(s->buffer, p, len);
+    s->buffered = len;
+}
+
+void Sha1_final(Sha1 *s, uint8_t digest[SHA1_SIZE]) {
+    uint64_t bits = s->total_len * 8;
+
+    s->buffer[s->buffered++] = 0x80;
+    if (s->buffered > 56) {
+        memset(s->buffer + s->buffered, 0, 64 - s->buffered);
+        sha1_block(s->h, s->buffer);
+        s->buffered = 0;
+    }
+    memset(s->buffer + s->buffered, 0, 56 - s->buffered);
+    for (int i = 0; i < 8; i++)
+        s->buffer[56 + i] = bits >> (56 - 8 * i);
+    sha1_block(s->h, s->buffer);
+
+    for (int i = 0; i < 5; i++) {
+        digest[4 * i] = s->h[i] >> 24;
+        digest[4 * i + 1] = s->h[i] >> 16;
+        digest[4 * i + 2] = s->h[i] >> 8;
+        digest[4 * i + 3] = s->h[i];
+    }
+}
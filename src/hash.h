@@ -0,0 +1,40 @@
+// File: hash.h
+// -----------------------
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint64_t, uint32_t, uint8_t
+
+// Streaming 64-bit XXH64. Fast and well distributed, not meant to resist
+// anyone crafting collisions on purpose.
+typedef struct {
+    uint64_t total_len;
+    uint64_t v[4];
+    uint8_t buffer[32];
+    size_t buffered;
+    uint64_t seed;
+} Hash64;
+
+void Hash64_init(Hash64 *h, uint64_t seed);
+void Hash64_update(Hash64 *h, const void *data, size_t len);
+uint64_t Hash64_final(const Hash64 *h);
+// One shot version of the above
+uint64_t hash64(const void *data, size_t len, uint64_t seed);
+
+#define SHA1_SIZE 20
+
+// Streaming SHA-1, only for names of git objects: it has to be the hash git
+// uses, it's no protection against anything
+typedef struct {
+    uint64_t total_len;
+    uint32_t h[5];
+    uint8_t buffer[64];
+    size_t buffered;
+} Sha1;
+
+void Sha1_init(Sha1 *s);
+void Sha1_update(Sha1 *s, const void *data, size_t len);
+void Sha1_final(Sha1 *s, uint8_t digest[SHA1_SIZE]);
+
+#endif // HASH_H
@@ -0,0 +1,609 @@
+// File: highlight.c
+// -----------------------
+#define _POSIX_C_SOURCE 200809L    // for fseeko
+#include <ctype.h>                 // for isalpha, isalnum, isdigit
+#include <curses.h>                // for has_colors, start_color, use_default_colors, init_pair, COLOR_*
+#include <stdio.h>                 // for FILE, fread, fseeko, fclose
+#include <stdlib.h>                // for malloc, calloc, realloc, free
+#include <string.h>                // for strlen, strrchr, strncmp, memcmp, memcpy, memchr
+#include <sys/types.h>             // for off_t
+// Local includes
+#include <highlight.h>             // for Highlighter, HighlightClass, HighlightLine, HighlightSpan
+#include <utils.h>                 // for MIN, MAX, SIZE
+
+// Bytes read from the file at once
+#define READ_CHUNK (64 * 1024)
+
+enum {
+    LANG_PREPROC       = 1 << 0,  // '#' starting a line is a directive
+    LANG_CHAR_QUOTES   = 1 << 1,  // Single quotes delimit strings too
+    LANG_TRIPLE_QUOTES = 1 << 2,  // """ and ''' strings span lines
+    LANG_BACKTICK      = 1 << 3,  // `...` strings span lines
+    LANG_DOLLAR        = 1 << 4,  // '$' may start an identifier
+    LANG_KEYS          = 1 << 5,  // `key:` and `key =` at the start of a line
+    LANG_SECTIONS      = 1 << 6,  // [section] lines
+    LANG_MARKUP        = 1 << 7,  // <tags>
+    LANG_HEADINGS      = 1 << 8,  // '#' starting a line is a heading
+};
+
+// Lexer states at the end of a line
+enum {
+    STATE_NORMAL = 0,
+    STATE_BLOCK_COMMENT,
+    STATE_TRIPLE_DOUBLE,
+    STATE_TRIPLE_SINGLE,
+    STATE_BACKTICK,
+};
+
+typedef struct {
+    // Space separated, like the word lists below
+    const char *extensions;
+    const char *line_comment;
+    const char *line_comment2;
+    const char *block_open;
+    const char *block_close;
+    const char *keywords;
+    const char *types;
+    unsigned int flags;
+} Language;
+
+static const Language languages[] = {
+    {
+        "c h cpp hpp", "//", NULL, "/*", "*/",
+        "auto break case const continue default do else enum extern for goto if inline register restrict "
+        "return sizeof static struct switch typedef union volatile while class namespace template typename "
+        "public private protected virtual override new delete this using try catch throw operator friend "
+        "NULL true false constexpr noexcept static_assert alignas alignof thread_local",
+        "void char short int long float double signed unsigned bool size_t ssize_t off_t uint8_t uint16_t "
+        "uint32_t uint64_t int8_t int16_t int32_t int64_t uintptr_t intptr_t FILE",
+        LANG_PREPROC | LANG_CHAR_QUOTES,
+    },
+    {
+        "java", "//", NULL, "/*", "*/",
+        "abstract assert break case catch class const continue default do else enum extends final finally "
+        "for goto if implements import instanceof interface native new package private protected public "
+        "return static strictfp super switch synchronized this throw throws transient try volatile while "
+        "var record true false null",
+        "boolean byte char short int long float double void String Object",
+        LANG_CHAR_QUOTES,
+    },
+    {
+        "kt", "//", NULL, "/*", "*/",
+        "as break class continue do else false for fun if in interface is null object package return super "
+        "this throw true try typealias val var when while import private public protected internal override "
+        "open abstract data sealed companion lateinit suspend",
+        "Int Long Short Byte Float Double Boolean Char String Unit Any",
+        LANG_CHAR_QUOTES | LANG_TRIPLE_QUOTES,
+    },
+    {
+        "swift", "//", NULL, "/*", "*/",
+        "associatedtype class deinit enum extension fileprivate func import init inout internal let open "
+        "operator private protocol public static struct subscript typealias var break case continue default "
+        "defer do else fallthrough for guard if in repeat return switch where while as catch false is nil "
+        "rethrows super self throw throws true try async await",
+        "Int Double Float String Bool Character Array Dictionary Set Optional Void",
+        LANG_TRIPLE_QUOTES,
+    },
+    {
+        "js", "//", NULL, "/*", "*/",
+        "break case catch class const continue debugger default delete do else export extends finally for "
+        "function if import in instanceof let new return super switch this throw try typeof var void while "
+        "with yield async await of true false null undefined",
+        NULL,
+        LANG_CHAR_QUOTES | LANG_BACKTICK | LANG_DOLLAR,
+    },
+    {
+        "go", "//", NULL, "/*", "*/",
+        "break case chan const continue default defer else fallthrough for func go goto if import interface "
+        "map package range return select struct switch type var true false nil iota",
+        "bool byte rune string error int int8 int16 int32 int64 uint uint8 uint16 uint32 uint64 uintptr "
+        "float32 float64 complex64 complex128 any",
+        LANG_CHAR_QUOTES | LANG_BACKTICK,
+    },
+    {
+        // No LANG_CHAR_QUOTES, lifetimes would open strings
+        "rs", "//", NULL, "/*", "*/",
+        "as async await break const continue crate dyn else enum extern false fn for if impl in let loop "
+        "match mod move mut pub ref return self Self static struct super trait true type unsafe use where while",
+        "i8 i16 i32 i64 i128 isize u8 u16 u32 u64 u128 usize f32 f64 bool char str String Vec Option Result Box",
+        LANG_PREPROC,
+    },
+    {
+        "php", "//", "#", "/*", "*/",
+        "abstract and array as break callable case catch class clone const continue declare default do echo "
+        "else elseif empty extends final finally fn for foreach function global goto if implements include "
+        "include_once instanceof interface isset list match namespace new or print private protected public "
+        "require require_once return static switch throw trait try unset use var while yield true false null",
+        NULL,
+        LANG_CHAR_QUOTES | LANG_DOLLAR,
+    },
+    {
+        "css", NULL, NULL, "/*", "*/",
+        "important inherit initial none auto",
+        NULL,
+        LANG_CHAR_QUOTES | LANG_KEYS,
+    },
+    {
+        "py", "#", NULL, NULL, NULL,
+        "False None True and as assert async await break class continue def del elif else except finally for "
+        "from global if import in is lambda nonlocal not or pass raise return try while with yield match case self",
+        "int float str bytes bool list dict set tuple object",
+        LANG_CHAR_QUOTES | LANG_TRIPLE_QUOTES,
+    },
+    {
+        "rb", "#", NULL, NULL, NULL,
+        "BEGIN END alias and begin break case class def do else elsif end ensure false for if in module next "
+        "nil not or redo rescue retry return self super then true undef unless until when while yield require",
+        NULL,
+        LANG_CHAR_QUOTES,
+    },
+    {
+        "pl", "#", NULL, NULL, NULL,
+        "my our local sub if elsif else unless while until for foreach do last next redo return use no "
+        "require package print undef and or not",
+        NULL,
+        LANG_CHAR_QUOTES | LANG_DOLLAR,
+    },
+    {
+        "sh", "#", NULL, NULL, NULL,
+        "if then else elif fi case esac for while until do done in function return local export readonly "
+        "shift exit break continue echo set unset source",
+        NULL,
+        LANG_CHAR_QUOTES | LANG_DOLLAR,
+    },
+    {
+        "bat", "::", "REM ", NULL, NULL,
+        "echo set if else goto call exit for in do not exist defined errorlevel setlocal endlocal",
+        NULL,
+        0,
+    },
+    {
+        "json", NULL, NULL, NULL, NULL,
+        "true false null",
+        NULL,
+        LANG_KEYS,
+    },
+    {
+        "yaml yml", "#", NULL, NULL, NULL,
+        "true false null yes no on off",
+        NULL,
+        LANG_CHAR_QUOTES | LANG_KEYS,
+    },
+    {
+        "toml", "#", NULL, NULL, NULL,
+        "true false",
+        NULL,
+        LANG_CHAR_QUOTES | LANG_TRIPLE_QUOTES | LANG_KEYS | LANG_SECTIONS,
+    },
+    {
+        "ini conf", "#", ";", NULL, NULL,
+        "true false yes no on off",
+        NULL,
+        LANG_KEYS | LANG_SECTIONS,
+    },
+    {
+        "html xml", NULL, NULL, "<!--", "-->",
+        NULL,
+        NULL,
+        LANG_MARKUP,
+    },
+    {
+        "md", NULL, NULL, NULL, NULL,
+        NULL,
+        NULL,
+        LANG_HEADINGS | LANG_BACKTICK,
+    },
+};
+
+// Where a line starts, and the lexer state there
+typedef struct {
+    off_t offset;
+    unsigned char state;
+} LineCheckpoint;
+
+typedef struct {
+    size_t text;
+    int len;
+    size_t spans;
+    int num_spans;
+} Row;
+
+struct Highlighter {
+    FILE *file;
+    // NULL for plain text
+    const Language *lang;
+
+    LineCheckpoint *checkpoints;
+    size_t num_checkpoints, checkpoints_cap;
+    SIZE total_lines;
+
+    // The start of the current line, HIGHLIGHT_MAX_LINE bytes
+    char *line;
+    // What was read of the file past the current line
+    char *chunk;
+    size_t chunk_pos, chunk_len;
+
+    // Lines of the last call, repeated calls are answered from here
+    char *text;
+    size_t text_len, text_cap;
+    HighlightSpan *spans;
+    size_t num_spans, spans_cap;
+    Row *rows;
+    SIZE rows_cap;
+    SIZE cached_first, cached_count, cached_n;
+};
+
+void Highlight_init_colors(void) {
+    if (!has_colors())
+        return;
+    start_color();
+    use_default_colors();
+    init_pair(HL_KEYWORD, COLOR_YELLOW, -1);
+    init_pair(HL_TYPE, COLOR_CYAN, -1);
+    init_pair(HL_STRING, COLOR_GREEN, -1);
+    init_pair(HL_NUMBER, COLOR_MAGENTA, -1);
+    init_pair(HL_COMMENT, COLOR_BLUE, -1);
+    init_pair(HL_PREPROC, COLOR_MAGENTA, -1);
+    init_pair(HL_KEY, COLOR_CYAN, -1);
+    init_pair(HL_TAG, COLOR_BLUE, -1);
+}
+
+static bool in_list(const char *list, const char *word, size_t len) {
+    if (list == NULL)
+        return false;
+    for (const char *p = list; *p;) {
+        while (*p == ' ')
+            p++;
+        const char *end = p;
+        while (*end && *end != ' ')
+            end++;
+        if ((size_t)(end - p) == len && memcmp(p, word, len) == 0)
+            return true;
+        p = end;
+    }
+    return false;
+}
+
+static const Language *language_for(const char *path) {
+    const char *ext = strrchr(path, '.');
+    if (ext == NULL)
+        return NULL;
+    ext++;
+    for (size_t i = 0; i < sizeof(languages) / sizeof(languages[0]); i++)
+        if (in_list(languages[i].extensions, ext, strlen(ext)))
+            return &languages[i];
+    return NULL;
+}
+
+static bool starts_with(const char *s, int len, const char *prefix) {
+    int n = prefix ? strlen(prefix) : 0;
+    return n > 0 && n <= len && memcmp(s, prefix, n) == 0;
+}
+
+// Index right after `close`, searching from `from`, or -1
+static int find_close(const char *s, int len, int from, const char *close, bool escapes) {
+    int n = strlen(close);
+    for (int i = from; i + n <= len; i++) {
+        if (escapes && s[i] == '\\') {
+            i++;
+            continue;
+        }
+        if (memcmp(s + i, close, n) == 0)
+            return i + n;
+    }
+    return -1;
+}
+
+static void emit(HighlightSpan *spans, int *num_spans, int start, int len, HighlightClass cls) {
+    if (spans != NULL && len > 0)
+        spans[(*num_spans)++] = (HighlightSpan){ start, len, cls };
+}
+
+// Lexes one line starting in `state` and returns the state at its end. With
+// no `spans` only the state is computed, for lines that aren't shown.
+static int lex_line(const Language *lang, const char *s, int len, int state, HighlightSpan *spans, int *num_spans) {
+    bool line_start = true;
+    int i = 0;
+
+    while (i < len) {
+        // Constructs spanning lines
+        if (state != STATE_NORMAL) {
+            const char *close = state == STATE_BLOCK_COMMENT ? lang->block_close
+                              : state == STATE_TRIPLE_DOUBLE ? "\"\"\""
+                              : state == STATE_TRIPLE_SINGLE ? "'''"
+                              : "`";
+            int end = find_close(s, len, i, close, state != STATE_BLOCK_COMMENT);
+            emit(spans, num_spans, i, (end == -1 ? len : end) - i,
+                 state == STATE_BLOCK_COMMENT ? HL_COMMENT : HL_STRING);
+            if (end == -1)
+                return state;
+            i = end;
+            state = STATE_NORMAL;
+            line_start = false;
+            continue;
+        }
+
+        char c = s[i];
+        const char *rest = s + i;
+        int rest_len = len - i;
+
+        if (c == ' ' || c == '\t' || c == '\r') {
+            i++;
+            continue;
+        }
+        if (starts_with(rest, rest_len, lang->line_comment) || starts_with(rest, rest_len, lang->line_comment2)) {
+            emit(spans, num_spans, i, rest_len, HL_COMMENT);
+            return state;
+        }
+        if (starts_with(rest, rest_len, lang->block_open)) {
+            state = STATE_BLOCK_COMMENT;
+            // The opening can't be part of the closing, as in "/*/"
+            int open = strlen(lang->block_open);
+            emit(spans, num_spans, i, open, HL_COMMENT);
+            i += open;
+            continue;
+        }
+        if (line_start && c == '#' && (lang->flags & (LANG_PREPROC | LANG_HEADINGS))) {
+            emit(spans, num_spans, i, rest_len, (lang->flags & LANG_PREPROC) ? HL_PREPROC : HL_KEYWORD);
+            return state;
+        }
+        if (line_start && c == '[' && (lang->flags & LANG_SECTIONS)) {
+            emit(spans, num_spans, i, rest_len, HL_TYPE);
+            return state;
+        }
+        if ((lang->flags & LANG_TRIPLE_QUOTES) && (starts_with(rest, rest_len, "\"\"\"") || starts_with(rest, rest_len, "'''"))) {
+            state = c == '"' ? STATE_TRIPLE_DOUBLE : STATE_TRIPLE_SINGLE;
+            emit(spans, num_spans, i, 3, HL_STRING);
+            i += 3;
+            continue;
+        }
+        if (c == '`' && (lang->flags & LANG_BACKTICK)) {
+            state = STATE_BACKTICK;
+            emit(spans, num_spans, i, 1, HL_STRING);
+            i++;
+            continue;
+        }
+        if (c == '"' || (c == '\'' && (lang->flags & LANG_CHAR_QUOTES))) {
+            char quote[2] = { c, '\0' };
+            int end = find_close(s, len, i + 1, quote, true);
+            if (end == -1)
+                end = len;
+            HighlightClass cls = HL_STRING;
+            if (lang->flags & LANG_KEYS) {
+                int j = end;
+                while (j < len && (s[j] == ' ' || s[j] == '\t'))
+                    j++;
+                if (j < len && s[j] == ':')
+                    cls = HL_KEY;
+            }
+            emit(spans, num_spans, i, end - i, cls);
+            i = end;
+            line_start = false;
+            continue;
+        }
+        if (c == '<' && (lang->flags & LANG_MARKUP)) {
+            int end = find_close(s, len, i + 1, ">", false);
+            if (end == -1)
+                end = len;
+            emit(spans, num_spans, i, end - i, HL_TAG);
+            i = end;
+            line_start = false;
+            continue;
+        }
+        if (isdigit((unsigned char)c) || (c == '.' && i + 1 < len && isdigit((unsigned char)s[i + 1]))) {
+            int j = i + 1;
+            while (j < len && (isalnum((unsigned char)s[j]) || s[j] == '.' || s[j] == '_'))
+                j++;
+            emit(spans, num_spans, i, j - i, HL_NUMBER);
+            i = j;
+            line_start = false;
+            continue;
+        }
+        if (isalpha((unsigned char)c) || c == '_' || (c == '$' && (lang->flags & LANG_DOLLAR))) {
+            bool keys = lang->flags & LANG_KEYS;
+            int j = i + 1;
+            while (j < len && (isalnum((unsigned char)s[j]) || s[j] == '_' || (keys && (s[j] == '-' || s[j] == '.'))))
+                j++;
+
+            if (spans != NULL) {
+                HighlightClass cls = HL_PLAIN;
+                int k = j;
+                while (k < len && (s[k] == ' ' || s[k] == '\t'))
+                    k++;
+                if (keys && line_start && k < len && (s[k] == ':' || s[k] == '='))
+                    cls = HL_KEY;
+                else if (in_list(lang->keywords, s + i, j - i))
+                    cls = HL_KEYWORD;
+                else if (in_list(lang->types, s + i, j - i))
+                    cls = HL_TYPE;
+                if (cls != HL_PLAIN)
+                    emit(spans, num_spans, i, j - i, cls);
+            }
+            i = j;
+            line_start = false;
+            continue;
+        }
+
+        // "- key: value" in YAML lists
+        line_start = line_start && c == '-' && (lang->flags & LANG_KEYS);
+        i++;
+    }
+    return state;
+}
+
+Highlighter *Highlight_open(const char *path, FILE *file) {
+    Highlighter *h = calloc(1, sizeof(Highlighter));
+    LineCheckpoint *checkpoints = malloc(64 * sizeof(LineCheckpoint));
+    char *line = malloc(HIGHLIGHT_MAX_LINE);
+    char *chunk = malloc(READ_CHUNK);
+    if (h == NULL || checkpoints == NULL || line == NULL || chunk == NULL) {
+        free(h);
+        free(checkpoints);
+        free(line);
+        free(chunk);
+        fclose(file);
+        return NULL;
+    }
+    h->file = file;
+    h->line = line;
+    h->chunk = chunk;
+    h->lang = language_for(path);
+    h->checkpoints = checkpoints;
+    h->checkpoints_cap = 64;
+    h->checkpoints[0] = (LineCheckpoint){ 0, STATE_NORMAL };
+    h->num_checkpoints = 1;
+    h->total_lines = -1;
+    h->cached_n = -1;
+    return h;
+}
+
+void Highlight_close(Highlighter *h) {
+    if (h == NULL)
+        return;
+    fclose(h->file);
+    free(h->checkpoints);
+    free(h->line);
+    free(h->chunk);
+    free(h->text);
+    free(h->spans);
+    free(h->rows);
+    free(h);
+}
+
+static bool reserve(void **buf, size_t *cap, size_t need, size_t size) {
+    if (need <= *cap)
+        return true;
+    size_t new_cap = MAX(*cap * 2, need + 256);
+    void *p = realloc(*buf, new_cap * size);
+    if (p == NULL)
+        return false;
+    *buf = p;
+    *cap = new_cap;
+    return true;
+}
+
+static void add_checkpoint(Highlighter *h, off_t offset, int state) {
+    if (reserve((void **)&h->checkpoints, &h->checkpoints_cap, h->num_checkpoints + 1, sizeof(LineCheckpoint)))
+        h->checkpoints[h->num_checkpoints++] = (LineCheckpoint){ offset, state };
+}
+
+// Reads the next line into h->line. Only its first HIGHLIGHT_MAX_LINE bytes
+// are kept, the rest is skipped however long it is. Returns the bytes
+// consumed, the newline included, 0 at the end of the file.
+static size_t read_line(Highlighter *h, int *len, bool *ended) {
+    size_t consumed = 0;
+    *len = 0;
+    *ended = false;
+    for (;;) {
+        if (h->chunk_pos == h->chunk_len) {
+            h->chunk_pos = 0;
+            h->chunk_len = fread(h->chunk, 1, READ_CHUNK, h->file);
+            if (h->chunk_len == 0)
+                return consumed;
+        }
+        const char *start = h->chunk + h->chunk_pos;
+        const char *newline = memchr(start, '\n', h->chunk_len - h->chunk_pos);
+        size_t take = newline != NULL ? (size_t)(newline - start) : h->chunk_len - h->chunk_pos;
+        size_t keep = MIN(take, (size_t)(HIGHLIGHT_MAX_LINE - *len));
+        memcpy(h->line + *len, start, keep);
+        *len += keep;
+        consumed += take;
+        h->chunk_pos += take;
+        if (newline != NULL) {
+            h->chunk_pos++;
+            *ended = true;
+            return consumed + 1;
+        }
+    }
+}
+
+// Lexes from the checkpoint before `first`, only the lines that are shown
+// get their spans
+static SIZE lex_lines(Highlighter *h, SIZE first, SIZE count) {
+    size_t cp = MIN((size_t)first / HIGHLIGHT_CHECKPOINT_LINES, h->num_checkpoints - 1);
+    SIZE line = cp * HIGHLIGHT_CHECKPOINT_LINES;
+    off_t offset = h->checkpoints[cp].offset;
+    int state = h->checkpoints[cp].state;
+    SIZE n = 0, scanned = 0;
+
+    h->text_len = h->num_spans = 0;
+    if ((h->total_lines >= 0 && first >= h->total_lines) || fseeko(h->file, offset, SEEK_SET) != 0)
+        return 0;
+    h->chunk_pos = h->chunk_len = 0;
+    size_t rows_cap = h->rows_cap;
+    if (!reserve((void **)&h->rows, &rows_cap, count, sizeof(Row)))
+        return 0;
+    h->rows_cap = rows_cap;
+
+    while (n < count) {
+        if (line % HIGHLIGHT_CHECKPOINT_LINES == 0 && (size_t)line / HIGHLIGHT_CHECKPOINT_LINES == h->num_checkpoints)
+            add_checkpoint(h, offset, state);
+
+        int len;
+        bool ended;
+        size_t got = read_line(h, &len, &ended);
+        if (got == 0) {
+            h->total_lines = line;
+            break;
+        }
+        offset += got;
+        if (len > 0 && h->line[len - 1] == '\r')
+            len--;
+
+        if (line < first) {
+            // Plain text has no state to carry over
+            if (h->lang != NULL)
+                state = lex_line(h->lang, h->line, len, state, NULL, NULL);
+            // Keeps going on the next call, from the checkpoints added so far
+            if (++scanned > HIGHLIGHT_BUDGET_LINES)
+                return -1;
+        } else {
+            if (!reserve((void **)&h->text, &h->text_cap, h->text_len + len, 1)
+                || !reserve((void **)&h->spans, &h->spans_cap, h->num_spans + len, sizeof(HighlightSpan)))
+                return n;
+            memcpy(h->text + h->text_len, h->line, len);
+
+            int num_spans = 0;
+            if (h->lang != NULL)
+                state = lex_line(h->lang, h->line, len, state, h->spans + h->num_spans, &num_spans);
+            h->rows[n++] = (Row){ h->text_len, len, h->num_spans, num_spans };
+            h->text_len += len;
+            h->num_spans += num_spans;
+        }
+
+        line++;
+        if (!ended) {
+            h->total_lines = line;
+            break;
+        }
+    }
+    return n;
+}
+
+SIZE Highlight_lines(Highlighter *h, SIZE first, SIZE count, HighlightLine *lines) {
+    if (first < 0 || count <= 0)
+        return 0;
+
+    if (first != h->cached_first || count != h->cached_count || h->cached_n < 0) {
+        h->cached_first = first;
+        h->cached_count = count;
+        h->cached_n = lex_lines(h, first, count);
+        if (h->cached_n < 0)
+            return -1;
+    }
+
+    for (SIZE i = 0; i < h->cached_n; i++) {
+        const Row *row = &h->rows[i];
+        lines[i] = (HighlightLine){
+            .text = h->text + row->text,
+            .len = row->len,
+            .spans = h->spans + row->spans,
+            .num_spans = row->num_spans,
+        };
+    }
+    return h->cached_n;
+}
+
+SIZE Highlight_line_count(const Highlighter *h) {
+    return h->total_lines;
+}
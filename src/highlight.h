@@ -0,0 +1,61 @@
+// File: highlight.h
+// -----------------------
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include <stdio.h>    // for FILE
+#include <utils.h>    // for SIZE
+
+typedef enum {
+    HL_PLAIN = 0,
+    HL_KEYWORD,
+    HL_TYPE,
+    HL_STRING,
+    HL_NUMBER,
+    HL_COMMENT,
+    HL_PREPROC,
+    // Keys of JSON, YAML, TOML and INI files
+    HL_KEY,
+    // Markup tags
+    HL_TAG,
+    HL_COUNT,
+} HighlightClass;
+
+// The lexer state at the start of every this many lines is remembered, so
+// showing any line only lexes from the checkpoint before it
+#define HIGHLIGHT_CHECKPOINT_LINES 64
+// Lines lexed by one call beyond the known checkpoints. Jumping far into a
+// big file takes a few frames instead of freezing the UI.
+#define HIGHLIGHT_BUDGET_LINES 50000
+// Only the start of very long lines is lexed
+#define HIGHLIGHT_MAX_LINE 4096
+
+typedef struct {
+    int start;
+    int len;
+    HighlightClass cls;
+} HighlightSpan;
+
+typedef struct {
+    const char *text;
+    int len;
+    const HighlightSpan *spans;
+    int num_spans;
+} HighlightLine;
+
+typedef struct Highlighter Highlighter;
+
+// Sets up the color pairs, one per HighlightClass, if the terminal has colors
+void Highlight_init_colors(void);
+// Takes ownership of `file`, which must be seekable. The language is picked
+// from the extension of `path`, unknown ones are shown without colors.
+Highlighter *Highlight_open(const char *path, FILE *file);
+void Highlight_close(Highlighter *h);
+// Lexes lines [first, first + count), valid until the next call. Returns how
+// many there are, fewer at the end of the file, or -1 when the budget ran out
+// before reaching them: calling again goes on from there.
+SIZE Highlight_lines(Highlighter *h, SIZE first, SIZE count, HighlightLine *lines);
+// Number of lines, -1 until the end of the file has been seen
+SIZE Highlight_line_count(const Highlighter *h);
+
+#endif // HIGHLIGHT_H
@@ -0,0 +1,100 @@
+// File: jump.c
+// -----------------------
+#include <curses.h>        // for WINDOW, newwin, delwin, wgetch, mvwprintw, werase, wrefresh, wattron, wattroff, box
+#include <stdlib.h>        // for malloc, free
+#include <string.h>        // for strdup
+// Local includes
+#include <frecency.h>      // for Frecency_search, Frecency_sync, Frecency_poll, FRECENCY_MAX_QUERY
+#include <fsio.h>          // for Fsio_poll
+#include <jump.h>          // for jump_view
+#include <utils.h>         // for MIN, MAX, SIZE
+
+static void draw(WINDOW *win, const char *query, const char **results, SIZE count, SIZE cursor) {
+    int lines, cols;
+    getmaxyx(win, lines, cols);
+
+    werase(win);
+    box(win, 0, 0);
+    mvwprintw(win, 0, 2, "Jump to directory");
+    mvwprintw(win, 1, 2, "> %.*s", MAX(cols - 6, 1), query);
+
+    for (SIZE i = 0; i < count && i < lines - 5; i++) {
+        if (i == cursor)
+            wattron(win, A_REVERSE);
+        mvwprintw(win, 3 + i, 2, "%.*s", MAX(cols - 4, 1), results[i]);
+        if (i == cursor)
+            wattroff(win, A_REVERSE);
+    }
+    if (count == 0)
+        mvwprintw(win, 3, 2, query[0] ? "No visited directory matches" : "No directory visited yet");
+
+    mvwprintw(win, lines - 1, 2, "Type to filter, up/down to select, enter to go, esc to cancel");
+    wrefresh(win);
+}
+
+char *jump_view(void) {
+    // What the other instances visited since
+    Frecency_sync();
+
+    WINDOW *win = newwin(LINES, COLS, 0, 0);
+    keypad(win, TRUE);
+    wtimeout(win, 100);
+
+    SIZE max = MAX(LINES - 5, 1);
+    const char **results = malloc(max * sizeof(const char *));
+    char query[FRECENCY_MAX_QUERY + 1] = "";
+    SIZE query_len = 0, cursor = 0;
+    char *chosen = NULL;
+
+    while (results != NULL) {
+        // The index may be read back meanwhile, which the results point to
+        Fsio_poll();
+        Frecency_poll();
+        SIZE count = Frecency_search(query, results, MIN(max, (SIZE)MAX(getmaxy(win) - 5, 1)));
+        cursor = count > 0 ? MIN(cursor, count - 1) : 0;
+        draw(win, query, results, count, cursor);
+
+        int ch = wgetch(win);
+        if (ch == ERR)
+            continue;
+        if (ch == 27 || ch == KEY_F(1))
+            break;
+        if (ch == '\n' || ch == KEY_ENTER) {
+            if (count > 0) {
+                chosen = strdup(results[cursor]);
+                break;
+            }
+            continue;
+        }
+
+        switch (ch) {
+            case KEY_UP:
+                cursor = cursor > 0 ? cursor - 1 : 0;
+                break;
+            case KEY_DOWN:
+                cursor = cursor + 1 < count ? cursor + 1 : cursor;
+                break;
+            case KEY_BACKSPACE:
+            case 127:
+            case 8:
+                if (query_len > 0)
+                    query[--query_len] = '\0';
+                cursor = 0;
+                break;
+            default:
+                // Bytes of UTF-8 names are matched as they are
+                if (ch >= ' ' && ch < 256 && ch != 127 && query_len < FRECENCY_MAX_QUERY) {
+                    query[query_len++] = (char)ch;
+                    query[query_len] = '\0';
+                    cursor = 0;
+                }
+                break;
+        }
+    }
+
+    werase(win);
+    wrefresh(win);
+    delwin(win);
+    free(results);
+    return chosen;
+}
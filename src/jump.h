@@ -0,0 +1,11 @@
+// File: jump.h
+// -----------------------
+#ifndef JUMP_H
+#define JUMP_H
+
+// Asks for a directory among those visited before, narrowed down by what the
+// user types and ranked by Frecency_search. Returns the chosen path, to be
+// freed, or NULL if the user left with Esc.
+char *jump_view(void);
+
+#endif // JUMP_H
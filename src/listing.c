@@ -0,0 +1,552 @@
+// File: listing.c
+// -----------------------
+#define _GNU_SOURCE              // for strdup, O_PATH, struct stat st_mtim, clock_gettime, CLOCK_MONOTONIC
+#include <errno.h>               // for errno, ENOENT, ENOTDIR
+#include <fcntl.h>               // for open, openat, O_PATH, O_DIRECTORY, O_CLOEXEC, AT_SYMLINK_NOFOLLOW
+#include <stdlib.h>              // for calloc, free, qsort, bsearch
+#include <string.h>              // for memset, strcmp, strdup
+#include <sys/stat.h>            // for stat, fstat, fstatat, struct stat, S_ISDIR, S_ISLNK
+#include <time.h>                // for struct timespec, clock_gettime
+#include <unistd.h>              // for dup, close
+// Local includes
+#include <files.h>               // for FileAttr, FileAttr_get_name, FileAttr_is_dir, FileAttr_get_meta, mk_attr, append_files_to_vec_cancellable
+#include <fsio.h>                // for Fsio_submit, FSIO_DEADLINE_LIST
+#include <listing.h>             // for Listing, LISTING_SLOTS
+#include <metadata.h>            // for Metadata_forget
+#include <prefetch.h>            // for Prefetch_take
+#include <tar.h>                 // for Tar_stat, Tar_in_archive
+#include <utils.h>               // for MAX, is_directory, same_dir_state, elapsed_ms
+#include <vector.h>              // for Vector, Vector_new, Vector_bye, Vector_add, Vector_len, Vector_set_len, Vector_set_len_no_free, Vector_sane_cap
+#include <watch.h>               // for Watch_add, Watch_subscribe, Watch_unsubscribe, Watch_drop_unused, WatchEvent
+#include <workpool.h>            // for Job, Job_new, Job_cancel, Job_cancelled
+
+// Filled on the worker, moved into the listing on the UI thread
+typedef struct {
+    // NULL once the listing is gone. Both kinds of jobs start with it.
+    Listing *listing;
+    char *path;
+    // Handle of the directory, looked up as `name` in `at` if it's -1. Both
+    // stay -1 for archives, which go by `path`.
+    int fd;
+    int at;
+    char *name;
+    // Added before reading, so nothing that changes meanwhile is missed
+    int wd;
+    // Only read the directory if its identity isn't `known` anymore
+    bool check;
+    struct stat known;
+    struct stat st;
+    bool changed;
+    bool complete;
+    bool in_archive;
+    Vector files;
+} ListingRead;
+
+// An entry the watch reported, as it is now
+typedef struct {
+    const char *name;
+    bool exists;
+    bool is_dir;
+    ino_t inode;
+    // Found in the listing while patching it
+    bool listed;
+} EntryChange;
+
+// Stats the names the watch reported, whose entries are then patched into
+// the listing on the UI thread
+typedef struct {
+    Listing *listing;
+    char *path;
+    int fd;
+    // Sorted and without duplicates once run, `entries` points into it
+    Vector names;
+    EntryChange *entries;
+    size_t count;
+    bool failed;
+} ListingChange;
+
+static Listing *listings[LISTING_SLOTS];
+static unsigned long use_clock;
+
+static void identity(const char *path, struct stat *st) {
+    // Directories inside archives change along with the archive
+    if (stat(path, st) != 0 && !Tar_stat(path, st))
+        memset(st, 0, sizeof(*st));
+}
+
+static void close_fd(int *fd) {
+    if (*fd != -1)
+        close(*fd);
+    *fd = -1;
+}
+
+static void listing_run(Job *job) {
+    ListingRead *r = job->data;
+
+    // Only the first read looks the directory up, relative to its parent
+    if (r->fd == -1)
+        r->fd = r->at != -1
+            ? openat(r->at, r->name, O_PATH | O_DIRECTORY | O_CLOEXEC)
+            : open(r->path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+    if (r->fd != -1) {
+        r->wd = Watch_add(r->fd);
+        if (fstat(r->fd, &r->st) == -1)
+            memset(&r->st, 0, sizeof(r->st));
+    } else {
+        // Archives aren't directories, they're watched as the file they are
+        // and read by their path
+        int file = open(r->path, O_PATH | O_CLOEXEC);
+        r->wd = Watch_add(file);
+        close_fd(&file);
+        identity(r->path, &r->st);
+        r->in_archive = Tar_in_archive(r->path);
+    }
+    if (r->check && same_dir_state(&r->st, &r->known))
+        return;
+
+    r->changed = true;
+    r->complete = append_files_to_vec_cancellable(&r->files, r->fd, r->path, &job->cancelled);
+    Vector_sane_cap(&r->files);
+}
+
+static void free_read(ListingRead *r) {
+    Vector_bye(&r->files);
+    close_fd(&r->fd);
+    close_fd(&r->at);
+    free(r->name);
+    free(r->path);
+    free(r);
+}
+
+// The directory was found, where it was looked up doesn't matter anymore
+static void adopt_handle(Listing *l, int *fd) {
+    if (l->fd != -1 || *fd == -1)
+        return;
+    l->fd = *fd;
+    *fd = -1;
+    close_fd(&l->at);
+    free(l->name);
+    l->name = NULL;
+}
+
+static void free_listing(Listing *l) {
+    Watch_unsubscribe(l->wd, l);
+    close_fd(&l->fd);
+    close_fd(&l->at);
+    free(l->name);
+    Metadata_forget(&l->files);
+    Vector_bye(&l->files);
+    Vector_bye(&l->changes);
+    free(l->path);
+    free(l);
+}
+
+static void drop(Listing *l) {
+    for (size_t i = 0; i < LISTING_SLOTS; i++)
+        if (listings[i] == l)
+            listings[i] = NULL;
+    free_listing(l);
+}
+
+static void clear_changes(Listing *l) {
+    Vector_set_len(&l->changes, 0);
+}
+
+static void listing_event(void *owner, const WatchEvent *event) {
+    Listing *l = owner;
+
+    if (event->name == NULL) {
+        // Events were lost, or the directory itself went away. Archives only
+        // tell that the whole file was written.
+        if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_IGNORED))
+            l->rescan = true;
+        else if (l->in_archive && (event->mask & IN_CLOSE_WRITE))
+            l->rescan = true;
+        return;
+    }
+    if (l->rescan)
+        return;
+
+    size_t n = Vector_len(l->changes);
+    // Bursts of writes to the same file are the usual case, the worker sorts
+    // out the rest of the duplicates
+    if (n > 0 && strcmp(l->changes.el[n - 1], event->name) == 0)
+        return;
+    char *name = n < LISTING_MAX_CHANGES ? strdup(event->name) : NULL;
+    if (name == NULL) {
+        clear_changes(l);
+        l->rescan = true;
+        return;
+    }
+    if (n == 0)
+        clock_gettime(CLOCK_MONOTONIC, &l->first_change);
+    Vector_add(&l->changes, 1);
+    l->changes.el[n] = name;
+    Vector_set_len_no_free(&l->changes, n + 1);
+}
+
+// The listing gets the events of `wd` instead of the watch it had
+static void adopt_watch(Listing *l, int wd) {
+    if (wd == l->wd)
+        return;
+    Watch_unsubscribe(l->wd, l);
+    l->wd = Watch_subscribe(wd, listing_event, l) ? wd : -1;
+    if (l->wd == -1)
+        Watch_drop_unused(wd);
+}
+
+static void submit_read(Listing *l);
+
+// Reopened while the job ran: the watch may have been dropped meanwhile, so
+// it's added again and the directory checked
+static void after_job(Listing *l) {
+    if (l->recheck && l->job == NULL && l->refs > 0)
+        submit_read(l);
+}
+
+static void listing_done(Job *job) {
+    ListingRead *r = job->data;
+    Listing *l = r->listing;
+    bool watched = false;
+
+    if (l != NULL) {
+        l->job = NULL;
+        if (!job->ran || Job_cancelled(job) || (r->changed && !r->complete)) {
+            // Closed while it was read, unless it was opened again since
+            if (l->refs > 0)
+                submit_read(l);
+            else if (l->loading)
+                drop(l);
+        } else {
+            // A listing nobody has open isn't kept up to date
+            if (l->refs > 0) {
+                adopt_watch(l, r->wd);
+                watched = true;
+            }
+            adopt_handle(l, &r->fd);
+            l->in_archive = r->in_archive;
+            l->st = r->st;
+            if (r->changed) {
+                // Results of metadata jobs for the old entries must not land
+                // in the new ones
+                Metadata_forget(&l->files);
+                Vector_bye(&l->files);
+                l->files = r->files;
+                r->files = Vector_new(0);
+                l->generation++;
+            }
+            l->loading = false;
+            after_job(l);
+        }
+    }
+    if (!watched)
+        Watch_drop_unused(r->wd);
+
+    free_read(r);
+}
+
+static void submit_read(Listing *l) {
+    ListingRead *r = calloc(1, sizeof(ListingRead));
+    char *path = strdup(l->path);
+    char *name = l->name != NULL ? strdup(l->name) : NULL;
+    Job *job = r != NULL && path != NULL && (name != NULL || l->name == NULL)
+        ? Job_new(listing_run, listing_done, r, JOB_PRIO_HIGH)
+        : NULL;
+    if (job == NULL) {
+        free(r);
+        free(path);
+        free(name);
+        // Better empty than loading forever
+        l->loading = false;
+        return;
+    }
+
+    r->listing = l;
+    r->path = path;
+    r->name = name;
+    // The worker's own copies, the listing may close its own meanwhile. If
+    // there are no descriptors left, the path is looked up instead.
+    r->fd = l->fd != -1 ? dup(l->fd) : -1;
+    r->at = l->fd == -1 && l->at != -1 ? dup(l->at) : -1;
+    r->wd = -1;
+    r->check = !l->loading && !l->force;
+    r->known = l->st;
+    r->files = Vector_new(10);
+    l->force = false;
+    l->recheck = false;
+    l->job = job;
+    Fsio_submit(job, l->path, FSIO_DEADLINE_LIST);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int compare_change(const void *name, const void *entry) {
+    return strcmp(name, ((const EntryChange *)entry)->name);
+}
+
+static void change_run(Job *job) {
+    ListingChange *c = job->data;
+
+    size_t len = Vector_len(c->names), n = 0;
+    qsort(c->names.el, len, sizeof(char *), compare_names);
+    for (size_t i = 0; i < len; i++) {
+        if (n > 0 && strcmp(c->names.el[n - 1], c->names.el[i]) == 0)
+            free(c->names.el[i]);
+        else
+            c->names.el[n++] = c->names.el[i];
+    }
+    Vector_set_len_no_free(&c->names, n);
+
+    c->entries = calloc(MAX(n, 1), sizeof(EntryChange));
+    if (c->entries == NULL || c->fd == -1) {
+        c->failed = true;
+        return;
+    }
+
+    for (size_t i = 0; i < n && !Job_cancelled(job); i++) {
+        EntryChange *e = &c->entries[i];
+        struct stat st;
+        e->name = c->names.el[i];
+        if (fstatat(c->fd, e->name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            e->exists = true;
+            e->inode = st.st_ino;
+            // Links are listed as what they point to, like readdir entries
+            e->is_dir = S_ISLNK(st.st_mode) ? is_directory(c->fd, e->name) : S_ISDIR(st.st_mode);
+        } else {
+            // Whatever can't be stat'ed is still there, as append_files_to_vec
+            // would list it
+            e->exists = errno != ENOENT && errno != ENOTDIR;
+            e->is_dir = e->exists;
+        }
+        c->count++;
+    }
+}
+
+// Removes the entries that are gone, replaces the ones that changed type and
+// adds the new ones at the end, where readdir tends to return them too
+static void apply_changes(Listing *l, ListingChange *c) {
+    // The entries move around, in-flight metadata is thrown away and fetched
+    // again for whatever is on screen
+    Metadata_forget(&l->files);
+
+    size_t len = Vector_len(l->files), kept = 0;
+    for (size_t i = 0; i < len; i++) {
+        FileAttr fa = l->files.el[i];
+        FileMeta *meta = FileAttr_get_meta(fa);
+        if (meta->state == META_PENDING)
+            meta->state = META_STALE;
+
+        EntryChange *e = bsearch(FileAttr_get_name(fa), c->entries, c->count, sizeof(EntryChange), compare_change);
+        if (e != NULL) {
+            e->listed = true;
+            if (!e->exists) {
+                free(fa);
+                continue;
+            }
+            FileAttr replacement = e->is_dir != FileAttr_is_dir(fa) ? mk_attr(e->name, e->is_dir, e->inode) : NULL;
+            if (replacement != NULL) {
+                free(fa);
+                fa = replacement;
+            } else if (meta->state == META_READY) {
+                meta->state = META_STALE;
+            }
+        }
+        l->files.el[kept++] = fa;
+    }
+    Vector_set_len_no_free(&l->files, kept);
+
+    size_t added = 0;
+    for (size_t i = 0; i < c->count; i++)
+        added += c->entries[i].exists && !c->entries[i].listed;
+    Vector_add(&l->files, added);
+    for (size_t i = 0; i < c->count; i++) {
+        const EntryChange *e = &c->entries[i];
+        if (!e->exists || e->listed)
+            continue;
+        FileAttr fa = mk_attr(e->name, e->is_dir, e->inode);
+        if (fa != NULL)
+            l->files.el[kept++] = fa;
+    }
+    Vector_set_len_no_free(&l->files, kept);
+    l->generation++;
+}
+
+static void change_done(Job *job) {
+    ListingChange *c = job->data;
+    Listing *l = c->listing;
+
+    if (l != NULL) {
+        l->job = NULL;
+        // What changed would be lost, the directory is read again instead
+        if (!job->ran || Job_cancelled(job) || c->failed)
+            l->rescan = true;
+        else
+            apply_changes(l, c);
+        after_job(l);
+    }
+
+    Vector_bye(&c->names);
+    close_fd(&c->fd);
+    free(c->entries);
+    free(c->path);
+    free(c);
+}
+
+static void submit_changes(Listing *l) {
+    ListingChange *c = calloc(1, sizeof(ListingChange));
+    char *path = strdup(l->path);
+    Job *job = c != NULL && path != NULL ? Job_new(change_run, change_done, c, JOB_PRIO_HIGH) : NULL;
+    if (job == NULL) {
+        free(c);
+        free(path);
+        // Tried again by the next Listing_poll
+        return;
+    }
+
+    c->listing = l;
+    c->path = path;
+    c->fd = l->fd != -1 ? dup(l->fd) : -1;
+    c->names = l->changes;
+    l->changes = Vector_new(16);
+    l->job = job;
+    Fsio_submit(job, l->path, FSIO_DEADLINE_STAT);
+}
+
+static Listing *find(const char *path) {
+    for (size_t i = 0; i < LISTING_SLOTS; i++)
+        if (listings[i] != NULL && strcmp(listings[i]->path, path) == 0)
+            return listings[i];
+    return NULL;
+}
+
+// Returns a free slot, evicting the least recently used listing that is
+// neither open nor being read if needed
+static Listing **grab_slot(void) {
+    Listing **victim = NULL;
+    for (size_t i = 0; i < LISTING_SLOTS; i++) {
+        Listing *l = listings[i];
+        if (l == NULL)
+            return &listings[i];
+        if (l->refs == 0 && l->job == NULL && (victim == NULL || l->last_use < (*victim)->last_use))
+            victim = &listings[i];
+    }
+    if (victim != NULL) {
+        free_listing(*victim);
+        *victim = NULL;
+    }
+    return victim;
+}
+
+Listing *Listing_open(const char *path, int at, const char *name) {
+    Listing *l = find(path);
+    if (l != NULL) {
+        l->refs++;
+        l->last_use = ++use_clock;
+        if (l->job == NULL)
+            submit_read(l);
+        else if (l->refs == 1)
+            l->recheck = true;
+        return l;
+    }
+
+    Listing **slot = grab_slot();
+    if (slot == NULL)
+        return NULL;
+    l = calloc(1, sizeof(Listing));
+    if (l == NULL)
+        return NULL;
+    l->path = strdup(path);
+    if (l->path == NULL) {
+        free(l);
+        return NULL;
+    }
+    l->files = Vector_new(10);
+    l->changes = Vector_new(16);
+    l->wd = -1;
+    l->fd = -1;
+    l->at = at != -1 && name != NULL ? dup(at) : -1;
+    l->name = l->at != -1 ? strdup(name) : NULL;
+    if (l->name == NULL)
+        close_fd(&l->at);
+    // The cursor usually rested on the entry long enough for the prefetcher
+    // to read it already, it only needs to be checked then
+    int prefetched = -1;
+    l->loading = !Prefetch_take(path, &l->files, &l->st, &prefetched);
+    adopt_handle(l, &prefetched);
+    l->refs = 1;
+    l->last_use = ++use_clock;
+    *slot = l;
+    submit_read(l);
+    return l;
+}
+
+void Listing_close(Listing *l) {
+    if (l == NULL)
+        return;
+    l->refs--;
+    l->last_use = ++use_clock;
+    if (l->refs > 0)
+        return;
+
+    // Cached listings are checked when they're opened again instead
+    Watch_unsubscribe(l->wd, l);
+    l->wd = -1;
+    clear_changes(l);
+    l->rescan = false;
+    // Nobody waits for it anymore
+    if (l->loading && l->job != NULL)
+        Job_cancel(l->job);
+}
+
+bool Listing_is_cached(const char *path) {
+    const Listing *l = find(path);
+    return l != NULL && !l->loading;
+}
+
+void Listing_reload(Listing *l) {
+    l->force = true;
+    // Read again by listing_done, or by Listing_poll after change_done
+    if (l->job != NULL)
+        Job_cancel(l->job);
+    else
+        submit_read(l);
+}
+
+void Listing_poll(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (size_t i = 0; i < LISTING_SLOTS; i++) {
+        Listing *l = listings[i];
+        // One job per listing, changes wait for the one in flight
+        if (l == NULL || l->refs == 0 || l->loading || l->job != NULL)
+            continue;
+
+        if (l->rescan) {
+            // The read sees whatever the names were about
+            l->rescan = false;
+            clear_changes(l);
+            l->force = true;
+            submit_read(l);
+        } else if (Vector_len(l->changes) > 0 && elapsed_ms(&l->first_change, &now) >= LISTING_COALESCE_MS) {
+            submit_changes(l);
+        }
+    }
+}
+
+void Listing_bye(void) {
+    for (size_t i = 0; i < LISTING_SLOTS; i++) {
+        Listing *l = listings[i];
+        if (l == NULL)
+            continue;
+        if (l->job != NULL) {
+            *(Listing **)l->job->data = NULL;
+            Job_cancel(l->job);
+        }
+        free_listing(l);
+        listings[i] = NULL;
+    }
+}
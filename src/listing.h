@@ -0,0 +1,78 @@
+// File: listing.h
+// -----------------------
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <stdbool.h>  // for bool
+#include <sys/stat.h> // for struct stat
+#include <time.h>     // for struct timespec
+#include <vector.h>   // for Vector
+#include <workpool.h> // for Job
+
+// Directories listed at once, open or kept for when they are opened again.
+// Must be larger than the number of tabs.
+#define LISTING_SLOTS 16
+// Changes reported by inotify are collected for this long before the
+// entries they name are stat'ed and patched into the listing
+#define LISTING_COALESCE_MS 100
+// Past this many changed names the directory is just read again
+#define LISTING_MAX_CHANGES 4096
+
+// The entries of a directory, shared by every tab showing it. Their
+// metadata lives in the entries, so it's shared too.
+typedef struct {
+    char *path;
+    Vector files;
+    // Handle (O_PATH) of the directory everything is read through, -1 until
+    // the first read found it and for archives, which go by `path`
+    int fd;
+    // Where the first read looks it up: `name` in the directory handle `at`
+    int at;
+    char *name;
+    // Identity of the directory when it was read, used to detect stale data
+    struct stat st;
+    // Not read yet, `files` is empty
+    bool loading;
+    bool in_archive;
+    // Read or check in flight
+    Job *job;
+    // The next read must not be skipped even if the directory looks the same
+    bool force;
+    int refs;
+    // For LRU eviction of listings nobody has open
+    unsigned long last_use;
+    // Bumped whenever `files` changes, so tabs can find their entry again
+    unsigned long generation;
+    // inotify watch of an open listing, -1 if there's none
+    int wd;
+    // Names the watch reported since the last update, and when the first one
+    // came in
+    Vector changes;
+    struct timespec first_change;
+    // Events were lost or the directory itself went away, read it again
+    bool rescan;
+    // Opened again while a job was in flight, check it once that's done
+    bool recheck;
+} Listing;
+
+// Returns the listing of `path` right away, which is `name` in the directory
+// handle `at` (kept by the caller, -1 to look `path` up from the root). It's
+// read through fsio if it isn't cached, `loading` is set until then. A cached listing is shown as is
+// while a worker checks whether the directory changed, and replaced if it
+// did. Open listings are watched with inotify and kept up to date by
+// Listing_poll. NULL if there's no memory or every slot is busy.
+Listing *Listing_open(const char *path, int at, const char *name);
+void Listing_close(Listing *l);
+// Whether there's a listing of `path` already, there's no point in
+// prefetching it then
+bool Listing_is_cached(const char *path);
+// Reads the directory again, for everyone that has it open
+void Listing_reload(Listing *l);
+// Patches the changes the watches reported into the open listings, removing
+// the entries that are gone and adding the new ones at the end. Once per
+// main loop iteration, after Watch_poll.
+void Listing_poll(void);
+// Frees the cached listings, they must all be closed
+void Listing_bye(void);
+
+#endif // LISTING_H
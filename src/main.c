@@ -2,22 +2,55 @@
 // -----------------------
 #include <stdio.h>     // for snprintf
 #include <stdlib.h>    // for free, malloc
-#include <unistd.h>    // for getenv
-#include <curses.h>    // for initscr, noecho, cbreak, keypad, curs_set, timeout, endwin, LINES, COLS, getch, timeout, wtimeout, ERR, KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT, KEY_F1, newwin, subwin, box, wrefresh, werase, mvwprintw, wattron, wattroff, A_REVERSE, A_BOLD, getmaxyx, refresh
+#include <unistd.h>    // for getenv, sysconf, dup, close
+#include <curses.h>    // for initscr, noecho, cbreak, keypad, curs_set, timeout, endwin, LINES, COLS, getch, timeout, wtimeout, ERR, KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT, KEY_F1, newwin, subwin, box, wrefresh, werase, mvwprintw, wattron, wattroff, A_REVERSE, A_BOLD, COLOR_PAIR, waddnstr, wmove, getmaxyx, getmaxx, refresh
 #include <dirent.h>    // for opendir, readdir, closedir
 #include <sys/types.h> // for types like SIZE
 #include <sys/stat.h>  // for struct stat
-#include <string.h>    // for strlen, strcpy, strdup, strrchr, strtok, strncmp
+#include <string.h>    // for strlen, strdup, strcmp, memmove
 // Local includes
-#include <utils.h>     // for MIN, MAX
+#include <utils.h>     // for MIN, MAX, path_join, path_parent
 #include <vector.h>    // for Vector
 #include <files.h>     // for FileAttr, FileAttr_get_name, FileAttr_is_dir
 #include <vecstack.h>  // for VecStack, VecStack_empty, VecStack_push, VecStack_pop
-#include <files.h>     // for path_join, is_supported_file_type, display_file_info
+#include <files.h>     // for is_supported_file_type, display_file_info
 #include <utils.h>     // for die
-
-#define MAX_PATH_LENGTH 256
-VecStack directoryStack;
+#include <workpool.h>  // for WorkPool, WorkPool_init, WorkPool_poll, WorkPool_bye
+#include <prefetch.h>  // for Prefetch_init, Prefetch_hint, Prefetch_cancel_except
+#include <listing.h>   // for Listing, Listing_open, Listing_close, Listing_reload, Listing_is_cached, Listing_poll, Listing_bye
+#include <metadata.h>  // for Metadata_init, Metadata_request, Metadata_format
+#include <du.h>        // for du_view
+#include <dupes.h>     // for dupes_view
+#include <compare.h>   // for compare_view
+#include <tar.h>       // for Tar_bye
+#include <compressed.h> // for Compressed_format_name
+#include <highlight.h> // for HighlightLine, HighlightSpan, Highlight_init_colors
+#include <fsio.h>      // for Fsio_init, Fsio_poll, Fsio_pending, Fsio_unresponsive, Fsio_bye
+#include <preview.h>   // for Preview, Preview_init, Preview_get, Preview_bye
+#include <watch.h>     // for Watch_init, Watch_poll, Watch_bye
+#include <frecency.h>  // for Frecency_init, Frecency_visit, Frecency_poll, Frecency_bye
+#include <jump.h>      // for jump_view
+#include <search.h>    // for search_view
+#include <gitstatus.h> // for GitDirStatus, GitStatus_init, GitStatus_get, GitStatus_marker, GitStatus_bye
+#include <daemon.h>    // for Daemon_run
+
+// Upper bound for the general purpose workers, the rest of the cores are left
+// for whatever the user is running next to us
+#define MAX_WORKERS 4
+// As many as '1' to '9' can switch to, LISTING_SLOTS must be larger
+#define MAX_TABS 9
+// Directories whose handles a tab keeps to go back up, above that their paths
+// are looked up again
+#define MAX_HANDLES 32
+WorkPool workPool;
+// MetaColumn flags of the columns shown next to the names, toggled with 'm'
+unsigned int metaColumns = 0;
+
+// Handle (O_PATH) of a directory that was left for one of its entries, -1 if
+// it has none (inside archives, or too deep)
+typedef struct {
+    int fd;
+} DirHandle;
 
 typedef struct {
     SIZE start;
@@ -26,17 +59,35 @@ typedef struct {
     SIZE num_files;
 } CursorAndSlice;
 
-// Function to update the stack when navigating left or right
-void updateDirectoryStack(const char *newDirectory) {
-    char *token;
-    char *copy = strdup(newDirectory);
-
-    // Push each directory onto the stack
-    for (token = strtok(copy, "/"); token; token = strtok(NULL, "/")) {
-        VecStack_push(&directoryStack, strdup(token));
-    }
-
-    free(copy);
+// A place in the tree with its own cursor and scroll state. Tabs showing the
+// same directory share its Listing, so it's read and stored only once.
+typedef struct {
+    Listing *listing;
+    // DirHandles of the directories entered to get here, the parent last
+    VecStack stack;
+    CursorAndSlice cas;
+    // First line shown by the preview
+    SIZE preview_start;
+    // Entry under the cursor as of `generation` of the listing, the cursor
+    // follows it when entries come and go
+    char *selected;
+    unsigned long generation;
+} Tab;
+
+Tab tabs[MAX_TABS];
+int numTabs = 0;
+// Tabs shown by the left and right panes, the right one shows the preview
+// unless dualPane is set
+int paneTabs[2] = { 0, 0 };
+int focusedPane = 0;
+bool dualPane = false;
+
+// Whether the entry may be a directory or an archive worth reading ahead.
+// Only the name is looked at, this runs on every cursor move.
+bool looks_enterable(FileAttr fa) {
+    const char *name = FileAttr_get_name(fa);
+    size_t len = strlen(name);
+    return FileAttr_is_dir(fa) || (len > 4 && strcmp(name + len - 4, ".tar") == 0);
 }
 
 bool is_hidden(const char *filename) {
@@ -45,47 +96,68 @@ bool is_hidden(const char *filename) {
 
 void draw_directory_window(
     WINDOW *window,
-    const char *directory,
+    const char *title,
     FileAttr *files,
     SIZE files_len,
-    SIZE selected_entry
+    SIZE selected_entry,
+    unsigned int meta_columns,
+    const GitDirStatus *git,
+    bool active
 ) {
     [[maybe_unused]]
     int cols, lines;
     getmaxyx(window, lines, cols);
 
+    int meta_width = Metadata_columns_width(meta_columns);
+    // Inside a work tree the names make room for the git status markers
+    int name_x = git != NULL ? 5 : 2;
+
     werase(window);
     box(window, 0, 0);
-    mvwprintw(window, 0, 2, "Directory: %.*s", cols - 4, directory);
+    // In bold for the focused pane of the dual pane layout
+    if (active)
+        wattron(window, A_BOLD);
+    mvwprintw(window, 0, 2, "%.*s", cols - 4, title);
+    if (active)
+        wattroff(window, A_BOLD);
 
     for (SIZE i = 0; i < files_len; i++) {
         const char *current_name = FileAttr_get_name(files[i]);
         const char *extension = strrchr(current_name, '.');
         int extension_len = extension ? strlen(extension) : 0;
 
-        int max_display_length = cols - 4;
+        int max_display_length = cols - 2 - name_x - meta_width;
 
         if (i == selected_entry)
             wattron(window, A_REVERSE);
         if (FileAttr_is_dir(files[i]))
             wattron(window, A_BOLD);
 
+        if (git != NULL)
+            mvwprintw(window, i + 2, 2, "%s ", GitStatus_marker(git, current_name));
+
         if ((int)strlen(current_name) > max_display_length) {
             if (extension_len && extension_len + 5 < max_display_length)
                 mvwprintw(
-                    window, i + 2, 2,
+                    window, i + 2, name_x,
                     "%.*s... %s",
                     max_display_length - 4 - extension_len, current_name,
                     extension
                 );
             else
                 mvwprintw(
-                    window, i + 2, 2,
+                    window, i + 2, name_x,
                     "%.*s...",
                     max_display_length - 3, current_name
                 );
         } else {
-            mvwprintw(window, i + 2, 2, "%s", current_name);
+            mvwprintw(window, i + 2, name_x, "%s", current_name);
+        }
+
+        if (meta_columns) {
+            char meta[64];
+            Metadata_format(meta, sizeof(meta), FileAttr_get_meta(files[i]), meta_columns);
+            mvwprintw(window, i + 2, cols - 2 - meta_width, "%s", meta);
         }
 
         if (i == selected_entry)
@@ -97,48 +169,86 @@ void draw_directory_window(
     wrefresh(window);
 }
 
-void draw_preview_window(WINDOW *window, const char *current_directory, const char *selected_entry) {
+void draw_highlighted_line(WINDOW *window, int y, int x, int width, const HighlightLine *line) {
+    int len = MIN(line->len, width);
+    int pos = 0;
+
+    wmove(window, y, x);
+    for (int i = 0; i < line->num_spans && pos < len; i++) {
+        const HighlightSpan *span = &line->spans[i];
+        int start = MIN(span->start, len);
+        int end = MIN(span->start + span->len, len);
+        if (start > pos)
+            waddnstr(window, line->text + pos, start - pos);
+        wattron(window, COLOR_PAIR(span->cls));
+        waddnstr(window, line->text + start, end - start);
+        wattroff(window, COLOR_PAIR(span->cls));
+        pos = end;
+    }
+    if (len > pos)
+        waddnstr(window, line->text + pos, len - pos);
+}
+
+// Everything comes from the workers, see preview.h
+void draw_preview_window(WINDOW *window, const Listing *listing, const char *selected_entry, SIZE *first_line, bool active) {
     // Clear the window
     werase(window);
 
     // Draw a border around the window
     box(window, 0, 0);
 
-    // Display the selected entry path
-    char file_path[MAX_PATH_LENGTH];
-    path_join(file_path, current_directory, selected_entry);
-    mvwprintw(window, 0, 2, "Selected Entry: %.*s", COLS - 4, file_path);
-
+    // Display the selected entry path, in bold while the arrows scroll the
+    // preview
+    char *file_path = path_join(listing->path, selected_entry);
+    if (file_path == NULL) {
+        wrefresh(window);
+        return;
+    }
     // Get the window's dimensions
     int max_x, max_y;
     getmaxyx(window, max_y, max_x);
 
-    // Display file info
-    display_file_info(window, file_path, max_x);
+    if (active)
+        wattron(window, A_BOLD);
+    mvwprintw(window, 0, 2, "Selected Entry: %.*s", MAX(max_x - 20, 0), file_path);
+    if (active)
+        wattroff(window, A_BOLD);
 
-    // Check if the selected entry is a supported file type
-    if (is_supported_file_type(file_path)) {
-        FILE *file = fopen(file_path, "r");
-        if (file) {
-            char line[256];
-            int line_num = 5; // Start displaying file content from line 5
+    // Text starts on line 7, compressed data on line 7 too but without the
+    // blank line after it
+    const Preview *preview = Preview_get(
+        file_path, listing->fd, selected_entry,
+        first_line, MIN(max_y - 9, PREVIEW_MAX_ROWS)
+    );
+    free(file_path);
 
+    // Display file info
+    if (preview->stat_failed)
+        mvwprintw(window, 1, 2, "Unable to retrieve file information");
+    else if (preview->have_stat)
+        display_file_info(window, &preview->st, preview->dir_size, max_x);
+
+    int line_num = 5;
+    if (preview->loading) {
+        mvwprintw(window, line_num, 2, "Loading...");
+    } else if (preview->kind == PREVIEW_UNREADABLE) {
+        if (preview->format != COMPRESSED_NONE)
+            mvwprintw(window, 6, 2, "Unable to decompress %s data", Compressed_format_name(preview->format));
+        else
+            mvwprintw(window, line_num, 2, "Unable to open file for preview");
+    } else if (preview->kind != PREVIEW_NONE) {
+        if (preview->kind == PREVIEW_TEXT) {
             // Add a blank line before the file content
             mvwprintw(window, line_num++, 2, " ");
-
             // add a line, mentioning "Previewing file: <filename>"
-			            mvwprintw(window, line_num++, 2, "Previewing file: %s", selected_entry);
-			while (fgets(line, sizeof(line), file) && line_num < max_y - 2) {
-                mvwprintw(window, line_num++, 2, "%.*s", max_x - 2, line);
-            }
-
-            // Add a blank line after the file content
-            mvwprintw(window, line_num++, 2, " ");
-
-            fclose(file);
+            mvwprintw(window, line_num++, 2, "Previewing file: %s", selected_entry);
         } else {
-            mvwprintw(window, 5, 2, "Unable to open file for preview");
+            line_num = 6;
+            mvwprintw(window, line_num++, 2, "Previewing %s compressed file: %s",
+                      Compressed_format_name(preview->format), selected_entry);
         }
+        for (SIZE i = 0; i < preview->num_lines && line_num < max_y - 2; i++)
+            draw_highlighted_line(window, line_num++, 2, max_x - 4, &preview->lines[i]);
     }
 
     // Refresh the window
@@ -152,140 +262,352 @@ void fix_cursor(CursorAndSlice *cas) {
     cas->start = MAX(cas->start, cas->cursor + 1 - cas->num_lines);
 }
 
-void path_join(char *result, const char *base, const char *extra) {
-    size_t base_len = strlen(base);
-    size_t extra_len = strlen(extra);
-
-    if (base_len == 0) {
-        // If the base is an empty string, copy the extra to the result
-        strncpy(result, extra, MAX_PATH_LENGTH);
-    } else if (extra_len == 0) {
-        // If the extra is an empty string, copy the base to the result
-        strncpy(result, base, MAX_PATH_LENGTH);
-    } else {
-        // Check if the base ends with a slash
-        if (base[base_len - 1] == '/') {
-            // No need to skip the first character of 'extra'
-            snprintf(result, MAX_PATH_LENGTH, "%s%s", base, extra);
-        } else {
-            snprintf(result, MAX_PATH_LENGTH, "%s/%s", base, extra);
+// Name of the entry under the cursor, "" in empty directories
+const char *Tab_selected(const Tab *tab) {
+    if (Vector_len(tab->listing->files) == 0)
+        return "";
+    return FileAttr_get_name(tab->listing->files.el[tab->cas.cursor]);
+}
+
+// Index of the entry called `name`, looking at `hint` first. -1 if it's gone.
+SIZE find_entry(const Vector *files, const char *name, SIZE hint) {
+    SIZE len = Vector_len(*files);
+    if (hint < len && strcmp(FileAttr_get_name(files->el[hint]), name) == 0)
+        return hint;
+    for (SIZE i = 0; i < len; i++)
+        if (strcmp(FileAttr_get_name(files->el[i]), name) == 0)
+            return i;
+    return -1;
+}
+
+// The listing may have been reloaded by another tab or patched with what
+// changed in the directory. Keeps the cursor on the same entry, on the same
+// row, or on the one that took its place if it's gone.
+void Tab_sync(Tab *tab) {
+    const Listing *listing = tab->listing;
+    if (tab->generation != listing->generation) {
+        tab->generation = listing->generation;
+        SIZE found = tab->selected != NULL ? find_entry(&listing->files, tab->selected, tab->cas.cursor) : -1;
+        if (found >= 0) {
+            tab->cas.start = MAX(found - (tab->cas.cursor - tab->cas.start), 0);
+            tab->cas.cursor = found;
         }
     }
 
-    // Ensure null-terminated
-    result[MAX_PATH_LENGTH - 1] = '\0';
+    tab->cas.num_lines = LINES - 5;
+    tab->cas.num_files = Vector_len(listing->files);
+    fix_cursor(&tab->cas);
+
+    // What's selected is looked for once the entries are there
+    const char *name = Tab_selected(tab);
+    if (!listing->loading && (tab->selected == NULL || strcmp(tab->selected, name) != 0)) {
+        free(tab->selected);
+        tab->selected = strdup(name);
+    }
+}
+
+bool Tab_open(Tab *tab, const char *path) {
+    Listing *listing = Listing_open(path, -1, NULL);
+    if (listing == NULL)
+        return false;
+    *tab = (Tab){
+        .listing = listing,
+        .stack = VecStack_empty(),
+        .cas = { .num_lines = LINES - 5, .num_files = Vector_len(listing->files) },
+        .generation = listing->generation,
+    };
+    Frecency_visit(listing->path);
+    return true;
 }
 
-void reload_directory(Vector *files, const char *current_directory) {
-    // Empties the vector
-    Vector_set_len(files, 0);
-    // Reads the filenames
-    append_files_to_vec(files, current_directory);
-    // Makes the vector shorter
-    Vector_sane_cap(files);
+static void Tab_drop_handles(Tab *tab) {
+    DirHandle *handle;
+    while ((handle = VecStack_pop(&tab->stack)) != NULL) {
+        if (handle->fd != -1)
+            close(handle->fd);
+        free(handle);
+    }
 }
 
-void navigate_up(CursorAndSlice *cas, const Vector *files, const char **selected_entry) {
-    cas->cursor -= 1;
-    fix_cursor(cas);
-    *selected_entry = FileAttr_get_name(files->el[cas->cursor]);
+void Tab_close(Tab *tab) {
+    Listing_close(tab->listing);
+    Tab_drop_handles(tab);
+    VecStack_bye(&tab->stack);
+    free(tab->selected);
 }
 
-void navigate_down(CursorAndSlice *cas, const Vector *files, const char **selected_entry) {
-    cas->cursor += 1;
-    fix_cursor(cas);
-    *selected_entry = FileAttr_get_name(files->el[cas->cursor]);
+// Shows `path` in the tab, with the cursor on the first entry. It's `name` in
+// the directory handle `at`, see Listing_open.
+bool Tab_chdir(Tab *tab, const char *path, int at, const char *name) {
+    Listing *listing = Listing_open(path, at, name);
+    if (listing == NULL)
+        return false;
+    Listing_close(tab->listing);
+    tab->listing = listing;
+    tab->generation = listing->generation;
+    tab->cas.cursor = tab->cas.start = 0;
+    tab->preview_start = 0;
+    free(tab->selected);
+    tab->selected = NULL;
+    Tab_sync(tab);
+    Frecency_visit(listing->path);
+    return true;
 }
 
-void navigate_left(char **current_directory, Vector *files, CursorAndSlice *dir_window_cas) {
-    // Check if the current directory is the root directory
-    if (strcmp(*current_directory, "/") != 0) {
-        // If not the root directory, move up one level
-        char *last_slash = strrchr(*current_directory, '/');
-        if (last_slash != NULL) {
-            *last_slash = '\0'; // Remove the last directory from the path
-            reload_directory(files, *current_directory);
-        }
-    }
+// Shows `path` in the tab from wherever it was, it's looked up from the root
+bool Tab_jump(Tab *tab, const char *path) {
+    if (!Tab_chdir(tab, path, -1, NULL))
+        return false;
+    // They lead back up the old path
+    Tab_drop_handles(tab);
+    return true;
+}
 
-    // Check if the current directory is now an empty string
-    if ((*current_directory)[0] == '\0') {
-        // If empty, set it back to the root directory
-        strcpy(*current_directory, "/");
-        reload_directory(files, *current_directory);
+// Puts the cursor on `name`, now or once the listing is read
+void Tab_select(Tab *tab, const char *name) {
+    SIZE found = find_entry(&tab->listing->files, name, 0);
+    if (found >= 0) {
+        tab->cas.cursor = found;
+        fix_cursor(&tab->cas);
     }
+    free(tab->selected);
+    tab->selected = strdup(name);
+}
 
-    // Pop the last directory from the stack
-    free(VecStack_pop(&directoryStack));
+void navigate_up(Tab *tab) {
+    tab->cas.cursor -= 1;
+    fix_cursor(&tab->cas);
+    tab->preview_start = 0;
+}
 
-    // Reset selected entries and scroll positions
-    dir_window_cas->cursor = 0;
-    dir_window_cas->start = 0;
-    dir_window_cas->num_lines = LINES - 5;
-    dir_window_cas->num_files = Vector_len(*files);
+void navigate_down(Tab *tab) {
+    tab->cas.cursor += 1;
+    fix_cursor(&tab->cas);
+    tab->preview_start = 0;
 }
 
-// Function to navigate right
-void navigate_right(char **current_directory, const char *selected_entry, Vector *files, CursorAndSlice *dir_window_cas) {
-    // Check if the selected entry is a directory
-    if (!FileAttr_is_dir(files->el[dir_window_cas->cursor])) {
-        // If not a directory, simply return
+void navigate_left(Tab *tab) {
+    // Check if the current directory is the root directory
+    if (strcmp(tab->listing->path, "/") == 0)
         return;
-    }
 
-    char new_path[MAX_PATH_LENGTH];
-    path_join(new_path, *current_directory, selected_entry);
+    // If not the root directory, move up one level. The handle of the parent
+    // is used if there's one, above the directory the tab was opened on the
+    // path is looked up.
+    char *parent = path_parent(tab->listing->path);
+    const DirHandle *handle = VecStack_peek(&tab->stack);
+    bool opened = handle != NULL && handle->fd != -1
+        ? parent != NULL && Tab_chdir(tab, parent, handle->fd, ".")
+        : parent != NULL && Tab_chdir(tab, parent, -1, NULL);
+    free(parent);
+    if (!opened) {
+        mvprintw(LINES - 1, 1, "Memory allocation error");
+        refresh();
+        return;
+    }
 
-    // Save the current cursor position
-    SIZE saved_cursor = dir_window_cas->cursor;
+    // The listing has its own copy of the handle
+    DirHandle *popped = VecStack_pop(&tab->stack);
+    if (popped != NULL && popped->fd != -1)
+        close(popped->fd);
+    free(popped);
+}
 
-    // Push the selected entry onto the stack
-    char* new_entry = strdup(selected_entry);
-    if (new_entry == NULL) {
-        mvprintw(LINES - 1, 1, "Memory allocation error");
+// Function to navigate right
+void navigate_right(Tab *tab) {
+    // Check if the directory is empty
+    if (Vector_len(tab->listing->files) == 0) {
+        mvprintw(LINES - 1, 1, "Empty directory");
         refresh();
         return;
     }
-    VecStack_push(&directoryStack, new_entry);
 
-    // Update the current directory and reload files
-    free(*current_directory);
-    *current_directory = strdup(new_path);
-    if (*current_directory == NULL) {
+    // Check if the selected entry is a directory or an archive. Archives go by
+    // their name, reading their header could block on a dead mount.
+    if (!looks_enterable(tab->listing->files.el[tab->cas.cursor])) {
+        // If not, simply return
+        return;
+    }
+
+    // The directory is opened relative to this one, whose handle is pushed
+    // onto the stack to come back to it the same way
+    const Listing *listing = tab->listing;
+    const char *selected_entry = Tab_selected(tab);
+    char *new_path = path_join(listing->path, selected_entry);
+    DirHandle *handle = malloc(sizeof(DirHandle));
+    if (handle != NULL)
+        handle->fd = listing->fd != -1 && Vector_len(tab->stack.v) < MAX_HANDLES ? dup(listing->fd) : -1;
+    bool opened = new_path != NULL && handle != NULL && Tab_chdir(tab, new_path, listing->fd, selected_entry);
+    free(new_path);
+    if (!opened) {
+        if (handle != NULL && handle->fd != -1)
+            close(handle->fd);
+        free(handle);
         mvprintw(LINES - 1, 1, "Memory allocation error");
         refresh();
-        VecStack_pop(&directoryStack);  // Rollback stack operation
         return;
     }
+    VecStack_push(&tab->stack, handle);
+}
 
-    // Check if the new directory is empty
-    if (Vector_len(*files) == 0) {
-        mvprintw(LINES - 1, 1, "Empty directory");
+// Shows tab `index` in the focused pane, swapping the panes if the other one
+// shows it already
+void switch_tab(int index) {
+    if (index >= numTabs)
+        return;
+    if (dualPane && paneTabs[!focusedPane] == index)
+        paneTabs[!focusedPane] = paneTabs[focusedPane];
+    paneTabs[focusedPane] = index;
+}
+
+// Opens a tab on the directory of the focused one, sharing its listing
+void new_tab(void) {
+    if (numTabs == MAX_TABS) {
+        mvprintw(LINES - 1, 1, "No more than %d tabs", MAX_TABS);
         refresh();
-        VecStack_pop(&directoryStack);  // Rollback stack operation
         return;
     }
 
-    reload_directory(files, *current_directory);
+    const Tab *tab = &tabs[paneTabs[focusedPane]];
+    if (!Tab_open(&tabs[numTabs], tab->listing->path))
+        return;
+    tabs[numTabs].cas = tab->cas;
+    paneTabs[focusedPane] = numTabs++;
+}
+
+void close_tab(int index) {
+    // The last one stays
+    if (numTabs == 1)
+        return;
+
+    Tab_close(&tabs[index]);
+    memmove(&tabs[index], &tabs[index + 1], (numTabs - index - 1) * sizeof(Tab));
+    numTabs--;
 
-    refresh();
+    for (int pane = 0; pane < 2; pane++) {
+        if (paneTabs[pane] > index)
+            paneTabs[pane]--;
+        else if (paneTabs[pane] == index)
+            paneTabs[pane] = MIN(index, numTabs - 1);
+    }
 
-    // Restore the cursor position based on the new directory's contents
-    dir_window_cas->cursor = saved_cursor;
-    dir_window_cas->start = 0; // Reset other parameters if needed
-    dir_window_cas->num_lines = LINES - 5;
-    dir_window_cas->num_files = Vector_len(*files);
+    // Both panes ended up on the same tab
+    if (dualPane && paneTabs[0] == paneTabs[1]) {
+        if (numTabs == 1) {
+            dualPane = false;
+            focusedPane = 0;
+        } else {
+            paneTabs[!focusedPane] = (paneTabs[focusedPane] + 1) % numTabs;
+        }
+    }
+}
+
+// Replaces the preview with a second directory pane showing another tab,
+// opening one if there's a single tab
+void toggle_dual_pane(void) {
+    if (dualPane) {
+        paneTabs[0] = paneTabs[focusedPane];
+        focusedPane = 0;
+        dualPane = false;
+        return;
+    }
+
+    if (numTabs == 1) {
+        if (!Tab_open(&tabs[1], tabs[0].listing->path))
+            return;
+        tabs[1].cas = tabs[0].cas;
+        numTabs = 2;
+    }
+    paneTabs[1] = (paneTabs[0] + 1) % numTabs;
+    dualPane = true;
+}
+
+// Called whenever the user hasn't pressed anything for a whole getch()
+// timeout. If the cursor sits on a directory, start reading it in the
+// background so that entering it is instant.
+void prefetch_selected(const Tab *tab) {
+    if (Vector_len(tab->listing->files) == 0 || !looks_enterable(tab->listing->files.el[tab->cas.cursor]))
+        return;
+
+    const char *name = Tab_selected(tab);
+    char *path = path_join(tab->listing->path, name);
+    // Another tab may have it open already
+    if (path != NULL && !Listing_is_cached(path))
+        Prefetch_hint(path, tab->listing->fd, name);
+    free(path);
+}
+
+// The cursor moved: keep reading the directory under it only
+void cancel_stale_prefetches(const Tab *tab) {
+    if (Vector_len(tab->listing->files) == 0 || !looks_enterable(tab->listing->files.el[tab->cas.cursor])) {
+        Prefetch_cancel_except(NULL);
+        return;
+    }
+
+    char *path = path_join(tab->listing->path, Tab_selected(tab));
+    Prefetch_cancel_except(path);
+    free(path);
+}
+
+// Draws the listing of tab `index` in a directory window `width` columns wide
+void draw_tab(WINDOW *window, int index, int width, bool active) {
+    Tab *tab = &tabs[index];
+
+    // Only the rows on screen (and a few around them) are stat'ed
+    unsigned int shown_columns = Metadata_fit_columns(metaColumns, width - 4);
+    Metadata_request(
+        tab->listing->path, tab->listing->fd, &tab->listing->files,
+        tab->cas.start, tab->cas.num_lines,
+        shown_columns
+    );
+
+    // Room for the tab numbers, the rest is cut to the width of the window
+    char title[512];
+    if (numTabs > 1)
+        snprintf(title, sizeof(title), "[%d/%d] Directory: %s", index + 1, numTabs, tab->listing->path);
+    else
+        snprintf(title, sizeof(title), "Directory: %s", tab->listing->path);
+
+    if (tab->listing->loading) {
+        werase(window);
+        box(window, 0, 0);
+        mvwprintw(window, 0, 2, "%.*s", width - 4, title);
+        mvwprintw(window, 2, 2, "Loading...");
+        wrefresh(window);
+        return;
+    }
+
+    const GitDirStatus *git = NULL;
+    if (!tab->listing->in_archive)
+        git = GitStatus_get(tab->listing->path, tab->listing->generation);
+
+    draw_directory_window(
+        window, title,
+        (FileAttr *)&tab->listing->files.el[tab->cas.start],
+        // TODO: make sure that its impossible for num_lines to get past
+        //       num_files.
+        MIN(tab->cas.num_lines, tab->cas.num_files - tab->cas.start),
+        tab->cas.cursor - tab->cas.start,
+        shown_columns,
+        git,
+        active
+    );
 }
 
 // TODO: make it adapt itself when the screen gets resized
 
 // TODO: fix when resize the files go voer the border
-int main() {
+int main(int argc, char *argv[]) {
+    // Serves the listings of every other instance instead of showing any
+    if (argc > 1 && strcmp(argv[1], "--daemon") == 0)
+        return Daemon_run();
+
     WINDOW *mainwin;
     initscr();
     noecho();
     cbreak();
     keypad(stdscr, TRUE);
+    Highlight_init_colors();
     // Hides the cursor
     // X/Open Curses, Issue 4, Version 2
     curs_set(0);
@@ -317,45 +639,28 @@ int main() {
     box(previewwin, 0, 0);
     wrefresh(previewwin);
 
-    directoryStack = VecStack_empty();  // Initialize the directory stack
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    WorkPool_init(&workPool, MIN(MAX(cores, 1), MAX_WORKERS), 0);
+    // Listings, stats and reads never run on this thread
+    Fsio_init(PREFETCH_MAX_INFLIGHT);
+    // Directories visited here and by other instances, for jumping to them
+    Frecency_init();
+    // Open listings and the preview follow changes on disk, if inotify is there
+    Watch_init();
+    Prefetch_init();
+    Metadata_init();
+    Preview_init();
+    // Markers of what changed in git work trees
+    GitStatus_init(&workPool);
 
     // Get the default root directory ("/") or user's home directory
     const char *default_directory = getenv("HOME");
     if (default_directory == NULL)
         default_directory = "/";
 
-    char *current_directory = strdup(default_directory);
-    const char *selected_entry = "";
-
-
-    Vector files = Vector_new(10);
-    append_files_to_vec(&files, current_directory);
-
-    CursorAndSlice dir_window_cas = {
-        // Previously called start_entry_dir
-        .start = 0,
-        // Previously called selected_entry_dir
-        .cursor = 0,
-        // What used to be end_entry_dir was LINES - 6, and it represented the
-        // last valid entry. Therefore the length is LINES - 6 + 1 - start
-        .num_lines = LINES - 5,
-        // Used for cursor validation
-        .num_files = Vector_len(files),
-    };
-
-    CursorAndSlice preview_window_cas = {
-        // Previously called start_entry_preview
-        .start = 0,
-        // Previously called selected_entry_preview
-        .cursor = 0,
-        // What used to be end_entry_preview was LINES - 6, and it represented
-        // the last valid entry. Therefore the length is LINES - 6 + 1 - start
-        .num_lines = LINES - 5,
-        // FIXME: I don't think it should be validated by the number of files
-        //        since it isn't the dir window
-        .num_files = Vector_len(files),
-    };
-
+    if (!Tab_open(&tabs[0], default_directory))
+        die(1, "Could not read %s", default_directory);
+    numTabs = 1;
 
     enum {
         DIRECTORY_WIN_ACTIVE = 1,
@@ -366,62 +671,162 @@ int main() {
     while ((ch = getch()) != KEY_F(1)) {
         // Handle key presses and update screen
 
-        // Update selected_entry based on user interaction
-        selected_entry = FileAttr_get_name(files.el[dir_window_cas.cursor]);
+        // Finish whatever the workers got done since the last iteration
+        WorkPool_poll(&workPool);
+        Fsio_poll();
+        // and whatever changed in the watched directories
+        Watch_poll();
+        Listing_poll();
+        Frecency_poll();
+
+        // A tab sharing a listing with others may have reloaded it
+        for (int i = 0; i < numTabs; i++)
+            Tab_sync(&tabs[i]);
+        Tab *tab = &tabs[paneTabs[focusedPane]];
 
         // ERR is returned if nothing has been pressed for 100ms
+        if (ch == ERR && active_window == DIRECTORY_WIN_ACTIVE)
+            prefetch_selected(tab);
+
         if (ch != ERR) {
             switch (ch) {
                 // Inside the switch statement in the main function
                 case KEY_UP:
                     // Move up in the active window
-                    if (active_window == DIRECTORY_WIN_ACTIVE)
-                        navigate_up(&dir_window_cas, &files, &selected_entry);
-                    else
-                        navigate_up(&preview_window_cas, &files, &selected_entry);
+                    if (active_window == DIRECTORY_WIN_ACTIVE) {
+                        navigate_up(tab);
+                        cancel_stale_prefetches(tab);
+                    } else {
+                        // Scrolls the preview
+                        tab->preview_start = MAX(tab->preview_start - 1, 0);
+                    }
                     break;
                 case KEY_DOWN:
                     // Move down in the active window
-                    if (active_window == DIRECTORY_WIN_ACTIVE)
-                        navigate_down(&dir_window_cas, &files, &selected_entry);
+                    if (active_window == DIRECTORY_WIN_ACTIVE) {
+                        navigate_down(tab);
+                        cancel_stale_prefetches(tab);
+                    } else {
+                        // Clamped by draw_preview_window once the end is known
+                        tab->preview_start += 1;
+                    }
+                    break;
+                case KEY_PPAGE:
+                    if (active_window == PREVIEW_WIN_ACTIVE)
+                        tab->preview_start = MAX(tab->preview_start - tab->cas.num_lines, 0);
+                    break;
+                case KEY_NPAGE:
+                    if (active_window == PREVIEW_WIN_ACTIVE)
+                        tab->preview_start += tab->cas.num_lines;
+                    break;
+                case '\t':
+                    // Switches what the arrows move: the cursor or the
+                    // preview, or the cursor of the other pane
+                    if (dualPane)
+                        focusedPane = !focusedPane;
                     else
-                        navigate_down(&preview_window_cas, &files, &selected_entry);
+                        active_window = active_window == DIRECTORY_WIN_ACTIVE ? PREVIEW_WIN_ACTIVE : DIRECTORY_WIN_ACTIVE;
                     break;
                 case KEY_LEFT:
                     // Navigate left (go up in the directory tree)
-                    navigate_left(&current_directory, &files, &dir_window_cas);
-                    // Reload the file list for the new directory
-                    // (similar code as initializing the file list)
-                    // ...
-
-                    // Update selected_entry based on user interaction
-                    selected_entry = FileAttr_get_name(files.el[dir_window_cas.cursor]);
-
-                    // Reset selected entries and scroll positions
-                    dir_window_cas.cursor = preview_window_cas.cursor = 0;
-                    dir_window_cas.start = preview_window_cas.start = 0;
-                    dir_window_cas.num_lines = preview_window_cas.num_lines = LINES - 5;
-                    dir_window_cas.num_files = preview_window_cas.num_files = Vector_len(files);
+                    navigate_left(tab);
+                    cancel_stale_prefetches(tab);
                     break;
                 case KEY_RIGHT:
                     // Navigate right (go into the selected directory)
-                    navigate_right(
-                            &current_directory,
-                            FileAttr_get_name(files.el[dir_window_cas.cursor]),
-                            &files,
-                            &dir_window_cas
-                    );
-
-                    // Reload the file list for the new directory
-                    // (similar code as initializing the file list)
-                    // ...
-
-                    // FIXME: repeated code
-                    dir_window_cas.cursor = preview_window_cas.cursor = 0;
-                    dir_window_cas.start = preview_window_cas.start = 0;
-                    dir_window_cas.num_lines = preview_window_cas.num_lines = LINES - 5;
-                    dir_window_cas.num_files = preview_window_cas.num_files = Vector_len(files);
+                    navigate_right(tab);
+                    cancel_stale_prefetches(tab);
+                    break;
+                case 't':
+                    new_tab();
+                    break;
+                case 'w':
+                    close_tab(paneTabs[focusedPane]);
+                    break;
+                case 'p':
+                    // The second pane takes the place of the preview
+                    toggle_dual_pane();
+                    active_window = DIRECTORY_WIN_ACTIVE;
+                    break;
+                case '1': case '2': case '3': case '4': case '5':
+                case '6': case '7': case '8': case '9':
+                    switch_tab(ch - '1');
+                    break;
+                case 'm':
+                    // Toggle the size, mtime, mode and owner columns
+                    metaColumns = metaColumns ? 0 : META_COL_ALL;
+                    break;
+                case 'u':
+                case 'U':
+                    if (tab->listing->in_archive) {
+                        mvwprintw(mainwin, LINES - 1, 1, "Not available inside archives");
+                        break;
+                    }
+                    // Disk usage of the current directory, 'U' also counts
+                    // whatever is mounted below it
+                    du_view(tab->listing->path, ch == 'U');
+
+                    // Entries may have been deleted from the view, the other
+                    // tabs showing this directory see it too
+                    Listing_reload(tab->listing);
+                    tab->cas.cursor = tab->cas.start = 0;
+                    tab->preview_start = 0;
                     break;
+                case 'D':
+                    if (tab->listing->in_archive) {
+                        mvwprintw(mainwin, LINES - 1, 1, "Not available inside archives");
+                        break;
+                    }
+                    // Duplicate files below the current directory
+                    dupes_view(&workPool, tab->listing->path);
+
+                    Listing_reload(tab->listing);
+                    tab->cas.cursor = tab->cas.start = 0;
+                    tab->preview_start = 0;
+                    break;
+                case 'C': {
+                    // The directory of the left pane against the one of the
+                    // right pane, both have to be on screen
+                    if (!dualPane) {
+                        mvwprintw(mainwin, LINES - 1, 1, "Open a second pane with p to compare directories");
+                        break;
+                    }
+                    const Listing *left = tabs[paneTabs[0]].listing, *right = tabs[paneTabs[1]].listing;
+                    if (left->in_archive || right->in_archive) {
+                        mvwprintw(mainwin, LINES - 1, 1, "Not available inside archives");
+                        break;
+                    }
+                    compare_view(&workPool, left->path, right->path);
+                    break;
+                }
+                case 'g': {
+                    // Straight to a directory visited before, by a few
+                    // characters of its path
+                    char *target = jump_view();
+                    if (target != NULL && !Tab_jump(tab, target))
+                        mvwprintw(mainwin, LINES - 1, 1, "Could not read %.*s", COLS - 20, target);
+                    else if (target != NULL)
+                        cancel_stale_prefetches(tab);
+                    free(target);
+                    break;
+                }
+                case 's': {
+                    if (tab->listing->in_archive) {
+                        mvwprintw(mainwin, LINES - 1, 1, "Not available inside archives");
+                        break;
+                    }
+                    // Contents of the files below the current directory, the
+                    // file of the match chosen gets selected
+                    char *found = search_view(&workPool, tab->listing->path);
+                    char *dir = found != NULL ? path_parent(found) : NULL;
+                    if (dir != NULL && Tab_jump(tab, dir)) {
+                        Tab_select(tab, strrchr(found, '/') + 1);
+                        cancel_stale_prefetches(tab);
+                    }
+                    free(dir);
+                    free(found);
+                    break;
+                }
                 default:
                     // Print the key code for debugging purposes
                     mvwprintw(mainwin, LINES - 1, 1, "Key pressed: %d", ch);
@@ -429,25 +834,49 @@ int main() {
             }
         }
 
-        // Draw the directory window
-        draw_directory_window(
-            dirwin, current_directory,
-            (FileAttr *)&files.el[dir_window_cas.start],
-            // TODO: make sure that its impossible for num_lines to get past
-            //       num_files.
-            MIN(dir_window_cas.num_lines, dir_window_cas.num_files - dir_window_cas.start),
-            dir_window_cas.cursor - dir_window_cas.start
-        );
-
-        // Draw the preview window
-        draw_preview_window(previewwin, current_directory, selected_entry);
+        // The keys may have opened, closed or switched tabs
+        for (int i = 0; i < numTabs; i++)
+            Tab_sync(&tabs[i]);
+        tab = &tabs[paneTabs[focusedPane]];
+
+        // Draw the directory window, and the second pane or the preview
+        draw_tab(dirwin, paneTabs[0], dir_win_width, dualPane && focusedPane == 0);
+        if (dualPane)
+            draw_tab(previewwin, paneTabs[1], preview_win_width, focusedPane == 1);
+        else
+            draw_preview_window(
+                previewwin, tab->listing, Tab_selected(tab),
+                &tab->preview_start, active_window == PREVIEW_WIN_ACTIVE
+            );
+
+        // Whatever is stuck keeps being waited for on its worker
+        const char *unresponsive = Fsio_unresponsive();
+        if (unresponsive != NULL) {
+            wattron(mainwin, A_REVERSE);
+            mvwprintw(mainwin, LINES - 1, 2, " %.*s is not responding ", COLS - 24, unresponsive);
+            wattroff(mainwin, A_REVERSE);
+        }
 
         // Refresh the main window
         wrefresh(mainwin);
+
+        // Results the user waits for show up sooner
+        timeout(Fsio_pending() ? 10 : 100);
     }
 
-    Vector_bye(&files);
-    free(current_directory);
+    Prefetch_bye();
+    Metadata_bye();
+    Preview_bye();
+    GitStatus_bye();
+    WorkPool_bye(&workPool);
+    Fsio_bye();
+    Frecency_bye();
+    Tar_bye();
+
+    for (int i = 0; i < numTabs; i++)
+        Tab_close(&tabs[i]);
+    Listing_bye();
+    Watch_bye();
 
     // Clean up
     endwin();
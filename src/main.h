@@ -5,6 +5,6 @@
 #ifndef CUPIDFM_MAIN_H
 #define CUPIDFM_MAIN_H
 
-void path_join(char *result, const char *path1, const char *path2);
+char *path_join(const char *base, const char *extra);
 
 #endif //CUPIDFM_MAIN_H
@@ -0,0 +1,451 @@
+// File: metadata.c
+// -----------------------
+#define _GNU_SOURCE        // for statx, AT_STATX_DONT_SYNC
+#include <fcntl.h>         // for open, O_RDONLY, O_DIRECTORY, AT_SYMLINK_NOFOLLOW
+#include <pthread.h>       // for pthread_mutex_t, pthread_mutex_lock, pthread_mutex_unlock
+#include <pwd.h>           // for getpwuid_r, struct passwd
+#include <stdio.h>         // for snprintf
+#include <stdlib.h>        // for malloc, free
+#include <string.h>        // for strcmp, strdup, memcpy
+#include <sys/stat.h>      // for statx, struct statx, fstatat, S_IS*
+#include <time.h>          // for strftime, localtime_r
+#include <unistd.h>        // for dup, close
+// Local includes
+#include <files.h>         // for FileAttr, FileAttr_get_name, FileAttr_get_meta, FileMeta
+#include <fsio.h>          // for Fsio_submit, FSIO_DEADLINE_STAT
+#include <metadata.h>      // for MetaColumn, META_BATCH, META_READAHEAD, META_MAX_INFLIGHT
+#include <utils.h>         // for MIN, MAX, SIZE
+#include <vector.h>        // for Vector, Vector_len
+#include <workpool.h>      // for Job, Job_new, Job_cancel
+
+#define SIZE_COL_WIDTH 6
+#define MTIME_COL_WIDTH 16
+#define MODE_COL_WIDTH 10
+#define OWNER_COL_WIDTH 8
+// Names get at least this many columns before metadata columns are dropped
+#define MIN_NAME_WIDTH 16
+
+#define OWNER_CACHE_SIZE 64
+
+typedef struct {
+    char *directory;
+    // A copy of the listing's handle, or -1 to open `directory`
+    int dirfd;
+    Vector *files;
+    // The listing was replaced or freed, its entries must not be touched
+    bool forgotten;
+    unsigned int columns;
+    size_t count;
+    SIZE index[META_BATCH];
+    char *names[META_BATCH];
+    FileMeta meta[META_BATCH];
+} MetaBatch;
+
+typedef struct {
+    Job *job;
+    const Vector *files;
+    SIZE first;
+    SIZE last;
+} InflightBatch;
+
+typedef struct {
+    bool used;
+    unsigned int uid;
+    char name[OWNER_COL_WIDTH + 1];
+} OwnerName;
+
+static InflightBatch inflight[META_MAX_INFLIGHT];
+
+// Filled by the workers (getpwuid_r may go through NSS and the network),
+// read by the UI thread
+static pthread_mutex_t owner_lock = PTHREAD_MUTEX_INITIALIZER;
+static OwnerName owners[OWNER_CACHE_SIZE];
+
+static void cache_owner(unsigned int uid) {
+    OwnerName *slot = &owners[uid % OWNER_CACHE_SIZE];
+
+    pthread_mutex_lock(&owner_lock);
+    bool cached = slot->used && slot->uid == uid;
+    pthread_mutex_unlock(&owner_lock);
+    if (cached)
+        return;
+
+    char buf[1024];
+    struct passwd pw, *result = NULL;
+    char name[OWNER_COL_WIDTH + 1];
+    if (getpwuid_r(uid, &pw, buf, sizeof(buf), &result) == 0 && result != NULL)
+        snprintf(name, sizeof(name), "%s", pw.pw_name);
+    else
+        snprintf(name, sizeof(name), "%u", uid);
+
+    pthread_mutex_lock(&owner_lock);
+    slot->used = true;
+    slot->uid = uid;
+    memcpy(slot->name, name, sizeof(name));
+    pthread_mutex_unlock(&owner_lock);
+}
+
+static void owner_name(char *buffer, size_t size, unsigned int uid) {
+    OwnerName *slot = &owners[uid % OWNER_CACHE_SIZE];
+
+    pthread_mutex_lock(&owner_lock);
+    if (slot->used && slot->uid == uid)
+        snprintf(buffer, size, "%s", slot->name);
+    else
+        snprintf(buffer, size, "%u", uid);
+    pthread_mutex_unlock(&owner_lock);
+}
+
+#ifdef STATX_BASIC_STATS
+static unsigned int statx_mask(unsigned int columns) {
+    unsigned int mask = 0;
+    if (columns & META_COL_SIZE)
+        mask |= STATX_SIZE;
+    if (columns & META_COL_MTIME)
+        mask |= STATX_MTIME;
+    if (columns & META_COL_MODE)
+        mask |= STATX_TYPE | STATX_MODE;
+    if (columns & META_COL_OWNER)
+        mask |= STATX_UID;
+    return mask;
+}
+
+static bool stat_entry(int dirfd, const char *name, unsigned int columns, FileMeta *meta) {
+    struct statx stx;
+    // Whatever the server has cached is good enough to be displayed
+    if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, statx_mask(columns), &stx) == -1)
+        return false;
+
+    meta->requested = columns;
+    meta->columns = 0;
+    if ((columns & META_COL_SIZE) && (stx.stx_mask & STATX_SIZE)) {
+        meta->size = stx.stx_size;
+        meta->columns |= META_COL_SIZE;
+    }
+    if ((columns & META_COL_MTIME) && (stx.stx_mask & STATX_MTIME)) {
+        meta->mtime = stx.stx_mtime.tv_sec;
+        meta->columns |= META_COL_MTIME;
+    }
+    if ((columns & META_COL_MODE) && (stx.stx_mask & STATX_MODE)) {
+        meta->mode = stx.stx_mode;
+        meta->columns |= META_COL_MODE;
+    }
+    if ((columns & META_COL_OWNER) && (stx.stx_mask & STATX_UID)) {
+        meta->uid = stx.stx_uid;
+        meta->columns |= META_COL_OWNER;
+    }
+    return true;
+}
+#else
+// Without statx every field is fetched anyway
+static bool stat_entry(int dirfd, const char *name, unsigned int columns, FileMeta *meta) {
+    struct stat st;
+    if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+        return false;
+
+    meta->size = st.st_size;
+    meta->mtime = st.st_mtime;
+    meta->mode = st.st_mode;
+    meta->uid = st.st_uid;
+    meta->columns = meta->requested = columns;
+    return true;
+}
+#endif
+
+static void metadata_run(Job *job) {
+    MetaBatch *batch = job->data;
+
+    int dirfd = batch->dirfd != -1 ? batch->dirfd : open(batch->directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd == -1) {
+        for (size_t i = 0; i < batch->count; i++)
+            batch->meta[i].state = META_ERROR;
+        return;
+    }
+
+    for (size_t i = 0; i < batch->count; i++) {
+        if (Job_cancelled(job))
+            break;
+
+        FileMeta *meta = &batch->meta[i];
+        if (stat_entry(dirfd, batch->names[i], batch->columns, meta)) {
+            meta->state = META_READY;
+            if (meta->columns & META_COL_OWNER)
+                cache_owner(meta->uid);
+        } else {
+            meta->state = META_ERROR;
+        }
+    }
+
+    if (dirfd != batch->dirfd)
+        close(dirfd);
+}
+
+static void free_batch(MetaBatch *batch) {
+    if (batch->dirfd != -1)
+        close(batch->dirfd);
+    free(batch->directory);
+    free(batch);
+}
+
+static void metadata_done(Job *job) {
+    MetaBatch *batch = job->data;
+
+    for (size_t i = 0; i < META_MAX_INFLIGHT; i++)
+        if (inflight[i].job == job)
+            inflight[i].job = NULL;
+
+    // Only touch the listing if it's still the one the batch was made for
+    if (!batch->forgotten) {
+        for (size_t i = 0; i < batch->count; i++) {
+            if ((size_t)batch->index[i] >= Vector_len(*batch->files))
+                continue;
+            FileAttr fa = batch->files->el[batch->index[i]];
+            if (strcmp(FileAttr_get_name(fa), batch->names[i]) != 0)
+                continue;
+
+            FileMeta *meta = FileAttr_get_meta(fa);
+            // Entries the job didn't get to are asked for again later
+            if (batch->meta[i].state == META_NONE || batch->meta[i].state == META_PENDING)
+                meta->state = META_NONE;
+            else
+                *meta = batch->meta[i];
+        }
+    }
+
+    for (size_t i = 0; i < batch->count; i++)
+        free(batch->names[i]);
+    free_batch(batch);
+}
+
+static void cancel_far_batches(const Vector *files, SIZE first, SIZE last) {
+    for (size_t i = 0; i < META_MAX_INFLIGHT; i++) {
+        InflightBatch *b = &inflight[i];
+        if (b->job != NULL && b->files == files && (b->last < first || b->first > last))
+            Job_cancel(b->job);
+    }
+}
+
+static InflightBatch *free_inflight_slot(void) {
+    for (size_t i = 0; i < META_MAX_INFLIGHT; i++)
+        if (inflight[i].job == NULL)
+            return &inflight[i];
+    return NULL;
+}
+
+static void submit_batch(MetaBatch *batch) {
+    InflightBatch *slot = free_inflight_slot();
+    Job *job = Job_new(metadata_run, metadata_done, batch, JOB_PRIO_HIGH);
+    if (job == NULL) {
+        // Let the next request try again
+        for (size_t i = 0; i < batch->count; i++) {
+            FileAttr fa = batch->files->el[batch->index[i]];
+            FileAttr_get_meta(fa)->state = META_NONE;
+            free(batch->names[i]);
+        }
+        free_batch(batch);
+        return;
+    }
+
+    slot->job = job;
+    slot->files = batch->files;
+    slot->first = batch->index[0];
+    slot->last = batch->index[batch->count - 1];
+    Fsio_submit(job, batch->directory, FSIO_DEADLINE_STAT);
+}
+
+static MetaBatch *new_batch(const char *directory, int dirfd, Vector *files, unsigned int columns) {
+    MetaBatch *batch = malloc(sizeof(MetaBatch));
+    if (batch == NULL)
+        return NULL;
+    batch->directory = strdup(directory);
+    if (batch->directory == NULL) {
+        free(batch);
+        return NULL;
+    }
+    // The worker's own copy, the listing may close its handle meanwhile
+    batch->dirfd = dirfd != -1 ? dup(dirfd) : -1;
+    batch->files = files;
+    batch->forgotten = false;
+    batch->columns = columns;
+    batch->count = 0;
+    return batch;
+}
+
+void Metadata_init(void) {
+    for (size_t i = 0; i < META_MAX_INFLIGHT; i++)
+        inflight[i].job = NULL;
+}
+
+void Metadata_bye(void) {
+    Metadata_forget(NULL);
+}
+
+void Metadata_forget(const Vector *files) {
+    for (size_t i = 0; i < META_MAX_INFLIGHT; i++) {
+        InflightBatch *b = &inflight[i];
+        if (b->job == NULL || (files != NULL && b->files != files))
+            continue;
+        ((MetaBatch *)b->job->data)->forgotten = true;
+        Job_cancel(b->job);
+    }
+}
+
+void Metadata_request(const char *directory, int dirfd, Vector *files, SIZE first, SIZE count, unsigned int columns) {
+    if (columns == 0)
+        return;
+
+    SIZE len = Vector_len(*files);
+    SIZE from = MAX(first - META_READAHEAD, 0);
+    SIZE to = MIN(first + count + META_READAHEAD, len);
+
+    cancel_far_batches(files, from, to - 1);
+
+    MetaBatch *batch = NULL;
+    for (SIZE i = from; i < to; i++) {
+        FileMeta *meta = FileAttr_get_meta(files->el[i]);
+        if (meta->state == META_PENDING)
+            continue;
+        // Stale entries are fetched again whatever the columns
+        if (meta->state == META_READY && (meta->requested & columns) == columns)
+            continue;
+        if (meta->state == META_ERROR)
+            continue;
+
+        if (batch == NULL) {
+            if (free_inflight_slot() == NULL)
+                return;
+            batch = new_batch(directory, dirfd, files, columns);
+            if (batch == NULL)
+                return;
+        }
+
+        batch->names[batch->count] = strdup(FileAttr_get_name(files->el[i]));
+        if (batch->names[batch->count] == NULL)
+            continue;
+        batch->index[batch->count] = i;
+        batch->meta[batch->count] = (FileMeta){ .state = META_PENDING };
+        batch->count++;
+        meta->state = META_PENDING;
+
+        if (batch->count == META_BATCH) {
+            submit_batch(batch);
+            batch = NULL;
+        }
+    }
+
+    if (batch != NULL) {
+        if (batch->count > 0) {
+            submit_batch(batch);
+        } else {
+            free_batch(batch);
+        }
+    }
+}
+
+void Metadata_fill(FileMeta *meta, unsigned int mode, unsigned int uid, unsigned long long size, long long mtime) {
+    *meta = (FileMeta){
+        .state = META_READY,
+        .columns = META_COL_ALL,
+        .requested = META_COL_ALL,
+        .mode = mode,
+        .uid = uid,
+        .size = size,
+        .mtime = mtime,
+    };
+    cache_owner(uid);
+}
+
+static int column_width(MetaColumn column) {
+    switch (column) {
+        case META_COL_SIZE:  return SIZE_COL_WIDTH;
+        case META_COL_MTIME: return MTIME_COL_WIDTH;
+        case META_COL_MODE:  return MODE_COL_WIDTH;
+        case META_COL_OWNER: return OWNER_COL_WIDTH;
+    }
+    return 0;
+}
+
+int Metadata_columns_width(unsigned int columns) {
+    int width = 0;
+    for (unsigned int column = META_COL_SIZE; column <= META_COL_OWNER; column <<= 1)
+        if (columns & column)
+            width += column_width(column) + 1;
+    return width;
+}
+
+unsigned int Metadata_fit_columns(unsigned int columns, int width) {
+    // Drop from the least important one
+    for (unsigned int column = META_COL_OWNER; column && Metadata_columns_width(columns) + MIN_NAME_WIDTH > width; column >>= 1)
+        columns &= ~column;
+    return columns;
+}
+
+static void format_size_short(char *buffer, size_t size, unsigned long long bytes) {
+    const char *units = "BKMGTPE";
+    double value = (double)bytes;
+    int i = 0;
+    while (value >= 1024 && units[i + 1] != '\0') {
+        value /= 1024;
+        i++;
+    }
+    if (i == 0)
+        snprintf(buffer, size, "%lluB", bytes);
+    else if (value < 10)
+        snprintf(buffer, size, "%.1f%c", value, units[i]);
+    else
+        snprintf(buffer, size, "%.0f%c", value, units[i]);
+}
+
+static void format_mode(char *buffer, unsigned int mode) {
+    buffer[0] = S_ISDIR(mode) ? 'd' : S_ISLNK(mode) ? 'l' : S_ISCHR(mode) ? 'c'
+              : S_ISBLK(mode) ? 'b' : S_ISFIFO(mode) ? 'p' : S_ISSOCK(mode) ? 's' : '-';
+    const char *rwx = "rwxrwxrwx";
+    for (int i = 0; i < 9; i++)
+        buffer[i + 1] = (mode & (0400 >> i)) ? rwx[i] : '-';
+    buffer[10] = '\0';
+}
+
+char *Metadata_format(char *buffer, size_t size, const FileMeta *meta, unsigned int columns) {
+    size_t used = 0;
+    buffer[0] = '\0';
+
+    for (unsigned int column = META_COL_SIZE; column <= META_COL_OWNER; column <<= 1) {
+        if (!(columns & column))
+            continue;
+
+        char field[32] = "";
+        // Fields fetched before stay on screen while they're fetched again
+        bool known = meta->state == META_READY || meta->state == META_STALE || meta->state == META_PENDING;
+        if (known && (meta->columns & column)) {
+            struct tm tm;
+            time_t mtime = meta->mtime;
+            switch ((MetaColumn)column) {
+                case META_COL_SIZE:
+                    if (S_ISDIR(meta->mode) && (meta->columns & META_COL_MODE))
+                        snprintf(field, sizeof(field), "-");
+                    else
+                        format_size_short(field, sizeof(field), meta->size);
+                    break;
+                case META_COL_MTIME:
+                    if (localtime_r(&mtime, &tm) != NULL)
+                        strftime(field, sizeof(field), "%Y-%m-%d %H:%M", &tm);
+                    break;
+                case META_COL_MODE:
+                    format_mode(field, meta->mode);
+                    break;
+                case META_COL_OWNER:
+                    owner_name(field, sizeof(field), meta->uid);
+                    break;
+            }
+        } else if (meta->state == META_ERROR) {
+            snprintf(field, sizeof(field), "?");
+        }
+
+        int written = snprintf(buffer + used, size - used, " %*.*s",
+                               column_width(column), column_width(column), field);
+        if (written < 0 || (size_t)written >= size - used)
+            break;
+        used += written;
+    }
+    return buffer;
+}
@@ -0,0 +1,56 @@
+// File: metadata.h
+// -----------------------
+#ifndef METADATA_H
+#define METADATA_H
+
+#include <stddef.h>   // for size_t
+#include <files.h>    // for FileMeta
+#include <utils.h>    // for SIZE
+#include <vector.h>   // for Vector
+
+// Optional columns of the directory window, in order of importance. When the
+// window is too narrow the least important ones are dropped first.
+typedef enum {
+    META_COL_SIZE  = 1 << 0,
+    META_COL_MTIME = 1 << 1,
+    META_COL_MODE  = 1 << 2,
+    META_COL_OWNER = 1 << 3,
+} MetaColumn;
+
+#define META_COL_ALL (META_COL_SIZE | META_COL_MTIME | META_COL_MODE | META_COL_OWNER)
+
+// Rows above and below the visible ones that are fetched too, so scrolling a
+// few lines doesn't show empty columns
+#define META_READAHEAD 32
+// Entries stat'ed by a single job
+#define META_BATCH 64
+// Jobs in flight at once, more requests wait for the next main loop iteration
+#define META_MAX_INFLIGHT 8
+
+// The entries are stat'ed through fsio
+void Metadata_init(void);
+void Metadata_bye(void);
+
+// The entries of `files` are about to be replaced or freed: cancels its
+// in-flight jobs and makes sure their results are thrown away. NULL forgets
+// every listing.
+void Metadata_forget(const Vector *files);
+// Makes sure the rows [first, first + count) of `files`, which lists
+// `directory`, get the fields needed for `columns`. They're stat'ed relative
+// to the handle `dirfd` unless it's -1. Rows out of range are ignored. Jobs
+// for rows of `files` far away from the range are cancelled, so several
+// listings can be on screen at once.
+void Metadata_request(const char *directory, int dirfd, Vector *files, SIZE first, SIZE count, unsigned int columns);
+// For entries stat'ed somewhere else, like by the daemon: every column of
+// `meta` is filled and the owner's name looked up. Workers only, the lookup
+// may block just like a stat.
+void Metadata_fill(FileMeta *meta, unsigned int mode, unsigned int uid, unsigned long long size, long long mtime);
+
+// Drops columns until a name of reasonable length fits in `width`
+unsigned int Metadata_fit_columns(unsigned int columns, int width);
+// Width of the formatted columns, including the separating spaces
+int Metadata_columns_width(unsigned int columns);
+// Formats the columns of an entry, leaving blanks for what isn't known yet
+char *Metadata_format(char *buffer, size_t size, const FileMeta *meta, unsigned int columns);
+
+#endif // METADATA_H
@@ -0,0 +1,232 @@
+// File: prefetch.c
+// -----------------------
+#define _GNU_SOURCE              // for strdup, O_PATH
+#include <fcntl.h>               // for open, openat, O_PATH, O_DIRECTORY, O_CLOEXEC
+#include <stdlib.h>              // for malloc, free
+#include <string.h>              // for strcmp, strdup
+#include <sys/stat.h>            // for stat, fstat, struct stat
+#include <unistd.h>              // for dup, close
+// Local includes
+#include <files.h>               // for append_files_to_vec_cancellable
+#include <fsio.h>                // for Fsio_submit, FSIO_DEADLINE_LIST
+#include <prefetch.h>            // for PREFETCH_MAX_INFLIGHT, PREFETCH_SLOTS
+#include <vector.h>              // for Vector, Vector_new, Vector_bye
+#include <workpool.h>            // for Job, Job_new, Job_cancel
+
+typedef enum {
+    SLOT_FREE = 0,
+    SLOT_LOADING,
+    SLOT_READY,
+} SlotState;
+
+typedef struct {
+    SlotState state;
+    char *path;
+    Job *job;
+    Vector files;
+    // Identity of the directory when it was read, used to detect stale data
+    struct stat st;
+    // Handle of the directory, handed to the listing along with `files`
+    int fd;
+    // For LRU eviction of finished listings
+    unsigned long last_use;
+} PrefetchSlot;
+
+// Filled on the worker, moved into the slot on the UI thread
+typedef struct {
+    char *path;
+    // Where to look the directory up, `at` is -1 for `path`
+    int at;
+    char *name;
+    int fd;
+    Vector files;
+    struct stat st;
+    bool complete;
+} PrefetchResult;
+
+static PrefetchSlot slots[PREFETCH_SLOTS];
+static unsigned long use_clock;
+
+static void free_result(PrefetchResult *res) {
+    if (res->at != -1)
+        close(res->at);
+    if (res->fd != -1)
+        close(res->fd);
+    free(res->name);
+    free(res->path);
+    free(res);
+}
+
+static void free_slot(PrefetchSlot *slot) {
+    if (slot->state == SLOT_READY) {
+        Vector_bye(&slot->files);
+        if (slot->fd != -1)
+            close(slot->fd);
+    }
+    free(slot->path);
+    slot->path = NULL;
+    slot->job = NULL;
+    slot->state = SLOT_FREE;
+}
+
+static PrefetchSlot *find_slot(const char *path) {
+    for (size_t i = 0; i < PREFETCH_SLOTS; i++)
+        if (slots[i].state != SLOT_FREE && strcmp(slots[i].path, path) == 0)
+            return &slots[i];
+    return NULL;
+}
+
+static size_t count_inflight(void) {
+    size_t n = 0;
+    for (size_t i = 0; i < PREFETCH_SLOTS; i++)
+        if (slots[i].state == SLOT_LOADING)
+            n++;
+    return n;
+}
+
+// Returns a free slot, evicting the least recently used finished listing if
+// needed. Loading slots are never evicted, they are only cancelled.
+static PrefetchSlot *grab_slot(void) {
+    PrefetchSlot *victim = NULL;
+    for (size_t i = 0; i < PREFETCH_SLOTS; i++) {
+        if (slots[i].state == SLOT_FREE)
+            return &slots[i];
+        if (slots[i].state == SLOT_READY && (victim == NULL || slots[i].last_use < victim->last_use))
+            victim = &slots[i];
+    }
+    if (victim)
+        free_slot(victim);
+    return victim;
+}
+
+static void prefetch_run(Job *job) {
+    PrefetchResult *res = job->data;
+
+    res->fd = res->at != -1
+        ? openat(res->at, res->name, O_PATH | O_DIRECTORY | O_CLOEXEC)
+        : open(res->path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    // Archives aren't directories, they're listed by their path
+    if (res->fd != -1 ? fstat(res->fd, &res->st) == -1 : stat(res->path, &res->st) == -1)
+        return;
+    res->complete = append_files_to_vec_cancellable(&res->files, res->fd, res->path, &job->cancelled);
+}
+
+static void prefetch_done(Job *job) {
+    PrefetchResult *res = job->data;
+    PrefetchSlot *slot = NULL;
+
+    for (size_t i = 0; i < PREFETCH_SLOTS; i++)
+        if (slots[i].state == SLOT_LOADING && slots[i].job == job)
+            slot = &slots[i];
+
+    if (slot != NULL && job->ran && res->complete && !Job_cancelled(job)) {
+        slot->state = SLOT_READY;
+        slot->job = NULL;
+        slot->files = res->files;
+        slot->st = res->st;
+        slot->fd = res->fd;
+        res->fd = -1;
+        slot->last_use = ++use_clock;
+    } else {
+        if (slot != NULL)
+            free_slot(slot);
+        Vector_bye(&res->files);
+    }
+
+    free_result(res);
+}
+
+void Prefetch_init(void) {
+    for (size_t i = 0; i < PREFETCH_SLOTS; i++)
+        slots[i].state = SLOT_FREE;
+}
+
+void Prefetch_bye(void) {
+    // Loading slots are released by prefetch_done when the pool shuts down
+    for (size_t i = 0; i < PREFETCH_SLOTS; i++) {
+        if (slots[i].state == SLOT_LOADING)
+            Job_cancel(slots[i].job);
+        else if (slots[i].state == SLOT_READY)
+            free_slot(&slots[i]);
+    }
+}
+
+void Prefetch_hint(const char *path, int at, const char *name) {
+    PrefetchSlot *slot = find_slot(path);
+    if (slot != NULL) {
+        slot->last_use = ++use_clock;
+        return;
+    }
+
+    if (count_inflight() >= PREFETCH_MAX_INFLIGHT)
+        return;
+
+    slot = grab_slot();
+    if (slot == NULL)
+        return;
+
+    PrefetchResult *res = malloc(sizeof(PrefetchResult));
+    if (res == NULL)
+        return;
+    res->path = strdup(path);
+    res->name = strdup(name);
+    // The worker's own handle, the caller's may be closed before it runs
+    res->at = at != -1 ? dup(at) : -1;
+    res->fd = -1;
+    slot->path = strdup(path);
+    if (res->path == NULL || res->name == NULL || slot->path == NULL) {
+        free_result(res);
+        free_slot(slot);
+        return;
+    }
+    res->files = Vector_new(10);
+    res->complete = false;
+
+    Job *job = Job_new(prefetch_run, prefetch_done, res, JOB_PRIO_IDLE);
+    if (job == NULL) {
+        Vector_bye(&res->files);
+        free_result(res);
+        free_slot(slot);
+        return;
+    }
+
+    slot->state = SLOT_LOADING;
+    slot->job = job;
+    slot->last_use = ++use_clock;
+    Fsio_submit(job, path, FSIO_DEADLINE_LIST);
+}
+
+void Prefetch_cancel_except(const char *path) {
+    for (size_t i = 0; i < PREFETCH_SLOTS; i++) {
+        PrefetchSlot *slot = &slots[i];
+        if (slot->state != SLOT_LOADING)
+            continue;
+        if (path != NULL && strcmp(slot->path, path) == 0)
+            continue;
+        // The slot stays busy until prefetch_done frees it, so the cap on
+        // in-flight reads also covers reads that are still winding down
+        Job_cancel(slot->job);
+    }
+}
+
+bool Prefetch_take(const char *path, Vector *files, struct stat *st, int *fd) {
+    PrefetchSlot *slot = find_slot(path);
+    if (slot == NULL)
+        return false;
+
+    if (slot->state == SLOT_LOADING) {
+        // Reading it again is at worst as slow as waiting for it
+        Job_cancel(slot->job);
+        return false;
+    }
+
+    Vector_bye(files);
+    *files = slot->files;
+    *st = slot->st;
+    *fd = slot->fd;
+    // The listing belongs to the caller now, don't let free_slot touch it
+    slot->files = Vector_new(0);
+    slot->fd = -1;
+    free_slot(slot);
+    return true;
+}
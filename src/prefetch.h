@@ -0,0 +1,34 @@
+// File: prefetch.h
+// -----------------------
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdbool.h>  // for bool
+#include <sys/stat.h> // for struct stat
+#include <vector.h>   // for Vector
+
+// How many directories may be read in the background at the same time
+#define PREFETCH_MAX_INFLIGHT 2
+// How many listings are kept around (finished or not)
+#define PREFETCH_SLOTS 6
+
+// Directories are read through fsio, on its idle workers
+void Prefetch_init(void);
+void Prefetch_bye(void);
+
+// The cursor is resting on the directory `path`, which is `name` in the
+// directory handle `at` (-1 to look `path` up instead): start reading it on
+// an idle worker unless it's already cached or being read.
+void Prefetch_hint(const char *path, int at, const char *name);
+// The cursor moved away, cancels every in-flight read except the one for
+// `path` (which may be NULL). Listings that already finished are kept.
+void Prefetch_cancel_except(const char *path);
+// If a listing of `path` is ready, replaces the contents of `files` with it,
+// sets *st to the directory's stat() when it was read, *fd to a handle of it
+// (or -1) that the caller owns now, and returns true. It's up to the caller
+// to check it's still fresh, this doesn't touch the disk. Otherwise cancels
+// any pending read of `path` and returns false, so the caller can read the
+// directory itself.
+bool Prefetch_take(const char *path, Vector *files, struct stat *st, int *fd);
+
+#endif // PREFETCH_H
@@ -0,0 +1,486 @@
+// File: preview.c
+// -----------------------
+#define _GNU_SOURCE              // for strdup, O_PATH, clock_gettime, CLOCK_MONOTONIC
+#include <fcntl.h>               // for open, openat, fcntl, O_RDONLY, O_PATH, O_NONBLOCK, O_NOCTTY, O_CLOEXEC, F_GETFL, F_SETFL
+#include <stdio.h>               // for FILE, fdopen
+#include <stdlib.h>              // for calloc, malloc, free
+#include <string.h>              // for memcpy, memset, strcmp, strdup
+#include <sys/stat.h>            // for fstat, struct stat, S_ISDIR, S_ISREG
+#include <time.h>                // for struct timespec, clock_gettime
+#include <unistd.h>              // for dup, close
+// Local includes
+#include <compressed.h>          // for Compressed, Compressed_detect, Compressed_open, Compressed_lines
+#include <files.h>               // for is_supported_file_type, get_directory_size
+#include <fsio.h>                // for Fsio_submit, FSIO_DEADLINE_STAT, FSIO_DEADLINE_READ
+#include <highlight.h>           // for Highlighter, Highlight_open, Highlight_lines, Highlight_close
+#include <preview.h>             // for Preview, PreviewKind, PREVIEW_MAX_ROWS, PREVIEW_REFRESH_MS
+#include <tar.h>                 // for Tar_stat, Tar_fopen
+#include <utils.h>               // for MIN, MAX, SIZE, elapsed_ms
+#include <watch.h>               // for Watch_add, Watch_subscribe, Watch_unsubscribe, Watch_drop_unused, WatchEvent
+#include <workpool.h>            // for Job, Job_new, Job_cancel, Job_cancelled
+
+// The file of the preview stays open, so redrawing and scrolling resume from
+// the checkpoints of its reader instead of reading everything again
+typedef struct {
+    char *path;
+    // The file is `name` in the directory handle `at`
+    int at;
+    char *name;
+    // Opened by the first content job, only touched by the one running
+    bool opened;
+    PreviewKind kind;
+    CompressedFormat format;
+    Highlighter *text;
+    Compressed *compressed;
+    Job *job;
+    // The selection moved on while a job was running, it frees the source
+    bool orphaned;
+} PreviewSource;
+
+typedef struct {
+    PreviewSource *source;
+    SIZE first;
+    SIZE count;
+    // Where the lines actually start, before `first` at the end of the file
+    SIZE actual_first;
+    SIZE num_lines;
+    HighlightLine *lines;
+    char *text;
+    HighlightSpan *spans;
+} ContentRead;
+
+typedef struct {
+    char *path;
+    int at;
+    char *name;
+    int wd;
+    bool failed;
+    bool in_archive;
+    struct stat st;
+    long size;
+} InfoRead;
+
+static Preview current;
+static char *current_path;
+// Where the target is, the handle is a copy of the listing's
+static char *current_name;
+static int current_at = -1;
+static PreviewSource *source;
+// Lines of `current`
+static ContentRead *shown;
+static Job *info_job;
+static Job *size_job;
+// The lines asked for last, and the ones waiting for the source to be free
+static SIZE requested_first = -1, requested_count;
+static SIZE wanted_first = -1, wanted_count;
+// The file ended before the requested lines, *first moves here
+static SIZE clamp_to = -1;
+// Watch of the target, which changed since it was read if `dirty`
+static int watch_wd = -1;
+static bool dirty;
+static struct timespec last_read;
+
+static void free_source(PreviewSource *src) {
+    Highlight_close(src->text);
+    Compressed_close(src->compressed);
+    if (src->at != -1)
+        close(src->at);
+    free(src->name);
+    free(src->path);
+    free(src);
+}
+
+static void free_info(InfoRead *r) {
+    if (r->at != -1)
+        close(r->at);
+    free(r->name);
+    free(r->path);
+    free(r);
+}
+
+// Opens the target relative to its directory. Members of archives have no
+// handle and aren't in the filesystem, that fails for them.
+static int open_target(int at, const char *name, const char *path, int flags) {
+    return at != -1 ? openat(at, name, flags | O_CLOEXEC) : open(path, flags | O_CLOEXEC);
+}
+
+static void free_content(ContentRead *c) {
+    if (c == NULL)
+        return;
+    free(c->lines);
+    free(c->text);
+    free(c->spans);
+    free(c);
+}
+
+static void open_source(PreviewSource *src) {
+    src->opened = true;
+    // Not blocking on a FIFO nor taking a tty, only regular files are read
+    int fd = open_target(src->at, src->name, src->path, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+    struct stat st;
+    if (fd != -1 && (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))) {
+        close(fd);
+        return;
+    }
+    if (fd != -1)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    // Compressed files are recognized by their magic bytes, whatever their
+    // name says
+    src->format = fd != -1 ? Compressed_detect(fd) : COMPRESSED_NONE;
+    if (src->format != COMPRESSED_NONE) {
+        src->compressed = Compressed_open(fd);
+        src->kind = src->compressed != NULL ? PREVIEW_COMPRESSED : PREVIEW_UNREADABLE;
+    } else if (is_supported_file_type(src->path)) {
+        FILE *file = fd != -1 ? fdopen(fd, "r") : NULL;
+        if (file == NULL && fd != -1)
+            close(fd);
+        // Members of archives are read straight from the archive
+        if (fd == -1)
+            file = Tar_fopen(src->path);
+        src->text = file != NULL ? Highlight_open(src->path, file) : NULL;
+        src->kind = src->text != NULL ? PREVIEW_TEXT : PREVIEW_UNREADABLE;
+    } else if (fd != -1) {
+        close(fd);
+    }
+}
+
+// Highlight_lines gives up after a budget of lines so the UI could show
+// progress, on a worker it only needs to check for cancellation
+static SIZE text_lines(Job *job, Highlighter *h, SIZE first, SIZE count, HighlightLine *lines) {
+    SIZE n;
+    while ((n = Highlight_lines(h, first, count, lines)) == -1)
+        if (Job_cancelled(job))
+            return 0;
+    return n;
+}
+
+// Copies the lines out of the reader, whose buffers only last until its next
+// call
+static bool keep_lines(ContentRead *c, const HighlightLine *lines, SIZE n) {
+    size_t text_len = 0, num_spans = 0;
+    for (SIZE i = 0; i < n; i++) {
+        text_len += lines[i].len;
+        num_spans += lines[i].num_spans;
+    }
+
+    c->lines = malloc(MAX(n, 1) * sizeof(HighlightLine));
+    c->text = malloc(MAX(text_len, 1));
+    c->spans = malloc(MAX(num_spans, 1) * sizeof(HighlightSpan));
+    if (c->lines == NULL || c->text == NULL || c->spans == NULL)
+        return false;
+
+    text_len = num_spans = 0;
+    for (SIZE i = 0; i < n; i++) {
+        memcpy(c->text + text_len, lines[i].text, lines[i].len);
+        // Compressed data has no spans at all
+        if (lines[i].num_spans > 0)
+            memcpy(c->spans + num_spans, lines[i].spans, lines[i].num_spans * sizeof(HighlightSpan));
+        c->lines[i] = (HighlightLine){
+            .text = c->text + text_len,
+            .len = lines[i].len,
+            .spans = c->spans + num_spans,
+            .num_spans = lines[i].num_spans,
+        };
+        text_len += lines[i].len;
+        num_spans += lines[i].num_spans;
+    }
+    c->num_lines = n;
+    return true;
+}
+
+static void content_run(Job *job) {
+    ContentRead *c = job->data;
+    PreviewSource *src = c->source;
+    if (!src->opened)
+        open_source(src);
+
+    HighlightLine lines[PREVIEW_MAX_ROWS];
+    SIZE count = MIN(c->count, PREVIEW_MAX_ROWS);
+    SIZE first = c->first;
+    SIZE n = 0;
+
+    if (src->kind == PREVIEW_TEXT) {
+        n = text_lines(job, src->text, first, count, lines);
+        if (n == 0 && first > 0 && !Job_cancelled(job)) {
+            // Scrolled past the end, which is known now
+            first = MAX(Highlight_line_count(src->text) - 1, 0);
+            n = text_lines(job, src->text, first, count, lines);
+        }
+    } else if (src->kind == PREVIEW_COMPRESSED) {
+        const char *texts[PREVIEW_MAX_ROWS];
+        int lens[PREVIEW_MAX_ROWS];
+        n = Compressed_lines(src->compressed, first, count, texts, lens);
+        if (n == 0 && first > 0) {
+            first = MAX(Compressed_line_count(src->compressed) - 1, 0);
+            n = Compressed_lines(src->compressed, first, count, texts, lens);
+        }
+        for (SIZE i = 0; i < n; i++)
+            lines[i] = (HighlightLine){ .text = texts[i], .len = lens[i] };
+    }
+
+    c->actual_first = first;
+    if (!keep_lines(c, lines, n))
+        c->num_lines = 0;
+}
+
+static void submit_content(SIZE first, SIZE count);
+
+static void content_done(Job *job) {
+    ContentRead *c = job->data;
+    PreviewSource *src = c->source;
+    src->job = NULL;
+
+    if (src->orphaned) {
+        free_source(src);
+        free_content(c);
+        return;
+    }
+
+    if (job->ran && !Job_cancelled(job)) {
+        free_content(shown);
+        shown = c;
+        current.loading = false;
+        current.kind = src->kind;
+        current.format = src->format;
+        current.first = c->actual_first;
+        current.num_lines = c->num_lines;
+        if (c->num_lines > 0)
+            memcpy(current.lines, c->lines, c->num_lines * sizeof(HighlightLine));
+        if (c->first == requested_first && c->actual_first != c->first)
+            clamp_to = c->actual_first;
+    } else {
+        free_content(c);
+    }
+
+    if (wanted_first >= 0) {
+        submit_content(wanted_first, wanted_count);
+        wanted_first = -1;
+    }
+}
+
+// Only one job reads from the source at a time, later requests wait
+static void submit_content(SIZE first, SIZE count) {
+    if (source->job != NULL) {
+        wanted_first = first;
+        wanted_count = count;
+        return;
+    }
+
+    ContentRead *c = calloc(1, sizeof(ContentRead));
+    Job *job = c != NULL ? Job_new(content_run, content_done, c, JOB_PRIO_HIGH) : NULL;
+    if (job == NULL) {
+        free(c);
+        return;
+    }
+    c->source = source;
+    c->first = first;
+    c->count = count;
+    source->job = job;
+    Fsio_submit(job, source->path, FSIO_DEADLINE_READ);
+}
+
+static void info_run(Job *job) {
+    InfoRead *r = job->data;
+    // Members of archives aren't watched, they have no descriptor
+    int fd = open_target(r->at, r->name, r->path, O_PATH);
+    r->wd = Watch_add(fd);
+    if (fd == -1 || fstat(fd, &r->st) == -1) {
+        r->in_archive = Tar_stat(r->path, &r->st);
+        r->failed = !r->in_archive;
+    }
+    if (fd != -1)
+        close(fd);
+}
+
+static void size_run(Job *job) {
+    InfoRead *r = job->data;
+    r->size = get_directory_size(r->path, &job->cancelled);
+}
+
+static void size_done(Job *job) {
+    InfoRead *r = job->data;
+    if (job == size_job) {
+        size_job = NULL;
+        if (job->ran && !Job_cancelled(job))
+            current.dir_size = r->size >= 0 ? r->size : PREVIEW_SIZE_UNKNOWN;
+    }
+    free_info(r);
+}
+
+static void preview_event([[maybe_unused]] void *owner, [[maybe_unused]] const WatchEvent *event) {
+    dirty = true;
+}
+
+// The target may have been replaced by another file, which has its own watch
+static void adopt_watch(int wd) {
+    if (wd == watch_wd)
+        return;
+    Watch_unsubscribe(watch_wd, &current);
+    watch_wd = Watch_subscribe(wd, preview_event, &current) ? wd : -1;
+    if (watch_wd == -1)
+        Watch_drop_unused(wd);
+}
+
+static void info_done(Job *job) {
+    InfoRead *r = job->data;
+    if (job == info_job && job->ran && !Job_cancelled(job))
+        adopt_watch(r->wd);
+    else
+        Watch_drop_unused(r->wd);
+
+    if (job == info_job) {
+        info_job = NULL;
+        if (job->ran && !Job_cancelled(job)) {
+            current.have_stat = true;
+            current.stat_failed = r->failed;
+            current.st = r->st;
+        }
+
+        if (current.have_stat && S_ISDIR(current.st.st_mode)) {
+            // The index of an archive has the sizes of its directories already
+            if (r->in_archive) {
+                current.dir_size = r->st.st_size;
+            } else if ((size_job = Job_new(size_run, size_done, r, JOB_PRIO_HIGH)) != NULL) {
+                // Summing a tree takes as long as it takes, no deadline
+                Fsio_submit(size_job, r->path, 0);
+                return;
+            } else {
+                current.dir_size = PREVIEW_SIZE_UNKNOWN;
+            }
+        }
+    }
+    free_info(r);
+}
+
+static void submit_info(void) {
+    clock_gettime(CLOCK_MONOTONIC, &last_read);
+    InfoRead *r = calloc(1, sizeof(InfoRead));
+    if (r != NULL) {
+        r->path = strdup(current_path);
+        r->name = strdup(current_name);
+        // The job's own handle, the preview may move on while it runs
+        r->at = current_at != -1 ? dup(current_at) : -1;
+        r->wd = -1;
+    }
+    info_job = r != NULL && r->path != NULL && r->name != NULL
+        ? Job_new(info_run, info_done, r, JOB_PRIO_HIGH) : NULL;
+    if (info_job == NULL) {
+        if (r != NULL)
+            free_info(r);
+        current.have_stat = current.stat_failed = true;
+        return;
+    }
+    Fsio_submit(info_job, current_path, FSIO_DEADLINE_STAT);
+}
+
+static PreviewSource *new_source(void) {
+    PreviewSource *src = calloc(1, sizeof(PreviewSource));
+    if (src == NULL)
+        return NULL;
+    src->path = strdup(current_path);
+    src->name = strdup(current_name);
+    src->at = current_at != -1 ? dup(current_at) : -1;
+    if (src->path == NULL || src->name == NULL) {
+        free_source(src);
+        return NULL;
+    }
+    return src;
+}
+
+// Lets go of the source, a job still running on it frees it when it's done
+static void release_source(void) {
+    if (source != NULL) {
+        if (source->job != NULL) {
+            source->orphaned = true;
+            Job_cancel(source->job);
+        } else {
+            free_source(source);
+        }
+    }
+    source = NULL;
+}
+
+// Reads a target that changed again once the previous reads are done. What
+// is shown stays until the new lines are in, so there's no flicker.
+static void refresh_if_dirty(void) {
+    if (!dirty || info_job != NULL || size_job != NULL || (source != NULL && source->job != NULL))
+        return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (elapsed_ms(&last_read, &now) < PREVIEW_REFRESH_MS)
+        return;
+
+    // The readers' checkpoints may not match the file anymore
+    PreviewSource *fresh = new_source();
+    if (fresh == NULL)
+        return;
+    dirty = false;
+    release_source();
+    source = fresh;
+    submit_info();
+    requested_first = wanted_first = clamp_to = -1;
+}
+
+// Lets go of the old file, the jobs still running on it clean up after
+// themselves
+static void forget_current(void) {
+    if (info_job != NULL)
+        Job_cancel(info_job);
+    if (size_job != NULL)
+        Job_cancel(size_job);
+    info_job = size_job = NULL;
+    release_source();
+    Watch_unsubscribe(watch_wd, &current);
+    watch_wd = -1;
+    dirty = false;
+
+    free_content(shown);
+    shown = NULL;
+    free(current_path);
+    free(current_name);
+    current_path = current_name = NULL;
+    if (current_at != -1)
+        close(current_at);
+    current_at = -1;
+    requested_first = wanted_first = clamp_to = -1;
+}
+
+void Preview_init(void) {
+    memset(&current, 0, sizeof(current));
+}
+
+void Preview_bye(void) {
+    forget_current();
+}
+
+const Preview *Preview_get(const char *path, int at, const char *name, SIZE *first, SIZE count) {
+    if (current_path == NULL || strcmp(current_path, path) != 0) {
+        forget_current();
+        current = (Preview){ .dir_size = PREVIEW_SIZE_PENDING, .loading = true };
+        current_path = strdup(path);
+        current_name = strdup(name);
+        current_at = at != -1 ? dup(at) : -1;
+        source = current_path != NULL && current_name != NULL ? new_source() : NULL;
+        if (source == NULL) {
+            forget_current();
+            current.loading = false;
+            return &current;
+        }
+        submit_info();
+    } else {
+        refresh_if_dirty();
+    }
+
+    if (clamp_to >= 0) {
+        *first = clamp_to;
+        requested_first = clamp_to;
+        clamp_to = -1;
+    }
+    if (*first != requested_first || count != requested_count) {
+        requested_first = *first;
+        requested_count = count;
+        submit_content(*first, count);
+    }
+    return &current;
+}
@@ -0,0 +1,62 @@
+// File: preview.h
+// -----------------------
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <stdbool.h>    // for bool
+#include <sys/stat.h>   // for struct stat
+#include <compressed.h> // for CompressedFormat
+#include <highlight.h>  // for HighlightLine
+#include <utils.h>      // for SIZE
+
+// More rows than any terminal has
+#define PREVIEW_MAX_ROWS 512
+
+// A watched target that changed is read again at most this often, so a log
+// being written shows its new lines without being read on every write
+#define PREVIEW_REFRESH_MS 500
+
+// Directory sizes that aren't known
+#define PREVIEW_SIZE_PENDING (-1)
+#define PREVIEW_SIZE_UNKNOWN (-2)
+
+typedef enum {
+    // Nothing to show below the file information
+    PREVIEW_NONE = 0,
+    PREVIEW_TEXT,
+    PREVIEW_COMPRESSED,
+    // A supported file that can't be opened, or data that can't be decompressed
+    PREVIEW_UNREADABLE,
+} PreviewKind;
+
+// What the preview window shows, filled in as the workers find out
+typedef struct {
+    // Set once the stat() of the file (or archive member) is back
+    bool have_stat;
+    bool stat_failed;
+    struct stat st;
+    // Size of everything below a directory, or one of PREVIEW_SIZE_*
+    long dir_size;
+    // Known once the file was opened, `loading` until the first lines are in
+    bool loading;
+    PreviewKind kind;
+    CompressedFormat format;
+    // The lines from `first`, which may still be the previous ones while
+    // newer ones are read
+    SIZE first;
+    SIZE num_lines;
+    HighlightLine lines[PREVIEW_MAX_ROWS];
+} Preview;
+
+void Preview_init(void);
+// Cancels what's in flight, the readers are freed once their jobs return
+void Preview_bye(void);
+// Returns what's known about the preview of `path` with up to `count` lines
+// from *first, asking fsio for the rest. Never touches the disk itself. The
+// target is `name` in the directory handle `at`, which is copied; -1 looks
+// `path` up instead. The target is watched, and read again when it changes.
+// *first is moved back once the end of the file is found to be before it.
+// Valid until the next call.
+const Preview *Preview_get(const char *path, int at, const char *name, SIZE *first, SIZE count);
+
+#endif // PREVIEW_H
@@ -0,0 +1,559 @@
+// File: search.c
+// -----------------------
+#define _GNU_SOURCE        // for memmem, memrchr, strndup, O_PATH, clock_gettime, CLOCK_MONOTONIC
+#include <curses.h>        // for WINDOW, newwin, delwin, wgetch, mvwprintw, werase, wrefresh, wattron, wattroff
+#include <errno.h>         // for errno, EINTR
+#include <fcntl.h>         // for open, openat, posix_fadvise, O_RDONLY, O_PATH, O_DIRECTORY, O_NOFOLLOW, O_NONBLOCK, O_CLOEXEC
+#include <stdatomic.h>     // for atomic_bool, atomic_ullong, atomic_load, atomic_store, atomic_fetch_add
+#include <stdint.h>        // for uint32_t, uint64_t
+#include <stdio.h>         // for snprintf
+#include <stdlib.h>        // for malloc, realloc, calloc, free, qsort
+#include <string.h>        // for strcmp, strdup, strndup, memmem, memrchr, memchr, memcmp, memmove, memcpy
+#include <sys/stat.h>      // for struct stat, fstat, S_ISREG
+#include <time.h>          // for struct timespec, clock_gettime
+#include <unistd.h>        // for read, close
+// Local includes
+#include <files.h>         // for format_file_size
+#include <fsio.h>          // for Fsio_submit, Fsio_poll, FSIO_DEADLINE_READ
+#include <search.h>        // for search_view, SEARCH_MAX_MATCHES, SEARCH_LINE, SEARCH_BLOCK
+#include <trigram.h>       // for TrigramIndex, TrigramBuild, TrigramIndex_candidates
+#include <utils.h>         // for MIN, MAX, SIZE, path_join, elapsed_ms, fold_case
+#include <workpool.h>      // for WorkPool, Job, Job_new, WorkPool_submit, WorkPool_poll
+
+typedef struct {
+    // Relative to the root
+    char *path;
+    uint64_t line;
+    char *text;
+} SearchMatch;
+
+typedef struct Search Search;
+
+typedef struct {
+    Search *s;
+    // The index it runs on, which stays mapped while it has jobs
+    const TrigramIndex *ix;
+    char *literal;
+    size_t len;
+    // There's no uppercase letter in it, case is ignored
+    bool fold;
+    atomic_bool cancelled;
+    atomic_ullong matched;
+    atomic_ullong read_bytes;
+    uint32_t *candidates;
+    size_t ncandidates;
+    uint64_t candidate_bytes;
+    bool failed;
+
+    // Only on the UI thread
+    size_t pending_jobs;
+    // Another one replaced it, it goes once its jobs are done
+    bool retired;
+    SearchMatch *matches;
+    size_t nmatches, matches_cap;
+    struct timespec started;
+    long took_ms;
+} Query;
+
+typedef struct {
+    Query *q;
+    const uint32_t *files;
+    size_t count;
+    SearchMatch *matches;
+    size_t nmatches, matches_cap;
+} SearchChunk;
+
+struct Search {
+    WorkPool *pool;
+    char *root;
+    // Handle (O_PATH) of the root, files are opened relative to it
+    int root_fd;
+    // NULL until the previous index is mapped or a first one is built
+    TrigramIndex *ix;
+    // Set by the job mapping the previous index
+    TrigramIndex *found;
+    bool opened;
+    TrigramBuild *build;
+    // Replaces `ix` once no query runs on it
+    TrigramIndex *next;
+    char status[256];
+    bool leaving;
+
+    // Queries with jobs, the retired ones too
+    size_t queries_in_flight;
+    Query *query;
+    // Enter was pressed before there was an index
+    bool waiting;
+    char input[SEARCH_MAX_INPUT + 1];
+    size_t input_len;
+    SIZE cursor;
+    SIZE start;
+};
+
+static void free_matches(SearchMatch *matches, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        free(matches[i].path);
+        free(matches[i].text);
+    }
+    free(matches);
+}
+
+static void query_free(Query *q) {
+    free_matches(q->matches, q->nmatches);
+    free(q->candidates);
+    free(q->literal);
+    free(q);
+}
+
+static void job_finished(Query *q) {
+    if (--q->pending_jobs > 0)
+        return;
+    q->s->queries_in_flight--;
+    // The index may be replaced from now on
+    q->ix = NULL;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    q->took_ms = elapsed_ms(&q->started, &now);
+    if (q->retired)
+        query_free(q);
+}
+
+// The literal is folded already if case is ignored
+static const char *find(const Query *q, const char *hay, size_t len) {
+    if (!q->fold)
+        return memmem(hay, len, q->literal, q->len);
+    const unsigned char *h = (const unsigned char *)hay, *l = (const unsigned char *)q->literal;
+    for (size_t i = 0; i + q->len <= len; i++) {
+        size_t k = 0;
+        while (k < q->len && fold_case(h[i + k]) == l[k])
+            k++;
+        if (k == q->len)
+            return hay + i;
+    }
+    return NULL;
+}
+
+static uint64_t count_lines(const char *p, size_t len) {
+    uint64_t n = 0;
+    const char *end = p + len;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        n++;
+        p++;
+    }
+    return n;
+}
+
+// Returns false once there are enough matches
+static bool add_match(SearchChunk *c, const char *path, uint64_t line, const char *text, size_t len) {
+    if (atomic_fetch_add(&c->q->matched, 1) >= SEARCH_MAX_MATCHES)
+        return false;
+    if (c->nmatches == c->matches_cap) {
+        size_t cap = MAX(c->matches_cap * 2, 64);
+        SearchMatch *matches = realloc(c->matches, cap * sizeof(SearchMatch));
+        if (matches == NULL)
+            return false;
+        c->matches = matches;
+        c->matches_cap = cap;
+    }
+
+    len = MIN(len, SEARCH_LINE);
+    char *copy = malloc(len + 1);
+    char *copy_path = strdup(path);
+    if (copy == NULL || copy_path == NULL) {
+        free(copy);
+        free(copy_path);
+        return false;
+    }
+    // Tabs and control characters would mess up the row
+    for (size_t i = 0; i < len; i++)
+        copy[i] = (unsigned char)text[i] < ' ' || text[i] == 127 ? ' ' : text[i];
+    copy[len] = '\0';
+    c->matches[c->nmatches++] = (SearchMatch){ copy_path, line, copy };
+    return true;
+}
+
+// Searches `len` bytes of whole lines, the first being number *line
+static bool search_lines(SearchChunk *c, const char *path, const char *buf, size_t len, uint64_t *line) {
+    size_t pos = 0, counted = 0;
+    const char *m;
+    while (pos < len && (m = find(c->q, buf + pos, len - pos)) != NULL) {
+        size_t at = m - buf;
+        const char *nl = memrchr(buf + counted, '\n', at - counted);
+        size_t start = nl != NULL ? (size_t)(nl - buf) + 1 : counted;
+        *line += count_lines(buf + counted, start - counted);
+        counted = start;
+
+        const char *eol = memchr(buf + at, '\n', len - at);
+        size_t end = eol != NULL ? (size_t)(eol - buf) : len;
+        if (!add_match(c, path, *line, buf + start, end - start))
+            return false;
+        pos = eol != NULL ? end + 1 : len;
+    }
+    *line += count_lines(buf + counted, len - counted);
+    return true;
+}
+
+// Returns false once there are enough matches
+static bool search_file(SearchChunk *c, uint32_t file, char *buf) {
+    Query *q = c->q;
+    const char *path = TrigramIndex_path(q->ix, file);
+    // Not blocking on a FIFO that took the file's place
+    int fd = openat(q->s->root_fd, path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1)
+        return true;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return true;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    size_t have = 0;
+    uint64_t line = 1;
+    bool more = true, keep_going = true;
+    while (more && keep_going && !atomic_load(&q->cancelled)) {
+        ssize_t n = read(fd, buf + have, SEARCH_BLOCK - have);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            more = false;
+        } else {
+            have += n;
+            atomic_fetch_add(&q->read_bytes, n);
+        }
+
+        // Whole lines only, unless one fills the buffer
+        size_t end = have;
+        if (more) {
+            const char *nl = memrchr(buf, '\n', have);
+            if (nl != NULL)
+                end = nl - buf + 1;
+            else if (have < SEARCH_BLOCK)
+                continue;
+        }
+        keep_going = search_lines(c, path, buf, end, &line);
+        memmove(buf, buf + end, have - end);
+        have -= end;
+    }
+    close(fd);
+    return keep_going;
+}
+
+static void chunk_run(Job *job) {
+    SearchChunk *c = job->data;
+    char *buf = malloc(SEARCH_BLOCK);
+    for (size_t i = 0; buf != NULL && i < c->count && !atomic_load(&c->q->cancelled); i++)
+        if (!search_file(c, c->files[i], buf))
+            break;
+    free(buf);
+}
+
+static int compare_matches(const void *a, const void *b) {
+    const SearchMatch *ma = a, *mb = b;
+    int cmp = strcmp(ma->path, mb->path);
+    if (cmp != 0)
+        return cmp;
+    return ma->line < mb->line ? -1 : ma->line > mb->line;
+}
+
+static void chunk_done(Job *job) {
+    SearchChunk *c = job->data;
+    Query *q = c->q;
+
+    size_t added = 0;
+    if (!q->retired && c->nmatches > 0) {
+        SearchMatch *matches = realloc(q->matches, (q->nmatches + c->nmatches) * sizeof(SearchMatch));
+        if (matches != NULL) {
+            q->matches = matches;
+            memcpy(q->matches + q->nmatches, c->matches, c->nmatches * sizeof(SearchMatch));
+            q->nmatches += c->nmatches;
+            added = c->nmatches;
+            // By path and line, whichever job was done first
+            qsort(q->matches, q->nmatches, sizeof(SearchMatch), compare_matches);
+        }
+    }
+    if (added == 0)
+        free_matches(c->matches, c->nmatches);
+    else
+        free(c->matches);
+    free(c);
+    job_finished(q);
+}
+
+static void submit_chunks(Query *q) {
+    size_t first = 0;
+    while (first < q->ncandidates && !q->retired) {
+        size_t n = 0;
+        uint64_t bytes = 0;
+        while (first + n < q->ncandidates && n < SEARCH_CHUNK_FILES && (n == 0 || bytes < SEARCH_CHUNK_BYTES))
+            bytes += TrigramIndex_size(q->ix, q->candidates[first + n++]);
+
+        SearchChunk *c = calloc(1, sizeof(SearchChunk));
+        Job *job = c != NULL ? Job_new(chunk_run, chunk_done, c, JOB_PRIO_HIGH) : NULL;
+        if (job == NULL) {
+            free(c);
+            q->failed = true;
+            return;
+        }
+        c->q = q;
+        c->files = q->candidates + first;
+        c->count = n;
+        q->pending_jobs++;
+        WorkPool_submit(q->s->pool, job);
+        first += n;
+    }
+}
+
+static void candidates_run(Job *job) {
+    Query *q = job->data;
+    if (!TrigramIndex_candidates(q->ix, q->literal, q->len, &q->candidates, &q->ncandidates)) {
+        q->failed = true;
+        return;
+    }
+    for (size_t i = 0; i < q->ncandidates; i++)
+        q->candidate_bytes += TrigramIndex_size(q->ix, q->candidates[i]);
+}
+
+static void candidates_done(Job *job) {
+    Query *q = job->data;
+    if (!job->ran)
+        q->failed = true;
+    else
+        submit_chunks(q);
+    job_finished(q);
+}
+
+// The query shown is replaced, its jobs are cancelled
+static void retire(Search *s) {
+    Query *q = s->query;
+    s->query = NULL;
+    if (q == NULL)
+        return;
+    atomic_store(&q->cancelled, true);
+    if (q->pending_jobs > 0)
+        q->retired = true;
+    else
+        query_free(q);
+}
+
+static void start_query(Search *s) {
+    s->waiting = false;
+    retire(s);
+    s->cursor = s->start = 0;
+
+    Query *q = calloc(1, sizeof(Query));
+    char *literal = strndup(s->input, s->input_len);
+    Job *job = q != NULL && literal != NULL ? Job_new(candidates_run, candidates_done, q, JOB_PRIO_HIGH) : NULL;
+    if (job == NULL) {
+        free(q);
+        free(literal);
+        return;
+    }
+    q->s = s;
+    q->ix = s->ix;
+    q->literal = literal;
+    q->len = s->input_len;
+    q->fold = true;
+    for (size_t i = 0; i < q->len; i++)
+        if (literal[i] >= 'A' && literal[i] <= 'Z')
+            q->fold = false;
+    atomic_init(&q->cancelled, false);
+    atomic_init(&q->matched, 0);
+    atomic_init(&q->read_bytes, 0);
+    clock_gettime(CLOCK_MONOTONIC, &q->started);
+
+    s->query = q;
+    s->queries_in_flight++;
+    q->pending_jobs = 1;
+    WorkPool_submit(s->pool, job);
+}
+
+static void open_run(Job *job) {
+    Search *s = job->data;
+    s->root_fd = open(s->root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (s->root_fd != -1)
+        s->found = TrigramIndex_open(s->root);
+}
+
+static void open_done(Job *job) {
+    Search *s = job->data;
+    s->opened = true;
+    s->ix = s->found;
+    if (s->leaving)
+        return;
+    if (s->root_fd == -1) {
+        snprintf(s->status, sizeof(s->status), "The directory can't be read");
+        return;
+    }
+    s->build = TrigramBuild_start(s->pool, s->root, s->ix);
+    if (s->build == NULL)
+        snprintf(s->status, sizeof(s->status), "Out of memory");
+}
+
+static void draw(WINDOW *win, Search *s) {
+    int lines, cols;
+    getmaxyx(win, lines, cols);
+    SIZE num_lines = lines - 6;
+    char read[32], total[32], status[256];
+    const Query *q = s->query;
+
+    s->start = MIN(s->start, s->cursor);
+    s->start = MAX(s->start, s->cursor + 1 - num_lines);
+
+    werase(win);
+    box(win, 0, 0);
+    mvwprintw(win, 0, 2, "Search: %.*s", MAX(cols - 12, 1), s->root);
+    mvwprintw(win, 1, 2, "> %.*s", MAX(cols - 6, 1), s->input);
+
+    if (s->build != NULL)
+        TrigramBuild_status(s->build, status, sizeof(status));
+    else
+        snprintf(status, sizeof(status), "%s", s->opened ? s->status : "Looking for the index...");
+    if (s->ix != NULL)
+        mvwprintw(win, 2, 2, "%u files indexed. %.*s", TrigramIndex_files(s->ix), MAX(cols - 30, 1), status);
+    else
+        mvwprintw(win, 2, 2, "%.*s", MAX(cols - 4, 1), status);
+
+    for (SIZE i = s->start; q != NULL && i < (SIZE)q->nmatches && i - s->start < num_lines; i++) {
+        const SearchMatch *m = &q->matches[i];
+        if (i == s->cursor)
+            wattron(win, A_REVERSE);
+        mvwprintw(win, 4 + i - s->start, 2, "%.*s:%llu: %.*s", MAX(cols / 2, 1), m->path,
+                  (unsigned long long)m->line, MAX(cols - 4, 1), m->text);
+        if (i == s->cursor)
+            wattroff(win, A_REVERSE);
+    }
+
+    if (q == NULL)
+        mvwprintw(win, lines - 2, 2, s->waiting ? "The search starts once there's an index"
+                                                : "Type a string, enter to search, esc to leave");
+    else if (q->pending_jobs > 0)
+        mvwprintw(win, lines - 2, 2, "Searching %zu of %u files: %s of %s read",
+                  q->ncandidates, TrigramIndex_files(q->ix),
+                  format_file_size(read, atomic_load(&q->read_bytes)), format_file_size(total, q->candidate_bytes));
+    else if (q->failed)
+        mvwprintw(win, lines - 2, 2, "Out of memory, the search is incomplete");
+    else
+        mvwprintw(win, lines - 2, 2, "%zu%s matches, %zu files read in %ld ms. Enter opens the directory of a match",
+                  q->nmatches, q->nmatches >= SEARCH_MAX_MATCHES ? " (or more)" : "", q->ncandidates, q->took_ms);
+    wrefresh(win);
+}
+
+// Returns whether the view is done with
+static bool handle_key(Search *s, int ch, char **chosen) {
+    Query *q = s->query;
+    switch (ch) {
+        case 27:
+        case KEY_F(1):
+            return true;
+        case KEY_UP:
+            s->cursor = MAX(s->cursor - 1, 0);
+            break;
+        case KEY_DOWN:
+            if (q != NULL)
+                s->cursor = MIN(s->cursor + 1, MAX((SIZE)q->nmatches - 1, 0));
+            break;
+        case '\n':
+        case KEY_ENTER:
+            // A match is chosen once the search is the one typed
+            if (q != NULL && q->len == s->input_len && memcmp(q->literal, s->input, q->len) == 0) {
+                if (q->nmatches > 0) {
+                    *chosen = path_join(s->root, q->matches[s->cursor].path);
+                    return true;
+                }
+            } else if (s->input_len > 0) {
+                if (s->ix != NULL)
+                    start_query(s);
+                else
+                    s->waiting = true;
+            }
+            break;
+        case KEY_BACKSPACE:
+        case 127:
+        case 8:
+            if (s->input_len > 0)
+                s->input[--s->input_len] = '\0';
+            break;
+        default:
+            // Bytes of UTF-8 strings are searched as they are
+            if (ch >= ' ' && ch < 256 && ch != 127 && s->input_len < SEARCH_MAX_INPUT) {
+                s->input[s->input_len++] = (char)ch;
+                s->input[s->input_len] = '\0';
+            }
+            break;
+    }
+    return false;
+}
+
+char *search_view(WorkPool *pool, const char *root) {
+    Search *s = calloc(1, sizeof(Search));
+    if (s == NULL)
+        return NULL;
+    s->pool = pool;
+    s->root = strdup(root);
+    // Looked up by the job, the root may be on a hung mount
+    s->root_fd = -1;
+    Job *open_job = s->root != NULL ? Job_new(open_run, open_done, s, JOB_PRIO_HIGH) : NULL;
+    if (open_job == NULL) {
+        free(s->root);
+        free(s);
+        return NULL;
+    }
+    // The cache may be on a slow disk too
+    Fsio_submit(open_job, s->root, FSIO_DEADLINE_READ);
+
+    WINDOW *win = newwin(LINES, COLS, 0, 0);
+    keypad(win, TRUE);
+    wtimeout(win, 100);
+
+    char *chosen = NULL;
+    for (;;) {
+        WorkPool_poll(pool);
+        Fsio_poll();
+
+        if (s->build != NULL && TrigramBuild_done(s->build)) {
+            TrigramBuild_status(s->build, s->status, sizeof(s->status));
+            TrigramIndex *ix = TrigramBuild_finish(s->build);
+            s->build = NULL;
+            if (ix != NULL)
+                s->next = ix;
+        }
+        // Queries point into the index, it can only go once they are done
+        if (s->next != NULL && s->queries_in_flight == 0) {
+            TrigramIndex_close(s->ix);
+            s->ix = s->next;
+            s->next = NULL;
+        }
+        if (s->waiting && s->ix != NULL)
+            start_query(s);
+
+        // Jobs point to the view, it can only go once they are done
+        if (s->leaving && s->opened && s->build == NULL && s->queries_in_flight == 0)
+            break;
+
+        draw(win, s);
+        // Results show up sooner
+        wtimeout(win, s->queries_in_flight > 0 ? 10 : 100);
+        int ch = wgetch(win);
+        if (ch == ERR || s->leaving)
+            continue;
+        if (handle_key(s, ch, &chosen)) {
+            s->leaving = true;
+            retire(s);
+            if (s->build != NULL)
+                TrigramBuild_cancel(s->build);
+        }
+    }
+
+    werase(win);
+    wrefresh(win);
+    delwin(win);
+
+    TrigramIndex_close(s->ix);
+    TrigramIndex_close(s->next);
+    if (s->root_fd != -1)
+        close(s->root_fd);
+    free(s->root);
+    free(s);
+    return chosen;
+}
@@ -0,0 +1,29 @@
+// File: search.h
+// -----------------------
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <workpool.h>  // for WorkPool
+
+// Matches kept per search, it stops there
+#define SEARCH_MAX_MATCHES 10000
+// Bytes of a matching line that are shown
+#define SEARCH_LINE 200
+// Characters of a search string
+#define SEARCH_MAX_INPUT 255
+// Bytes read from a file at a time. A line longer than this is searched in
+// pieces, a match across two of them is missed.
+#define SEARCH_BLOCK (1 << 20)
+// Candidate files read by a single job, cut after this many bytes too
+#define SEARCH_CHUNK_FILES 256
+#define SEARCH_CHUNK_BYTES (64ULL << 20)
+
+// Looks for a literal string, typed in, in the files below `root`. The
+// files that may have it are found through the trigram index of the tree,
+// only those are read. The index is brought up to date when the view opens,
+// the previous one answers meanwhile. Case is ignored unless the string has
+// an uppercase letter. Returns the path of the file of the match chosen with
+// Enter, to be freed, or NULL if the user left with Esc.
+char *search_view(WorkPool *pool, const char *root);
+
+#endif // SEARCH_H
@@ -0,0 +1,767 @@
+// File: tar.c
+// -----------------------
+#define _GNU_SOURCE          // for fopencookie, cookie_io_functions_t, memrchr
+#include <errno.h>           // for errno, ENOTDIR, ENOENT
+#include <fcntl.h>           // for open, posix_fadvise, O_RDONLY, O_CLOEXEC
+#include <limits.h>          // for PATH_MAX
+#include <pthread.h>         // for pthread_mutex_t, pthread_mutex_lock, pthread_mutex_unlock
+#include <stdint.h>          // for uint32_t, uint64_t, UINT32_MAX
+#include <stdio.h>           // for FILE, fopencookie
+#include <stdlib.h>          // for malloc, calloc, realloc, free, strtoull
+#include <string.h>          // for memcpy, memcmp, memset, strlen, strrchr, strncmp
+#include <sys/stat.h>        // for struct stat, stat, fstat, S_ISREG, S_ISDIR, S_IFDIR, S_IFREG
+#include <unistd.h>          // for pread, close
+// Local includes
+#include <files.h>           // for FileAttr, FileAttr_get_meta, mk_attr
+#include <fsio.h>            // for Fsio_progress
+#include <hash.h>            // for hash64
+#include <metadata.h>        // for META_COL_ALL
+#include <tar.h>             // for TAR_CACHE_SLOTS
+#include <utils.h>           // for MIN, MAX
+
+#define BLOCK 512
+// Headers of small members are read this many bytes at a time, big members
+// are skipped with a single block read for the next header
+#define READ_BUFFER (64 * 1024)
+// Long names and pax headers bigger than that mean the archive is corrupt
+#define MAX_EXTENDED_HEADER (1024 * 1024)
+#define NONE UINT32_MAX
+
+typedef struct {
+    // Of the data, and of the whole subtree for directories
+    uint64_t size;
+    uint64_t offset;
+    long long mtime;
+    unsigned int mode;
+    unsigned int uid;
+    // Offsets in TarIndex.names
+    size_t name;
+    size_t link_name;
+    uint32_t link;
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t last_child;
+    uint32_t next_sibling;
+} TarEntry;
+
+typedef struct {
+    TarEntry *entries;
+    uint32_t count, cap;
+    char *names;
+    size_t names_len, names_cap;
+    // Open addressing, entry index + 1, 0 for free slots
+    uint32_t *table;
+    size_t table_cap;
+    int refs;
+} TarIndex;
+
+typedef struct {
+    TarIndex *index;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    unsigned long last_use;
+} CacheSlot;
+
+typedef struct {
+    int fd;
+    uint64_t buf_off;
+    size_t buf_len;
+    unsigned char buf[READ_BUFFER];
+} Reader;
+
+typedef struct {
+    int fd;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t pos;
+} MemberCookie;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static CacheSlot cache[TAR_CACHE_SLOTS];
+static unsigned long use_clock;
+
+static uint64_t parse_number(const unsigned char *field, size_t len) {
+    // GNU base-256 for values that don't fit in octal
+    if (field[0] & 0x80) {
+        uint64_t value = field[0] & 0x3f;
+        for (size_t i = 1; i < len; i++)
+            value = value << 8 | field[i];
+        return value;
+    }
+
+    uint64_t value = 0;
+    size_t i = 0;
+    while (i < len && field[i] == ' ')
+        i++;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+        value = value << 3 | (field[i] - '0');
+    return value;
+}
+
+static bool valid_header(const unsigned char *h) {
+    uint64_t stored = parse_number(h + 148, 8);
+    uint64_t sum = 0;
+    long long signed_sum = 0;
+    for (size_t i = 0; i < BLOCK; i++) {
+        unsigned char c = (i >= 148 && i < 156) ? ' ' : h[i];
+        sum += c;
+        signed_sum += (signed char)c;
+    }
+    // Some old tars summed signed chars
+    return stored == sum || (long long)stored == signed_sum;
+}
+
+static bool zero_block(const unsigned char *h) {
+    for (size_t i = 0; i < BLOCK; i++)
+        if (h[i])
+            return false;
+    return true;
+}
+
+static const unsigned char *read_block(Reader *r, uint64_t off, bool fill) {
+    if (off >= r->buf_off && off + BLOCK <= r->buf_off + r->buf_len)
+        return r->buf + (off - r->buf_off);
+
+    ssize_t got = pread(r->fd, r->buf, fill ? READ_BUFFER : BLOCK, off);
+    r->buf_off = off;
+    r->buf_len = got > 0 ? got : 0;
+    return r->buf_len >= BLOCK ? r->buf : NULL;
+}
+
+static char *read_data(int fd, uint64_t off, uint64_t size) {
+    if (size > MAX_EXTENDED_HEADER)
+        return NULL;
+    char *data = malloc(size + 1);
+    if (data == NULL)
+        return NULL;
+    if (pread(fd, data, size, off) != (ssize_t)size) {
+        free(data);
+        return NULL;
+    }
+    data[size] = '\0';
+    return data;
+}
+
+// Drops the empty and "." components and the slashes at both ends, in place
+static size_t normalize(char *path) {
+    size_t out = 0;
+    char *p = path;
+    while (*p) {
+        while (*p == '/')
+            p++;
+        char *end = p;
+        while (*end && *end != '/')
+            end++;
+        size_t len = end - p;
+        if (len && !(len == 1 && p[0] == '.')) {
+            if (out)
+                path[out++] = '/';
+            memmove(path + out, p, len);
+            out += len;
+        }
+        p = end;
+    }
+    path[out] = '\0';
+    return out;
+}
+
+static uint32_t find(const TarIndex *t, const char *path, size_t len) {
+    if (t->table_cap == 0)
+        return NONE;
+    size_t mask = t->table_cap - 1;
+    for (size_t i = hash64(path, len, 0) & mask;; i = (i + 1) & mask) {
+        uint32_t slot = t->table[i];
+        if (slot == 0)
+            return NONE;
+        const char *name = t->names + t->entries[slot - 1].name;
+        if (strncmp(name, path, len) == 0 && name[len] == '\0')
+            return slot - 1;
+    }
+}
+
+static bool grow_table(TarIndex *t) {
+    size_t cap = MAX(t->table_cap * 2, 1024);
+    uint32_t *table = calloc(cap, sizeof(uint32_t));
+    if (table == NULL)
+        return false;
+    for (uint32_t e = 0; e < t->count; e++) {
+        const char *name = t->names + t->entries[e].name;
+        size_t i = hash64(name, strlen(name), 0) & (cap - 1);
+        while (table[i])
+            i = (i + 1) & (cap - 1);
+        table[i] = e + 1;
+    }
+    free(t->table);
+    t->table = table;
+    t->table_cap = cap;
+    return true;
+}
+
+static size_t add_name(TarIndex *t, const char *name, size_t len) {
+    if (t->names_len + len + 1 > t->names_cap) {
+        size_t cap = MAX(t->names_cap * 2, t->names_len + len + 1 + 4096);
+        char *names = realloc(t->names, cap);
+        if (names == NULL)
+            return SIZE_MAX;
+        t->names = names;
+        t->names_cap = cap;
+    }
+    size_t off = t->names_len;
+    memcpy(t->names + off, name, len);
+    t->names[off + len] = '\0';
+    t->names_len += len + 1;
+    return off;
+}
+
+static uint32_t add_entry(TarIndex *t, const char *path, size_t len, const TarEntry *fields);
+
+static uint32_t ensure_dir(TarIndex *t, const char *path, size_t len) {
+    uint32_t idx = find(t, path, len);
+    if (idx != NONE)
+        return idx;
+    // Archives don't have to store the directories of their files
+    TarEntry dir = { .mode = S_IFDIR | 0755, .link_name = SIZE_MAX };
+    return add_entry(t, path, len, &dir);
+}
+
+// Later entries with the same name replace earlier ones, like extraction does
+static uint32_t add_entry(TarIndex *t, const char *path, size_t len, const TarEntry *fields) {
+    uint32_t idx = find(t, path, len);
+    if (idx != NONE) {
+        TarEntry *e = &t->entries[idx];
+        e->size = fields->size;
+        e->offset = fields->offset;
+        e->mtime = fields->mtime;
+        e->mode = fields->mode;
+        e->uid = fields->uid;
+        e->link_name = fields->link_name;
+        return idx;
+    }
+
+    const char *slash = memrchr(path, '/', len);
+    uint32_t parent = slash ? ensure_dir(t, path, slash - path) : 0;
+    if (parent == NONE)
+        return NONE;
+
+    if (t->count == t->cap) {
+        uint32_t cap = MAX(t->cap * 2, 1024);
+        TarEntry *entries = realloc(t->entries, cap * sizeof(TarEntry));
+        if (entries == NULL)
+            return NONE;
+        t->entries = entries;
+        t->cap = cap;
+    }
+    if ((t->count + 1) * 2 > t->table_cap && !grow_table(t))
+        return NONE;
+    size_t name = add_name(t, path, len);
+    if (name == SIZE_MAX)
+        return NONE;
+
+    idx = t->count++;
+    TarEntry *e = &t->entries[idx];
+    *e = *fields;
+    e->name = name;
+    e->link = NONE;
+    e->parent = parent;
+    e->first_child = e->last_child = e->next_sibling = NONE;
+
+    size_t mask = t->table_cap - 1;
+    size_t i = hash64(path, len, 0) & mask;
+    while (t->table[i])
+        i = (i + 1) & mask;
+    t->table[i] = idx + 1;
+
+    // Children are kept in archive order
+    if (idx != parent) {
+        TarEntry *p = &t->entries[parent];
+        if (p->last_child == NONE)
+            p->first_child = idx;
+        else
+            t->entries[p->last_child].next_sibling = idx;
+        p->last_child = idx;
+    }
+    return idx;
+}
+
+static void free_index(TarIndex *t) {
+    free(t->entries);
+    free(t->names);
+    free(t->table);
+    free(t);
+}
+
+// "len key=value\n" records, only the keys that matter for browsing
+static void parse_pax(char *data, size_t size, char **path, char **link, uint64_t *file_size, long long *mtime) {
+    char *p = data, *end = data + size;
+    while (p < end) {
+        char *rest;
+        unsigned long long len = strtoull(p, &rest, 10);
+        // The length counts itself, shorter than its own prefix it's garbage
+        if (len == 0 || len > (unsigned long long)(end - p) || *rest != ' '
+            || len <= (unsigned long long)(rest + 1 - p))
+            return;
+        char *record_end = p + len - 1;
+        char *key = rest + 1;
+        char *eq = memchr(key, '=', record_end - key);
+        if (eq != NULL && *record_end == '\n') {
+            *eq = *record_end = '\0';
+            char *value = eq + 1;
+            if (strcmp(key, "path") == 0) {
+                free(*path);
+                *path = strdup(value);
+            } else if (strcmp(key, "linkpath") == 0) {
+                free(*link);
+                *link = strdup(value);
+            } else if (strcmp(key, "size") == 0) {
+                *file_size = strtoull(value, NULL, 10);
+            } else if (strcmp(key, "mtime") == 0) {
+                *mtime = strtoll(value, NULL, 10);
+            }
+        }
+        p += len;
+    }
+}
+
+static unsigned int type_mode(char type) {
+    switch (type) {
+        case '1': // Hard link, the data is the target's
+        case '0':
+        case '\0':
+        case '7':
+        case 'S': return S_IFREG;
+        case '2': return S_IFLNK;
+        case '3': return S_IFCHR;
+        case '4': return S_IFBLK;
+        case '5':
+        case 'D': return S_IFDIR;
+        case '6': return S_IFIFO;
+        default:  return 0;
+    }
+}
+
+// Reads every header once, seeking over the data. Returns NULL if the file
+// isn't a tar archive or if *cancelled became true.
+static TarIndex *build_index(const char *archive, const atomic_bool *cancelled) {
+    int fd = open(archive, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    // Sizes in the headers are checked against it, a corrupt one could
+    // otherwise send the walk anywhere
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+    uint64_t archive_size = st.st_size;
+    // Only headers are read, readahead would pull in the data of big members
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+    Reader *r = malloc(sizeof(Reader));
+    TarIndex *t = calloc(1, sizeof(TarIndex));
+    TarEntry root = { .mode = S_IFDIR | 0755, .link_name = SIZE_MAX };
+    if (r == NULL || t == NULL || add_entry(t, "", 0, &root) != 0) {
+        free(r);
+        if (t)
+            free_index(t);
+        close(fd);
+        return NULL;
+    }
+    r->fd = fd;
+    r->buf_off = r->buf_len = 0;
+
+    char *long_name = NULL, *long_link = NULL;
+    uint64_t pax_size = UINT64_MAX;
+    long long pax_mtime = -1;
+    uint64_t off = 0;
+    bool fill = true;
+    bool ok = true;
+
+    for (size_t headers = 0;; headers++) {
+        if ((headers & 1023) == 0) {
+            if (cancelled != NULL && atomic_load(cancelled)) {
+                ok = false;
+                break;
+            }
+            // A huge archive legitimately takes long
+            Fsio_progress();
+        }
+
+        const unsigned char *h = read_block(r, off, fill);
+        if (h == NULL || zero_block(h))
+            break;
+        if (!valid_header(h)) {
+            // A truncated or damaged archive still shows what was readable
+            ok = headers > 0;
+            break;
+        }
+
+        char type = h[156];
+        uint64_t size = parse_number(h + 124, 12);
+        if (pax_size != UINT64_MAX && type != 'x' && type != 'L' && type != 'K')
+            size = pax_size;
+        uint64_t data = off + BLOCK;
+        if (data > archive_size || size > archive_size - data) {
+            // Truncated, or the size is garbage
+            ok = headers > 0;
+            break;
+        }
+        uint64_t next = data + (size + BLOCK - 1) / BLOCK * BLOCK;
+        if (next <= off)
+            break;
+
+        if (type == 'L' || type == 'K') {
+            char *value = read_data(fd, data, size);
+            if (value == NULL)
+                break;
+            free(type == 'L' ? long_name : long_link);
+            *(type == 'L' ? &long_name : &long_link) = value;
+        } else if (type == 'x') {
+            char *value = read_data(fd, data, size);
+            if (value == NULL)
+                break;
+            parse_pax(value, size, &long_name, &long_link, &pax_size, &pax_mtime);
+            free(value);
+        } else if (type_mode(type) != 0) {
+            char name[256 + 1 + 155 + 1];
+            const char *path = long_name;
+            if (path == NULL) {
+                // Only POSIX ustar has a prefix, GNU stores times there
+                if (memcmp(h + 257, "ustar\0", 6) == 0 && h[345])
+                    snprintf(name, sizeof(name), "%.155s/%.100s", h + 345, h);
+                else
+                    snprintf(name, sizeof(name), "%.100s", h);
+                path = name;
+            }
+
+            char *copy = strdup(path);
+            if (copy == NULL)
+                break;
+            size_t len = normalize(copy);
+
+            TarEntry e = {
+                .size = S_ISDIR(type_mode(type)) || type == '1' ? 0 : size,
+                .offset = data,
+                .mtime = pax_mtime >= 0 ? pax_mtime : (long long)parse_number(h + 136, 12),
+                .mode = type_mode(type) | (parse_number(h + 100, 8) & 07777),
+                .uid = parse_number(h + 108, 8),
+                .link_name = SIZE_MAX,
+            };
+            if (type == '1') {
+                char target[101];
+                snprintf(target, sizeof(target), "%.100s", h + 157);
+                char *link = strdup(long_link ? long_link : target);
+                if (link != NULL) {
+                    e.link_name = add_name(t, link, normalize(link));
+                    free(link);
+                }
+            }
+            if (len > 0 && add_entry(t, copy, len, &e) == NONE) {
+                free(copy);
+                break;
+            }
+            free(copy);
+        }
+        // Global pax headers, volume labels and such don't name members
+
+        if (type != 'x' && type != 'L' && type != 'K') {
+            free(long_name);
+            free(long_link);
+            long_name = long_link = NULL;
+            pax_size = UINT64_MAX;
+            pax_mtime = -1;
+        }
+        fill = next - off <= READ_BUFFER;
+        off = next;
+    }
+
+    free(long_name);
+    free(long_link);
+    free(r);
+    close(fd);
+    if (!ok) {
+        free_index(t);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < t->count; i++) {
+        TarEntry *e = &t->entries[i];
+        if (e->link_name != SIZE_MAX) {
+            const char *target = t->names + e->link_name;
+            e->link = find(t, target, strlen(target));
+        }
+    }
+    // Parents always come before their children
+    for (uint32_t i = t->count - 1; i > 0; i--)
+        t->entries[t->entries[i].parent].size += t->entries[i].size;
+
+    return t;
+}
+
+static void index_put(TarIndex *t) {
+    pthread_mutex_lock(&cache_lock);
+    if (--t->refs == 0)
+        free_index(t);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static CacheSlot *cache_find(const struct stat *st) {
+    for (size_t i = 0; i < TAR_CACHE_SLOTS; i++) {
+        CacheSlot *slot = &cache[i];
+        if (slot->index && slot->dev == st->st_dev && slot->ino == st->st_ino
+            && slot->size == st->st_size
+            && slot->mtime.tv_sec == st->st_mtim.tv_sec && slot->mtime.tv_nsec == st->st_mtim.tv_nsec)
+            return slot;
+    }
+    return NULL;
+}
+
+static TarIndex *index_get(const char *archive, const struct stat *st, const atomic_bool *cancelled) {
+    pthread_mutex_lock(&cache_lock);
+    CacheSlot *slot = cache_find(st);
+    if (slot != NULL) {
+        slot->last_use = ++use_clock;
+        slot->index->refs++;
+        TarIndex *t = slot->index;
+        pthread_mutex_unlock(&cache_lock);
+        return t;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    // Built without the lock, two threads may race to build the same index
+    // and the loser's copy is dropped
+    TarIndex *t = build_index(archive, cancelled);
+    if (t == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&cache_lock);
+    slot = cache_find(st);
+    if (slot != NULL) {
+        free_index(t);
+        t = slot->index;
+    } else {
+        slot = &cache[0];
+        for (size_t i = 1; i < TAR_CACHE_SLOTS; i++)
+            if (cache[i].index == NULL || (slot->index && cache[i].last_use < slot->last_use))
+                slot = &cache[i];
+        if (slot->index && --slot->index->refs == 0)
+            free_index(slot->index);
+        *slot = (CacheSlot){
+            .index = t,
+            .dev = st->st_dev,
+            .ino = st->st_ino,
+            .mtime = st->st_mtim,
+            .size = st->st_size,
+        };
+        // The cache holds a reference
+        t->refs = 1;
+    }
+    slot->last_use = ++use_clock;
+    t->refs++;
+    pthread_mutex_unlock(&cache_lock);
+    return t;
+}
+
+// Finds the archive in `path` by dropping components until what's left
+// exists. `archive` must hold PATH_MAX bytes, *inner points into `path`.
+static bool split_path(const char *path, char *archive, const char **inner, struct stat *st) {
+    size_t len = strlen(path);
+    if (len >= PATH_MAX)
+        return false;
+    memcpy(archive, path, len + 1);
+
+    for (;;) {
+        if (stat(archive, st) == 0) {
+            if (!S_ISREG(st->st_mode))
+                return false;
+            *inner = path + len;
+            while (**inner == '/')
+                (*inner)++;
+            return true;
+        }
+        if (errno != ENOTDIR && errno != ENOENT)
+            return false;
+        char *slash = strrchr(archive, '/');
+        if (slash == NULL || slash == archive)
+            return false;
+        *slash = '\0';
+        len = slash - archive;
+    }
+}
+
+// Looks up the member of `path`, taking a reference on its archive's index
+static TarIndex *lookup(const char *path, uint32_t *idx, char *archive, const atomic_bool *cancelled) {
+    const char *inner;
+    struct stat st;
+    if (!split_path(path, archive, &inner, &st))
+        return NULL;
+
+    TarIndex *t = index_get(archive, &st, cancelled);
+    if (t == NULL)
+        return NULL;
+
+    size_t len = strlen(inner);
+    while (len && inner[len - 1] == '/')
+        len--;
+    *idx = find(t, inner, len);
+    if (*idx == NONE) {
+        index_put(t);
+        return NULL;
+    }
+    return t;
+}
+
+// Hard links have the data of their target
+static const TarEntry *data_entry(const TarIndex *t, const TarEntry *e) {
+    return e->link != NONE ? &t->entries[e->link] : e;
+}
+
+bool Tar_is_archive(const char *path) {
+    unsigned char header[BLOCK];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    bool archive = pread(fd, header, BLOCK, 0) == BLOCK && !zero_block(header) && valid_header(header);
+    close(fd);
+    return archive;
+}
+
+bool Tar_in_archive(const char *path) {
+    char archive[PATH_MAX];
+    const char *inner;
+    struct stat st;
+    return split_path(path, archive, &inner, &st) && (*inner || Tar_is_archive(archive));
+}
+
+bool Tar_list(Vector *v, const char *path, const atomic_bool *cancelled) {
+    char archive[PATH_MAX];
+    uint32_t dir;
+    TarIndex *t = lookup(path, &dir, archive, cancelled);
+    if (t == NULL)
+        return cancelled == NULL || !atomic_load(cancelled);
+    if (!S_ISDIR(t->entries[dir].mode)) {
+        index_put(t);
+        return true;
+    }
+
+    bool complete = true;
+    size_t listed = 0;
+    for (uint32_t i = t->entries[dir].first_child; i != NONE; i = t->entries[i].next_sibling) {
+        if ((++listed & 4095) == 0 && cancelled != NULL && atomic_load(cancelled)) {
+            complete = false;
+            break;
+        }
+
+        const TarEntry *e = &t->entries[i];
+        const TarEntry *d = data_entry(t, e);
+        const char *name = t->names + e->name;
+        const char *base = strrchr(name, '/');
+
+        FileAttr fa = mk_attr(base ? base + 1 : name, S_ISDIR(e->mode), i);
+        if (fa == NULL)
+            continue;
+        // Everything the columns need is in the headers already
+        *FileAttr_get_meta(fa) = (FileMeta){
+            .state = META_READY,
+            .columns = META_COL_ALL,
+            .requested = META_COL_ALL,
+            .mode = e->mode,
+            .uid = e->uid,
+            .size = d->size,
+            .mtime = e->mtime,
+        };
+
+        Vector_add(v, 1);
+        v->el[Vector_len(*v)] = fa;
+        Vector_set_len(v, Vector_len(*v) + 1);
+    }
+
+    index_put(t);
+    return complete;
+}
+
+bool Tar_stat(const char *path, struct stat *st) {
+    char archive[PATH_MAX];
+    uint32_t idx;
+    TarIndex *t = lookup(path, &idx, archive, NULL);
+    if (t == NULL)
+        return false;
+
+    const TarEntry *e = &t->entries[idx];
+    memset(st, 0, sizeof(*st));
+    st->st_mode = e->mode;
+    st->st_size = data_entry(t, e)->size;
+    st->st_mtime = e->mtime;
+    st->st_uid = e->uid;
+    st->st_nlink = 1;
+    index_put(t);
+    return true;
+}
+
+static ssize_t member_read(void *cookie, char *buf, size_t size) {
+    MemberCookie *m = cookie;
+    size = MIN(size, m->size - m->pos);
+    if (size == 0)
+        return 0;
+    ssize_t got = pread(m->fd, buf, size, m->offset + m->pos);
+    if (got > 0)
+        m->pos += got;
+    return got;
+}
+
+static int member_seek(void *cookie, off64_t *offset, int whence) {
+    MemberCookie *m = cookie;
+    int64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (int64_t)m->pos : (int64_t)m->size;
+    if (whence != SEEK_SET && whence != SEEK_CUR && whence != SEEK_END)
+        return -1;
+    if (base + *offset < 0)
+        return -1;
+    m->pos = MIN((uint64_t)(base + *offset), m->size);
+    *offset = m->pos;
+    return 0;
+}
+
+static int member_close(void *cookie) {
+    MemberCookie *m = cookie;
+    close(m->fd);
+    free(m);
+    return 0;
+}
+
+FILE *Tar_fopen(const char *path) {
+    char archive[PATH_MAX];
+    uint32_t idx;
+    TarIndex *t = lookup(path, &idx, archive, NULL);
+    if (t == NULL)
+        return NULL;
+
+    const TarEntry *e = data_entry(t, &t->entries[idx]);
+    MemberCookie *m = S_ISREG(e->mode) ? malloc(sizeof(MemberCookie)) : NULL;
+    if (m != NULL)
+        *m = (MemberCookie){ .offset = e->offset, .size = e->size };
+    index_put(t);
+    if (m == NULL)
+        return NULL;
+
+    m->fd = open(archive, O_RDONLY | O_CLOEXEC);
+    FILE *file = m->fd != -1
+        ? fopencookie(m, "r", (cookie_io_functions_t){ .read = member_read, .seek = member_seek, .close = member_close })
+        : NULL;
+    if (file == NULL) {
+        if (m->fd != -1)
+            close(m->fd);
+        free(m);
+    }
+    return file;
+}
+
+void Tar_bye(void) {
+    pthread_mutex_lock(&cache_lock);
+    for (size_t i = 0; i < TAR_CACHE_SLOTS; i++) {
+        if (cache[i].index && --cache[i].index->refs == 0)
+            free_index(cache[i].index);
+        cache[i].index = NULL;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
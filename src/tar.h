@@ -0,0 +1,35 @@
+// File: tar.h
+// -----------------------
+#ifndef TAR_H
+#define TAR_H
+
+#include <stdatomic.h> // for atomic_bool
+#include <stdbool.h>   // for bool
+#include <stdio.h>     // for FILE
+#include <sys/stat.h>  // for struct stat
+#include <vector.h>    // for Vector
+
+// Indexes of this many archives are kept, keyed by (dev, inode, mtime)
+#define TAR_CACHE_SLOTS 4
+
+// Archives are browsed through virtual paths: "/x/backup.tar/etc/fstab" is
+// the member "etc/fstab" of "/x/backup.tar". Nothing is ever extracted, the
+// first use of an archive reads its headers once and the members are read
+// straight from the archive afterwards.
+
+// Whether `path` is a file that starts with a valid tar header
+bool Tar_is_archive(const char *path);
+// Whether `path` is an archive or goes through one
+bool Tar_in_archive(const char *path);
+// Lists the directory `path` of an archive, `path` being the archive itself
+// for its top level. Returns false if *cancelled became true, true otherwise
+// (even if `path` isn't in an archive, in which case nothing is listed).
+bool Tar_list(Vector *v, const char *path, const atomic_bool *cancelled);
+// stat() for members. Directories get the size of everything below them.
+bool Tar_stat(const char *path, struct stat *st);
+// Opens a regular member for reading, seekable, NULL if that's not possible
+FILE *Tar_fopen(const char *path);
+// Drops the cached indexes
+void Tar_bye(void);
+
+#endif // TAR_H
@@ -0,0 +1,1015 @@
+// File: trigram.c
+// -----------------------
+#define _GNU_SOURCE        // for qsort_r, O_PATH
+#include <fcntl.h>         // for open, openat, posix_fadvise, O_RDONLY, O_PATH, O_DIRECTORY, O_NOFOLLOW, O_NONBLOCK, O_CLOEXEC
+#include <stdatomic.h>     // for atomic_bool, atomic_ullong, atomic_load, atomic_store, atomic_fetch_add
+#include <stdint.h>        // for uint32_t, uint64_t, int64_t, UINT32_MAX
+#include <stdio.h>         // for FILE, fwrite, fflush, fseek, fclose, fileno, setvbuf, snprintf
+#include <stdlib.h>        // for malloc, realloc, calloc, free, qsort, qsort_r, bsearch, getenv
+#include <string.h>        // for strlen, strcmp, strdup, memcmp, memcpy, memchr, memset
+#include <sys/mman.h>      // for mmap, munmap, PROT_READ, MAP_PRIVATE, MAP_FAILED
+#include <sys/stat.h>      // for struct stat, fstat, S_ISREG
+#include <unistd.h>        // for close
+// Local includes
+#include <files.h>         // for format_file_size
+#include <fsio.h>          // for Fsio_submit, FSIO_DEADLINE_LIST
+#include <hash.h>          // for hash64
+#include <trigram.h>       // for TrigramIndex, TrigramBuild, TRIGRAM_CHUNK_BYTES, TRIGRAM_SEGMENT_PAIRS
+#include <utils.h>         // for MIN, MAX, path_join, make_parents, create_temp, replace_with_temp, discard_temp, fold_case, read_full
+#include <walk.h>          // for walk_tree, Walker, WalkEntry
+#include <workpool.h>      // for WorkPool, Job, Job_new, WorkPool_submit
+
+#define TRI_NONE UINT32_MAX
+// Bytes read from a file at a time
+#define TRI_BLOCK (256 << 10)
+// Native byte order, it's a cache read back where it was written
+#define TRI_MAGIC "CFMTRI1\n"
+
+// Every section starts 8 bytes aligned, the root follows the header
+typedef struct {
+    char magic[8];
+    uint32_t nfiles;
+    uint32_t ntrigrams;
+    uint64_t files;
+    uint64_t names;
+    uint64_t names_len;
+    uint64_t table;
+    uint64_t postings;
+    uint64_t postings_len;
+    uint64_t root_len;
+} TriHeader;
+
+// Sorted by path
+typedef struct {
+    uint64_t size;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t flags;
+    uint64_t name;         // Offset in the names, '\0' terminated
+} TriFile;
+
+// Sorted by trigram. The files having it are a list of varint deltas that
+// runs to the next entry's.
+typedef struct {
+    uint32_t trigram;
+    uint32_t count;
+    uint64_t offset;       // In the postings
+} TriEntry;
+
+struct TrigramIndex {
+    unsigned char *map;
+    size_t map_len;
+    const TriHeader *header;
+    const TriFile *files;
+    const char *names;
+    const TriEntry *table;
+    const unsigned char *postings;
+    // Ids in the lists are below this. Segments, written while building,
+    // have no files of their own.
+    uint32_t limit;
+};
+
+typedef enum {
+    BUILD_WALKING,
+    BUILD_READING,
+    BUILD_MERGING,
+    BUILD_DONE,
+} BuildState;
+
+struct TrigramBuild {
+    WorkPool *pool;
+    char *root;
+    // The index in the cache, segments are written next to it
+    char *file;
+    const TrigramIndex *previous;
+    // Handle (O_PATH) of the root, files are opened relative to it
+    int root_fd;
+    atomic_bool cancelled;
+    // Only on the UI thread
+    BuildState state;
+    size_t pending_jobs;
+    char error[128];
+    // Set by the walk or the merge, whichever is running
+    const char *failure;
+
+    // Regular files below the root, sorted by path once the walk is done
+    TriFile *files;
+    size_t nfiles, files_cap;
+    char *names;
+    size_t names_len, names_cap;
+    // Length of the root in the walked paths, with the slash
+    size_t prefix;
+    bool out_of_memory;
+    // New id of every file of `previous` that didn't change, TRI_NONE for
+    // the others
+    uint32_t *old_to_new;
+    // Files to read
+    uint32_t *changed;
+    size_t nchanged;
+    uint64_t to_read;
+
+    TrigramIndex **segments;
+    size_t nsegments, segments_cap;
+    TrigramIndex *result;
+
+    // Progress, read by the UI thread
+    atomic_ullong walked;
+    atomic_ullong read_bytes;
+};
+
+typedef struct {
+    TrigramBuild *b;
+    const uint32_t *ids;
+    size_t count;
+    // Found for each file
+    uint32_t *flags;
+    TrigramIndex **segments;
+    size_t nsegments, segments_cap;
+    const char *failure;
+} TriChunk;
+
+// (trigram << 32 | file)
+typedef struct {
+    uint64_t *el;
+    size_t len;
+} TriPairs;
+
+typedef struct {
+    FILE *f;
+    uint64_t offset;
+    // Where the postings start
+    uint64_t postings;
+    bool failed;
+    TriEntry *table;
+    size_t len, cap;
+    unsigned char *scratch;
+    size_t scratch_cap;
+} TriWriter;
+
+// Where a list of the merge comes from
+typedef struct {
+    const TrigramIndex *ix;
+    // Ids of the previous index are mapped to the new ones
+    const uint32_t *map;
+    size_t pos;
+} TriSource;
+
+static unsigned char *put_varint(unsigned char *p, uint32_t v) {
+    while (v >= 0x80) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+// NULL if it's cut or too long
+static const unsigned char *get_varint(const unsigned char *p, const unsigned char *end, uint32_t *v) {
+    uint32_t value = 0;
+    for (int shift = 0; p < end && shift < 35; shift += 7) {
+        value |= (uint32_t)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) {
+            *v = value;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static bool section_fits(const TrigramIndex *ix, uint64_t offset, uint64_t count, size_t size) {
+    return offset % 8 == 0 && offset <= ix->map_len && count <= (ix->map_len - offset) / size;
+}
+
+// Damaged files are thrown away rather than trusted
+static bool index_valid(const TrigramIndex *ix) {
+    const TriHeader *h = (const TriHeader *)ix->map;
+    if (memcmp(h->magic, TRI_MAGIC, sizeof(h->magic)) != 0
+        || h->root_len > ix->map_len - sizeof(TriHeader)
+        || !section_fits(ix, h->files, h->nfiles, sizeof(TriFile))
+        || !section_fits(ix, h->names, h->names_len, 1)
+        || !section_fits(ix, h->table, h->ntrigrams, sizeof(TriEntry))
+        || !section_fits(ix, h->postings, h->postings_len, 1))
+        return false;
+
+    const char *names = (const char *)ix->map + h->names;
+    if (h->nfiles > 0 && (h->names_len == 0 || names[h->names_len - 1] != '\0'))
+        return false;
+    const TriFile *files = (const TriFile *)(ix->map + h->files);
+    for (uint32_t i = 0; i < h->nfiles; i++)
+        if (files[i].name >= h->names_len)
+            return false;
+    const TriEntry *table = (const TriEntry *)(ix->map + h->table);
+    for (uint32_t i = 0; i < h->ntrigrams; i++)
+        if (table[i].offset > h->postings_len || (i > 0 && table[i].trigram <= table[i - 1].trigram))
+            return false;
+    return true;
+}
+
+static TrigramIndex *map_index(int fd, bool segment) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (uint64_t)st.st_size < sizeof(TriHeader))
+        return NULL;
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    TrigramIndex *ix = malloc(sizeof(TrigramIndex));
+    if (ix == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    ix->map = map;
+    ix->map_len = st.st_size;
+    if (!index_valid(ix)) {
+        TrigramIndex_close(ix);
+        return NULL;
+    }
+
+    const TriHeader *h = map;
+    ix->header = h;
+    ix->files = (const TriFile *)(ix->map + h->files);
+    ix->names = (const char *)ix->map + h->names;
+    ix->table = (const TriEntry *)(ix->map + h->table);
+    ix->postings = ix->map + h->postings;
+    ix->limit = segment ? TRI_NONE : h->nfiles;
+    return ix;
+}
+
+// Decodes up to `max` ids of the list of table entry `e`. Returns how many
+// there were, fewer than its count if the list is damaged.
+static size_t decode_list(const TrigramIndex *ix, size_t e, uint32_t *ids, size_t max) {
+    const TriEntry *entry = &ix->table[e];
+    uint64_t end = e + 1 < ix->header->ntrigrams ? ix->table[e + 1].offset : ix->header->postings_len;
+    if (entry->offset > end)
+        return 0;
+    const unsigned char *p = ix->postings + entry->offset, *stop = ix->postings + end;
+    size_t n = 0;
+    uint32_t id = 0;
+    while (n < entry->count && n < max && p != NULL && p < stop) {
+        uint32_t delta;
+        p = get_varint(p, stop, &delta);
+        if (p == NULL || (n > 0 && delta == 0) || delta >= ix->limit - id)
+            break;
+        id += delta;
+        ids[n++] = id;
+    }
+    return n;
+}
+
+static char *cache_dir(void) {
+    const char *cache = getenv("XDG_CACHE_HOME");
+    if (cache != NULL && cache[0] == '/')
+        return path_join(cache, "cupidfm/trigram");
+    const char *home = getenv("HOME");
+    if (home == NULL || home[0] != '/')
+        return NULL;
+    return path_join(home, ".cache/cupidfm/trigram");
+}
+
+// Named after a hash of the root, which is in the file to tell collisions
+static char *index_file(const char *root) {
+    char *dir = cache_dir();
+    if (dir == NULL)
+        return NULL;
+    char name[24];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash64(root, strlen(root), 0));
+    char *file = path_join(dir, name);
+    free(dir);
+    return file;
+}
+
+TrigramIndex *TrigramIndex_open(const char *root) {
+    char *file = index_file(root);
+    int fd = file != NULL ? open(file, O_RDONLY | O_CLOEXEC) : -1;
+    free(file);
+    if (fd == -1)
+        return NULL;
+    TrigramIndex *ix = map_index(fd, false);
+    close(fd);
+
+    size_t len = strlen(root);
+    if (ix != NULL && (ix->header->root_len != len || memcmp(ix->map + sizeof(TriHeader), root, len) != 0)) {
+        TrigramIndex_close(ix);
+        return NULL;
+    }
+    return ix;
+}
+
+void TrigramIndex_close(TrigramIndex *ix) {
+    if (ix == NULL)
+        return;
+    munmap(ix->map, ix->map_len);
+    free(ix);
+}
+
+uint32_t TrigramIndex_files(const TrigramIndex *ix) {
+    return ix->header->nfiles;
+}
+
+const char *TrigramIndex_path(const TrigramIndex *ix, uint32_t file) {
+    return ix->names + ix->files[file].name;
+}
+
+uint64_t TrigramIndex_size(const TrigramIndex *ix, uint32_t file) {
+    return ix->files[file].size;
+}
+
+uint32_t TrigramIndex_flags(const TrigramIndex *ix, uint32_t file) {
+    return ix->files[file].flags;
+}
+
+static int compare_trigram(const void *key, const void *entry) {
+    uint32_t t = *(const uint32_t *)key, other = ((const TriEntry *)entry)->trigram;
+    return t < other ? -1 : t > other;
+}
+
+static int compare_counts(const void *a, const void *b, void *ctx) {
+    const TrigramIndex *ix = ctx;
+    uint32_t ca = ix->table[*(const size_t *)a].count, cb = ix->table[*(const size_t *)b].count;
+    return ca < cb ? -1 : ca > cb;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    uint32_t ia = *(const uint32_t *)a, ib = *(const uint32_t *)b;
+    return ia < ib ? -1 : ia > ib;
+}
+
+// Keeps the ids of `a` that are in `b`, both sorted
+static size_t intersect(uint32_t *a, size_t na, const uint32_t *b, size_t nb) {
+    size_t n = 0, i = 0, j = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j])
+            i++;
+        else if (a[i] > b[j])
+            j++;
+        else {
+            a[n++] = a[i++];
+            j++;
+        }
+    }
+    return n;
+}
+
+bool TrigramIndex_candidates(const TrigramIndex *ix, const char *literal, size_t len,
+                             uint32_t **ids, size_t *count) {
+    uint32_t nfiles = ix->header->nfiles;
+    uint32_t *found = malloc(MAX(nfiles, 1) * sizeof(uint32_t));
+    size_t *entries = len >= 3 ? malloc((len - 2) * sizeof(size_t)) : NULL;
+    uint32_t *other = len >= 3 ? malloc(MAX(nfiles, 1) * sizeof(uint32_t)) : NULL;
+    if (found == NULL || (len >= 3 && (entries == NULL || other == NULL))) {
+        free(found);
+        free(entries);
+        free(other);
+        return false;
+    }
+
+    size_t n = 0;
+    if (len < 3) {
+        for (uint32_t i = 0; i < nfiles; i++)
+            if (!(ix->files[i].flags & TRIGRAM_BINARY))
+                found[n++] = i;
+    } else {
+        // The rarest trigram first, the lists only get shorter
+        const unsigned char *l = (const unsigned char *)literal;
+        size_t nentries = 0;
+        bool missing = false;
+        for (size_t k = 0; k + 2 < len && !missing; k++) {
+            uint32_t t = (uint32_t)fold_case(l[k]) << 16 | (uint32_t)fold_case(l[k + 1]) << 8 | fold_case(l[k + 2]);
+            const TriEntry *e = bsearch(&t, ix->table, ix->header->ntrigrams, sizeof(TriEntry), compare_trigram);
+            if (e == NULL)
+                missing = true;
+            else
+                entries[nentries++] = e - ix->table;
+        }
+        if (!missing) {
+            qsort_r(entries, nentries, sizeof(size_t), compare_counts, (void *)ix);
+            n = decode_list(ix, entries[0], found, nfiles);
+            for (size_t k = 1; k < nentries && n > 0; k++) {
+                size_t m = decode_list(ix, entries[k], other, nfiles);
+                n = intersect(found, n, other, m);
+            }
+        }
+
+        // Files that couldn't be read are read now to be sure
+        size_t before = n;
+        for (uint32_t i = 0; i < nfiles; i++)
+            if ((ix->files[i].flags & TRIGRAM_ERROR) && bsearch(&i, found, before, sizeof(uint32_t), compare_ids) == NULL)
+                found[n++] = i;
+        if (n > before)
+            qsort(found, n, sizeof(uint32_t), compare_ids);
+    }
+
+    free(entries);
+    free(other);
+    *ids = found;
+    *count = n;
+    return true;
+}
+
+static void put(TriWriter *w, const void *data, size_t len) {
+    if (len > 0 && !w->failed && fwrite(data, 1, len, w->f) != len)
+        w->failed = true;
+    w->offset += len;
+}
+
+static void pad(TriWriter *w) {
+    static const char zeros[8];
+    put(w, zeros, (8 - w->offset % 8) % 8);
+}
+
+static void writer_init(TriWriter *w, FILE *f) {
+    *w = (TriWriter){ .f = f };
+    // Written for real once everything else is
+    TriHeader header = { 0 };
+    put(w, &header, sizeof(header));
+}
+
+// `ids` sorted, without duplicates
+static void put_list(TriWriter *w, uint32_t trigram, const uint32_t *ids, size_t n) {
+    if (n == 0 || w->failed)
+        return;
+    if (w->len == w->cap) {
+        size_t cap = MAX(w->cap * 2, 4096);
+        TriEntry *table = realloc(w->table, cap * sizeof(TriEntry));
+        if (table == NULL) {
+            w->failed = true;
+            return;
+        }
+        w->table = table;
+        w->cap = cap;
+    }
+    // 5 bytes at most per varint
+    if (n * 5 > w->scratch_cap) {
+        unsigned char *scratch = realloc(w->scratch, n * 5);
+        if (scratch == NULL) {
+            w->failed = true;
+            return;
+        }
+        w->scratch = scratch;
+        w->scratch_cap = n * 5;
+    }
+
+    unsigned char *p = w->scratch;
+    uint32_t previous = 0;
+    for (size_t i = 0; i < n; i++) {
+        p = put_varint(p, ids[i] - previous);
+        previous = ids[i];
+    }
+    w->table[w->len++] = (TriEntry){ .trigram = trigram, .count = n, .offset = w->offset - w->postings };
+    put(w, w->scratch, p - w->scratch);
+}
+
+// Writes the table, then the header with the rest of its fields filled in
+// by the caller
+static bool writer_finish(TriWriter *w, TriHeader *h) {
+    memcpy(h->magic, TRI_MAGIC, sizeof(h->magic));
+    h->postings = w->postings;
+    h->postings_len = w->offset - w->postings;
+    pad(w);
+    h->table = w->offset;
+    h->ntrigrams = w->len;
+    put(w, w->table, w->len * sizeof(TriEntry));
+    if (!w->failed && (fseek(w->f, 0, SEEK_SET) != 0 || fwrite(h, sizeof(TriHeader), 1, w->f) != 1 || fflush(w->f) != 0))
+        w->failed = true;
+    free(w->table);
+    free(w->scratch);
+    return !w->failed;
+}
+
+static bool add_file(TrigramBuild *b, const char *name, const struct stat *st) {
+    size_t len = strlen(name) + 1;
+    if (b->nfiles >= TRI_NONE - 1)
+        return false;
+    if (b->nfiles == b->files_cap) {
+        size_t cap = MAX(b->files_cap * 2, 1024);
+        TriFile *files = realloc(b->files, cap * sizeof(TriFile));
+        if (files == NULL)
+            return false;
+        b->files = files;
+        b->files_cap = cap;
+    }
+    if (b->names_len + len > b->names_cap) {
+        size_t cap = MAX(b->names_cap * 2, b->names_len + len + 65536);
+        char *names = realloc(b->names, cap);
+        if (names == NULL)
+            return false;
+        b->names = names;
+        b->names_cap = cap;
+    }
+    memcpy(b->names + b->names_len, name, len);
+    b->files[b->nfiles++] = (TriFile){
+        .size = st->st_size,
+        .mtime_sec = st->st_mtim.tv_sec,
+        .mtime_nsec = st->st_mtim.tv_nsec,
+        .name = b->names_len,
+    };
+    b->names_len += len;
+    return true;
+}
+
+static bool walk_visit(void *ctx, const WalkEntry *e, [[maybe_unused]] uintptr_t *cookie) {
+    TrigramBuild *b = ctx;
+    atomic_fetch_add(&b->walked, 1);
+    if (S_ISREG(e->st->st_mode) && !b->out_of_memory && !add_file(b, e->path + b->prefix, e->st))
+        b->out_of_memory = true;
+    return true;
+}
+
+static int compare_files(const void *a, const void *b, void *names) {
+    return strcmp((const char *)names + ((const TriFile *)a)->name, (const char *)names + ((const TriFile *)b)->name);
+}
+
+// Both lists are sorted by path. The new ids of the files that didn't change
+// are in the same order as their old ones, so their lists stay sorted once
+// mapped.
+static bool match_previous(TrigramBuild *b) {
+    const TrigramIndex *old = b->previous;
+    uint32_t nold = old != NULL ? old->header->nfiles : 0;
+    b->changed = malloc(MAX(b->nfiles, 1) * sizeof(uint32_t));
+    b->old_to_new = malloc(MAX(nold, 1) * sizeof(uint32_t));
+    if (b->changed == NULL || b->old_to_new == NULL)
+        return false;
+    for (uint32_t j = 0; j < nold; j++)
+        b->old_to_new[j] = TRI_NONE;
+
+    uint32_t j = 0;
+    for (uint32_t i = 0; i < b->nfiles; i++) {
+        TriFile *f = &b->files[i];
+        const char *name = b->names + f->name;
+        while (j < nold && strcmp(TrigramIndex_path(old, j), name) < 0)
+            j++;
+        const TriFile *o = j < nold && strcmp(TrigramIndex_path(old, j), name) == 0 ? &old->files[j] : NULL;
+        if (o != NULL && !(o->flags & TRIGRAM_ERROR) && o->size == f->size
+            && o->mtime_sec == f->mtime_sec && o->mtime_nsec == f->mtime_nsec) {
+            b->old_to_new[j] = i;
+            f->flags = o->flags;
+        } else {
+            b->changed[b->nchanged++] = i;
+            b->to_read += f->size;
+        }
+    }
+    return true;
+}
+
+static void walk_run(Job *job) {
+    TrigramBuild *b = job->data;
+    Walker walker = {
+        .visit = walk_visit,
+        .ctx = b,
+        // Like du, what's mounted below is another tree
+        .one_filesystem = true,
+        .cancelled = &b->cancelled,
+    };
+    if (!walk_tree(b->root, 0, &walker)) {
+        b->failure = atomic_load(&b->cancelled) ? "Cancelled" : "The directory can't be read";
+        return;
+    }
+    if (b->nfiles > 0)
+        qsort_r(b->files, b->nfiles, sizeof(TriFile), compare_files, b->names);
+    if (b->out_of_memory || !match_previous(b)) {
+        b->failure = "Out of memory";
+        return;
+    }
+
+    make_parents(b->file);
+    b->root_fd = open(b->root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (b->root_fd == -1)
+        b->failure = "The directory can't be read";
+}
+
+static int compare_pairs(const void *a, const void *b) {
+    uint64_t pa = *(const uint64_t *)a, pb = *(const uint64_t *)b;
+    return pa < pb ? -1 : pa > pb;
+}
+
+// Writes the pairs out sorted as a segment, which has the same layout as an
+// index without files
+static bool flush_segment(TriChunk *c, TriPairs *pairs) {
+    if (c->nsegments == c->segments_cap) {
+        size_t cap = MAX(c->segments_cap * 2, 8);
+        TrigramIndex **segments = realloc(c->segments, cap * sizeof(TrigramIndex *));
+        if (segments == NULL) {
+            c->failure = "Out of memory";
+            return false;
+        }
+        c->segments = segments;
+        c->segments_cap = cap;
+    }
+    FILE *f = create_temp(c->b->file, NULL);
+    if (f == NULL) {
+        c->failure = "The cache can't be written";
+        return false;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+    qsort(pairs->el, pairs->len, sizeof(uint64_t), compare_pairs);
+    TriWriter w;
+    writer_init(&w, f);
+    w.postings = w.offset;
+    // The files of a chunk, so there are no more ids per trigram than that
+    uint32_t ids[TRIGRAM_CHUNK_FILES];
+    for (size_t start = 0, end; start < pairs->len; start = end) {
+        uint32_t trigram = pairs->el[start] >> 32;
+        size_t n = 0;
+        for (end = start; end < pairs->len && pairs->el[end] >> 32 == trigram; end++)
+            if (n < TRIGRAM_CHUNK_FILES)
+                ids[n++] = (uint32_t)pairs->el[end];
+        put_list(&w, trigram, ids, n);
+    }
+    pairs->len = 0;
+
+    TriHeader h = { 0 };
+    TrigramIndex *segment = writer_finish(&w, &h) ? map_index(fileno(f), true) : NULL;
+    fclose(f);
+    if (segment == NULL) {
+        c->failure = "The cache can't be written";
+        return false;
+    }
+    c->segments[c->nsegments++] = segment;
+    return true;
+}
+
+// Adds the trigrams of file `id` to the pairs, once each thanks to `seen`
+// (a bit per trigram, clear again when this returns). Returns its flags.
+static uint32_t read_file(TriChunk *c, uint32_t id, unsigned char *buf, uint64_t *seen, TriPairs *pairs) {
+    TrigramBuild *b = c->b;
+    // Not blocking on a FIFO that took the file's place
+    int fd = openat(b->root_fd, b->names + b->files[id].name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1)
+        return TRIGRAM_ERROR;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return TRIGRAM_ERROR;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    uint32_t flags = 0, window = 0;
+    uint64_t bytes = 0;
+    size_t first = pairs->len;
+    bool flushed = false;
+    for (;;) {
+        ssize_t n = read_full(fd, buf, TRI_BLOCK);
+        if (n == -1)
+            flags = TRIGRAM_ERROR;
+        if (n <= 0)
+            break;
+        // Like grep, a NUL byte early on means it's binary
+        if (bytes == 0 && memchr(buf, '\0', n) != NULL) {
+            flags = TRIGRAM_BINARY;
+            break;
+        }
+
+        for (ssize_t k = 0; k < n; k++) {
+            window = (window << 8 | fold_case(buf[k])) & 0xffffff;
+            if (bytes + (uint64_t)k < 2 || (seen[window >> 6] & (1ULL << (window & 63))))
+                continue;
+            seen[window >> 6] |= 1ULL << (window & 63);
+            pairs->el[pairs->len++] = (uint64_t)window << 32 | id;
+        }
+        bytes += n;
+        atomic_fetch_add(&b->read_bytes, n);
+
+        if (pairs->len >= TRIGRAM_SEGMENT_PAIRS) {
+            if (!flush_segment(c, pairs))
+                break;
+            flushed = true;
+        }
+        if (n < TRI_BLOCK)
+            break;
+        // Half read, it's read again next time
+        if (atomic_load(&b->cancelled)) {
+            flags = TRIGRAM_ERROR;
+            break;
+        }
+    }
+    close(fd);
+
+    if (flushed)
+        memset(seen, 0, (1 << 24) / 8);
+    else
+        for (size_t k = first; k < pairs->len; k++)
+            seen[(pairs->el[k] >> 32) >> 6] &= ~(1ULL << ((pairs->el[k] >> 32) & 63));
+    return flags;
+}
+
+static void chunk_run(Job *job) {
+    TriChunk *c = job->data;
+    TrigramBuild *b = c->b;
+    unsigned char *buf = malloc(TRI_BLOCK);
+    uint64_t *seen = calloc((1 << 24) / 64, sizeof(uint64_t));
+    // A block adds no more pairs than it has bytes
+    TriPairs pairs = { malloc((TRIGRAM_SEGMENT_PAIRS + TRI_BLOCK) * sizeof(uint64_t)), 0 };
+
+    if (buf == NULL || seen == NULL || pairs.el == NULL)
+        c->failure = "Out of memory";
+    for (size_t i = 0; i < c->count && c->failure == NULL && !atomic_load(&b->cancelled); i++)
+        c->flags[i] = read_file(c, c->ids[i], buf, seen, &pairs);
+    if (c->failure == NULL && pairs.len > 0)
+        flush_segment(c, &pairs);
+
+    free(buf);
+    free(seen);
+    free(pairs.el);
+}
+
+static void fail(TrigramBuild *b, const char *message) {
+    if (b->error[0] == '\0')
+        snprintf(b->error, sizeof(b->error), "%s", message);
+}
+
+// The sources with the smallest trigram on top
+static void sift_down(TriSource *heap, size_t len, size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < len; child++)
+            if (heap[child].ix->table[heap[child].pos].trigram < heap[smallest].ix->table[heap[smallest].pos].trigram)
+                smallest = child;
+        if (smallest == i)
+            return;
+        TriSource tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// Writes the files, then for every trigram the lists of the previous index
+// (mapped to the new ids) and of the segments merged. Returns what went
+// wrong, NULL if nothing did.
+static const char *write_index(TrigramBuild *b, FILE *f, TriSource *heap, uint32_t *ids, uint32_t *list) {
+    const TrigramIndex *old = b->previous;
+    size_t nold = old != NULL ? old->header->nfiles : 0;
+    size_t len = 0;
+    if (old != NULL && old->header->ntrigrams > 0)
+        heap[len++] = (TriSource){ old, b->old_to_new, 0 };
+    for (size_t s = 0; s < b->nsegments; s++)
+        if (b->segments[s]->header->ntrigrams > 0)
+            heap[len++] = (TriSource){ b->segments[s], NULL, 0 };
+    for (size_t i = len / 2; i-- > 0;)
+        sift_down(heap, len, i);
+
+    TriWriter w;
+    TriHeader h = { .nfiles = b->nfiles, .root_len = strlen(b->root) };
+    writer_init(&w, f);
+    put(&w, b->root, h.root_len);
+    pad(&w);
+    h.files = w.offset;
+    put(&w, b->files, b->nfiles * sizeof(TriFile));
+    h.names = w.offset;
+    h.names_len = b->names_len;
+    put(&w, b->names, b->names_len);
+    pad(&w);
+    w.postings = w.offset;
+
+    for (size_t steps = 0; len > 0 && !w.failed; steps++) {
+        if (steps % 4096 == 0 && atomic_load(&b->cancelled))
+            break;
+        uint32_t trigram = heap[0].ix->table[heap[0].pos].trigram;
+        size_t n = 0, sources = 0;
+        while (len > 0 && heap[0].ix->table[heap[0].pos].trigram == trigram) {
+            TriSource *s = &heap[0];
+            size_t m = decode_list(s->ix, s->pos, list, s->map != NULL ? nold : b->nfiles);
+            for (size_t k = 0; k < m; k++) {
+                uint32_t id = s->map != NULL ? s->map[list[k]] : list[k];
+                if (id < b->nfiles && n < b->nfiles)
+                    ids[n++] = id;
+            }
+            sources++;
+            if (++s->pos == s->ix->header->ntrigrams)
+                heap[0] = heap[--len];
+            sift_down(heap, len, 0);
+        }
+
+        // Each list is sorted, and they have no file in common
+        if (sources > 1) {
+            qsort(ids, n, sizeof(uint32_t), compare_ids);
+            size_t unique = 0;
+            for (size_t k = 0; k < n; k++)
+                if (unique == 0 || ids[unique - 1] != ids[k])
+                    ids[unique++] = ids[k];
+            n = unique;
+        }
+        put_list(&w, trigram, ids, n);
+    }
+
+    if (atomic_load(&b->cancelled)) {
+        free(w.table);
+        free(w.scratch);
+        return "Cancelled";
+    }
+    if (!writer_finish(&w, &h) || (b->result = map_index(fileno(f), false)) == NULL)
+        return "The cache can't be written";
+    return NULL;
+}
+
+static void merge_run(Job *job) {
+    TrigramBuild *b = job->data;
+    size_t nold = b->previous != NULL ? b->previous->header->nfiles : 0;
+    TriSource *heap = malloc((b->nsegments + 1) * sizeof(TriSource));
+    uint32_t *ids = malloc(MAX(b->nfiles, 1) * sizeof(uint32_t));
+    uint32_t *list = malloc(MAX(MAX(nold, b->nfiles), 1) * sizeof(uint32_t));
+    char *tmp = NULL;
+
+    FILE *f = NULL;
+    if (heap == NULL || ids == NULL || list == NULL)
+        b->failure = "Out of memory";
+    else if ((f = create_temp(b->file, &tmp)) == NULL)
+        b->failure = "The cache can't be written";
+
+    if (f != NULL) {
+        setvbuf(f, NULL, _IOFBF, 1 << 20);
+        b->failure = write_index(b, f, heap, ids, list);
+        // Replaced at once, another instance may be reading it
+        if (b->failure != NULL)
+            discard_temp(f, tmp);
+        else if (!replace_with_temp(f, tmp, b->file))
+            b->failure = "The cache can't be written";
+    }
+
+    if (b->failure != NULL) {
+        TrigramIndex_close(b->result);
+        b->result = NULL;
+    }
+    free(heap);
+    free(ids);
+    free(list);
+}
+
+static void merge_done(Job *job) {
+    TrigramBuild *b = job->data;
+    b->pending_jobs--;
+    if (!job->ran)
+        fail(b, "Cancelled");
+    else if (b->failure != NULL)
+        fail(b, b->failure);
+    b->state = BUILD_DONE;
+}
+
+// Once every file is read, unless something failed
+static void start_merge(TrigramBuild *b) {
+    if (atomic_load(&b->cancelled))
+        fail(b, "Cancelled");
+    Job *merge = b->error[0] == '\0' ? Job_new(merge_run, merge_done, b, JOB_PRIO_HIGH) : NULL;
+    if (merge == NULL) {
+        fail(b, "Out of memory");
+        b->state = BUILD_DONE;
+        return;
+    }
+    b->state = BUILD_MERGING;
+    b->pending_jobs++;
+    WorkPool_submit(b->pool, merge);
+}
+
+static void chunk_done(Job *job) {
+    TriChunk *c = job->data;
+    TrigramBuild *b = c->b;
+    b->pending_jobs--;
+
+    if (!job->ran)
+        fail(b, "Cancelled");
+    else if (c->failure != NULL)
+        fail(b, c->failure);
+    else
+        for (size_t i = 0; i < c->count; i++)
+            b->files[c->ids[i]].flags = c->flags[i];
+
+    for (size_t s = 0; s < c->nsegments; s++) {
+        if (b->nsegments == b->segments_cap) {
+            size_t cap = MAX(b->segments_cap * 2, 32);
+            TrigramIndex **segments = realloc(b->segments, cap * sizeof(TrigramIndex *));
+            if (segments == NULL) {
+                fail(b, "Out of memory");
+                TrigramIndex_close(c->segments[s]);
+                continue;
+            }
+            b->segments = segments;
+            b->segments_cap = cap;
+        }
+        b->segments[b->nsegments++] = c->segments[s];
+    }
+    free(c->segments);
+    free(c->flags);
+    free(c);
+
+    if (b->pending_jobs == 0)
+        start_merge(b);
+}
+
+// The files that changed are split among jobs of about TRIGRAM_CHUNK_BYTES
+static void submit_chunks(TrigramBuild *b) {
+    size_t first = 0;
+    while (first < b->nchanged) {
+        size_t n = 0;
+        uint64_t bytes = 0;
+        while (first + n < b->nchanged && n < TRIGRAM_CHUNK_FILES && (n == 0 || bytes < TRIGRAM_CHUNK_BYTES))
+            bytes += b->files[b->changed[first + n++]].size;
+
+        TriChunk *c = calloc(1, sizeof(TriChunk));
+        uint32_t *flags = calloc(n, sizeof(uint32_t));
+        Job *job = c != NULL && flags != NULL ? Job_new(chunk_run, chunk_done, c, JOB_PRIO_HIGH) : NULL;
+        if (job == NULL) {
+            free(c);
+            free(flags);
+            fail(b, "Out of memory");
+            return;
+        }
+        *c = (TriChunk){ .b = b, .ids = b->changed + first, .count = n, .flags = flags };
+        b->pending_jobs++;
+        WorkPool_submit(b->pool, job);
+        first += n;
+    }
+}
+
+static void walk_done(Job *job) {
+    TrigramBuild *b = job->data;
+    b->pending_jobs--;
+    if (!job->ran || b->failure != NULL) {
+        fail(b, job->ran ? b->failure : "Cancelled");
+        b->state = BUILD_DONE;
+        return;
+    }
+
+    b->state = BUILD_READING;
+    submit_chunks(b);
+    if (b->pending_jobs == 0)
+        start_merge(b);
+}
+
+TrigramBuild *TrigramBuild_start(WorkPool *pool, const char *root, const TrigramIndex *previous) {
+    TrigramBuild *b = calloc(1, sizeof(TrigramBuild));
+    if (b == NULL)
+        return NULL;
+    b->pool = pool;
+    b->previous = previous;
+    b->root_fd = -1;
+    atomic_init(&b->cancelled, false);
+    atomic_init(&b->walked, 0);
+    atomic_init(&b->read_bytes, 0);
+    size_t len = strlen(root);
+    b->prefix = len + (len > 0 && root[len - 1] != '/');
+    b->root = strdup(root);
+    b->file = index_file(root);
+
+    Job *walk = b->root != NULL && b->file != NULL ? Job_new(walk_run, walk_done, b, JOB_PRIO_HIGH) : NULL;
+    if (walk == NULL) {
+        free(b->root);
+        free(b->file);
+        free(b);
+        return NULL;
+    }
+    b->state = BUILD_WALKING;
+    b->pending_jobs = 1;
+    // A hung mount shows up as not responding instead of a walk that never ends
+    Fsio_submit(walk, b->root, FSIO_DEADLINE_LIST);
+    return b;
+}
+
+void TrigramBuild_cancel(TrigramBuild *b) {
+    atomic_store(&b->cancelled, true);
+}
+
+bool TrigramBuild_done(const TrigramBuild *b) {
+    return b->state == BUILD_DONE;
+}
+
+const char *TrigramBuild_status(const TrigramBuild *b, char *buffer, size_t size) {
+    char read[32], total[32];
+    switch (b->state) {
+        case BUILD_WALKING:
+            snprintf(buffer, size, "Updating the index: %llu entries walked",
+                     (unsigned long long)atomic_load(&b->walked));
+            break;
+        case BUILD_READING:
+            snprintf(buffer, size, "Updating the index: reading %zu files that changed, %s of %s",
+                     b->nchanged, format_file_size(read, atomic_load(&b->read_bytes)),
+                     format_file_size(total, b->to_read));
+            break;
+        case BUILD_MERGING:
+            snprintf(buffer, size, "Updating the index: writing it");
+            break;
+        case BUILD_DONE:
+            if (b->error[0] != '\0')
+                snprintf(buffer, size, "The index couldn't be updated: %s", b->error);
+            else
+                snprintf(buffer, size, "Index up to date, %zu files read again", b->nchanged);
+            break;
+    }
+    return buffer;
+}
+
+TrigramIndex *TrigramBuild_finish(TrigramBuild *b) {
+    TrigramIndex *result = b->result;
+    for (size_t s = 0; s < b->nsegments; s++)
+        TrigramIndex_close(b->segments[s]);
+    if (b->root_fd != -1)
+        close(b->root_fd);
+    free(b->segments);
+    free(b->files);
+    free(b->names);
+    free(b->old_to_new);
+    free(b->changed);
+    free(b->root);
+    free(b->file);
+    free(b);
+    return result;
+}
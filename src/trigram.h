@@ -0,0 +1,65 @@
+// File: trigram.h
+// -----------------------
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <stdbool.h>   // for bool
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint32_t, uint64_t
+#include <workpool.h>  // for WorkPool
+
+// Files that changed are read by jobs of about this many bytes, several at
+// once
+#define TRIGRAM_CHUNK_BYTES (64ULL << 20)
+#define TRIGRAM_CHUNK_FILES 4096
+// (trigram, file) pairs a job collects before it writes them out sorted, as
+// one of the segments merged into the index at the end. 8 bytes each.
+#define TRIGRAM_SEGMENT_PAIRS (4 << 20)
+
+enum {
+    // There's a NUL byte at the start, it's not searched
+    TRIGRAM_BINARY = 1 << 0,
+    // Couldn't be read, it's read again by the next update
+    TRIGRAM_ERROR = 1 << 1,
+};
+
+// The files below a directory and, for every trigram of their contents
+// (ASCII case folded), which files have it. It's mapped from the cache,
+// $XDG_CACHE_HOME/cupidfm/trigram (~/.cache/cupidfm/trigram), read only, so
+// it can be queried from several threads.
+typedef struct TrigramIndex TrigramIndex;
+typedef struct TrigramBuild TrigramBuild;
+
+// Maps the index of `root`, NULL if there's none yet or it's damaged. May
+// block, only on workers.
+TrigramIndex *TrigramIndex_open(const char *root);
+void TrigramIndex_close(TrigramIndex *ix);
+
+uint32_t TrigramIndex_files(const TrigramIndex *ix);
+// Relative to the root
+const char *TrigramIndex_path(const TrigramIndex *ix, uint32_t file);
+uint64_t TrigramIndex_size(const TrigramIndex *ix, uint32_t file);
+uint32_t TrigramIndex_flags(const TrigramIndex *ix, uint32_t file);
+// Stores in *ids the files that may contain the `len` bytes of `literal`,
+// ignoring ASCII case: those having every trigram of it, or every text file
+// for less than 3 bytes. They have to be read to be sure. The ids are sorted
+// and malloc()ed. Returns false if there's no memory.
+bool TrigramIndex_candidates(const TrigramIndex *ix, const char *literal, size_t len,
+                             uint32_t **ids, size_t *count);
+
+// Brings the index of `root` up to date in the background: the tree is
+// walked, files whose size and mtime are those `previous` has (may be NULL)
+// keep their trigrams and only the others are read. The walk is an fsio
+// request, the reads are jobs of `pool`. `previous` must stay mapped until
+// the build is done. NULL if there's no memory.
+TrigramBuild *TrigramBuild_start(WorkPool *pool, const char *root, const TrigramIndex *previous);
+void TrigramBuild_cancel(TrigramBuild *b);
+// Whether every job is done, which WorkPool_poll and Fsio_poll find out
+bool TrigramBuild_done(const TrigramBuild *b);
+// Describes how far it got, or what went wrong once it's done
+const char *TrigramBuild_status(const TrigramBuild *b, char *buffer, size_t size);
+// Frees a build that's done and returns the new index, NULL if it failed or
+// was cancelled
+TrigramIndex *TrigramBuild_finish(TrigramBuild *b);
+
+#endif // TRIGRAM_H
@@ -1,20 +1,22 @@
 // File: utils.c
 // -----------------------
-#include <errno.h>     // for errno
+#define _GNU_SOURCE    // for strndup, fstatat, mkostemp
+#include <errno.h>     // for errno, EINTR
 #include <stdarg.h>    // for va_list, va_start, va_end
-#include <stdio.h>     // for fprintf, stderr, vfprintf
-#include <stdlib.h>    // for exit
-#include <string.h>    // for strerror
+#include <stdio.h>     // for FILE, fprintf, stderr, vfprintf, fdopen, fileno, fflush, fclose, rename
+#include <stdlib.h>    // for exit, malloc, free, mkostemp
+#include <string.h>    // for strerror, strlen, strrchr, strchr, strndup, strdup, memcpy
 #include <sys/wait.h>  // for WEXITSTATUS, WIFEXITED
 #include <dirent.h>    // for DIR, struct dirent, opendir, readdir, closedir
 #include <curses.h>    // for initscr, noecho, keypad, stdscr, clear, printw, refresh, mvaddch, getch, endwin
-#include <unistd.h>    // for system
-#include <sys/types.h> // for stat
-#include <sys/stat.h>  // for stat, S_ISDIR
+#include <unistd.h>    // for system, read, close, fsync, unlink
+#include <fcntl.h>     // for openat, O_RDONLY, O_CLOEXEC
+#include <sys/types.h> // for stat, ssize_t
+#include <sys/stat.h>  // for fstatat, fstat, mkdir, struct stat, S_ISDIR
+#include <time.h>      // for struct timespec
 // Local includes
 #include "utils.h"
 
-#define MAX_PATH_LENGTH 256
 #define MAX_DISPLAY_LENGTH 32
 
 
@@ -147,14 +149,159 @@ void preview_file(const char *filename) {
     fclose(file);
 }
 
-bool is_directory(const char *path, const char *filename) {
+bool is_directory(int dirfd, const char *filename) {
     struct stat path_stat;
-    char full_path[MAX_PATH_LENGTH];
-    snprintf(full_path, sizeof(full_path), "%s/%s", path, filename);
 
-    if (stat(full_path, &path_stat) == 0)
+    if (fstatat(dirfd, filename, &path_stat, 0) == 0)
         return S_ISDIR(path_stat.st_mode);
 
     return true;
 }
 
+char *path_join(const char *base, const char *extra) {
+    size_t base_len = strlen(base);
+    size_t extra_len = strlen(extra);
+    // No slash is added to an empty base or one ending with a slash already,
+    // an empty extra leaves the base as is
+    bool slash = base_len > 0 && extra_len > 0 && base[base_len - 1] != '/';
+
+    char *result = malloc(base_len + slash + extra_len + 1);
+    if (result == NULL)
+        return NULL;
+    memcpy(result, base, base_len);
+    if (slash)
+        result[base_len] = '/';
+    memcpy(result + base_len + slash, extra, extra_len + 1);
+    return result;
+}
+
+char *path_parent(const char *path) {
+    const char *last_slash = strrchr(path, '/');
+    if (last_slash == NULL)
+        return strndup(path, strlen(path));
+    // The parent of "/x" is "/"
+    return strndup(path, last_slash == path ? 1 : (size_t)(last_slash - path));
+}
+
+bool same_dir_state(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev
+        && a->st_ino == b->st_ino
+        && a->st_mtim.tv_sec == b->st_mtim.tv_sec
+        && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+long elapsed_ms(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000 + (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+unsigned char fold_case(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+ssize_t read_full(int fd, void *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, (char *)buf + got, len - got);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            return -1;
+        if (n == 0)
+            break;
+        got += n;
+    }
+    return got;
+}
+
+void make_parents(const char *path) {
+    char *dirs = strdup(path);
+    if (dirs == NULL)
+        return;
+    for (char *slash = strchr(dirs + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(dirs, 0700) == -1 && errno != EEXIST)
+            break;
+        *slash = '/';
+    }
+    free(dirs);
+}
+
+FILE *create_temp(const char *path, char **name) {
+    size_t len = strlen(path);
+    char *tmp = malloc(len + sizeof(".XXXXXX"));
+    if (tmp == NULL)
+        return NULL;
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    FILE *f = fd != -1 ? fdopen(fd, "w+") : NULL;
+    if (f == NULL) {
+        if (fd != -1) {
+            close(fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        return NULL;
+    }
+    if (name != NULL) {
+        *name = tmp;
+    } else {
+        unlink(tmp);
+        free(tmp);
+    }
+    return f;
+}
+
+bool replace_with_temp(FILE *f, char *name, const char *path) {
+    bool ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    ok = ok && rename(name, path) == 0;
+    if (!ok)
+        unlink(name);
+    free(name);
+    return ok;
+}
+
+void discard_temp(FILE *f, char *name) {
+    fclose(f);
+    unlink(name);
+    free(name);
+}
+
+char *slurp_file(int dirfd, const char *name, size_t max, size_t *len) {
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    char *data = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size >= 0 && (size_t)st.st_size <= max)
+        data = malloc(st.st_size + 1);
+    if (data == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    // It may have shrunk meanwhile, whatever is there is taken
+    size_t done = 0;
+    while (done < (size_t)st.st_size) {
+        ssize_t n = read(fd, data + done, st.st_size - done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1) {
+            free(data);
+            close(fd);
+            return NULL;
+        }
+        if (n == 0)
+            break;
+        done += n;
+    }
+    close(fd);
+
+    data[done] = '\0';
+    if (len != NULL)
+        *len = done;
+    return data;
+}
@@ -1,3 +1,8 @@
+#include <stdio.h>     // for FILE
+#include <sys/stat.h>  // for struct stat
+#include <sys/types.h> // for ssize_t
+#include <time.h>      // for struct timespec
+
 // Must be signed
 #define SIZE int
 
@@ -9,10 +14,42 @@
 [[noreturn]]
 void die(int r, const char *format, ...);
 
-void path_join(char *result, const char *path1, const char *path2);
+// Paths are only built for display and as keys of the caches, the files
+// themselves are reached relative to directory handles. Both return
+// malloc()ed strings, NULL if there's no memory.
+char *path_join(const char *base, const char *extra);
+// "/" for "/" itself
+char *path_parent(const char *path);
+// Same directory, not modified in between: its listing is still good
+bool same_dir_state(const struct stat *a, const struct stat *b);
+// Milliseconds from `from` to `to`, both CLOCK_MONOTONIC
+long elapsed_ms(const struct timespec *from, const struct timespec *to);
+// ASCII lowercase, other bytes (UTF-8 included) are left alone
+unsigned char fold_case(unsigned char c);
+// Fills `buf` unless the file ends first, retrying interrupted reads.
+// Returns how much was read, -1 on error.
+ssize_t read_full(int fd, void *buf, size_t len);
+// Creates the directories leading to the file `path`, private to the user
+void make_parents(const char *path);
+// Files are rewritten by writing a new one next to them and renaming it over
+// them, readers see either one whole. create_temp opens it for reading and
+// writing, NULL on failure. Its malloc()ed name is stored in *name if that's
+// wanted, otherwise it's unlinked right away and goes with the last handle.
+FILE *create_temp(const char *path, char **name);
+// Puts the temporary file in place of `path`, on disk first so a crash
+// leaves one or the other. Either way `f` is closed and `name` freed, the
+// temporary file is removed if it wasn't renamed.
+bool replace_with_temp(FILE *f, char *name, const char *path);
+// Gives up on it
+void discard_temp(FILE *f, char *name);
+// Reads the whole file `name` of the directory handle `dirfd` (AT_FDCWD for
+// the working directory), '\0' terminated. The result is malloc()ed, NULL if
+// it can't be read or it's larger than `max` bytes.
+char *slurp_file(int dirfd, const char *name, size_t max, size_t *len);
 void create_file(const char *filename);
 void edit_file(const char *filename);
 void display_files(const char *directory);
 void preview_file(const char *filename);
 void change_directory(const char *new_directory, const char ***files, int *num_files, int *selected_entry, int *start_entry, int *end_entry);
-bool is_directory(const char *path, const char *filename);
+// Follows symlinks, entries that can't be stat'ed count as directories
+bool is_directory(int dirfd, const char *filename);
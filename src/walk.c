@@ -0,0 +1,189 @@
+// File: walk.c
+// -----------------------
+#define _GNU_SOURCE        // for fdopendir, O_NOFOLLOW, O_CLOEXEC
+#include <dirent.h>        // for DIR, struct dirent, fdopendir, readdir, closedir, dirfd
+#include <errno.h>         // for errno
+#include <fcntl.h>         // for open, openat, O_RDONLY, O_DIRECTORY, AT_FDCWD
+#include <stdlib.h>        // for malloc, realloc, free
+#include <string.h>        // for strlen, memcpy, strcmp
+#include <sys/stat.h>      // for fstat, fstatat, S_ISDIR
+#include <unistd.h>        // for close
+// Local includes
+#include <fsio.h>          // for Fsio_progress
+#include <walk.h>          // for Walker, WalkEntry
+
+typedef struct {
+    DIR *dir;
+    uintptr_t cookie;
+    struct stat st;
+    // Length of the path of this directory and where its name starts in it
+    size_t path_len;
+    size_t name_off;
+} WalkFrame;
+
+typedef struct {
+    char *buf;
+    size_t cap;
+} PathBuf;
+
+static bool path_reserve(PathBuf *p, size_t len) {
+    if (len + 1 <= p->cap)
+        return true;
+    size_t cap = p->cap ? p->cap : 256;
+    while (cap < len + 1)
+        cap *= 2;
+    char *buf = realloc(p->buf, cap);
+    if (buf == NULL)
+        return false;
+    p->buf = buf;
+    p->cap = cap;
+    return true;
+}
+
+// The path of the frame's directory must be in the buffer when this is called
+static void leave_frame(const Walker *w, PathBuf *path, WalkFrame *frames, size_t depth) {
+    WalkFrame *frame = &frames[depth];
+    closedir(frame->dir);
+
+    path->buf[frame->path_len] = '\0';
+    WalkEntry entry = {
+        .name = path->buf + frame->name_off,
+        .path = path->buf,
+        .dirfd = depth > 0 ? dirfd(frames[depth - 1].dir) : AT_FDCWD,
+        .st = &frame->st,
+        .depth = depth,
+        .parent = depth > 0 ? frames[depth - 1].cookie : 0,
+    };
+    if (w->leave)
+        w->leave(w->ctx, &entry, frame->cookie);
+}
+
+bool walk_tree(const char *root, uintptr_t root_cookie, const Walker *w) {
+    int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    size_t frames_cap = 16;
+    WalkFrame *frames = malloc(frames_cap * sizeof(WalkFrame));
+    PathBuf path = { NULL, 0 };
+    size_t root_len = strlen(root);
+    if (frames == NULL || !path_reserve(&path, root_len)) {
+        free(frames);
+        close(fd);
+        return false;
+    }
+    memcpy(path.buf, root, root_len + 1);
+
+    WalkFrame *top = &frames[0];
+    if (fstat(fd, &top->st) == -1 || (top->dir = fdopendir(fd)) == NULL) {
+        close(fd);
+        free(frames);
+        free(path.buf);
+        return false;
+    }
+    top->cookie = root_cookie;
+    top->path_len = root_len;
+    top->name_off = 0;
+    dev_t root_dev = top->st.st_dev;
+
+    // Index of the top frame
+    size_t depth = 0;
+    bool cancelled = false;
+    for (;;) {
+        if (w->cancelled != NULL && atomic_load(w->cancelled)) {
+            cancelled = true;
+            break;
+        }
+
+        // Run as an fsio request, the deadline is per step of the walk
+        Fsio_progress();
+        WalkFrame *frame = &frames[depth];
+        struct dirent *dent = readdir(frame->dir);
+        if (dent == NULL) {
+            leave_frame(w, &path, frames, depth);
+            if (depth == 0)
+                break;
+            depth--;
+            continue;
+        }
+        if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+            continue;
+
+        // Build the path of the entry on top of the path of its directory
+        size_t name_len = strlen(dent->d_name);
+        size_t base_len = frame->path_len;
+        bool needs_slash = base_len > 0 && path.buf[base_len - 1] != '/';
+        size_t entry_len = base_len + needs_slash + name_len;
+        if (!path_reserve(&path, entry_len))
+            continue;
+        if (needs_slash)
+            path.buf[base_len] = '/';
+        memcpy(path.buf + base_len + needs_slash, dent->d_name, name_len + 1);
+
+        int parent_fd = dirfd(frame->dir);
+        struct stat st;
+        WalkEntry entry = {
+            .name = path.buf + base_len + needs_slash,
+            .path = path.buf,
+            .dirfd = parent_fd,
+            .st = &st,
+            .depth = depth + 1,
+            .parent = frame->cookie,
+        };
+        if (fstatat(parent_fd, dent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            if (w->error)
+                w->error(w->ctx, &entry, errno);
+            continue;
+        }
+
+        uintptr_t cookie = 0;
+        bool descend = w->visit(w->ctx, &entry, &cookie);
+        if (!S_ISDIR(st.st_mode) || !descend)
+            continue;
+        if (w->one_filesystem && st.st_dev != root_dev)
+            continue;
+
+        int child_fd = openat(parent_fd, dent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        DIR *child = child_fd == -1 ? NULL : fdopendir(child_fd);
+        if (child == NULL) {
+            int err = errno;
+            if (child_fd != -1)
+                close(child_fd);
+            if (w->error)
+                w->error(w->ctx, &entry, err);
+            // It was visited, so it's left too even if nothing is inside
+            if (w->leave)
+                w->leave(w->ctx, &entry, cookie);
+            continue;
+        }
+
+        if (depth + 1 == frames_cap) {
+            WalkFrame *grown = realloc(frames, frames_cap * 2 * sizeof(WalkFrame));
+            if (grown == NULL) {
+                closedir(child);
+                if (w->leave)
+                    w->leave(w->ctx, &entry, cookie);
+                continue;
+            }
+            frames = grown;
+            frames_cap *= 2;
+        }
+
+        depth++;
+        frames[depth] = (WalkFrame){
+            .dir = child,
+            .cookie = cookie,
+            .st = st,
+            .path_len = entry_len,
+            .name_off = base_len + needs_slash,
+        };
+    }
+
+    if (cancelled)
+        for (size_t i = 0; i <= depth; i++)
+            closedir(frames[i].dir);
+
+    free(frames);
+    free(path.buf);
+    return !cancelled;
+}
@@ -0,0 +1,49 @@
+// File: walk.h
+// -----------------------
+#ifndef WALK_H
+#define WALK_H
+
+#include <stdatomic.h> // for atomic_bool
+#include <stdbool.h>   // for bool
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uintptr_t
+#include <sys/stat.h>  // for struct stat
+
+typedef struct {
+    const char *name;
+    // Full path of the entry, only valid during the callback
+    const char *path;
+    // The directory containing the entry, for the *at() family
+    int dirfd;
+    // lstat() of the entry
+    const struct stat *st;
+    // 1 for the entries of the root
+    size_t depth;
+    // Cookie of the directory containing the entry
+    uintptr_t parent;
+} WalkEntry;
+
+typedef struct {
+    // Called for every entry below the root. Returning false for a directory
+    // skips its contents. Whatever is stored in *cookie for a directory is
+    // handed as `parent` to its entries and to leave().
+    bool (*visit)(void *ctx, const WalkEntry *entry, uintptr_t *cookie);
+    // Called once all the entries of a directory were visited, including the
+    // root (with depth 0). It's safe to remove the directory from here.
+    void (*leave)(void *ctx, const WalkEntry *entry, uintptr_t cookie);
+    // Called when an entry can't be stat'ed or a directory can't be read.
+    // May be NULL.
+    void (*error)(void *ctx, const WalkEntry *entry, int err);
+    void *ctx;
+    // Don't descend into directories on another device than the root
+    bool one_filesystem;
+    // Checked between entries, may be NULL
+    const atomic_bool *cancelled;
+} Walker;
+
+// Walks the tree iteratively (depth first, one open descriptor per level, no
+// recursion) without following symlinks. Returns false if the root couldn't
+// be opened or the walk was cancelled.
+bool walk_tree(const char *root, uintptr_t root_cookie, const Walker *walker);
+
+#endif // WALK_H
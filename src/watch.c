@@ -0,0 +1,131 @@
+// File: watch.c
+// -----------------------
+#include <errno.h>         // for errno, EINTR
+#include <stdalign.h>      // for alignas
+#include <stdio.h>         // for snprintf
+#include <stdlib.h>        // for realloc, free
+#include <sys/inotify.h>   // for inotify_init1, inotify_add_watch, inotify_rm_watch, struct inotify_event
+#include <unistd.h>        // for read, close
+// Local includes
+#include <watch.h>         // for WatchEvent, WatchFn, WATCH_MASK, WATCH_MAX_READS
+
+typedef struct {
+    int wd;
+    WatchFn fn;
+    void *owner;
+} Subscriber;
+
+// Only written by Watch_init and Watch_bye, workers just pass it to the kernel
+static int inotify_fd = -1;
+static Subscriber *subscribers;
+static size_t num_subscribers, subscribers_cap;
+
+static bool subscribed(int wd) {
+    for (size_t i = 0; i < num_subscribers; i++)
+        if (subscribers[i].wd == wd)
+            return true;
+    return false;
+}
+
+// The kernel dropped the watch, the subscribers were told already
+static void forget_wd(int wd) {
+    size_t kept = 0;
+    for (size_t i = 0; i < num_subscribers; i++)
+        if (subscribers[i].wd != wd)
+            subscribers[kept++] = subscribers[i];
+    num_subscribers = kept;
+}
+
+static void dispatch(const struct inotify_event *ev) {
+    WatchEvent event = {
+        .mask = ev->mask,
+        .name = ev->len > 0 && ev->name[0] != '\0' ? ev->name : NULL,
+    };
+    bool everyone = ev->mask & IN_Q_OVERFLOW;
+    for (size_t i = 0; i < num_subscribers; i++)
+        if (everyone || subscribers[i].wd == ev->wd)
+            subscribers[i].fn(subscribers[i].owner, &event);
+
+    if (ev->mask & IN_IGNORED)
+        forget_wd(ev->wd);
+}
+
+bool Watch_init(void) {
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return inotify_fd != -1;
+}
+
+void Watch_bye(void) {
+    if (inotify_fd != -1)
+        close(inotify_fd);
+    inotify_fd = -1;
+    free(subscribers);
+    subscribers = NULL;
+    num_subscribers = subscribers_cap = 0;
+}
+
+int Watch_fd(void) {
+    return inotify_fd;
+}
+
+int Watch_add(int fd) {
+    if (inotify_fd == -1 || fd < 0)
+        return -1;
+    // inotify only takes paths, the link in /proc leads straight to the inode
+    char link[32];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    return inotify_add_watch(inotify_fd, link, WATCH_MASK);
+}
+
+bool Watch_subscribe(int wd, WatchFn fn, void *owner) {
+    if (wd < 0)
+        return false;
+    if (num_subscribers == subscribers_cap) {
+        size_t cap = subscribers_cap ? subscribers_cap * 2 : 8;
+        Subscriber *grown = realloc(subscribers, cap * sizeof(Subscriber));
+        if (grown == NULL)
+            return false;
+        subscribers = grown;
+        subscribers_cap = cap;
+    }
+    subscribers[num_subscribers++] = (Subscriber){ .wd = wd, .fn = fn, .owner = owner };
+    return true;
+}
+
+void Watch_unsubscribe(int wd, void *owner) {
+    if (wd < 0)
+        return;
+    for (size_t i = 0; i < num_subscribers; i++) {
+        if (subscribers[i].wd == wd && subscribers[i].owner == owner) {
+            subscribers[i] = subscribers[--num_subscribers];
+            break;
+        }
+    }
+    Watch_drop_unused(wd);
+}
+
+void Watch_drop_unused(int wd) {
+    if (wd >= 0 && !subscribed(wd))
+        inotify_rm_watch(inotify_fd, wd);
+}
+
+void Watch_poll(void) {
+    if (inotify_fd == -1)
+        return;
+
+    alignas(struct inotify_event) char buf[16 * 1024];
+    for (int reads = 0; reads < WATCH_MAX_READS; reads++) {
+        ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len == -1 && errno == EINTR)
+            continue;
+        // EAGAIN once the queue is empty
+        if (len <= 0)
+            return;
+
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            dispatch(ev);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
@@ -0,0 +1,51 @@
+// File: watch.h
+// -----------------------
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>     // for bool
+#include <stdint.h>      // for uint32_t
+#include <sys/inotify.h> // for IN_* event masks
+
+// Every watch asks for the same events: the kernel keeps one watch per inode,
+// and adding it again with another mask would replace the first one
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_MODIFY \
+    | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+// Reads of the event queue per Watch_poll, the rest waits for the next one
+#define WATCH_MAX_READS 16
+
+typedef struct {
+    // IN_* flags, IN_Q_OVERFLOW when events were lost
+    uint32_t mask;
+    // Entry of the watched directory the event is about, NULL if it's about
+    // the watched file or directory itself
+    const char *name;
+} WatchEvent;
+
+// Must not subscribe or unsubscribe anything
+typedef void (*WatchFn)(void *owner, const WatchEvent *event);
+
+// Without inotify nothing is ever watched, the rest still works
+bool Watch_init(void);
+void Watch_bye(void);
+// The inotify descriptor, for a loop waiting in poll() rather than calling
+// Watch_poll regularly. -1 without inotify.
+int Watch_fd(void);
+
+// Starts watching the file `fd` refers to (O_PATH is enough), returns the
+// watch descriptor or -1. It may block on a dead mount, so it's meant for
+// workers, with the result handed to the UI thread. Adding the same inode
+// twice gives the same descriptor.
+int Watch_add(int fd);
+// UI thread only from here on. `fn` gets the events of `wd` until
+// unsubscribed, or until the watch goes away (after an IN_IGNORED event).
+bool Watch_subscribe(int wd, WatchFn fn, void *owner);
+// The watch is removed once nobody is subscribed to it
+void Watch_unsubscribe(int wd, void *owner);
+// For watches added by jobs whose results were thrown away
+void Watch_drop_unused(int wd);
+// Reads the queued events and hands them out. An overflow of the queue goes
+// to every subscriber.
+void Watch_poll(void);
+
+#endif // WATCH_H
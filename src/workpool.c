@@ -0,0 +1,208 @@
+// File: workpool.c
+// -----------------------
+#define _GNU_SOURCE        // for SCHED_IDLE
+#include <pthread.h>       // for pthread_create, pthread_join, pthread_mutex_*, pthread_cond_*
+#include <sched.h>         // for SCHED_IDLE, struct sched_param
+#include <stdlib.h>        // for malloc, calloc, realloc, free
+#include <sys/resource.h>  // for setpriority, PRIO_PROCESS
+// Local includes
+#include <utils.h>         // for die
+#include <workpool.h>      // for WorkPool, Job, JobPriority
+
+// Nice value used for the idle workers when SCHED_IDLE isn't available
+#define IDLE_NICE 19
+
+Job *Job_new(JobRunFn run, JobDoneFn done, void *data, JobPriority priority) {
+    Job *job = malloc(sizeof(Job));
+    if (job == NULL)
+        return NULL;
+
+    job->run = run;
+    job->done = done;
+    job->data = data;
+    job->priority = priority;
+    atomic_init(&job->cancelled, false);
+    job->ran = false;
+    job->next = NULL;
+    return job;
+}
+
+void Job_cancel(Job *job) {
+    atomic_store(&job->cancelled, true);
+}
+
+bool Job_cancelled(const Job *job) {
+    return atomic_load(&job->cancelled);
+}
+
+// Must be called with the lock held
+static void push_done(WorkPool *pool, Job *job) {
+    job->next = NULL;
+    if (pool->done_tail)
+        pool->done_tail->next = job;
+    else
+        pool->done_head = job;
+    pool->done_tail = job;
+}
+
+// Must be called with the lock held. Idle workers only look at the idle queue
+// so speculative work can never delay what the user asked for.
+static Job *pop_job(WorkPool *pool, bool idle_worker) {
+    for (int prio = idle_worker ? JOB_PRIO_IDLE : JOB_PRIO_HIGH; prio < JOB_PRIO_COUNT; prio++) {
+        Job *job = pool->queue_head[prio];
+        if (job) {
+            pool->queue_head[prio] = job->next;
+            if (pool->queue_head[prio] == NULL)
+                pool->queue_tail[prio] = NULL;
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void worker_loop(WorkPool *pool, bool idle_worker) {
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        Job *job = NULL;
+        while (!pool->stopping && (job = pop_job(pool, idle_worker)) == NULL) {
+            if (!idle_worker && pool->retiring > 0)
+                break;
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->stopping)
+            break;
+        if (job == NULL) {
+            pool->retiring--;
+            break;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+        if (!Job_cancelled(job)) {
+            job->run(job);
+            job->ran = true;
+        }
+        pthread_mutex_lock(&pool->lock);
+
+        push_done(pool, job);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void *worker_main(void *arg) {
+    worker_loop(arg, false);
+    return NULL;
+}
+
+static void *idle_worker_main(void *arg) {
+#ifdef SCHED_IDLE
+    struct sched_param param = { .sched_priority = 0 };
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+#endif
+        // On Linux the nice value is per thread
+        setpriority(PRIO_PROCESS, 0, IDLE_NICE);
+
+    worker_loop(arg, true);
+    return NULL;
+}
+
+void WorkPool_init(WorkPool *pool, size_t nthreads, size_t idle_threads) {
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    for (int prio = 0; prio < JOB_PRIO_COUNT; prio++)
+        pool->queue_head[prio] = pool->queue_tail[prio] = NULL;
+    pool->done_head = pool->done_tail = NULL;
+    pool->stopping = false;
+    pool->retiring = 0;
+
+    pool->nthreads = nthreads + idle_threads;
+    pool->threads = calloc(pool->nthreads, sizeof(pthread_t));
+    if (pool->threads == NULL)
+        die(1, "Couldn't allocate %zu worker threads", pool->nthreads);
+
+    for (size_t i = 0; i < pool->nthreads; i++) {
+        void *(*entry)(void *) = i < nthreads ? worker_main : idle_worker_main;
+        if (pthread_create(&pool->threads[i], NULL, entry, pool) != 0)
+            die(1, "Couldn't start worker thread %zu", i);
+    }
+}
+
+bool WorkPool_add_worker(WorkPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_t *threads = pool->stopping ? NULL : realloc(pool->threads, (pool->nthreads + 1) * sizeof(pthread_t));
+    bool added = threads != NULL;
+    if (added) {
+        pool->threads = threads;
+        added = pthread_create(&pool->threads[pool->nthreads], NULL, worker_main, pool) == 0;
+        if (added)
+            pool->nthreads++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return added;
+}
+
+void WorkPool_retire_worker(WorkPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->retiring++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void WorkPool_submit(WorkPool *pool, Job *job) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->stopping) {
+        Job_cancel(job);
+        push_done(pool, job);
+    } else {
+        job->next = NULL;
+        if (pool->queue_tail[job->priority])
+            pool->queue_tail[job->priority]->next = job;
+        else
+            pool->queue_head[job->priority] = job;
+        pool->queue_tail[job->priority] = job;
+        // Idle and general workers wait on the same condition, so a signal
+        // might wake one that can't take this job
+        pthread_cond_broadcast(&pool->wake);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+size_t WorkPool_poll(WorkPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    Job *job = pool->done_head;
+    pool->done_head = pool->done_tail = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    size_t count = 0;
+    while (job) {
+        Job *next = job->next;
+        if (job->done)
+            job->done(job);
+        free(job);
+        job = next;
+        count++;
+    }
+    return count;
+}
+
+void WorkPool_bye(WorkPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    for (int prio = 0; prio < JOB_PRIO_COUNT; prio++) {
+        Job *job;
+        while ((job = pop_job(pool, prio == JOB_PRIO_IDLE)) != NULL) {
+            Job_cancel(job);
+            push_done(pool, job);
+        }
+    }
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+    free(pool->threads);
+
+    WorkPool_poll(pool);
+
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+}
@@ -0,0 +1,79 @@
+// File: workpool.h
+// -----------------------
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <pthread.h>   // for pthread_t, pthread_mutex_t, pthread_cond_t
+#include <stdatomic.h> // for atomic_bool
+#include <stdbool.h>   // for bool
+#include <stddef.h>    // for size_t
+
+typedef enum {
+    // Work the user is waiting for right now
+    JOB_PRIO_HIGH = 0,
+    // Speculative work, only picked up by threads with nothing better to do
+    JOB_PRIO_IDLE = 1,
+    JOB_PRIO_COUNT,
+} JobPriority;
+
+typedef struct Job Job;
+
+// Runs on a worker thread. Long running jobs should check Job_cancelled()
+// between steps and bail out early when it returns true.
+typedef void (*JobRunFn)(Job *job);
+// Runs on the UI thread from WorkPool_poll(), even if the job was cancelled
+// (or never ran). It owns job->data and must free it. The Job itself is freed
+// by the pool right after this returns.
+typedef void (*JobDoneFn)(Job *job);
+
+struct Job {
+    JobRunFn run;
+    JobDoneFn done;
+    void *data;
+    JobPriority priority;
+    atomic_bool cancelled;
+    bool ran;
+    Job *next;
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    Job *queue_head[JOB_PRIO_COUNT];
+    Job *queue_tail[JOB_PRIO_COUNT];
+    Job *done_head;
+    Job *done_tail;
+    pthread_t *threads;
+    size_t nthreads;
+    // General workers that exit the next time they find nothing to do
+    size_t retiring;
+    bool stopping;
+} WorkPool;
+
+// Starts `nthreads` general workers and `idle_threads` extra workers that run
+// with a lowered scheduling priority and only ever take JOB_PRIO_IDLE jobs.
+void WorkPool_init(WorkPool *pool, size_t nthreads, size_t idle_threads);
+// Cancels every queued job, waits for the running ones and runs all the
+// pending done callbacks.
+void WorkPool_bye(WorkPool *pool);
+
+// Starts one more general worker, for when some are stuck. Returns false if
+// that's not possible.
+bool WorkPool_add_worker(WorkPool *pool);
+// One general worker exits once the queue is empty, for when the stuck ones
+// came back. It's still joined by WorkPool_bye.
+void WorkPool_retire_worker(WorkPool *pool);
+
+Job *Job_new(JobRunFn run, JobDoneFn done, void *data, JobPriority priority);
+void Job_cancel(Job *job);
+bool Job_cancelled(const Job *job);
+
+// Hands the job over to the pool. The pointer stays valid until its done
+// callback has returned.
+void WorkPool_submit(WorkPool *pool, Job *job);
+// Runs the done callbacks of every finished job. Must be called from the UI
+// thread, usually once per main loop iteration. Returns the number of
+// callbacks that were run.
+size_t WorkPool_poll(WorkPool *pool);
+
+#endif // WORKPOOL_H
@@ -0,0 +1,76 @@
+// File: highlight_test.c
+// -----------------------
+#include <assert.h>   // for assert
+#include <stdio.h>    // for FILE, tmpfile, fprintf, fputc, rewind, puts
+#include <string.h>   // for strncmp
+// Local includes
+#include <highlight.h> // for Highlighter, HighlightLine, Highlight_open, Highlight_lines, Highlight_close
+
+// Plain text has no language: scrolling past the first checkpoint lexes the
+// lines before the ones shown without one
+static void scroll_plain_text(void) {
+    FILE *file = tmpfile();
+    assert(file != NULL);
+    SIZE total = HIGHLIGHT_CHECKPOINT_LINES * 3;
+    for (SIZE i = 0; i < total; i++)
+        fprintf(file, "line %ld\n", (long)i);
+    rewind(file);
+
+    Highlighter *h = Highlight_open("notes.txt", file);
+    assert(h != NULL);
+    HighlightLine lines[5];
+    assert(Highlight_lines(h, 3, 5, lines) == 5);
+    assert(lines[0].len == 6 && strncmp(lines[0].text, "line 3", 6) == 0);
+    assert(lines[0].num_spans == 0);
+
+    SIZE first = HIGHLIGHT_CHECKPOINT_LINES + 10;
+    assert(Highlight_lines(h, first, 5, lines) == 5);
+    char expected[32];
+    int len = snprintf(expected, sizeof(expected), "line %ld", (long)first);
+    assert(lines[0].len == len && strncmp(lines[0].text, expected, len) == 0);
+
+    assert(Highlight_lines(h, total - 2, 5, lines) == 2);
+    assert(Highlight_line_count(h) == total);
+    Highlight_close(h);
+}
+
+// Only the start of a long line is kept, the lines after it and the
+// checkpoints still start in the right place
+static void long_lines(void) {
+    FILE *file = tmpfile();
+    assert(file != NULL);
+    for (int i = 0; i < HIGHLIGHT_MAX_LINE * 40; i++)
+        fputc('a' + i % 26, file);
+    fputc('\n', file);
+    SIZE total = HIGHLIGHT_CHECKPOINT_LINES * 2;
+    for (SIZE i = 1; i < total; i++)
+        fprintf(file, "line %ld\r\n", (long)i);
+    rewind(file);
+
+    Highlighter *h = Highlight_open("notes.txt", file);
+    assert(h != NULL);
+    HighlightLine lines[2];
+    assert(Highlight_lines(h, 0, 2, lines) == 2);
+    assert(lines[0].len == HIGHLIGHT_MAX_LINE && strncmp(lines[0].text, "abc", 3) == 0);
+    assert(lines[1].len == 6 && strncmp(lines[1].text, "line 1", 6) == 0);
+
+    SIZE first = HIGHLIGHT_CHECKPOINT_LINES + 3;
+    assert(Highlight_lines(h, first, 2, lines) == 2);
+    char expected[32];
+    int len = snprintf(expected, sizeof(expected), "line %ld", (long)first);
+    assert(lines[0].len == len && strncmp(lines[0].text, expected, len) == 0);
+    // Answered from the checkpoint past the long line
+    assert(Highlight_lines(h, first + 1, 1, lines) == 1);
+    len = snprintf(expected, sizeof(expected), "line %ld", (long)first + 1);
+    assert(lines[0].len == len && strncmp(lines[0].text, expected, len) == 0);
+    assert(Highlight_lines(h, total - 1, 5, lines) == 1);
+    assert(Highlight_line_count(h) == total);
+    Highlight_close(h);
+}
+
+int main(void) {
+    scroll_plain_text();
+    long_lines();
+    puts("highlight_test: ok");
+    return 0;
+}
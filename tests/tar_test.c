@@ -0,0 +1,92 @@
+// File: tar_test.c
+// -----------------------
+#define _DEFAULT_SOURCE // for mkdtemp
+#include <assert.h>   // for assert
+#include <stdint.h>   // for uint64_t
+#include <stdio.h>    // for FILE, fopen, fwrite, fclose, snprintf, puts
+#include <stdlib.h>   // for mkdtemp
+#include <string.h>   // for memset, memcpy, strlen
+#include <sys/stat.h> // for struct stat
+#include <unistd.h>   // for unlink, rmdir
+// Local includes
+#include <tar.h>      // for Tar_stat, Tar_bye
+
+#define BLOCK 512
+
+// A ustar header with a valid checksum, `size` in base-256 when it doesn't
+// fit in octal
+static void header(unsigned char *h, const char *name, char type, uint64_t size) {
+    memset(h, 0, BLOCK);
+    memcpy(h, name, strlen(name));
+    memcpy(h + 100, "0000644", 7);
+    memcpy(h + 108, "0000000", 7);
+    memcpy(h + 116, "0000000", 7);
+    if (size < 077777777777ULL) {
+        snprintf((char *)h + 124, 12, "%011llo", (unsigned long long)size);
+    } else {
+        h[124] = 0x80;
+        for (int i = 11; i > 3; i--, size >>= 8)
+            h[124 + i] = size & 0xff;
+    }
+    memcpy(h + 136, "00000000000", 11);
+    h[156] = type;
+    memcpy(h + 257, "ustar\0" "00", 8);
+
+    unsigned int sum = 0;
+    memset(h + 148, ' ', 8);
+    for (int i = 0; i < BLOCK; i++)
+        sum += h[i];
+    snprintf((char *)h + 148, 8, "%06o", sum);
+}
+
+static void write_archive(const char *path, const unsigned char *blocks, size_t count) {
+    FILE *f = fopen(path, "w");
+    assert(f != NULL);
+    assert(fwrite(blocks, BLOCK, count, f) == count);
+    fclose(f);
+}
+
+// A pax record shorter than its own length prefix
+static void short_pax_record(const char *dir) {
+    unsigned char blocks[5 * BLOCK] = { 0 };
+    header(blocks, "pax", 'x', 3);
+    memcpy(blocks + BLOCK, "1 x", 3);
+    header(blocks + 2 * BLOCK, "file", '0', 0);
+
+    char archive[256], member[300];
+    snprintf(archive, sizeof(archive), "%s/pax.tar", dir);
+    snprintf(member, sizeof(member), "%s/file", archive);
+    write_archive(archive, blocks, 5);
+    struct stat st;
+    assert(Tar_stat(member, &st) && st.st_size == 0);
+    unlink(archive);
+}
+
+// A size that makes the offset of the next header wrap around
+static void wrapping_size(const char *dir) {
+    unsigned char blocks[4 * BLOCK] = { 0 };
+    header(blocks, "file", '0', 0);
+    header(blocks + BLOCK, "huge", '0', UINT64_MAX - 600);
+
+    char archive[256], member[300];
+    snprintf(archive, sizeof(archive), "%s/huge.tar", dir);
+    snprintf(member, sizeof(member), "%s/file", archive);
+    write_archive(archive, blocks, 4);
+    struct stat st;
+    assert(Tar_stat(member, &st));
+    snprintf(member, sizeof(member), "%s/huge", archive);
+    assert(!Tar_stat(member, &st));
+    unlink(archive);
+}
+
+int main(void) {
+    char dir[] = "/tmp/tar_test.XXXXXX";
+    char *made = mkdtemp(dir);
+    assert(made != NULL);
+    short_pax_record(dir);
+    wrapping_size(dir);
+    Tar_bye();
+    rmdir(dir);
+    puts("tar_test: ok");
+    return 0;
+}